@@ -101,12 +101,21 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
     }
     JDWP_TRACE_DATA("GetValues: values=" << length 
         << ", signature=" << JDWP_CHECK_NULL(signature));
+    WriteArrayRegion(jni, m_cmdParser->reply, arrayObject, signature,
+        firstIndex, length);
+}
+
+void
+ArrayReference::WriteArrayRegion(JNIEnv *jni, OutputPacketComposer& reply,
+        jarray arrayObject, const char* signature, jint firstIndex,
+        jint length) throw(AgentException)
+{
     jvalue value;
     ClassManager& classManager = AgentBase::GetClassManager();
     switch (signature[1]) {
         case 'Z': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_BOOLEAN);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_BOOLEAN);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -120,13 +129,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.z = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(boolean)" << value.z);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_BOOLEAN, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_BOOLEAN, value);
             }
             return;
         }
         case 'B': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_BYTE);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_BYTE);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -140,13 +149,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.b = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(byte)" << value.b);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_BYTE, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_BYTE, value);
             }
             return;
         }
         case 'C': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_CHAR);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_CHAR);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -160,13 +169,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.c = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(char)" << value.c);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_CHAR, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_CHAR, value);
             }
             return;
         }
         case 'S': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_SHORT);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_SHORT);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -180,13 +189,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.s = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(short)" << value.s);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_SHORT, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_SHORT, value);
             }
             return;
         }
         case 'I': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_INT);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_INT);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -200,13 +209,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.i = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(int)" << value.i);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_INT, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_INT, value);
             }
             return;
         }
         case 'J': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_LONG);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_LONG);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -220,13 +229,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.j = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(long)" << value.j);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_LONG, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_LONG, value);
             }
             return;
         }
         case 'F': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_FLOAT);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_FLOAT);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -240,13 +249,13 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.f = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(float)" << value.f);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_FLOAT, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_FLOAT, value);
             }
             return;
         }
         case 'D': {
-            m_cmdParser->reply.WriteByte(JDWP_TAG_DOUBLE);
-            m_cmdParser->reply.WriteInt(length);
+            reply.WriteByte(JDWP_TAG_DOUBLE);
+            reply.WriteInt(length);
             if ( length == 0 ) {
                 return;
             }
@@ -260,21 +269,21 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
                 value.d = bufferArray[i];
                 JDWP_TRACE_DATA("GetValues: send: index=" << i
                     << ", value=(double)" << value.d);
-                m_cmdParser->reply.WriteUntaggedValue(jni, JDWP_TAG_DOUBLE, value);
+                reply.WriteUntaggedValue(jni, JDWP_TAG_DOUBLE, value);
             }
             return;
         }
         case '[':
-            m_cmdParser->reply.WriteByte(JDWP_TAG_ARRAY);
+            reply.WriteByte(JDWP_TAG_ARRAY);
             break;
         case 'L':
-            m_cmdParser->reply.WriteByte(JDWP_TAG_OBJECT);
+            reply.WriteByte(JDWP_TAG_OBJECT);
             break;
         default:
             JDWP_TRACE_DATA("GetValues: bad type signature: " << JDWP_CHECK_NULL(signature));
             throw AgentException(JDWP_ERROR_INVALID_ARRAY);
     }
-    m_cmdParser->reply.WriteInt(length);
+    reply.WriteInt(length);
 
     JDWP_TRACE_DATA("GetValues: send: length=" << length);
     for (int i = 0; i < length; i++) {
@@ -287,8 +296,9 @@ ArrayReference::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
             << ", tag=" << tag 
             << ", value=(object)" << objArrayElement);
 
-        m_cmdParser->reply.WriteByte(tag);
-        m_cmdParser->reply.WriteObjectID(jni, objArrayElement);
+        reply.WriteByte(tag);
+        reply.WriteObjectID(jni, objArrayElement);
+        jni->DeleteLocalRef(objArrayElement);
     }
 
 }
@@ -34,12 +34,29 @@
 
 namespace jdwp {
 
+    class OutputPacketComposer;
+
     /**
      * The namespace includes declaration of the classes implementing commands
      * from the <code>ArrayReference</code> command set.
      */
     namespace ArrayReference {
 
+        /**
+         * Writes the values of the given array region in the form of the
+         * <code>arrayregion</code> JDWP data type.
+         *
+         * @param jni         - the JNI interface pointer
+         * @param reply       - the packet to write values to
+         * @param arrayObject - the array
+         * @param signature   - the signature of the array class
+         * @param firstIndex  - the first index of the region
+         * @param length      - the number of values in the region
+         */
+        void WriteArrayRegion(JNIEnv *jni, OutputPacketComposer& reply,
+            jarray arrayObject, const char* signature, jint firstIndex,
+            jint length) throw(AgentException);
+
         /**
          * The class implements the <code>Length</code> command from the
          * <code>ArrayReference</code> command set.
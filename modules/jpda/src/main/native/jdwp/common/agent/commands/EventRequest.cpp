@@ -19,9 +19,12 @@
 /**
  * @author Vitaly A. Provodin, Pavel N. Vyssotski
  */
+#include <string.h>
+
 #include "EventRequest.h"
 #include "PacketParser.h"
 #include "RequestManager.h"
+#include "AgentManager.h"
 #include "Log.h"
 
 using namespace jdwp;
@@ -30,6 +33,21 @@ using namespace EventRequest;
 //-----------------------------------------------------------------------------
 //Set--------------------------------------------------------------------------
 
+/**
+ * Takes the local variables capability for modifiers reading locals. Their
+ * evaluation treats failed reads as a mismatch, so a missing capability is
+ * not an error here.
+ */
+static void RequireLocalVariables() throw()
+{
+    try {
+        AgentBase::GetAgentManager().RequireCapability(
+            AgentManager::CAP_LOCAL_VARIABLES);
+    } catch (AgentException& e) {
+        JDWP_TRACE_DATA("Set: local variables are not available");
+    }
+}
+
 void
 EventRequest::SetHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
@@ -44,6 +62,15 @@ EventRequest::SetHandler::Execute(JNIEnv *jni) throw(AgentException)
         << ", suspendPolicy=" << suspendPolicy
         << ", modCount=" << modCount);
 
+    // tracepoint is a non-suspending breakpoint request with captured values
+    bool isTracepoint = (eventKind == JDWP_EVENT_TRACEPOINT);
+    if (isTracepoint) {
+        if (suspendPolicy != JDWP_SUSPEND_NONE) {
+            throw IllegalArgumentException();
+        }
+        eventKind = JDWP_EVENT_BREAKPOINT;
+    }
+
     AgentEventRequest* request = (eventKind == JDWP_EVENT_SINGLE_STEP) ?
         new StepRequest(suspendPolicy, modCount) :
         new AgentEventRequest(eventKind, suspendPolicy, modCount);
@@ -64,6 +91,19 @@ EventRequest::SetHandler::Execute(JNIEnv *jni) throw(AgentException)
                     break;
                 }
 
+            case JDWP_MODIFIER_SAMPLE:
+                {
+                    jint interval = m_cmdParser->command.ReadInt();
+                    jint maxPerSecond = m_cmdParser->command.ReadInt();
+                    if (interval <= 0 || maxPerSecond < 0) {
+                        throw AgentException(JDWP_ERROR_INVALID_COUNT);
+                    }
+                    modifier = new SampleModifier(interval, maxPerSecond);
+                    JDWP_TRACE_DATA("Set: modifier=SAMPLE, interval=" << interval
+                        << ", maxPerSecond=" << maxPerSecond);
+                    break;
+                }
+
             case JDWP_MODIFIER_CONDITIONAL:
                 {
                     jint id = m_cmdParser->command.ReadInt();
@@ -283,6 +323,8 @@ EventRequest::SetHandler::Execute(JNIEnv *jni) throw(AgentException)
                     if (thread == 0) {
                         throw AgentException(JDWP_ERROR_INVALID_THREAD);
                     }
+                    GetAgentManager().RequireCapability(
+                        AgentManager::CAP_SINGLE_STEP);
                     reinterpret_cast<StepRequest*>
                         (request)->Init(jni, thread, size, depth);
                     modifier = new StepModifier(jni, thread, size, depth);
@@ -303,10 +345,140 @@ EventRequest::SetHandler::Execute(JNIEnv *jni) throw(AgentException)
                     jobject instance = m_cmdParser->command.ReadObjectID(jni);
                     JDWP_TRACE_DATA("Set: modifier=INSTANCE_ONLY, instance=" << instance);
 
+                    // the instance of a method event is read from slot 0
+                    RequireLocalVariables();
                     modifier = new InstanceOnlyModifier(jni, instance);
                     break;
                 }
 
+            case JDWP_MODIFIER_DEFERRED_LOCATION:
+                {
+                    if (eventKind != JDWP_EVENT_BREAKPOINT) {
+                        throw IllegalArgumentException();
+                    }
+                    char* pattern = m_cmdParser->command.ReadStringNoFree();
+                    JDWP_ASSERT(pattern != 0);
+                    AgentAutoFree afPattern(pattern JDWP_FILE_LINE);
+                    jint line = m_cmdParser->command.ReadInt();
+                    char* methodName = m_cmdParser->command.ReadStringNoFree();
+                    AgentAutoFree afMethodName(methodName JDWP_FILE_LINE);
+                    char* methodSignature = m_cmdParser->command.ReadStringNoFree();
+                    AgentAutoFree afMethodSignature(methodSignature JDWP_FILE_LINE);
+                    jlocation codeIndex = m_cmdParser->command.ReadLong();
+                    if (line <= 0 && (methodName[0] == '\0' || codeIndex < 0)) {
+                        throw IllegalArgumentException();
+                    }
+                    // replace '.' with '/' to be matched with signature
+                    for (char* p = pattern; *p != '\0'; p++) {
+                        if (*p == '.') {
+                            *p = '/';
+                        }
+                    }
+                    modifier = new DeferredLocationModifier(pattern, line,
+                        methodName, methodSignature, codeIndex);
+                    // the strings are owned by the modifier from now on
+                    afPattern.Release();
+                    afMethodName.Release();
+                    afMethodSignature.Release();
+                    JDWP_TRACE_DATA("Set: modifier=DEFERRED_LOCATION, classPattern="
+                        << pattern << ", line=" << line
+                        << ", methodName=" << methodName
+                        << ", methodSignature=" << methodSignature
+                        << ", codeIndex=" << codeIndex);
+                    break;
+                }
+
+            case JDWP_MODIFIER_CONDITION_EXPRESSION:
+                {
+                    if (eventKind != JDWP_EVENT_SINGLE_STEP &&
+                        eventKind != JDWP_EVENT_BREAKPOINT &&
+                        eventKind != JDWP_EVENT_EXCEPTION &&
+                        eventKind != JDWP_EVENT_FIELD_ACCESS &&
+                        eventKind != JDWP_EVENT_FIELD_MODIFICATION &&
+                        eventKind != JDWP_EVENT_METHOD_ENTRY &&
+                        eventKind != JDWP_EVENT_METHOD_EXIT)
+                    {
+                        throw IllegalArgumentException();
+                    }
+                    char* text = m_cmdParser->command.ReadStringNoFree();
+                    JDWP_ASSERT(text != 0);
+                    JDWP_TRACE_DATA("Set: modifier=CONDITION_EXPRESSION, expression="
+                        << text);
+                    AgentAutoFree autoFreeText(text JDWP_FILE_LINE);
+                    RequireLocalVariables();
+                    ConditionExpression* expression = new ConditionExpression();
+                    try {
+                        expression->Compile(text);
+                    } catch (AgentException& e) {
+                        delete expression;
+                        throw e;
+                    }
+                    modifier = new ConditionalModifier(expression);
+                    break;
+                }
+
+            case JDWP_MODIFIER_CAPTURE:
+                {
+                    if (!isTracepoint || request->GetCapture() != 0) {
+                        throw IllegalArgumentException();
+                    }
+                    jint count = m_cmdParser->command.ReadInt();
+                    if (count < 0) {
+                        throw IllegalArgumentException();
+                    }
+                    RequireLocalVariables();
+                    CaptureModifier* capture = new CaptureModifier();
+                    modifier = capture;
+                    request->AddModifier(modifier, i);
+                    JDWP_TRACE_DATA("Set: modifier=CAPTURE, count=" << count);
+                    for (jint j = 0; j < count; j++) {
+                        CaptureModifier::Capture value;
+                        memset(&value, 0, sizeof(value));
+                        value.kind = static_cast<jdwpCaptureKind>(
+                            m_cmdParser->command.ReadByte());
+                        switch (value.kind) {
+                        case JDWP_CAPTURE_LOCAL:
+                            value.slot = m_cmdParser->command.ReadInt();
+                            value.tag = static_cast<jdwpTag>(
+                                m_cmdParser->command.ReadByte());
+                            break;
+                        case JDWP_CAPTURE_THIS_FIELD:
+                            {
+                                AgentAutoFree afName(
+                                    m_cmdParser->command.ReadStringNoFree()
+                                    JDWP_FILE_LINE);
+                                value.signature = m_cmdParser->command.ReadStringNoFree();
+                                value.name = static_cast<char*>(afName.Release());
+                                value.tag = static_cast<jdwpTag>(value.signature[0]);
+                                break;
+                            }
+                        case JDWP_CAPTURE_THREAD_NAME:
+                        case JDWP_CAPTURE_TIMESTAMP:
+                            break;
+                        default:
+                            throw IllegalArgumentException();
+                        }
+                        // added before validation to be freed with the modifier
+                        capture->AddCapture(value);
+                        if (value.kind == JDWP_CAPTURE_LOCAL ||
+                            value.kind == JDWP_CAPTURE_THIS_FIELD)
+                        {
+                            if (strchr("ZBCSIJFDL[stglc", value.tag) == 0 ||
+                                value.tag == '\0')
+                            {
+                                throw AgentException(JDWP_ERROR_INVALID_TAG);
+                            }
+                        }
+                        JDWP_TRACE_DATA("Set: capture #" << j
+                            << ": kind=" << value.kind
+                            << ", slot=" << value.slot
+                            << ", tag=" << value.tag
+                            << ", name=" << JDWP_CHECK_NULL(value.name)
+                            << ", signature=" << JDWP_CHECK_NULL(value.signature));
+                    }
+                    continue;
+                }
+
             default:
                 JDWP_TRACE_DATA("Set: bad modifier: " << modifierByte);
                 throw IllegalArgumentException();
@@ -314,6 +486,9 @@ EventRequest::SetHandler::Execute(JNIEnv *jni) throw(AgentException)
             }
             request->AddModifier(modifier, i);
         }
+        if (isTracepoint && request->GetCapture() == 0) {
+            throw IllegalArgumentException();
+        }
     } catch (AgentException& e) {
         delete request;
         throw e;
@@ -336,6 +511,9 @@ EventRequest::ClearHandler::Execute(JNIEnv *jni)
     JDWP_TRACE_DATA("Clear: event="
         << GetRequestManager().GetEventKindName(eventKind) 
         << ", eventKind=" << eventKind << ", requestId=" << id);
+    if (eventKind == JDWP_EVENT_TRACEPOINT) {
+        eventKind = JDWP_EVENT_BREAKPOINT;
+    }
     GetRequestManager().DeleteRequest(jni, eventKind, id);
 }
 
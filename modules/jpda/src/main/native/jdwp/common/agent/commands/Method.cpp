@@ -21,6 +21,8 @@
  */
 #include "Method.h"
 #include "PacketParser.h"
+#include "ClassManager.h"
+#include "AgentManager.h"
 
 using namespace jdwp;
 using namespace Method;
@@ -49,6 +51,11 @@ Method::LineTableHandler::Execute(JNIEnv *jni) throw(AgentException)
     }
 #endif
 
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, refType, methodID)) {
+        return;
+    }
+
     jboolean isNative;
     JVMTI_TRACE(err, GetJvmtiEnv()->IsMethodNative(methodID, &isNative));
     if (err != JVMTI_ERROR_NONE) {
@@ -67,11 +74,10 @@ Method::LineTableHandler::Execute(JNIEnv *jni) throw(AgentException)
     if (err != JVMTI_ERROR_NONE) {
         throw AgentException(err);
     }    
-    jint entry_count = 0;
-    jvmtiLineNumberEntry* table = 0;
-    JVMTI_TRACE(err, GetJvmtiEnv()->GetLineNumberTable(methodID,
-        &entry_count, &table));
-    JvmtiAutoFree afv(table);
+    const LineTable* lineTable = GetClassManager().GetLineTable(methodID);
+    jint entry_count = lineTable->m_count;
+    const jvmtiLineNumberEntry* table = lineTable->m_entries;
+    err = lineTable->m_error;
     if (err == JVMTI_ERROR_MUST_POSSESS_CAPABILITY ||
         err == JVMTI_ERROR_ABSENT_INFORMATION)
     {
@@ -104,11 +110,15 @@ Method::LineTableHandler::Execute(JNIEnv *jni) throw(AgentException)
     } else {
         throw AgentException(err);
     }
+
+    replyCache.StoreReply(jni, m_cmdParser, refType, methodID);
 }
 
 void
 Method::VariableTableHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
+    GetAgentManager().RequireCapability(AgentManager::CAP_LOCAL_VARIABLES);
+
     jclass refType = m_cmdParser->command.ReadReferenceTypeID(jni);
     jmethodID methodID = m_cmdParser->command.ReadMethodID(jni);
 
@@ -129,6 +139,11 @@ Method::VariableTableHandler::Execute(JNIEnv *jni) throw(AgentException)
     }
 #endif
 
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, refType, methodID)) {
+        return;
+    }
+
     jboolean isNative;
     jvmtiError err;
     JVMTI_TRACE(err, GetJvmtiEnv()->IsMethodNative(methodID, &isNative));
@@ -199,6 +214,8 @@ Method::VariableTableHandler::Execute(JNIEnv *jni) throw(AgentException)
             reinterpret_cast<unsigned char*>(table[i].generic_signature)));
         JDWP_ASSERT(err==JVMTI_ERROR_NONE);
     }
+
+    replyCache.StoreReply(jni, m_cmdParser, refType, methodID);
 }
 
 void
@@ -223,6 +240,12 @@ Method::BytecodesHandler::Execute(JNIEnv *jni) throw(AgentException)
             << ", classSignature=" << JDWP_CHECK_NULL(classSignature));
     }
 #endif
+
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, refType, methodID)) {
+        return;
+    }
+
     jint bytecode_count;
     unsigned char* bytecodes = 0;
 
@@ -236,6 +259,8 @@ Method::BytecodesHandler::Execute(JNIEnv *jni) throw(AgentException)
 
     JDWP_TRACE_DATA("Bytecodes: send: bytecode_count=" << bytecode_count);
     m_cmdParser->reply.WriteByteArray(reinterpret_cast<jbyte*>(bytecodes), bytecode_count);
+
+    replyCache.StoreReply(jni, m_cmdParser, refType, methodID);
 }
 
 void
@@ -275,6 +300,8 @@ Method::IsObsoleteHandler::Execute(JNIEnv *jni) throw(AgentException)
 void
 Method::VariableTableWithGenericHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
+    GetAgentManager().RequireCapability(AgentManager::CAP_LOCAL_VARIABLES);
+
     jclass refType = m_cmdParser->command.ReadReferenceTypeID(jni);
     jmethodID methodID = m_cmdParser->command.ReadMethodID(jni);
 #ifndef NDEBUG    
@@ -293,6 +320,12 @@ Method::VariableTableWithGenericHandler::Execute(JNIEnv *jni) throw(AgentExcepti
             << ", classSignature=" << JDWP_CHECK_NULL(classSignature));
     }
 #endif
+
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, refType, methodID)) {
+        return;
+    }
+
     jint size;
 
     jvmtiError err;
@@ -354,4 +387,6 @@ Method::VariableTableWithGenericHandler::Execute(JNIEnv *jni) throw(AgentExcepti
             reinterpret_cast<unsigned char*>(table[i].generic_signature)));
         JDWP_ASSERT(err==JVMTI_ERROR_NONE);
     }
+
+    replyCache.StoreReply(jni, m_cmdParser, refType, methodID);
 }
@@ -69,6 +69,134 @@ ObjectReference::ReferenceTypeHandler::Execute(JNIEnv *jni) throw (AgentExceptio
 
 } // ReferenceTypeHandler::Execute()
 
+//------------------------------------------------------------------------------
+
+jdwpTag
+ObjectReference::GetFieldValue(JNIEnv *jni, jobject object, jclass cls,
+        jfieldID field, const char* signature, bool isStatic, jvalue& value)
+    throw (AgentException)
+{
+    jdwpTag tag;
+    switch ( signature[0] ) {
+    case 'Z':
+        tag = JDWP_TAG_BOOLEAN;
+        if ( isStatic ) {
+            value.z = jni->GetStaticBooleanField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(boolean)" << value.z);
+        } else {
+            value.z = jni->GetBooleanField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(boolean)" << value.z);
+        }
+        break;
+    case 'B':
+        tag = JDWP_TAG_BYTE;
+        if ( isStatic ) {
+            value.b = jni->GetStaticByteField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(byte)" << value.b);
+        } else {
+            value.b = jni->GetByteField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(byte)" << value.b);
+        }
+        break;
+    case 'C':
+        tag = JDWP_TAG_CHAR;
+        if ( isStatic ) {
+            value.c = jni->GetStaticCharField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(char)" << value.c);
+        } else {
+            value.c = jni->GetCharField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(char)" << value.c);
+        }
+        break;
+    case 'S':
+        tag = JDWP_TAG_SHORT;
+        if ( isStatic ) {
+            value.s = jni->GetStaticShortField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(short)" << value.s);
+        } else {
+            value.s = jni->GetShortField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(short)" << value.s);
+        }
+        break;
+    case 'I':
+        tag = JDWP_TAG_INT;
+        if ( isStatic ) {
+            value.i = jni->GetStaticIntField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(int)" << value.i);
+        } else {
+            value.i = jni->GetIntField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(int)" << value.i);
+        }
+        break;
+    case 'J':
+        tag = JDWP_TAG_LONG;
+        if ( isStatic ) {
+            value.j = jni->GetStaticLongField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(long)" << value.l);
+        } else {
+            value.j = jni->GetLongField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(long)" << value.l);
+        }
+        break;
+    case 'F':
+        tag = JDWP_TAG_FLOAT;
+        if ( isStatic ) {
+            value.f = jni->GetStaticFloatField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(float)" << value.f);
+        } else {
+            value.f = jni->GetFloatField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(float)" << value.f);
+        }
+        break;
+    case 'D':
+        tag = JDWP_TAG_DOUBLE;
+        if ( isStatic ) {
+            value.d = jni->GetStaticDoubleField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(double)" << value.d);
+        } else {
+            value.d = jni->GetDoubleField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(double)" << value.d);
+        }
+        break;
+    case 'L':
+    case '[':
+        if ( isStatic ) {
+            value.l = jni->GetStaticObjectField(cls, field);
+            JDWP_TRACE_DATA("GetValues: get static: fieldID=" << field
+                << ", value=(object)" << value.l);
+        } else {
+            value.l = jni->GetObjectField(object, field);
+            JDWP_TRACE_DATA("GetValues: get instance: fieldID=" << field
+                << ", value=(double)" << value.l);
+        }
+        tag = AgentBase::GetClassManager().GetJdwpTag(jni, value.l);
+        break;
+    default:
+        // should not reach here
+        JDWP_TRACE_DATA("GetValues: bad field signature: fieldID=" << field
+                << ", signature: " << signature);
+        throw InternalErrorException();
+    }
+
+    return tag;
+}
+
 //------------------------------------------------------------------------------
 //GetValuesHandler(2)-----------------------------------------------------------
 
@@ -149,142 +277,8 @@ ObjectReference::GetValuesHandler::Execute(JNIEnv *jni) throw (AgentException)
         }
 
         jvalue fieldValue;
-        jdwpTag fieldValueTag;
-        switch ( fieldSignature[0] ) {
-        case 'Z':
-            fieldValueTag = JDWP_TAG_BOOLEAN;
-            if ( isFieldStatic ) {
-                fieldValue.z = jni->GetStaticBooleanField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(boolean)" << fieldValue.z);
-            } else {
-                fieldValue.z = jni->GetBooleanField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(boolean)" << fieldValue.z);
-            }
-            break;
-        case 'B':
-            fieldValueTag = JDWP_TAG_BYTE;
-            if ( isFieldStatic ) {
-                fieldValue.b = jni->GetStaticByteField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(byte)" << fieldValue.b);
-            } else {
-                fieldValue.b = jni->GetByteField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(byte)" << fieldValue.b);
-            }
-            break;
-        case 'C':
-            fieldValueTag = JDWP_TAG_CHAR;
-            if ( isFieldStatic ) {
-                fieldValue.c = jni->GetStaticCharField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(char)" << fieldValue.c);
-            } else {
-                fieldValue.c = jni->GetCharField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(char)" << fieldValue.c);
-            }
-            break;
-        case 'S':
-            fieldValueTag = JDWP_TAG_SHORT;
-            if ( isFieldStatic ) {
-                fieldValue.s = jni->GetStaticShortField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(short)" << fieldValue.s);
-            } else {
-                fieldValue.s = jni->GetShortField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(short)" << fieldValue.s);
-            }
-            break;
-        case 'I':
-            fieldValueTag = JDWP_TAG_INT;
-            if ( isFieldStatic ) {
-                fieldValue.i = jni->GetStaticIntField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(int)" << fieldValue.i);
-            } else {
-                fieldValue.i = jni->GetIntField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(int)" << fieldValue.i);
-            }
-            break;
-        case 'J':
-            fieldValueTag = JDWP_TAG_LONG;
-            if ( isFieldStatic ) {
-                fieldValue.j = jni->GetStaticLongField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(long)" << fieldValue.l);
-            } else {
-                fieldValue.j = jni->GetLongField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(long)" << fieldValue.l);
-            }
-            break;
-        case 'F':
-            fieldValueTag = JDWP_TAG_FLOAT;
-            if ( isFieldStatic ) {
-                fieldValue.f = jni->GetStaticFloatField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(float)" << fieldValue.f);
-            } else {
-                fieldValue.f = jni->GetFloatField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(float)" << fieldValue.f);
-            }
-            break;
-        case 'D':
-            fieldValueTag = JDWP_TAG_DOUBLE;
-            if ( isFieldStatic ) {
-                fieldValue.d = jni->GetStaticDoubleField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(double)" << fieldValue.d);
-            } else {
-                fieldValue.d = jni->GetDoubleField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(double)" << fieldValue.d);
-            }
-            break;
-        case 'L':
-        case '[':
-            if ( isFieldStatic ) {
-                fieldValue.l = jni->GetStaticObjectField(jvmClass, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get static: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(object)" << fieldValue.l);
-            } else {
-                fieldValue.l = jni->GetObjectField(jvmObject, jvmFieldID);
-                JDWP_TRACE_DATA("GetValues: get instance: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", value=(double)" << fieldValue.l);
-            }
-            fieldValueTag = AgentBase::GetClassManager().GetJdwpTag(jni, fieldValue.l);
-            break;
-        default:
-            // should not reach here
-            JDWP_TRACE_DATA("GetValues: bad field signature: field#=" << i
-                    << ", fieldID=" << jvmFieldID
-                    << ", signature: " << fieldSignature);
-            throw InternalErrorException();
-        }
+        jdwpTag fieldValueTag = GetFieldValue(jni, jvmObject, jvmClass,
+            jvmFieldID, fieldSignature, (isFieldStatic == JNI_TRUE), fieldValue);
 
         m_cmdParser->reply.WriteValue(jni, fieldValueTag, fieldValue);
        
@@ -41,6 +41,23 @@ namespace jdwp {
      * from the <code>ObjectReference</code> command set.
      */
     namespace ObjectReference {
+
+        /**
+         * Gets the value of the field of the given object or class.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param object    - the object, ignored for a static field
+         * @param cls       - the class of the object
+         * @param field     - the field
+         * @param signature - the signature of the field
+         * @param isStatic  - whether the field is static
+         * @param value     - the value of the field
+         *
+         * @return The JDWP tag of the value.
+         */
+        jdwpTag GetFieldValue(JNIEnv *jni, jobject object, jclass cls,
+            jfieldID field, const char* signature, bool isStatic,
+            jvalue& value) throw (AgentException);
         
     // =========================================================================
         /**
@@ -38,6 +38,11 @@ ReferenceType::SignatureHandler::Execute(JNIEnv *jni) throw (AgentException)
     // JDWP_ERROR_INVALID_CLASS, JDWP_ERROR_INVALID_OBJECT
     JDWP_TRACE_DATA("Signature: received: refTypeID=" << jvmClass);
 
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, jvmClass, 0)) {
+        return;
+    }
+
     char* classSignature = 0;
     char* classGenericSignature = 0;
     char** genericSignaturePtr = 0;
@@ -69,6 +74,7 @@ ReferenceType::SignatureHandler::Execute(JNIEnv *jni) throw (AgentException)
     JDWP_TRACE_DATA("Signature: send: classSignature=" << JDWP_CHECK_NULL(classSignature) 
         << ", classGenericSignature=" << JDWP_CHECK_NULL(classGenericSignature));
 
+    replyCache.StoreReply(jni, m_cmdParser, jvmClass, 0);
 } // SignatureHandler::Execute()
 
 //------------------------------------------------------------------------------
@@ -144,6 +150,44 @@ ReferenceType::ModifiersHandler::Execute(JNIEnv *jni) throw (AgentException)
 
 } // ModifiersHandler::Execute()
 
+//------------------------------------------------------------------------------
+
+jint
+ReferenceType::GetFieldModifiers(jclass cls, jfieldID field) throw (AgentException)
+{
+    jvmtiEnv* jvmti = AgentBase::GetJvmtiEnv();
+    jvmtiError err;
+
+    jint fieldModifiers;
+    JVMTI_TRACE(err, jvmti->GetFieldModifiers(cls, field, &fieldModifiers));
+
+    if (err != JVMTI_ERROR_NONE) {
+        // Can be: JVMTI_ERROR_INVALID_CLASS, JVMTI_ERROR_INVALID_FIELDID,
+        // JVMTI_ERROR_NULL_POINTER
+        throw AgentException(err);
+    }
+
+    jint fieldSyntheticFlag = 0xf0000000;
+    jboolean isFieldSynthetic;
+    JVMTI_TRACE(err, jvmti->IsFieldSynthetic(cls, field, &isFieldSynthetic));
+
+    if (err != JVMTI_ERROR_NONE) {
+        // Can be: JVMTI_ERROR_MUST_POSSESS_CAPABILITY,JVMTI_ERROR_INVALID_CLASS,
+        // JVMTI_ERROR_INVALID_FIELDID, JVMTI_ERROR_NULL_POINTER
+        if (err == JVMTI_ERROR_MUST_POSSESS_CAPABILITY) {
+            fieldSyntheticFlag = 0;
+        } else {
+            throw AgentException(err);
+        }
+    } else {
+        if ( ! isFieldSynthetic ) {
+            fieldSyntheticFlag = 0;
+        }
+    }
+
+    return fieldModifiers | fieldSyntheticFlag;
+}
+
 //------------------------------------------------------------------------------
 //FieldsHandler(4,14)----------------------------------------------------------
 
@@ -163,6 +207,11 @@ ReferenceType::FieldsHandler::Execute(JNIEnv *jni) throw (AgentException)
             << ", classSignature=" << JDWP_CHECK_NULL(signature));
     }
 #endif
+
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, jvmClass, 0)) {
+        return;
+    }
   
     jvmtiEnv* jvmti = AgentBase::GetJvmtiEnv();
 
@@ -216,36 +265,7 @@ ReferenceType::FieldsHandler::Execute(JNIEnv *jni) throw (AgentException)
             }
         }
        
-        jint fieldModifiers;
-        JVMTI_TRACE(err, jvmti->GetFieldModifiers(jvmClass, jvmFieldID,
-            &fieldModifiers));
-
-        if (err != JVMTI_ERROR_NONE) {
-            // Can be: JVMTI_ERROR_INVALID_CLASS, JVMTI_ERROR_INVALID_FIELDID,
-            // JVMTI_ERROR_NULL_POINTER
-            throw AgentException(err);
-        }
-
-        jint fieldSyntheticFlag = 0xf0000000;
-        jboolean isFieldSynthetic;
-        JVMTI_TRACE(err, jvmti->IsFieldSynthetic(jvmClass, jvmFieldID,
-            &isFieldSynthetic));
-
-        if (err != JVMTI_ERROR_NONE) {
-            // Can be: JVMTI_ERROR_MUST_POSSESS_CAPABILITY,JVMTI_ERROR_INVALID_CLASS,
-            // JVMTI_ERROR_INVALID_FIELDID, JVMTI_ERROR_NULL_POINTER
-            if (err == JVMTI_ERROR_MUST_POSSESS_CAPABILITY) {
-                fieldSyntheticFlag = 0;
-            } else {
-                throw AgentException(err);
-            }
-        } else {
-            if ( ! isFieldSynthetic ) {
-                fieldSyntheticFlag = 0;
-            }
-        }
-
-        fieldModifiers = fieldModifiers | fieldSyntheticFlag;
+        jint fieldModifiers = GetFieldModifiers(jvmClass, jvmFieldID);
         m_cmdParser->reply.WriteInt(fieldModifiers);
         JDWP_TRACE_DATA("Fields: send: field#=" << i 
             << ", fieldsName=" << JDWP_CHECK_NULL(fieldName) 
@@ -255,6 +275,7 @@ ReferenceType::FieldsHandler::Execute(JNIEnv *jni) throw (AgentException)
 
      } // for (int i = 0; i < fieldsCount; i++)
 
+    replyCache.StoreReply(jni, m_cmdParser, jvmClass, 0);
 } // FieldsHandler::Execute()
 
 //------------------------------------------------------------------------------
@@ -276,6 +297,12 @@ ReferenceType::MethodsHandler::Execute(JNIEnv *jni) throw (AgentException)
             << ", classSignature=" << JDWP_CHECK_NULL(signature));  
     }
 #endif
+
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, jvmClass, 0)) {
+        return;
+    }
+
     jvmtiEnv* jvmti = AgentBase::GetJvmtiEnv();
 
     jint methodsCount = 0;
@@ -363,6 +390,7 @@ ReferenceType::MethodsHandler::Execute(JNIEnv *jni) throw (AgentException)
 
     } // for (int i = 0; i < methodsCount; i++)
 
+    replyCache.StoreReply(jni, m_cmdParser, jvmClass, 0);
 } // MethodsHandler::Execute()
 
 //------------------------------------------------------------------------------
@@ -518,6 +546,12 @@ ReferenceType::SourceFileHandler::Execute(JNIEnv *jni) throw (AgentException)
             << ", classSignature=" << JDWP_CHECK_NULL(signature));
     }
 #endif
+
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, jvmClass, 0)) {
+        return;
+    }
+
     char* sourceFileName = 0;
     jvmtiError err;
     JVMTI_TRACE(err, GetJvmtiEnv()->GetSourceFileName(jvmClass,
@@ -533,6 +567,7 @@ ReferenceType::SourceFileHandler::Execute(JNIEnv *jni) throw (AgentException)
     m_cmdParser->reply.WriteString(sourceFileName);
     JDWP_TRACE_DATA("SourceFile: send: sourceFile=" << JDWP_CHECK_NULL(sourceFileName));
 
+    replyCache.StoreReply(jni, m_cmdParser, jvmClass, 0);
 } // SourceFileHandler::Execute()
 
 //------------------------------------------------------------------------------
@@ -750,6 +785,12 @@ ReferenceType::InterfacesHandler::Execute(JNIEnv *jni)
             << ", classSignature=" << JDWP_CHECK_NULL(signature));
     }
 #endif
+
+    ReplyCache& replyCache = GetClassManager().GetReplyCache();
+    if (replyCache.WriteReply(jni, m_cmdParser, jvmClass, 0)) {
+        return;
+    }
+
     jint interfacesCount = 0;
     jclass* interfaces;
     jvmtiError err;
@@ -781,6 +822,7 @@ ReferenceType::InterfacesHandler::Execute(JNIEnv *jni)
 #endif
     }
 
+    replyCache.StoreReply(jni, m_cmdParser, jvmClass, 0);
 } // InterfacesHandler::Execute()
 
 //------------------------------------------------------------------------------
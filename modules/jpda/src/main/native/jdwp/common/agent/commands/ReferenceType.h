@@ -39,6 +39,16 @@ namespace jdwp {
      * from the <code>ReferenceType</code> command set.
      */
     namespace ReferenceType {
+
+        /**
+         * Returns the modifier bits of the field as sent by the
+         * <code>Fields</code> command, with the synthetic bit set for
+         * synthetic fields.
+         *
+         * @param cls   - the class of the field
+         * @param field - the field
+         */
+        jint GetFieldModifiers(jclass cls, jfieldID field) throw (AgentException);
         
     // =========================================================================
         /**
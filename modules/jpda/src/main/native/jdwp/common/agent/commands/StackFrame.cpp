@@ -23,6 +23,7 @@
 #include "PacketParser.h"
 #include "ClassManager.h"
 #include "ThreadManager.h"
+#include "AgentManager.h"
 
 using namespace jdwp;
 using namespace StackFrame;
@@ -30,6 +31,8 @@ using namespace StackFrame;
 void
 StackFrame::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
+    GetAgentManager().RequireCapability(AgentManager::CAP_LOCAL_VARIABLES);
+
     jthread thread = m_cmdParser->command.ReadThreadID(jni);
     jint frame = m_cmdParser->command.ReadFrameID(jni);
     jint slots = m_cmdParser->command.ReadInt();
@@ -175,6 +178,8 @@ StackFrame::GetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
 void
 StackFrame::SetValuesHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
+    GetAgentManager().RequireCapability(AgentManager::CAP_LOCAL_VARIABLES);
+
     jthread thread = m_cmdParser->command.ReadThreadID(jni);
     jint frame = m_cmdParser->command.ReadFrameID(jni);
     jint slotValues = m_cmdParser->command.ReadInt();
@@ -314,6 +319,8 @@ StackFrame::ThisObjectHandler::CheckErr(jvmtiError err) throw(AgentException)
 void
 StackFrame::ThisObjectHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
+    GetAgentManager().RequireCapability(AgentManager::CAP_LOCAL_VARIABLES);
+
     jthread thread = m_cmdParser->command.ReadThreadID(jni);
     
     if (thread == 0) {
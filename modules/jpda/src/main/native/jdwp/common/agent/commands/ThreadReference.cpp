@@ -78,21 +78,9 @@ ThreadReference::ResumeHandler::Execute(JNIEnv *jni) throw(AgentException)
 //-----------------------------------------------------------------------------
 //StatusHandler----------------------------------------------------------------
 
-void
-ThreadReference::StatusHandler::Execute(JNIEnv *jni) throw (AgentException)
+jint
+ThreadReference::GetThreadStatus(jint thread_state) throw (AgentException)
 {
-    jint thread_state;
-
-    jthread thrd = m_cmdParser->command.ReadThreadID(jni);
-    JDWP_TRACE_DATA("Status: received: threadID=" << thrd);
-
-    jvmtiError err;
-    JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadState(thrd, &thread_state));
-    JDWP_TRACE_DATA("Status: threadState=" << hex << thread_state);
-
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
     jint ret_value;
     jint const THREAD_STATE_SLEEPING =
         JVMTI_THREAD_STATE_SLEEPING | JVMTI_THREAD_STATE_ALIVE;
@@ -121,6 +109,25 @@ ThreadReference::StatusHandler::Execute(JNIEnv *jni) throw (AgentException)
             throw InternalErrorException();
         }
     }
+    return ret_value;
+}
+
+void
+ThreadReference::StatusHandler::Execute(JNIEnv *jni) throw (AgentException)
+{
+    jint thread_state;
+
+    jthread thrd = m_cmdParser->command.ReadThreadID(jni);
+    JDWP_TRACE_DATA("Status: received: threadID=" << thrd);
+
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadState(thrd, &thread_state));
+    JDWP_TRACE_DATA("Status: threadState=" << hex << thread_state);
+
+    if (err != JVMTI_ERROR_NONE)
+        throw AgentException(err);
+
+    jint ret_value = GetThreadStatus(thread_state);
     m_cmdParser->reply.WriteInt(ret_value);
     if (thread_state & JVMTI_THREAD_STATE_SUSPENDED)
         m_cmdParser->reply.WriteInt(JDWP_SUSPEND_STATUS_SUSPENDED);
@@ -39,6 +39,15 @@ namespace jdwp {
      * from the ThreadReference command set.
      */
     namespace ThreadReference {
+
+        /**
+         * Maps JVMTI thread state to JDWP thread status.
+         *
+         * @param threadState - the JVMTI thread state
+         *
+         * @return The <code>ThreadStatus</code> constant.
+         */
+        jint GetThreadStatus(jint threadState) throw (AgentException);
         
         /**
          * The class implements the <code>Name</code> command from the
@@ -0,0 +1,616 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// Vendor.cpp
+
+#include <string.h>
+#include <algorithm>
+
+#include "Vendor.h"
+#include "PacketParser.h"
+#include "ThreadManager.h"
+#include "ThreadReference.h"
+#include "ObjectReference.h"
+#include "ReferenceType.h"
+#include "ArrayReference.h"
+#include "ObjectManager.h"
+#include "ClassManager.h"
+#include "CommandDispatcher.h"
+
+using namespace jdwp;
+using namespace Vendor;
+
+//-----------------------------------------------------------------------------
+//ThreadStatesHandler----------------------------------------------------------
+
+void
+Vendor::ThreadStatesHandler::Execute(JNIEnv *jni) throw(AgentException)
+{
+    jint count = m_cmdParser->command.ReadInt();
+    JDWP_TRACE_DATA("ThreadStates: received: threads=" << count);
+    if (count < 0) {
+        throw AgentException(JDWP_ERROR_ILLEGAL_ARGUMENT);
+    }
+
+    jthread* listed = 0;
+    if (count > 0) {
+        listed = reinterpret_cast<jthread*>
+            (GetMemoryManager().Allocate(count * sizeof(jthread) JDWP_FILE_LINE));
+    }
+    AgentAutoFree aafListed(listed JDWP_FILE_LINE);
+    for (jint i = 0; i < count; i++) {
+        listed[i] = m_cmdParser->command.ReadThreadID(jni);
+    }
+
+    jvmtiError err;
+    jthread* all = 0;
+    if (count == 0) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetAllThreads(&count, &all));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+    }
+    JvmtiAutoFree afAll(all);
+
+    jthread* threads = listed;
+    if (all != 0) {
+        // don't report internal agent threads
+        ThreadManager& thrdMgr = GetThreadManager();
+        jint allCount = count;
+        count = 0;
+        for (jint i = 0; i < allCount; i++) {
+            if (!thrdMgr.IsAgentThread(jni, all[i])) {
+                all[count++] = all[i];
+            }
+        }
+        threads = all;
+    }
+
+    // states of all threads in one call
+    jvmtiStackInfo* stackInfo = 0;
+    if (count > 0) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadListStackTraces(count,
+            threads, 0, &stackInfo));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+    }
+    JvmtiAutoFree afStackInfo(stackInfo);
+
+    m_cmdParser->reply.WriteInt(count);
+    for (jint i = 0; i < count; i++) {
+        jthread thread = threads[i];
+        jint state = stackInfo[i].state;
+
+        jvmtiThreadInfo info;
+        info.name = 0;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadInfo(thread, &info));
+        JvmtiAutoFree afName(info.name);
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+
+        // not yet started threads have no Java thread state
+        jint status = ((state & (JVMTI_THREAD_STATE_ALIVE |
+                JVMTI_THREAD_STATE_TERMINATED)) == 0)
+            ? JDWP_THREAD_STATUS_ZOMBIE
+            : ThreadReference::GetThreadStatus(state);
+        bool isSuspended = (state & JVMTI_THREAD_STATE_SUSPENDED) != 0;
+
+        jint frameCount = -1;
+        if (isSuspended) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameCount(thread, &frameCount));
+            if (err != JVMTI_ERROR_NONE) {
+                frameCount = -1;
+            }
+        }
+        jint suspendCount = GetThreadManager().GetSuspendCount(jni, thread);
+
+        JDWP_TRACE_DATA("ThreadStates: send: thread#=" << i
+            << ", threadID=" << thread
+            << ", name=" << JDWP_CHECK_NULL(info.name)
+            << ", status=" << status
+            << ", suspended=" << isSuspended
+            << ", suspendCount=" << suspendCount
+            << ", frameCount=" << frameCount);
+
+        m_cmdParser->reply.WriteThreadID(jni, thread);
+        m_cmdParser->reply.WriteString(info.name);
+        m_cmdParser->reply.WriteInt(status);
+        m_cmdParser->reply.WriteInt(isSuspended ? JDWP_SUSPEND_STATUS_SUSPENDED : 0);
+        m_cmdParser->reply.WriteThreadGroupID(jni, info.thread_group);
+        m_cmdParser->reply.WriteInt(suspendCount);
+        m_cmdParser->reply.WriteInt(frameCount);
+
+        // keep local references bounded for thousands of threads
+        jni->DeleteLocalRef(info.thread_group);
+        jni->DeleteLocalRef(info.context_class_loader);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//ThreadStacksHandler----------------------------------------------------------
+
+void
+Vendor::ThreadStacksHandler::Execute(JNIEnv *jni) throw(AgentException)
+{
+    jint count = m_cmdParser->command.ReadInt();
+    JDWP_TRACE_DATA("ThreadStacks: received: threads=" << count);
+    if (count < 0) {
+        throw AgentException(JDWP_ERROR_ILLEGAL_ARGUMENT);
+    }
+
+    ThreadManager& thrdMgr = GetThreadManager();
+
+    jthread* listed = 0;
+    if (count > 0) {
+        listed = reinterpret_cast<jthread*>
+            (GetMemoryManager().Allocate(count * sizeof(jthread) JDWP_FILE_LINE));
+    }
+    AgentAutoFree aafListed(listed JDWP_FILE_LINE);
+    for (jint i = 0; i < count; i++) {
+        listed[i] = m_cmdParser->command.ReadThreadID(jni);
+    }
+    jint maxFrames = m_cmdParser->command.ReadInt();
+    bool withFrameIDs = (m_cmdParser->command.ReadBoolean() == JNI_TRUE);
+    JDWP_TRACE_DATA("ThreadStacks: received: maxFrames=" << maxFrames
+        << ", withFrameIDs=" << withFrameIDs);
+    if (maxFrames < -1) {
+        throw AgentException(JDWP_ERROR_INVALID_LENGTH);
+    }
+
+    jvmtiError err;
+    jthread* all = 0;
+    if (count == 0) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetAllThreads(&count, &all));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+    }
+    JvmtiAutoFree afAll(all);
+
+    jthread* threads = listed;
+    if (all != 0) {
+        // only suspended application threads
+        jint allCount = count;
+        count = 0;
+        for (jint i = 0; i < allCount; i++) {
+            if (!thrdMgr.IsAgentThread(jni, all[i]) && thrdMgr.IsSuspended(all[i])) {
+                all[count++] = all[i];
+            }
+        }
+        threads = all;
+    } else {
+        for (jint i = 0; i < count; i++) {
+            if (!thrdMgr.IsSuspended(threads[i]))
+                throw AgentException(JVMTI_ERROR_THREAD_NOT_SUSPENDED);
+        }
+    }
+
+    // stacks of all threads in one call
+    jint depth = (maxFrames == -1) ? DEFAULT_MAX_FRAMES : maxFrames;
+    jvmtiStackInfo* stackInfo = 0;
+    if (count > 0 && depth > 0) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadListStackTraces(count,
+            threads, depth, &stackInfo));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+    }
+    JvmtiAutoFree afStackInfo(stackInfo);
+
+    m_cmdParser->reply.WriteInt(count);
+    for (jint i = 0; i < count; i++) {
+        m_cmdParser->reply.WriteThreadID(jni, threads[i]);
+        if (stackInfo == 0) {
+            m_cmdParser->reply.WriteInt(0);
+            continue;
+        }
+        if (maxFrames == -1 && stackInfo[i].frame_count == depth) {
+            // deeper stack is taken alone
+            jint frameCount;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameCount(threads[i], &frameCount));
+            if (err != JVMTI_ERROR_NONE)
+                throw AgentException(err);
+            jvmtiFrameInfo* frames = reinterpret_cast<jvmtiFrameInfo*>
+                (GetMemoryManager().Allocate(sizeof(jvmtiFrameInfo) * frameCount
+                    JDWP_FILE_LINE));
+            AgentAutoFree aafFrames(frames JDWP_FILE_LINE);
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetStackTrace(threads[i], 0,
+                frameCount, frames, &frameCount));
+            if (err != JVMTI_ERROR_NONE)
+                throw AgentException(err);
+            WriteFrames(jni, threads[i], frames, frameCount, withFrameIDs);
+        } else {
+            WriteFrames(jni, threads[i], stackInfo[i].frame_buffer,
+                stackInfo[i].frame_count, withFrameIDs);
+        }
+    }
+}
+
+void
+Vendor::ThreadStacksHandler::WriteFrames(JNIEnv *jni, jthread thread,
+        const jvmtiFrameInfo* frames, jint frameCount, bool withFrameIDs)
+    throw(AgentException)
+{
+    jvmtiError err;
+
+    // frame IDs are bound to the whole depth of the stack
+    jint stackDepth = frameCount;
+    if (withFrameIDs) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameCount(thread, &stackDepth));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+    }
+
+    JDWP_TRACE_DATA("ThreadStacks: send: threadID=" << thread
+        << ", frames=" << frameCount
+        << ", stackDepth=" << stackDepth);
+
+    m_cmdParser->reply.WriteInt(frameCount);
+    for (jint j = 0; j < frameCount; j++) {
+        if (withFrameIDs) {
+            m_cmdParser->reply.WriteFrameID(jni, thread, j, stackDepth);
+        }
+
+        jclass declaring_class;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodDeclaringClass(frames[j].method,
+            &declaring_class));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+
+        jdwpTypeTag typeTag = GetClassManager().GetJdwpTypeTag(declaring_class);
+        m_cmdParser->reply.WriteLocation(jni, typeTag, declaring_class,
+            frames[j].method, frames[j].location);
+
+        // keep local references bounded for thousands of frames
+        jni->DeleteLocalRef(declaring_class);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//BatchHandler-----------------------------------------------------------------
+
+void
+Vendor::BatchHandler::Execute(JNIEnv *jni) throw(AgentException)
+{
+    jint count = m_cmdParser->command.ReadInt();
+    JDWP_TRACE_DATA("Batch: received: commands=" << count);
+    if (count < 0) {
+        throw AgentException(JDWP_ERROR_ILLEGAL_ARGUMENT);
+    }
+
+    m_cmdParser->reply.WriteInt(count);
+    CommandParser embedded;
+    for (jint i = 0; i < count; i++) {
+        embedded.ReadEmbeddedCommand(m_cmdParser->command);
+        CommandDispatcher::ExecEmbeddedCommand(jni, &embedded);
+        JDWP_TRACE_DATA("Batch: command " << i << ": "
+            << embedded.command.GetCommandSet() << "/"
+            << embedded.command.GetCommand()
+            << ", error=" << embedded.reply.GetError());
+        embedded.WriteEmbeddedReply(jni, &m_cmdParser->reply);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//ObjectGraphHandler-----------------------------------------------------------
+
+void
+Vendor::ObjectGraphHandler::Execute(JNIEnv *jni) throw(AgentException)
+{
+    jint count = m_cmdParser->command.ReadInt();
+    JDWP_TRACE_DATA("ObjectGraph: received: roots=" << count);
+    if (count < 0) {
+        throw AgentException(JDWP_ERROR_ILLEGAL_ARGUMENT);
+    }
+
+    jobject* roots = 0;
+    if (count > 0) {
+        roots = reinterpret_cast<jobject*>
+            (GetMemoryManager().Allocate(count * sizeof(jobject) JDWP_FILE_LINE));
+    }
+    AgentAutoFree aafRoots(roots JDWP_FILE_LINE);
+    for (jint i = 0; i < count; i++) {
+        roots[i] = m_cmdParser->command.ReadObjectID(jni);
+    }
+    m_maxDepth = m_cmdParser->command.ReadInt();
+    m_maxNodes = m_cmdParser->command.ReadInt();
+    m_maxPreview = m_cmdParser->command.ReadInt();
+    JDWP_TRACE_DATA("ObjectGraph: received: maxDepth=" << m_maxDepth
+        << ", maxNodes=" << m_maxNodes
+        << ", maxPreview=" << m_maxPreview);
+    if (m_maxDepth < 0 || m_maxNodes < 0 || m_maxPreview < 0) {
+        throw AgentException(JDWP_ERROR_ILLEGAL_ARGUMENT);
+    }
+
+    // number of nodes is written when known
+    OutputPacketComposer& reply = m_cmdParser->reply;
+    size_t countPosition = reply.GetPosition();
+    reply.WriteInt(0);
+
+    try {
+        for (jint i = 0; i < count; i++) {
+            AddNode(jni, roots[i], 0);
+        }
+        // nodes added while writing are written in turn
+        for (size_t i = 0; i < m_nodes.size(); i++) {
+            WriteNode(jni, m_nodes[i]);
+            jni->DeleteGlobalRef(m_nodes[i].object);
+            m_nodes[i].object = 0;
+        }
+    } catch (const AgentException& e) {
+        Clear(jni);
+        throw e;
+    }
+
+    JDWP_TRACE_DATA("ObjectGraph: send: nodes=" << m_nodes.size()
+        << ", types=" << m_types.size());
+
+    size_t currentPosition = reply.GetPosition();
+    jint currentLength = reply.GetLength();
+    reply.SetPosition(countPosition);
+    reply.WriteInt(static_cast<jint>(m_nodes.size()));
+    reply.SetPosition(currentPosition);
+    reply.SetLength(currentLength);
+
+    Clear(jni);
+}
+
+void
+Vendor::ObjectGraphHandler::AddNode(JNIEnv *jni, jobject object, jint depth)
+    throw(AgentException)
+{
+    if (object == 0 || m_nodes.size() >= static_cast<size_t>(m_maxNodes)) {
+        return;
+    }
+
+    ObjectID id = GetObjectManager().MapToObjectID(jni, object);
+    ObjectIDList::iterator it =
+        std::lower_bound(m_visited.begin(), m_visited.end(), id);
+    if (it != m_visited.end() && *it == id) {
+        return;
+    }
+    m_visited.insert(it, id);
+
+    NodeEntry node;
+    node.object = jni->NewGlobalRef(object);
+    if (node.object == 0) {
+        throw OutOfMemoryException();
+    }
+    node.depth = depth;
+    m_nodes.push_back(node);
+}
+
+void
+Vendor::ObjectGraphHandler::WriteNode(JNIEnv *jni, const NodeEntry& node)
+    throw(AgentException)
+{
+    if (jni->PushLocalFrame(NODE_LOCAL_FRAME) != 0) {
+        throw OutOfMemoryException();
+    }
+
+    try {
+        OutputPacketComposer& reply = m_cmdParser->reply;
+        ClassManager& classManager = GetClassManager();
+
+        jobject object = node.object;
+        jclass cls = jni->GetObjectClass(object);
+        jdwpTag tag = classManager.GetJdwpTag(jni, object);
+        reply.WriteByte(tag);
+        reply.WriteObjectID(jni, object);
+        reply.WriteByte(classManager.GetJdwpTypeTag(cls));
+        reply.WriteReferenceTypeID(jni, cls);
+        reply.WriteInt(node.depth);
+        JDWP_TRACE_DATA("ObjectGraph: send: object=" << object
+            << ", tag=" << tag
+            << ", depth=" << node.depth);
+
+        if (tag == JDWP_TAG_STRING) {
+            jstring str = static_cast<jstring>(object);
+            jsize length = jni->GetStringLength(str);
+            jsize previewLength = (length < m_maxPreview) ? length : m_maxPreview;
+
+            // modified UTF-8 takes at most 3 bytes per char
+            char* value = reinterpret_cast<char*>
+                (GetMemoryManager().Allocate(previewLength * 3 + 1 JDWP_FILE_LINE));
+            AgentAutoFree aafValue(value JDWP_FILE_LINE);
+            value[0] = '\0';
+            jni->GetStringUTFRegion(str, 0, previewLength, value);
+            classManager.CheckOnException(jni);
+
+            reply.WriteInt(length);
+            reply.WriteString(value);
+        } else if (tag == JDWP_TAG_ARRAY) {
+            jarray array = static_cast<jarray>(object);
+            jsize length = jni->GetArrayLength(array);
+            jsize previewLength = (length < m_maxPreview) ? length : m_maxPreview;
+
+            jvmtiError err;
+            char* signature = 0;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetClassSignature(cls, &signature, 0));
+            if (err != JVMTI_ERROR_NONE) {
+                throw AgentException(err);
+            }
+            JvmtiAutoFree afSignature(signature);
+
+            reply.WriteInt(length);
+            ArrayReference::WriteArrayRegion(jni, reply, array, signature,
+                0, previewLength);
+
+            if ((signature[1] == 'L' || signature[1] == '[')
+                && node.depth < m_maxDepth)
+            {
+                jobjectArray objectArray = static_cast<jobjectArray>(object);
+                for (jsize i = 0; i < previewLength; i++) {
+                    jobject element = jni->GetObjectArrayElement(objectArray, i);
+                    classManager.CheckOnException(jni);
+                    AddNode(jni, element, node.depth + 1);
+                    jni->DeleteLocalRef(element);
+                }
+            }
+        } else {
+            WriteFields(jni, object, cls, node.depth);
+        }
+    } catch (const AgentException& e) {
+        jni->PopLocalFrame(0);
+        throw e;
+    }
+
+    jni->PopLocalFrame(0);
+}
+
+void
+Vendor::ObjectGraphHandler::WriteFields(JNIEnv *jni, jobject object,
+        jclass cls, jint depth) throw(AgentException)
+{
+    OutputPacketComposer& reply = m_cmdParser->reply;
+
+    const TypeEntry& type = m_types[WriteType(jni, cls)];
+    reply.WriteInt(type.fieldCount);
+    for (jint i = 0; i < type.fieldCount; i++) {
+        jvalue value;
+        jdwpTag tag = ObjectReference::GetFieldValue(jni, object, cls,
+            type.fields[i].field, type.fields[i].signature, false, value);
+        reply.WriteValue(jni, tag, value);
+
+        if (value.l != 0 && (type.fields[i].signature[0] == 'L'
+                             || type.fields[i].signature[0] == '['))
+        {
+            if (depth < m_maxDepth) {
+                AddNode(jni, value.l, depth + 1);
+            }
+            jni->DeleteLocalRef(value.l);
+        }
+    }
+}
+
+size_t
+Vendor::ObjectGraphHandler::WriteType(JNIEnv *jni, jclass cls)
+    throw(AgentException)
+{
+    OutputPacketComposer& reply = m_cmdParser->reply;
+
+    for (size_t i = 0; i < m_types.size(); i++) {
+        if (jni->IsSameObject(m_types[i].cls, cls) == JNI_TRUE) {
+            reply.WriteBoolean(JNI_FALSE);
+            return i;
+        }
+    }
+
+    jvmtiEnv* jvmti = GetJvmtiEnv();
+    jvmtiError err;
+
+    TypeEntry type;
+    type.cls = static_cast<jclass>(jni->NewGlobalRef(cls));
+    if (type.cls == 0) {
+        throw OutOfMemoryException();
+    }
+    type.fieldCount = 0;
+    type.fields = 0;
+    m_types.push_back(type);
+    TypeEntry& entry = m_types.back();
+
+    reply.WriteBoolean(JNI_TRUE);
+    size_t countPosition = reply.GetPosition();
+    reply.WriteInt(0);
+
+    // instance fields of the class, then of its superclasses
+    for (jclass declaring = cls; declaring != 0; ) {
+        jint fieldsCount = 0;
+        jfieldID* fields = 0;
+        JVMTI_TRACE(err, jvmti->GetClassFields(declaring, &fieldsCount, &fields));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        JvmtiAutoFree afFields(fields);
+
+        for (jint i = 0; i < fieldsCount; i++) {
+            jint modifiers = ReferenceType::GetFieldModifiers(declaring, fields[i]);
+            if ((modifiers & ACC_STATIC) != 0) {
+                continue;
+            }
+
+            char* name = 0;
+            char* signature = 0;
+            JVMTI_TRACE(err, jvmti->GetFieldName(declaring, fields[i],
+                &name, &signature, 0));
+            if (err != JVMTI_ERROR_NONE) {
+                throw AgentException(err);
+            }
+            JvmtiAutoFree afName(name);
+            JvmtiAutoFree afSignature(signature);
+
+            reply.WriteFieldID(jni, fields[i]);
+            reply.WriteString(name);
+            reply.WriteString(signature);
+            reply.WriteInt(modifiers);
+
+            entry.fields = reinterpret_cast<FieldEntry*>
+                (GetMemoryManager().Reallocate(entry.fields,
+                    entry.fieldCount * sizeof(FieldEntry),
+                    (entry.fieldCount + 1) * sizeof(FieldEntry) JDWP_FILE_LINE));
+            FieldEntry& field = entry.fields[entry.fieldCount++];
+            field.field = fields[i];
+            field.signature[0] = signature[0];
+            field.signature[1] = '\0';
+        }
+
+        jclass superClass = jni->GetSuperclass(declaring);
+        if (declaring != cls) {
+            jni->DeleteLocalRef(declaring);
+        }
+        declaring = superClass;
+    }
+
+    size_t currentPosition = reply.GetPosition();
+    jint currentLength = reply.GetLength();
+    reply.SetPosition(countPosition);
+    reply.WriteInt(entry.fieldCount);
+    reply.SetPosition(currentPosition);
+    reply.SetLength(currentLength);
+
+    return m_types.size() - 1;
+}
+
+void
+Vendor::ObjectGraphHandler::Clear(JNIEnv *jni) throw()
+{
+    for (NodeList::iterator i = m_nodes.begin(); i != m_nodes.end(); i++) {
+        if (i->object != 0) {
+            jni->DeleteGlobalRef(i->object);
+        }
+    }
+    m_nodes.clear();
+    for (TypeList::iterator i = m_types.begin(); i != m_types.end(); i++) {
+        jni->DeleteGlobalRef(i->cls);
+        if (i->fields != 0) {
+            GetMemoryManager().Free(i->fields JDWP_FILE_LINE);
+        }
+    }
+    m_types.clear();
+    m_visited.clear();
+}
+
+//-----------------------------------------------------------------------------
+//ClassesChangedHandler--------------------------------------------------------
+
+void
+Vendor::ClassesChangedHandler::Execute(JNIEnv *jni) throw(AgentException)
+{
+    jlong generation = m_cmdParser->command.ReadLong();
+    JDWP_TRACE_DATA("ClassesChanged: received: generation=" << generation);
+
+    GetClassManager().GetClassRegistry().WriteChanges(jni,
+        &m_cmdParser->reply, generation);
+}
@@ -0,0 +1,225 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * Vendor.h
+ *
+ * Commands of the vendor-specific command set, which replace sequences of
+ * standard commands by a single round trip.
+ */
+
+#ifndef _VENDOR_H_
+#define _VENDOR_H_
+
+#include <vector>
+
+#include "AgentException.h"
+#include "CommandHandler.h"
+#include "AgentAllocator.h"
+#include "jdwpTypes.h"
+
+namespace jdwp {
+
+    /**
+     * The namespace includes declaration of the classes implementing commands
+     * from the Vendor command set.
+     */
+    namespace Vendor {
+
+        /**
+         * The class implements the <code>ThreadStates</code> command from the
+         * Vendor command set.
+         */
+        class ThreadStatesHandler : public SyncCommandHandler {
+        protected:
+
+            /**
+             * Executes the <code>ThreadStates</code> JDWP command for the
+             * Vendor command set.
+             *
+             * @param jni - the JNI interface pointer
+             */
+            virtual void Execute(JNIEnv *jni) throw(AgentException);
+
+        };//ThreadStatesHandler
+
+        /**
+         * The class implements the <code>ThreadStacks</code> command from the
+         * Vendor command set.
+         */
+        class ThreadStacksHandler : public SyncCommandHandler {
+        protected:
+
+            /**
+             * Executes the <code>ThreadStacks</code> JDWP command for the
+             * Vendor command set.
+             *
+             * @param jni - the JNI interface pointer
+             */
+            virtual void Execute(JNIEnv *jni) throw(AgentException);
+
+        private:
+
+            /** Frames taken for each thread by one call if all are asked. */
+            static const jint DEFAULT_MAX_FRAMES = 1024;
+
+            /**
+             * Writes frames of one thread.
+             */
+            void WriteFrames(JNIEnv *jni, jthread thread,
+                const jvmtiFrameInfo* frames, jint frameCount,
+                bool withFrameIDs) throw(AgentException);
+
+        };//ThreadStacksHandler
+
+        /**
+         * The class implements the <code>Batch</code> command from the
+         * Vendor command set.
+         */
+        class BatchHandler : public SyncCommandHandler {
+        protected:
+
+            /**
+             * Executes the <code>Batch</code> JDWP command for the
+             * Vendor command set.
+             *
+             * @param jni - the JNI interface pointer
+             */
+            virtual void Execute(JNIEnv *jni) throw(AgentException);
+
+        };//BatchHandler
+
+        /**
+         * The class implements the <code>ObjectGraph</code> command from the
+         * Vendor command set. The command walks fields of the given objects
+         * and returns the reached objects with their field values, as the
+         * <code>ObjectReference</code> and <code>ReferenceType</code>
+         * commands would for each of them.
+         */
+        class ObjectGraphHandler : public SyncCommandHandler {
+        protected:
+
+            /**
+             * Executes the <code>ObjectGraph</code> JDWP command for the
+             * Vendor command set.
+             *
+             * @param jni - the JNI interface pointer
+             */
+            virtual void Execute(JNIEnv *jni) throw(AgentException);
+
+        private:
+
+            /**
+             * Instance field of a type.
+             */
+            struct FieldEntry {
+                jfieldID field;
+                char signature[2];
+            };
+
+            /**
+             * Type of object nodes with its instance fields.
+             */
+            struct TypeEntry {
+                jclass cls;
+                jint fieldCount;
+                FieldEntry* fields;
+            };
+
+            /**
+             * Object to be written with its distance from the roots.
+             */
+            struct NodeEntry {
+                jobject object;
+                jint depth;
+            };
+
+            typedef vector<TypeEntry, AgentAllocator<TypeEntry> > TypeList;
+            typedef vector<NodeEntry, AgentAllocator<NodeEntry> > NodeList;
+            typedef vector<ObjectID, AgentAllocator<ObjectID> > ObjectIDList;
+
+            /** Local references used while one node is written. */
+            static const jint NODE_LOCAL_FRAME = 16;
+
+            /**
+             * Adds the object to the nodes unless it is null, already
+             * added, or the node limit is reached.
+             */
+            void AddNode(JNIEnv *jni, jobject object, jint depth)
+                throw(AgentException);
+
+            /**
+             * Writes the node and adds objects it references.
+             */
+            void WriteNode(JNIEnv *jni, const NodeEntry& node)
+                throw(AgentException);
+
+            /**
+             * Writes the instance field values of an object node.
+             */
+            void WriteFields(JNIEnv *jni, jobject object, jclass cls,
+                jint depth) throw(AgentException);
+
+            /**
+             * Writes whether the type of an object node is new and, for a new
+             * type, its instance fields.
+             *
+             * @return The index of the type in <code>m_types</code>.
+             */
+            size_t WriteType(JNIEnv *jni, jclass cls) throw(AgentException);
+
+            /**
+             * Deletes references held by the handler.
+             */
+            void Clear(JNIEnv *jni) throw();
+
+            jint m_maxDepth;
+            jint m_maxNodes;
+            jint m_maxPreview;
+            TypeList m_types;
+            NodeList m_nodes;
+            // sorted IDs of added nodes
+            ObjectIDList m_visited;
+
+        };//ObjectGraphHandler
+
+        /**
+         * The class implements the <code>ClassesChanged</code> command from
+         * the Vendor command set. The command returns classes prepared and
+         * unloaded since the given generation of the class registry, so that
+         * the debugger does not need to request all classes again.
+         */
+        class ClassesChangedHandler : public SyncCommandHandler {
+        protected:
+
+            /**
+             * Executes the <code>ClassesChanged</code> JDWP command for the
+             * Vendor command set.
+             *
+             * @param jni - the JNI interface pointer
+             */
+            virtual void Execute(JNIEnv *jni) throw(AgentException);
+
+        };//ClassesChangedHandler
+
+    }//Vendor
+
+}//jdwp
+
+#endif //_VENDOR_H_
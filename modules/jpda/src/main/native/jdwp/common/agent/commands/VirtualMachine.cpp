@@ -98,27 +98,15 @@ VirtualMachine::ClassesBySignatureHandler::Execute(JNIEnv *jni) throw(AgentExcep
     JDWP_TRACE_DATA("ClassesBySignature: received: "
         << "signature=" << JDWP_CHECK_NULL(signature));
 
-    jint classCount = 0;
-    jclass* classes = 0;
+    // classes are looked up in the registry hashed by signature
+    ClassRegistry::ClassList classes;
+    GetClassManager().GetClassRegistry().FindClasses(jni, signature, classes);
 
     jvmtiEnv* jvmti = AgentBase::GetJvmtiEnv();
 
     jvmtiError err;
-    JVMTI_TRACE(err, jvmti->GetLoadedClasses(&classCount, &classes));
-    JvmtiAutoFree dobj(classes);
-
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
     int i;
-    int count = 0;
-    for (i = 0; i < classCount; i++)
-    {
-        if (IsSignatureMatch(classes[i], signature)) {
-            classes[count] = classes[i];
-            count++;
-        }
-    }
+    int count = static_cast<int>(classes.size());
     size_t classCountPos = m_cmdParser->reply.GetPosition();
     m_cmdParser->reply.WriteInt(count);
     JDWP_TRACE_DATA("ClassesBySignature: classes=" << count);
@@ -173,98 +161,25 @@ VirtualMachine::ClassesBySignatureHandler::Execute(JNIEnv *jni) throw(AgentExcep
     }
 }
 
-bool
-VirtualMachine::ClassesBySignatureHandler::IsSignatureMatch(jclass klass,
-                                                            const char *signature)
-                                                            throw(AgentException)
-{
-    char* sign = 0;
-
-    jvmtiError err;
-    JVMTI_TRACE(err, GetJvmtiEnv()->GetClassSignature(klass, &sign, 0));
-    JvmtiAutoFree dobj(sign);
-
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
-    return strcmp(signature, sign) == 0;
-}
-
 //-----------------------------------------------------------------------------
 //AllClassesHandler------------------------------------------------------------
 
 void
 VirtualMachine::AllClassesHandler::Execute(JNIEnv *jni) throw(AgentException)
 {
-    jint classCount = 0;
-    jclass* classes = 0;
-
-    jvmtiEnv* jvmti = AgentBase::GetJvmtiEnv();
-    jvmtiError err;
-    JVMTI_TRACE(err, jvmti->GetLoadedClasses(&classCount, &classes));
-
-    JvmtiAutoFree dobj(classes);
-
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
-    JDWP_TRACE_DATA("AllClasses: classes=" << classCount);
-    size_t classCountPos = m_cmdParser->reply.GetPosition();
-    m_cmdParser->reply.WriteInt(classCount);
-
-    // don't trace signatures of all classes
-    int notIncludedClasses = 0;
-    for (int i = 0; i < classCount; i++) {
-        notIncludedClasses += Compose41Class(jni, jvmti, classes[i]);
-    }
-
-    if (notIncludedClasses > 0) {
-        size_t currentPos = m_cmdParser->reply.GetPosition();
-        jint currentLength = m_cmdParser->reply.GetLength();
-        m_cmdParser->reply.SetPosition(classCountPos);
-        m_cmdParser->reply.WriteInt(classCount - notIncludedClasses);
-        m_cmdParser->reply.SetPosition(currentPos);
-        m_cmdParser->reply.SetLength(currentLength);
-    }
+    WriteClasses(jni, false);
 }
 
 //-----------------------------------------------------------------------------
 
-int
-VirtualMachine::AllClassesHandler::Compose41Class(JNIEnv *jni, jvmtiEnv* jvmti,
-        jclass klass) throw (AgentException)
+void
+VirtualMachine::AllClassesHandler::WriteClasses(JNIEnv *jni, bool withGeneric)
+    throw(AgentException)
 {
-    jdwpTypeTag refTypeTag = GetClassManager().GetJdwpTypeTag(klass);
-
-    char* signature = 0;
-
-    jvmtiError err;
-    JVMTI_TRACE(err, jvmti->GetClassSignature(klass, &signature, 0));
-
-    JvmtiAutoFree dobj(signature);
-
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
-    jint status;
-    JVMTI_TRACE(err, jvmti->GetClassStatus(klass, &status));
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
-    // According to JVMTI spec ClassStatus flag for arrays and primitive classes must be zero
-    if (status == JVMTI_CLASS_STATUS_ARRAY || status == JVMTI_CLASS_STATUS_PRIMITIVE) {
-        status = 0;
-    } else if ( (status & JVMTI_CLASS_STATUS_PREPARED) == 0 ) {
-        // Given class is not prepared - don't return such class
-        return 1;
-    }
-
-    m_cmdParser->reply.WriteByte(refTypeTag);
-    m_cmdParser->reply.WriteReferenceTypeID(jni, klass);
-    m_cmdParser->reply.WriteString(signature);
-    m_cmdParser->reply.WriteInt(status);
-
-    return 0;
+    // the registry is kept up to date by ClassPrepare events, so classes
+    // are not enumerated and described again for every request
+    GetClassManager().GetClassRegistry().WriteClasses(jni,
+        &m_cmdParser->reply, withGeneric);
 }
 
 //-----------------------------------------------------------------------------
@@ -695,6 +610,11 @@ VirtualMachine::RedefineClassesHandler::Execute(JNIEnv *jni) throw(AgentExceptio
 
         if (err != JVMTI_ERROR_NONE)
             throw AgentException(err);
+
+        for (i = 0; i < classCount; i++) {
+            GetClassManager().InvalidateLineTables(classDefs[i].klass);
+            GetClassManager().GetReplyCache().Invalidate(jni, classDefs[i].klass);
+        }
     }
 }
 
@@ -713,52 +633,11 @@ VirtualMachine::SetDefaultStratumHandler::Execute(JNIEnv *jni) throw(AgentExcept
 //-----------------------------------------------------------------------------
 //AllClassesWithGenericHandler-------------------------------------------------
 
-int
-VirtualMachine::AllClassesWithGenericHandler::Compose41Class(JNIEnv *jni_env,
-            jvmtiEnv* jvmti, jclass klass) throw (AgentException)
+void
+VirtualMachine::AllClassesWithGenericHandler::Execute(JNIEnv *jni)
+    throw(AgentException)
 {
-    jdwpTypeTag refTypeTag = GetClassManager().GetJdwpTypeTag(klass);
-
-    char* signature = 0;
-    char* generic = 0;
-
-    jvmtiError err;
-    JVMTI_TRACE(err, jvmti->GetClassSignature(klass, &signature, &generic));
-
-    JvmtiAutoFree dobjs(signature);
-    JvmtiAutoFree dobjg(generic);
-
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
-    jint status;
-    JVMTI_TRACE(err, jvmti->GetClassStatus(klass, &status));
-    if (err != JVMTI_ERROR_NONE)
-        throw AgentException(err);
-
-    // According to JVMTI spec ClassStatus flag for arrays and primitive classes must be zero
-    if (status == JVMTI_CLASS_STATUS_ARRAY || status == JVMTI_CLASS_STATUS_PRIMITIVE) {
-        status = 0;
-    } else if ( (status & JVMTI_CLASS_STATUS_PREPARED) == 0 ) {
-        // Given class is not prepared - don't return such class
-        return 1;
-    }
-
-    m_cmdParser->reply.WriteByte(refTypeTag);
-    m_cmdParser->reply.WriteReferenceTypeID(jni_env, klass);
-    m_cmdParser->reply.WriteString(signature);
-
-    if (generic != 0)
-        m_cmdParser->reply.WriteString(generic);
-    else
-        m_cmdParser->reply.WriteString("");
-
-    m_cmdParser->reply.WriteInt(status);
-    JDWP_TRACE_DATA("AllClassesWithGeneric: typeTag=" << refTypeTag << ", refTypeID="
-         << klass << ", signature=" << JDWP_CHECK_NULL(signature) << ", generic=" 
-         << JDWP_CHECK_NULL(generic) << ", status=" << status);
-
-    return 0;
+    WriteClasses(jni, true);
 }
 
 //-----------------------------------------------------------------------------
@@ -72,10 +72,6 @@ namespace jdwp {
              */
             virtual void Execute(JNIEnv *jni) throw(AgentException);
 
-        private:
-            bool IsSignatureMatch(jclass klass, const char *signature)
-                throw(AgentException);
-
         };//ClassesBySignatureHandler
 
         /**
@@ -94,22 +90,12 @@ namespace jdwp {
             virtual void Execute(JNIEnv *jni) throw(AgentException);
 
             /**
-             * If the passed class (klass parameter) has status
-             * JVMTI_CLASS_STATUS_PREPARED then writes class type tag,
-             * reference id, signature and status
-             * to the reply packet and reutrn 0 - success sign.
-             * Otherwise (class not prepared) doesn't write class info
-             * to the reply packet and reutrn 1 - unsuccess sign.
-             *
-             * @param jni   - the JNI interface pointer
-             * @param jvmti - the JVMTI interface pointer
-             * @param klass - the Java class
+             * Writes the classes with or without generic signatures.
              *
-             * @return 0 on success,
-             *         1 otherwise.
+             * @param jni         - the JNI interface pointer
+             * @param withGeneric - whether to write generic signatures
              */
-            virtual int Compose41Class(JNIEnv *jni, jvmtiEnv* jvmti, jclass klass)
-                                            throw (AgentException);
+            void WriteClasses(JNIEnv *jni, bool withGeneric) throw(AgentException);
 
         };//AllClassesHandler
 
@@ -397,22 +383,12 @@ namespace jdwp {
         protected:
 
             /**
-             * If the passed class (klass parameter) has status
-             * JVMTI_CLASS_STATUS_PREPARED then writes class type tag,
-             * reference id, signature, generic signature and status
-             * to the reply packet and reutrn 0 - success sign.
-             * Otherwise (class not prepared) doesn't write class info
-             * to the reply packet and reutrn 1 - unsuccess sign.
+             * Executes the <code>AllClassesWithGeneric</code> JDWP command
+             * for the VirtualMachine command set.
              *
-             * @param jni   - the JNI interface pointer
-             * @param jvmti - the JVMTI interface pointer
-             * @param klass - Java class
-             *
-             * @return 0 on success,
-             *         1 otherwise.
+             * @param jni - the JNI interface pointer
              */
-            virtual int Compose41Class(JNIEnv *jni, jvmtiEnv* jvmti, jclass klass)
-                                            throw (AgentException);
+            virtual void Execute(JNIEnv *jni) throw(AgentException);
 
         };//AllClassesWithGenericHandler
 
@@ -68,17 +68,25 @@ static void Usage()
     std::fprintf(stdout,
         "\nUsage: java -agentlib:agent=[help] |"
         "\n\t[suspend=y|n][,transport=name][,address=addr]"
-        "\n\t[,server=y|n][,timeout=n]"
+        "\n\t[,server=y|n][,timeout=n][,inject=y|n]"
+        "\n\t[,overflow=block|drop|coalesce][,lazycaps=y|n]"
 #ifndef NDEBUG
         "\n\t[,trace=none|all|log_kinds][,src=all|sources][,log=filepath]\n"
 #endif//NDEBUG
         "\nWhere:"
         "\n\thelp\t\tOutput this message"
-        "\n\tsuspend=y|n\tSuspend on start (default: y)"
+        "\n\tsuspend=y|n\tSuspend on start, ignored on attach (default: y)"
         "\n\ttransport=name\tName of transport to use for connection"
         "\n\taddress=addr\tTransport address for connection"
         "\n\tserver=y|n\tListen for or attach to debugger (default: n)"
         "\n\ttimeout=n\tTime in ms to wait for connection (0-forever)"
+        "\n\tinject=y|n\tReport method entry/exit for class-filtered requests"
+        "\n\t\t\tby calls injected into matching classes (default: n)"
+        "\n\toverflow=policy\tHandling of non-suspending events when the event"
+        "\n\t\t\tqueue is full: block the posting thread, drop the"
+        "\n\t\t\toldest events or coalesce them (default: block)"
+        "\n\tlazycaps=y|n\tTake capabilities which slow down the VM, such as"
+        "\n\t\t\tsingle step and field watch, on first use (default: n)"
 #ifndef NDEBUG
         "\n\ttrace=log_kinds\tApplies filtering to log message kind (default: none)"
         "\n\tsrc=sources\tApplies filtering to __FILE__ (default: all)"
@@ -117,24 +125,30 @@ static void Usage()
 // event callbacks
 //-----------------------------------------------------------------------------
 
+static void
+StartAgent(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread) throw(AgentException)
+{
+    jint ver = jni->GetVersion();
+    JDWP_LOG("JNI version: 0x" << hex << ver);
+
+    // initialize agent
+    AgentBase::GetAgentManager().Init(jvmti, jni);
+
+    // if options onthrow or onuncaught are set, defer starting agent and enable notification of EXCEPTION event
+    if (AgentBase::GetOptionParser().GetOnthrow() || AgentBase::GetOptionParser().GetOnuncaught()) {
+        AgentBase::GetAgentManager().EnableInitialExceptionCatch(jvmti, jni);
+    } else {
+        AgentBase::GetAgentManager().Start(jvmti, jni);
+        RequestManager::HandleVMInit(jvmti, jni, thread);
+    }
+}
+
 static void JNICALL
 VMInit(jvmtiEnv *jvmti, JNIEnv *jni, jthread thread)
 {
     try {
         JDWP_TRACE_ENTRY("VMInit(" << jvmti << ',' << jni << ',' << thread << ')');
-        jint ver = jni->GetVersion();
-        JDWP_LOG("JNI version: 0x" << hex << ver);
-
-        // initialize agent
-        AgentBase::GetAgentManager().Init(jvmti, jni);
- 
-        // if options onthrow or onuncaught are set, defer starting agent and enable notification of EXCEPTION event
-        if (AgentBase::GetOptionParser().GetOnthrow() || AgentBase::GetOptionParser().GetOnuncaught()) {
-            AgentBase::GetAgentManager().EnableInitialExceptionCatch(jvmti, jni);
-        } else {
-            AgentBase::GetAgentManager().Start(jvmti, jni);
-            RequestManager::HandleVMInit(jvmti, jni, thread);
-        }
+        StartAgent(jvmti, jni, thread);
     } catch (TransportException& e) {
         JDWP_DIE("JDWP transport error in VM_INIT: " << e.TransportErrorMessage() << " [" << e.ErrCode() << "]");
     } catch (AgentException& e) {
@@ -165,8 +179,12 @@ VMDeath(jvmtiEnv *jvmti, JNIEnv *jni)
 // start-up and shutdown entry points
 //-----------------------------------------------------------------------------
 
-JNIEXPORT jint JNICALL 
-Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
+/**
+ * Creates agent modules and sets up JVMTI environment. The agent is started
+ * by the VM_INIT event, or right away if it is attached to a running VM.
+ */
+static jint
+LoadAgent(JavaVM *vm, char *options, bool isAttach)
 {
 
 //    static STDMemoryManager mm;
@@ -186,7 +204,7 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
     jvmtiEnv *jvmti = 0;
     jvmtiError err;
 
-    JDWP_TRACE_ENTRY("Agent_OnLoad(" << vm << "," << (void*)options << "," << reserved << ")");
+    JDWP_TRACE_ENTRY("LoadAgent(" << vm << "," << (void*)options << "," << isAttach << ")");
 
     // get JVMTI environment
     {
@@ -278,11 +296,15 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
         }
         #endif // NDEBUG
 
-        // exit if help option specified
+        // exit if help option specified, but never exit an attached VM
         if (AgentBase::GetOptionParser().GetHelp()) {
             Usage();
             JDWP_LOG("exit" << endl);
             delete env.optionParser;
+            if (isAttach) {
+                AgentBase::SetAgentEnv(0);
+                return JNI_ERR;
+            }
             std::exit(0);
         }
 
@@ -306,6 +328,7 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
         env.packetDispatcher = new PacketDispatcher();
         env.eventDispatcher = new EventDispatcher();
         env.agentManager = new AgentManager();
+        env.agentManager->SetAttached(isAttach);
     } catch (IllegalArgumentException&) {
         JDWP_INFO("JDWP error: Bad agent options: " << options);
         delete env.optionParser;
@@ -403,6 +426,15 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
         caps.can_generate_garbage_collection_events = 0;
         caps.can_generate_object_free_events = 0;
 
+        // retransformation makes VM keep original class files, so it is
+        // requested only for method entry/exit injection
+        if (!AgentBase::GetOptionParser().GetInject()) {
+            caps.can_retransform_classes = 0;
+        }
+
+        // expensive capabilities may be taken on first use
+        env.agentManager->FilterLazyCapabilities(caps);
+
         JVMTI_TRACE(err, jvmti->AddCapabilities(&caps));
         if (err != JVMTI_ERROR_NONE) {
             JDWP_INFO("Unable to add capabilities: " << err);
@@ -421,6 +453,7 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
         ecbs.Breakpoint = &RequestManager::HandleBreakpoint;
         //ecbs.ClassLoad = &ClassLoad;
         ecbs.ClassPrepare = &RequestManager::HandleClassPrepare;
+        ecbs.ClassFileLoadHook = &MethodTraceInjector::HandleClassFileLoadHook;
         ecbs.Exception = &RequestManager::HandleException;
         //ecbs.ExceptionCatch = &ExceptionCatch;
         ecbs.FieldAccess = &RequestManager::HandleFieldAccess;
@@ -439,11 +472,14 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
             return JNI_ERR;
         }
 
-        JVMTI_TRACE(err, jvmti->SetEventNotificationMode(JVMTI_ENABLE,
-            JVMTI_EVENT_VM_INIT, 0));
-        if (err != JVMTI_ERROR_NONE) {
-            JDWP_INFO("Unable to enable VM_INIT event: " << err);
-            return JNI_ERR;
+        // VM is already initialized in the live phase
+        if (!isAttach) {
+            JVMTI_TRACE(err, jvmti->SetEventNotificationMode(JVMTI_ENABLE,
+                JVMTI_EVENT_VM_INIT, 0));
+            if (err != JVMTI_ERROR_NONE) {
+                JDWP_INFO("Unable to enable VM_INIT event: " << err);
+                return JNI_ERR;
+            }
         }
         JVMTI_TRACE(err, jvmti->SetEventNotificationMode(JVMTI_ENABLE,
             JVMTI_EVENT_VM_DEATH, 0));
@@ -499,6 +535,55 @@ Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
     return JNI_OK;
 }
 
+JNIEXPORT jint JNICALL 
+Agent_OnLoad(JavaVM *vm, char *options, void *reserved)
+{
+    return LoadAgent(vm, options, false);
+}
+
+JNIEXPORT jint JNICALL 
+Agent_OnAttach(JavaVM *vm, char *options, void *reserved)
+{
+    // agent may be loaded only once
+    if (AgentBase::GetAgentEnv() != 0) {
+        JDWP_INFO("JDWP error: Agent is already loaded");
+        return JNI_ERR;
+    }
+
+    jint ret = LoadAgent(vm, options, true);
+    if (ret != JNI_OK) {
+        return ret;
+    }
+
+    JDWP_TRACE_ENTRY("Agent_OnAttach(" << vm << "," << (void*)options << "," << reserved << ")");
+
+    JNIEnv *jni = 0;
+    ret = vm->GetEnv(reinterpret_cast<void**>(&jni), JNI_VERSION_1_4);
+    if (ret != JNI_OK || jni == 0) {
+        JDWP_INFO("Unable to get JNI environment, return code = " << ret);
+        return JNI_ERR;
+    }
+
+    // start agent in the live phase as on VM_INIT event of attaching thread,
+    // but report errors instead of aborting the running VM
+    try {
+        jthread thread = 0;
+        jvmtiError err;
+        JVMTI_TRACE(err, AgentBase::GetJvmtiEnv()->GetCurrentThread(&thread));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        StartAgent(AgentBase::GetJvmtiEnv(), jni, thread);
+    } catch (TransportException& e) {
+        JDWP_INFO("JDWP transport error in Agent_OnAttach: " << e.TransportErrorMessage() << " [" << e.ErrCode() << "]");
+        return JNI_ERR;
+    } catch (AgentException& e) {
+        JDWP_INFO("JDWP error in Agent_OnAttach: " << e.what() << " [" << e.ErrCode() << "]");
+        return JNI_ERR;
+    }
+    return JNI_OK;
+}
+
 JNIEXPORT void JNICALL
 Agent_OnUnload(JavaVM *vm)
 {
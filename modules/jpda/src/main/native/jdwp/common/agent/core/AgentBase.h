@@ -371,6 +371,17 @@ namespace jdwp {
             }
         }
 
+        /**
+         * Gives up the saved pointer, which is not freed any more.
+         *
+         * @return The saved pointer.
+         */
+        void* Release() throw() {
+            void* ptr = m_ptr;
+            m_ptr = 0;
+            return ptr;
+        }
+
     private:
 
         AgentAutoFree(const AgentAutoFree& other) : m_ptr(other.m_ptr) { }
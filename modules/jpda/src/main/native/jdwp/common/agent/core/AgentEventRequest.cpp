@@ -22,9 +22,13 @@
 // AgentEventRequest.cpp
 
 #include <string.h>
+#include <algorithm>
 #include "AgentEventRequest.h"
+#include "Bytecode.h"
 #include "RequestManager.h"
+#include "ClassManager.h"
 #include "Log.h"
+#include "AtomicOps_pd.h"
 
 using namespace jdwp;
 
@@ -38,6 +42,8 @@ AgentEventRequest::AgentEventRequest(jdwpEventKind kind,
     m_modifierCount = modCount;
     m_modifiers = 0;
     m_isExpired = false;
+    m_isInjected = false;
+    m_refCount = 0;
     if (modCount != 0) {
         m_modifiers = reinterpret_cast<RequestModifier**>
             (GetMemoryManager().Allocate(sizeof(RequestModifier*)*modCount JDWP_FILE_LINE));
@@ -81,6 +87,26 @@ jthread AgentEventRequest::GetThread() const throw()
     return 0;
 }
 
+ClassMatchModifier* AgentEventRequest::GetClassMatch() const throw()
+{
+    for (jint i = 0; i < m_modifierCount; i++) {
+        if ((m_modifiers[i])->GetKind() == JDWP_MODIFIER_CLASS_MATCH) {
+            return reinterpret_cast<ClassMatchModifier*>(m_modifiers[i]);
+        }
+    }
+    return 0;
+}
+
+ExceptionOnlyModifier* AgentEventRequest::GetExceptionOnly() const throw()
+{
+    for (jint i = 0; i < m_modifierCount; i++) {
+        if ((m_modifiers[i])->GetKind() == JDWP_MODIFIER_EXCEPTION_ONLY) {
+            return reinterpret_cast<ExceptionOnlyModifier*>(m_modifiers[i]);
+        }
+    }
+    return 0;
+}
+
 FieldOnlyModifier* AgentEventRequest::GetField() const throw()
 {
     for (jint i = 0; i < m_modifierCount; i++) {
@@ -101,14 +127,155 @@ LocationOnlyModifier* AgentEventRequest::GetLocation() const throw()
     return 0;
 }
 
+DeferredLocationModifier* AgentEventRequest::GetDeferredLocation() const throw()
+{
+    for (jint i = 0; i < m_modifierCount; i++) {
+        if ((m_modifiers[i])->GetKind() == JDWP_MODIFIER_DEFERRED_LOCATION) {
+            return reinterpret_cast<DeferredLocationModifier*>(m_modifiers[i]);
+        }
+    }
+    return 0;
+}
+
+CaptureModifier* AgentEventRequest::GetCapture() const throw()
+{
+    for (jint i = 0; i < m_modifierCount; i++) {
+        if ((m_modifiers[i])->GetKind() == JDWP_MODIFIER_CAPTURE) {
+            return reinterpret_cast<CaptureModifier*>(m_modifiers[i]);
+        }
+    }
+    return 0;
+}
+
+bool AgentEventRequest::IsCounted() const throw()
+{
+    for (jint i = 0; i < m_modifierCount; i++) {
+        if ((m_modifiers[i])->GetKind() == JDWP_MODIFIER_COUNT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+jint AgentEventRequest::AddRef() throw()
+{
+    return AtomicIncrement(&m_refCount);
+}
+
+jint AgentEventRequest::Release() throw()
+{
+    return AtomicDecrement(&m_refCount);
+}
+
 
 //-----------------------------------------------------------------------------
 // StepRequest
 //-----------------------------------------------------------------------------
 
+/** Type for list of bytecode locations. */
+typedef vector<jlocation, AgentAllocator<jlocation> > LocationList;
+
+static void AddRangeExit(LocationList& exits, jint target, jint start,
+        jint end) throw(AgentException)
+{
+    if (target < start || target >= end) {
+        exits.push_back(target);
+    }
+}
+
+// collects locations outside of the code range [start, end) where control
+// can be passed by instructions of this range; returns false if the range
+// contains instructions with unknown successors
+static bool CollectRangeExits(const unsigned char* code, jint codeLength,
+        jint start, jint end, LocationList& exits) throw(AgentException)
+{
+    jint pc = start;
+    while (pc < end) {
+        jint opcode = code[pc];
+        if (opcode >= OPCODE_COUNT || opcode == OPCODE_RET) {
+            return false;
+        }
+
+        jint length = OPCODE_LENGTH[opcode];
+        bool fallsThrough = true;
+
+        if (opcode == OPCODE_TABLESWITCH || opcode == OPCODE_LOOKUPSWITCH) {
+            // operands are aligned to 4 bytes from the method start
+            jint base = (pc + 4) & ~3;
+            if (base + 12 > codeLength) {
+                return false;
+            }
+            jint count, first, step;
+            if (opcode == OPCODE_TABLESWITCH) {
+                jint low = ReadInt(code, base + 4);
+                jint high = ReadInt(code, base + 8);
+                if (high < low || high - low >= codeLength) {
+                    return false;
+                }
+                count = high - low + 1;
+                first = base + 12;
+                step = 4;
+            } else {
+                count = ReadInt(code, base + 4);
+                if (count < 0 || count >= codeLength) {
+                    return false;
+                }
+                first = base + 12;
+                step = 8;
+            }
+            length = first + count * step - pc - (step - 4);
+            if (pc + length > codeLength) {
+                return false;
+            }
+            AddRangeExit(exits, pc + ReadInt(code, base), start, end);
+            for (jint i = 0; i < count; i++) {
+                AddRangeExit(exits, pc + ReadInt(code, first + i * step),
+                    start, end);
+            }
+            fallsThrough = false;
+        } else if (opcode == OPCODE_WIDE) {
+            if (pc + 1 >= codeLength || code[pc+1] == OPCODE_RET) {
+                return false;
+            }
+            length = (code[pc+1] == OPCODE_IINC) ? 6 : 4;
+        } else if ((opcode >= OPCODE_IFEQ && opcode <= OPCODE_JSR) ||
+                   opcode == OPCODE_IFNULL || opcode == OPCODE_IFNONNULL)
+        {
+            if (pc + 3 > codeLength) {
+                return false;
+            }
+            AddRangeExit(exits, pc + ReadShort(code, pc + 1), start, end);
+            // subroutine called by jsr returns to the next instruction
+            fallsThrough = (opcode != OPCODE_GOTO);
+        } else if (opcode == OPCODE_GOTO_W || opcode == OPCODE_JSR_W) {
+            if (pc + 5 > codeLength) {
+                return false;
+            }
+            AddRangeExit(exits, pc + ReadInt(code, pc + 1), start, end);
+            fallsThrough = (opcode == OPCODE_JSR_W);
+        } else if ((opcode >= OPCODE_IRETURN && opcode <= OPCODE_RETURN) ||
+                   opcode == OPCODE_ATHROW)
+        {
+            // leaving the method is caught by FramePop and Exception requests
+            fallsThrough = false;
+        }
+
+        if (pc + length > codeLength) {
+            return false;
+        }
+        if (fallsThrough) {
+            AddRangeExit(exits, pc + length, start, end);
+        }
+        pc += length;
+    }
+    return true;
+}
+
 StepRequest::~StepRequest() throw()
 {
-    ControlSingleStep(false);
+    if (m_isActive) {
+        ControlSingleStep(false);
+    }
     JNIEnv *jni = GetJniEnv();
     if (m_framePopRequest != 0) {
         GetRequestManager().DeleteRequest(jni, m_framePopRequest);
@@ -116,9 +283,26 @@ StepRequest::~StepRequest() throw()
     if (m_methodEntryRequest != 0) {
         GetRequestManager().DeleteRequest(jni, m_methodEntryRequest);
     }
+    StopBreakpointStep(jni);
     jni->DeleteGlobalRef(m_thread);
 }
 
+void StepRequest::OnDelete(JNIEnv *jni) throw(AgentException)
+{
+    // event callbacks may still scan this request, so only stop stepping
+    // here and leave the rest to the destructor
+    ControlSingleStep(false);
+    if (m_framePopRequest != 0) {
+        GetRequestManager().DeleteRequest(jni, m_framePopRequest);
+        m_framePopRequest = 0;
+    }
+    if (m_methodEntryRequest != 0) {
+        GetRequestManager().DeleteRequest(jni, m_methodEntryRequest);
+        m_methodEntryRequest = 0;
+    }
+    StopBreakpointStep(jni);
+}
+
 jint StepRequest::GetCurrentLine() throw()
 {
     jint lineNumber = -1;
@@ -129,18 +313,7 @@ jint StepRequest::GetCurrentLine() throw()
         JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameLocation(m_thread, 0,
             &method, &location));
         if (err == JVMTI_ERROR_NONE && location != -1) {
-            jint cnt;
-            jvmtiLineNumberEntry* table = 0;
-            JVMTI_TRACE(err, GetJvmtiEnv()->GetLineNumberTable(method,
-                &cnt, &table));
-            JvmtiAutoFree jafTable(table);
-            if (err == JVMTI_ERROR_NONE && cnt > 0) {
-                jint i = 1;
-                while (i < cnt && location >= table[i].start_location) {
-                    i++;
-                }
-                lineNumber = table[i-1].line_number;
-            }
+            lineNumber = GetClassManager().GetLineNumber(method, location);
         }
     }
     return lineNumber;
@@ -200,6 +373,10 @@ void StepRequest::OnFramePop(JNIEnv *jni)
         currentCount = -1;
     }
 
+    if (m_depth == JDWP_STEP_OVER) {
+        StopBreakpointStep(jni);
+    }
+
     if (m_depth == JDWP_STEP_OVER ||
         (m_depth == JDWP_STEP_OUT && currentCount <= m_frameCount) ||
         (m_methodEntryRequest != 0 && currentCount-1 <= m_frameCount))
@@ -227,6 +404,240 @@ void StepRequest::OnMethodEntry(JNIEnv *jni, EventInfo &eInfo)
     }
 }
 
+void StepRequest::AddMethodEntryRequest(JNIEnv *jni)
+    throw(AgentException)
+{
+    // add internal MethodEntry event request for the thread
+    m_methodEntryRequest = new AgentEventRequest(
+        JDWP_EVENT_METHOD_ENTRY, JDWP_SUSPEND_NONE, 1);
+    m_methodEntryRequest->AddModifier(
+        new ThreadOnlyModifier(jni, m_thread), 0);
+    GetRequestManager().AddInternalRequest(jni, m_methodEntryRequest);
+}
+
+bool StepRequest::SkipExcludedFrame(JNIEnv *jni, jint frameCount)
+    throw(AgentException)
+{
+    if (m_framePopRequest == 0) {
+        return false;
+    }
+
+    // return from the excluded frame is caught by FramePop request,
+    // which cannot be set for native frames
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->NotifyFramePop(m_thread, 0));
+    if (err != JVMTI_ERROR_NONE) {
+        return false;
+    }
+
+    ControlSingleStep(false);
+    m_frameCount = frameCount;
+    if (m_depth == JDWP_STEP_INTO && m_methodEntryRequest == 0) {
+        // callbacks from the excluded frame into applicable classes
+        // are caught by MethodEntry request
+        AddMethodEntryRequest(jni);
+    }
+
+    JDWP_TRACE_EVENT("step: skip excluded frame=" << m_frameCount);
+    return true;
+}
+
+bool StepRequest::OnBreakpoint(JNIEnv *jni, EventInfo &eInfo)
+    throw(AgentException)
+{
+    bool isStepLocation = false;
+    for (RequestList::const_iterator i = m_breakpointRequests.begin();
+            i != m_breakpointRequests.end(); i++)
+    {
+        LocationOnlyModifier* location = (*i)->GetLocation();
+        if (location->GetMethod() == eInfo.method &&
+            location->GetLocation() == eInfo.location)
+        {
+            isStepLocation = true;
+            break;
+        }
+    }
+    if (!isStepLocation) {
+        return false;
+    }
+
+    // ignore recursive calls of the stepped method
+    jint currentCount;
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameCount(m_thread, &currentCount));
+    if (err != JVMTI_ERROR_NONE || currentCount != m_frameCount) {
+        return false;
+    }
+
+    // the line is left at this location, further steps use single stepping
+    StopBreakpointStep(jni);
+    ControlSingleStep(true);
+    return true;
+}
+
+void StepRequest::OnException(JNIEnv *jni) throw(AgentException)
+{
+    StopBreakpointStep(jni);
+    ControlSingleStep(true);
+}
+
+void StepRequest::OnCodeChanged(JNIEnv *jni, jclass cls) throw(AgentException)
+{
+    for (RequestList::const_iterator i = m_breakpointRequests.begin();
+            i != m_breakpointRequests.end(); i++)
+    {
+        LocationOnlyModifier* location = (*i)->GetLocation();
+        if (location != 0 &&
+            JNI_TRUE == jni->IsSameObject(location->GetClass(), cls))
+        {
+            JDWP_TRACE_EVENT("step over line by breakpoints stopped: "
+                "class code changed");
+            StopBreakpointStep(jni);
+            ControlSingleStep(true);
+            return;
+        }
+    }
+}
+
+bool StepRequest::IsOwnRequest(AgentEventRequest* request) const throw()
+{
+    return (request == m_exceptionRequest ||
+        find(m_breakpointRequests.begin(), m_breakpointRequests.end(),
+            request) != m_breakpointRequests.end());
+}
+
+bool StepRequest::StartBreakpointStep(JNIEnv *jni) throw()
+{
+    if (!GetCapabilities().canGetBytecodes) {
+        return false;
+    }
+
+    try {
+        jvmtiError err;
+        jvmtiJlocationFormat format;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetJLocationFormat(&format));
+        if (err != JVMTI_ERROR_NONE || format != JVMTI_JLOCATION_JVMBCI) {
+            return false;
+        }
+
+        jmethodID method;
+        jlocation location;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameLocation(m_thread, 0,
+            &method, &location));
+        if (err != JVMTI_ERROR_NONE || location == -1) {
+            return false;
+        }
+
+        const LineTable* lineTable = GetClassManager().GetLineTable(method);
+        if (lineTable->m_error != JVMTI_ERROR_NONE || lineTable->m_count <= 0) {
+            return false;
+        }
+
+        jint codeLength;
+        unsigned char* code = 0;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetBytecodes(method, &codeLength, &code));
+        JvmtiAutoFree afCode(code);
+        if (err != JVMTI_ERROR_NONE) {
+            return false;
+        }
+
+        // collect exits of all code ranges of the current line
+        const jvmtiLineNumberEntry* entries = lineTable->m_entries;
+        const jint entryCount = lineTable->m_count;
+        LocationList exits;
+        bool isLocationFound = false;
+        for (jint i = 0; i < entryCount; i++) {
+            if (entries[i].line_number != m_lineNumber) {
+                continue;
+            }
+            jlocation start = (i == 0) ? 0 : entries[i].start_location;
+            jlocation end = (i + 1 < entryCount) ?
+                entries[i+1].start_location : codeLength;
+            if (end > codeLength) {
+                return false;
+            }
+            if (start >= end) {
+                continue;
+            }
+            if (!CollectRangeExits(code, codeLength, static_cast<jint>(start),
+                    static_cast<jint>(end), exits))
+            {
+                return false;
+            }
+            isLocationFound = isLocationFound ||
+                (location >= start && location < end);
+        }
+        if (!isLocationFound) {
+            return false;
+        }
+
+        jclass cls;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodDeclaringClass(method, &cls));
+        if (err != JVMTI_ERROR_NONE) {
+            return false;
+        }
+
+        sort(exits.begin(), exits.end());
+        exits.erase(unique(exits.begin(), exits.end()), exits.end());
+        for (LocationList::const_iterator i = exits.begin(); i != exits.end(); i++) {
+            // jumps between ranges of the same line do not leave it
+            if (GetClassManager().GetLineNumber(method, *i) == m_lineNumber) {
+                continue;
+            }
+            AgentEventRequest* request = new AgentEventRequest(
+                JDWP_EVENT_BREAKPOINT, JDWP_SUSPEND_NONE, 2);
+            m_breakpointRequests.push_back(request);
+            request->AddModifier(
+                new LocationOnlyModifier(jni, cls, method, *i), 0);
+            request->AddModifier(new ThreadOnlyModifier(jni, m_thread), 1);
+        }
+        m_exceptionRequest = new AgentEventRequest(
+            JDWP_EVENT_EXCEPTION, JDWP_SUSPEND_NONE, 1);
+        m_exceptionRequest->AddModifier(new ThreadOnlyModifier(jni, m_thread), 0);
+
+        GetRequestManager().AddInternalRequests(jni, m_breakpointRequests);
+        try {
+            GetRequestManager().AddInternalRequest(jni, m_exceptionRequest);
+        } catch (AgentException&) {
+            RequestList requests;
+            requests.swap(m_breakpointRequests);
+            GetRequestManager().DeleteRequests(jni, requests);
+            throw;
+        }
+    } catch (AgentException& e) {
+        JDWP_TRACE_EVENT("step over line by breakpoints failed: " << e.what()
+            << " [" << e.ErrCode() << "]");
+        // the requests are not registered in RequestManager yet
+        for (RequestList::const_iterator i = m_breakpointRequests.begin();
+                i != m_breakpointRequests.end(); i++)
+        {
+            delete *i;
+        }
+        m_breakpointRequests.clear();
+        delete m_exceptionRequest;
+        m_exceptionRequest = 0;
+        return false;
+    }
+
+    JDWP_TRACE_EVENT("step over line by breakpoints: line=" << m_lineNumber
+        << ", breakpoints=" << m_breakpointRequests.size());
+    return true;
+}
+
+void StepRequest::StopBreakpointStep(JNIEnv *jni) throw(AgentException)
+{
+    if (m_exceptionRequest != 0) {
+        AgentEventRequest* request = m_exceptionRequest;
+        m_exceptionRequest = 0;
+        GetRequestManager().DeleteRequest(jni, request);
+    }
+    if (!m_breakpointRequests.empty()) {
+        RequestList requests;
+        requests.swap(m_breakpointRequests);
+        GetRequestManager().DeleteRequests(jni, requests);
+    }
+}
+
 void StepRequest::Init(JNIEnv *jni, jthread thread, jint size, jint depth)
     throw(AgentException)
 {
@@ -261,7 +672,13 @@ void StepRequest::Init(JNIEnv *jni, jthread thread, jint size, jint depth)
         }
     }
 
-    if (m_depth == JDWP_STEP_INTO ||
+    if (m_depth == JDWP_STEP_OVER && m_size == JDWP_STEP_LINE &&
+        m_frameCount > 0 && !m_isNative && m_lineNumber != -1 &&
+        StartBreakpointStep(jni))
+    {
+        // the line is left at internal breakpoints, by exception
+        // or on frame pop
+    } else if (m_depth == JDWP_STEP_INTO ||
         (m_depth == JDWP_STEP_OUT && m_frameCount > 0 && m_isNative) ||
         (m_depth == JDWP_STEP_OVER && m_frameCount > 0 &&
          (m_size == JDWP_STEP_MIN || m_isNative || m_lineNumber != -1)))
@@ -296,18 +713,17 @@ bool StepRequest::ApplyModifiers(JNIEnv *jni, EventInfo &eInfo)
 
     if (currentCount < m_frameCount) {
         // method exit
+        if (!IsClassApplicable(jni, eInfo) &&
+            SkipExcludedFrame(jni, currentCount))
+        {
+            return false;
+        }
     } else if (currentCount > m_frameCount) {
         // method entry
         if (m_depth != JDWP_STEP_INTO || !IsClassApplicable(jni, eInfo)) {
             ControlSingleStep(false);
             if (m_depth == JDWP_STEP_INTO) {
-                // add internal MethodEntry event request for the thread
-                m_methodEntryRequest = new AgentEventRequest(
-                    JDWP_EVENT_METHOD_ENTRY, JDWP_SUSPEND_NONE, 1);
-                m_methodEntryRequest->AddModifier(
-                    new ThreadOnlyModifier(jni, m_thread), 0);
-                GetRequestManager().AddInternalRequest(
-                    jni, m_methodEntryRequest);
+                AddMethodEntryRequest(jni);
             }
             JVMTI_TRACE(err, GetJvmtiEnv()->NotifyFramePop(m_thread, 0));
             if (err == JVMTI_ERROR_OPAQUE_FRAME) {
@@ -29,7 +29,10 @@
 #ifndef _AGENT_EVENT_REQUEST_H_
 #define _AGENT_EVENT_REQUEST_H_
 
+#include <vector>
+
 #include "AgentBase.h"
+#include "AgentAllocator.h"
 #include "RequestModifier.h"
 
 namespace jdwp {
@@ -139,11 +142,31 @@ namespace jdwp {
         virtual bool ApplyModifiers(JNIEnv* jni, EventInfo &eInfo)
             throw(AgentException);
 
+        /**
+         * Called when the request is removed from the list of requests.
+         * The request itself is deleted later, when no event callback
+         * refers to it any more.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        virtual void OnDelete(JNIEnv* jni) throw(AgentException) {}
+
         /**
          * Gets the Java thread from the corresponding ThreadOnly modifier.
          */
         virtual jthread GetThread() const throw();
 
+        /**
+         * Gets the first ClassMatch modifier from the saved list of modifiers.
+         */
+        ClassMatchModifier* GetClassMatch() const throw();
+
+        /**
+         * Gets the first ExceptionOnly modifier from the saved list of
+         * modifiers.
+         */
+        ExceptionOnlyModifier* GetExceptionOnly() const throw();
+
         /**
          * Gets the FieldOnly modifier from the saved list of modifiers.
          */
@@ -154,9 +177,60 @@ namespace jdwp {
          */
         LocationOnlyModifier* GetLocation() const throw();
 
+        /**
+         * Gets the DeferredLocation modifier from the saved list of modifiers.
+         */
+        DeferredLocationModifier* GetDeferredLocation() const throw();
+
+        /**
+         * Gets the Capture modifier from the saved list of modifiers.
+         * Only tracepoint requests have it.
+         */
+        CaptureModifier* GetCapture() const throw();
+
+        /**
+         * Returns whether the events of this request are reported by the
+         * code injected into the matching classes.
+         */
+        bool IsInjected() const throw() {
+            return m_isInjected;
+        }
+
+        /**
+         * Sets whether the events of this request are reported by the code
+         * injected into the matching classes. Used by
+         * <code>RequestManager</code> when the request is enabled.
+         */
+        void SetInjected(bool flag) throw() { m_isInjected = flag; }
+
+        /**
+         * Checks whether this request has a Count modifier, i.e. whether
+         * applying its modifiers changes the request state.
+         */
+        bool IsCounted() const throw();
+
+        /**
+         * Increments the number of request list snapshots referring to this
+         * request. Used by <code>RequestManager</code> only, may be called
+         * concurrently.
+         *
+         * @return New number of references.
+         */
+        jint AddRef() throw();
+
+        /**
+         * Decrements the number of request list snapshots referring to this
+         * request. Used by <code>RequestManager</code> only, may be called
+         * concurrently.
+         *
+         * @return New number of references.
+         */
+        jint Release() throw();
+
     protected:
 
         bool m_isExpired;
+        bool m_isInjected;
         jint m_modifierCount;
         RequestModifier** m_modifiers;
 
@@ -165,9 +239,14 @@ namespace jdwp {
         RequestID m_requestId;
         jdwpEventKind m_eventKind;
         jdwpSuspendPolicy m_suspendPolicy;
+        volatile jint m_refCount;
 
     };
 
+    /** Type for list of event requests. */
+    typedef vector<AgentEventRequest*,
+        AgentAllocator<AgentEventRequest*> > RequestList;
+
     /**
      * The class implements step event request that handles single step
      * events generated by target VM.
@@ -193,7 +272,8 @@ namespace jdwp {
             m_isNative(false),
             m_isActive(false),
             m_framePopRequest(0),
-            m_methodEntryRequest(0)
+            m_methodEntryRequest(0),
+            m_exceptionRequest(0)
         { JDWP_ASSERT(modCount > 0); }
 
         /**
@@ -201,6 +281,14 @@ namespace jdwp {
          */
         ~StepRequest() throw();
 
+        /**
+         * Disables single stepping and removes internal requests
+         * of this step request.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void OnDelete(JNIEnv* jni) throw(AgentException);
+
         /**
          * Handles step on frame pop event.
          *
@@ -217,6 +305,48 @@ namespace jdwp {
         void OnMethodEntry(JNIEnv *jni, EventInfo &eInfo)
             throw(AgentException);
 
+        /**
+         * Handles step on breakpoint event. If the breakpoint is one of the
+         * internal breakpoints set for stepping over the current line and
+         * occurred in the stepped frame, the line is left and stepping is
+         * switched back to single stepping.
+         *
+         * @param jni   - the JNI interface pointer
+         * @param eInfo - event information
+         *
+         * @return <code>true</code> if the step is completed at the
+         *         breakpoint location, otherwise <code>false</code>.
+         */
+        bool OnBreakpoint(JNIEnv *jni, EventInfo &eInfo)
+            throw(AgentException);
+
+        /**
+         * Handles step on exception event. The exception handler location is
+         * not known in advance, so stepping is switched back to single
+         * stepping.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void OnException(JNIEnv *jni) throw(AgentException);
+
+        /**
+         * Handles retransformation of the given class. Internal breakpoints
+         * set in its methods refer to the previous code, so stepping over
+         * the line is switched back to single stepping.
+         *
+         * @param jni - the JNI interface pointer
+         * @param cls - the retransformed class
+         */
+        void OnCodeChanged(JNIEnv *jni, jclass cls) throw(AgentException);
+
+        /**
+         * Checks whether the given request is an internal request created
+         * by this step request.
+         *
+         * @param request - the event request to check
+         */
+        bool IsOwnRequest(AgentEventRequest* request) const throw();
+
         /**
          * Initializes step event request.
          * @param jni    - the JNI interface pointer
@@ -263,6 +393,47 @@ namespace jdwp {
          */
         void ControlSingleStep(bool enable) throw();
 
+        /**
+         * Adds internal MethodEntry request for the step thread.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void AddMethodEntryRequest(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Stops single stepping in a frame of an excluded class entered by
+         * return from the stepped method, until the frame is popped or an
+         * applicable method is entered from it by step into.
+         *
+         * @param jni        - the JNI interface pointer
+         * @param frameCount - the number of frames including excluded one
+         *
+         * @return <code>false</code> if the frame cannot be skipped and
+         *         single stepping should be continued.
+         */
+        bool SkipExcludedFrame(JNIEnv* jni, jint frameCount)
+            throw(AgentException);
+
+        /**
+         * Starts stepping over the current line with internal breakpoints
+         * set at all locations where control can leave the line in the
+         * current method. Return from the method is caught by the FramePop
+         * request and exceptions by an internal Exception request.
+         *
+         * @param jni - the JNI interface pointer
+         *
+         * @return <code>false</code> if the method code cannot be analyzed
+         *         and single stepping should be used instead.
+         */
+        bool StartBreakpointStep(JNIEnv* jni) throw();
+
+        /**
+         * Removes internal requests set by <code>StartBreakpointStep()</code>.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void StopBreakpointStep(JNIEnv* jni) throw(AgentException);
+
         /**
          * Checks whether at least one modifier can be applied.
          *
@@ -280,6 +451,8 @@ namespace jdwp {
         bool m_isActive;
         AgentEventRequest* m_framePopRequest;
         AgentEventRequest* m_methodEntryRequest;
+        AgentEventRequest* m_exceptionRequest;
+        RequestList m_breakpointRequests;
 
     };
 
@@ -20,6 +20,8 @@
  * @author Aleksander V. Budniy
  */
 
+#include <string.h>
+
 #include "AgentManager.h"
 #include "ClassManager.h"
 #include "ObjectManager.h"
@@ -29,6 +31,7 @@
 #include "TransportManager.h"
 #include "PacketDispatcher.h"
 #include "EventDispatcher.h"
+#include "AtomicOps_pd.h"
 
 using namespace jdwp;
 
@@ -39,6 +42,9 @@ void AgentManager::Init(jvmtiEnv *jvmti, JNIEnv *jni) throw (AgentException)
     JDWP_TRACE_PROG("Init: init agent modules and load transport");
 
     AgentBase::SetIsDead(false);
+    if (AgentBase::GetOptionParser().GetLazyCapabilities()) {
+        UpdateLazyCapabilities(jvmti);
+    }
     AgentBase::GetClassManager().Init(jni);
     AgentBase::GetObjectManager().Init(jni);
     AgentBase::GetThreadManager().Init(jni);
@@ -161,3 +167,117 @@ void AgentManager::DisableInitialExceptionCatch(jvmtiEnv *jvmti, JNIEnv *jni) th
         throw AgentException(err);
     }
 }
+
+void AgentManager::FilterLazyCapabilities(jvmtiCapabilities& caps) throw()
+{
+    if (AgentBase::GetOptionParser().GetLazyCapabilities()) {
+        caps.can_generate_single_step_events = 0;
+        caps.can_generate_field_access_events = 0;
+        caps.can_generate_field_modification_events = 0;
+        caps.can_access_local_variables = 0;
+        caps.can_pop_frame = 0;
+        m_lazyCaps = 0;
+    } else {
+        m_lazyCaps =
+            (caps.can_generate_single_step_events ? CAP_SINGLE_STEP : 0) |
+            (caps.can_generate_field_access_events ? CAP_FIELD_ACCESS : 0) |
+            (caps.can_generate_field_modification_events ? CAP_FIELD_MODIFICATION : 0) |
+            (caps.can_access_local_variables ? CAP_LOCAL_VARIABLES : 0) |
+            (caps.can_pop_frame ? CAP_POP_FRAME : 0);
+    }
+}
+
+void AgentManager::RequireCapability(LazyCapability cap) throw (AgentException)
+{
+    if ((m_lazyCaps & cap) != 0) {
+        return;
+    }
+
+    JDWP_TRACE_ENTRY("RequireCapability(" << cap << ")");
+
+    jvmtiCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    switch (cap) {
+    case CAP_SINGLE_STEP:
+        caps.can_generate_single_step_events = 1;
+        break;
+    case CAP_FIELD_ACCESS:
+        caps.can_generate_field_access_events = 1;
+        break;
+    case CAP_FIELD_MODIFICATION:
+        caps.can_generate_field_modification_events = 1;
+        break;
+    case CAP_LOCAL_VARIABLES:
+        caps.can_access_local_variables = 1;
+        break;
+    case CAP_POP_FRAME:
+        caps.can_pop_frame = 1;
+        break;
+    }
+
+    // adding a possessed capability again is harmless, so concurrent
+    // callers need no lock
+    jvmtiError err;
+    JVMTI_TRACE(err, AgentBase::GetJvmtiEnv()->AddCapabilities(&caps));
+    if (err != JVMTI_ERROR_NONE) {
+        JDWP_INFO("Unable to add capability " << cap << ": " << err);
+        throw AgentException(JVMTI_ERROR_MUST_POSSESS_CAPABILITY);
+    }
+
+    jint oldCaps;
+    do {
+        oldCaps = m_lazyCaps;
+    } while (!AtomicCompareAndSet(&m_lazyCaps, oldCaps, oldCaps | cap));
+}
+
+void AgentManager::UpdateLazyCapabilities(jvmtiEnv *jvmti) throw (AgentException)
+{
+    JDWP_TRACE_ENTRY("UpdateLazyCapabilities(" << jvmti << ")");
+
+    // some capabilities are available only in the OnLoad phase
+    jvmtiCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    jvmtiError err;
+    JVMTI_TRACE(err, jvmti->GetPotentialCapabilities(&caps));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    jdwpCapabilities& jdwpCaps = AgentBase::GetCapabilities();
+    jdwpCaps.canWatchFieldAccess = caps.can_generate_field_access_events;
+    jdwpCaps.canWatchFieldModification =
+        caps.can_generate_field_modification_events;
+    jdwpCaps.canPopFrames = caps.can_pop_frame;
+
+    JDWP_TRACE_PROG("UpdateLazyCapabilities: singleStep="
+        << caps.can_generate_single_step_events
+        << ", localVariables=" << caps.can_access_local_variables
+        << ", watchFieldAccess=" << jdwpCaps.canWatchFieldAccess
+        << ", watchFieldModification=" << jdwpCaps.canWatchFieldModification
+        << ", popFrames=" << jdwpCaps.canPopFrames);
+}
+
+void AgentManager::RelinquishLazyCapabilities() throw ()
+{
+    if (!AgentBase::GetOptionParser().GetLazyCapabilities() || m_lazyCaps == 0) {
+        return;
+    }
+
+    JDWP_TRACE_ENTRY("RelinquishLazyCapabilities()");
+
+    jvmtiCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    caps.can_generate_single_step_events = (m_lazyCaps & CAP_SINGLE_STEP) != 0;
+    caps.can_generate_field_access_events = (m_lazyCaps & CAP_FIELD_ACCESS) != 0;
+    caps.can_generate_field_modification_events =
+        (m_lazyCaps & CAP_FIELD_MODIFICATION) != 0;
+    caps.can_access_local_variables = (m_lazyCaps & CAP_LOCAL_VARIABLES) != 0;
+    caps.can_pop_frame = (m_lazyCaps & CAP_POP_FRAME) != 0;
+    m_lazyCaps = 0;
+
+    jvmtiError err;
+    JVMTI_TRACE(err, AgentBase::GetJvmtiEnv()->RelinquishCapabilities(&caps));
+    if (err != JVMTI_ERROR_NONE) {
+        JDWP_INFO("Unable to relinquish capabilities: " << err);
+    }
+}
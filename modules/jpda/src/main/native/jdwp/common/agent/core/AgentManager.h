@@ -49,12 +49,26 @@ namespace jdwp {
     class AgentManager : public AgentBase {
 
     public :
+
+        /**
+         * Expensive capabilities, which are not taken at load time in the
+         * lazy capabilities mode, but on first use in the live phase.
+         */
+        enum LazyCapability {
+            CAP_SINGLE_STEP = 0x01,
+            CAP_FIELD_ACCESS = 0x02,
+            CAP_FIELD_MODIFICATION = 0x04,
+            CAP_LOCAL_VARIABLES = 0x08,
+            CAP_POP_FRAME = 0x10
+        };
         
         /**
          * A constructor.
          */
         AgentManager() throw() {
             m_isStarted = false;
+            m_isAttached = false;
+            m_lazyCaps = 0;
         }
 
         /**
@@ -97,6 +111,20 @@ namespace jdwp {
             m_isStarted = isStarted;
         }
 
+        /*
+         * Returns whether this agent is attached to a running VM.
+         */
+        bool IsAttached() throw() {
+            return m_isAttached;
+        }
+
+        /*
+         * Sets whether this agent is attached to a running VM.
+         */
+        void SetAttached(bool isAttached) throw() {
+            m_isAttached = isAttached;
+        }
+
         /**
          * Enables catching initial EXCEPTION event to launch debugger.
          */
@@ -107,9 +135,45 @@ namespace jdwp {
          */
         void DisableInitialExceptionCatch(jvmtiEnv *jvmti, JNIEnv *jni) throw (AgentException);
 
+        /**
+         * Removes the lazily taken capabilities from the given set of
+         * capabilities if the lazy capabilities mode is on, and otherwise
+         * remembers which of them are in the set.
+         *
+         * @param caps - the capabilities to be added at load time
+         */
+        void FilterLazyCapabilities(jvmtiCapabilities& caps) throw();
+
+        /**
+         * Ensures that the given lazily taken capability is possessed by
+         * the agent, adding it on first use.
+         *
+         * @param cap - the required capability
+         *
+         * @exception AgentException(JVMTI_ERROR_MUST_POSSESS_CAPABILITY)
+         *            is thrown if the capability cannot be added.
+         */
+        void RequireCapability(LazyCapability cap) throw (AgentException);
+
+        /**
+         * Gives up the lazily taken capabilities after a debugger session,
+         * so that they are taken again only if the next session needs them.
+         */
+        void RelinquishLazyCapabilities() throw ();
+
     private :
 
+        /**
+         * Updates JDWP capabilities of lazily taken JVMTI capabilities to
+         * the capabilities still available in the live phase.
+         */
+        void UpdateLazyCapabilities(jvmtiEnv *jvmti) throw (AgentException);
+
         bool volatile m_isStarted;
+        bool m_isAttached;
+
+        // mask of possessed lazy capabilities
+        jint volatile m_lazyCaps;
 
     }; //class AgentManager
 
@@ -0,0 +1,172 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// AgentThreadPool.cpp
+
+#include "AgentThreadPool.h"
+#include "ThreadManager.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+AgentThreadPool::AgentThreadPool() throw()
+    : m_monitor(0)
+    , m_workerCount(0)
+    , m_idleCount(0)
+    , m_isStopped(false)
+{}
+
+AgentThreadPool::~AgentThreadPool() throw()
+{}
+
+void AgentThreadPool::Init(JNIEnv *jni) throw()
+{
+    JDWP_TRACE_ENTRY("Init(" << jni << ")");
+
+    m_monitor = new AgentMonitor("_jdwp_AgentThreadPool_monitor");
+    m_workerCount = 0;
+    m_idleCount = 0;
+    m_isStopped = false;
+}
+
+void AgentThreadPool::Clean(JNIEnv *jni) throw()
+{
+    JDWP_TRACE_ENTRY("Clean(" << jni << ")");
+
+    if (m_monitor == 0) {
+        return;
+    }
+
+    jint workerCount;
+    try {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        m_isStopped = true;
+        for (TaskQueue::iterator i = m_tasks.begin(); i != m_tasks.end(); i++) {
+            JDWP_TRACE_THREAD("Clean: drop task arg=" << i->arg);
+            i->release(i->arg);
+        }
+        m_tasks.clear();
+        m_monitor->NotifyAll();
+        for (jint i = 0; i < STOP_WAITS && m_workerCount > 0; i++) {
+            m_monitor->Wait(STOP_TIMEOUT);
+        }
+        workerCount = m_workerCount;
+    } catch (AgentException& e) {
+        JDWP_INFO("JDWP error in AgentThreadPool: " << e.what() << " [" << e.ErrCode() << "]");
+        return;
+    }
+
+    // workers still busy with their tasks use the monitor afterwards
+    if (workerCount == 0) {
+        delete m_monitor;
+        m_monitor = 0;
+    } else {
+        JDWP_TRACE_THREAD("Clean: busy workers=" << workerCount);
+    }
+}
+
+void AgentThreadPool::Execute(JNIEnv *jni, jvmtiStartFunction proc, void *arg,
+        TaskRelease release)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Execute(" << jni << ',' << proc << ',' << arg << ")");
+
+    {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        Task task;
+        task.proc = proc;
+        task.arg = arg;
+        task.release = release;
+        m_tasks.push_back(task);
+
+        // awaked workers do not count as idle any more
+        if (static_cast<jint>(m_tasks.size()) <= m_idleCount) {
+            m_monitor->Notify();
+            return;
+        }
+        m_workerCount++;
+    }
+
+    JDWP_TRACE_THREAD("Execute: start new worker");
+    try {
+        GetThreadManager().RunAgentThread(jni, StartWorker, this,
+            JVMTI_THREAD_MAX_PRIORITY, "_jdwp_AgentThreadPool_worker");
+    } catch (AgentException& e) {
+        JDWP_ASSERT(e.ErrCode() != JDWP_ERROR_NULL_POINTER);
+        JDWP_ASSERT(e.ErrCode() != JDWP_ERROR_INVALID_PRIORITY);
+
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        m_workerCount--;
+        for (TaskQueue::iterator i = m_tasks.begin(); i != m_tasks.end(); i++) {
+            if (i->arg == arg && i->proc == proc) {
+                m_tasks.erase(i);
+                throw e;
+            }
+        }
+        // task is already taken by another worker
+    }
+}
+
+void JNICALL
+AgentThreadPool::StartWorker(jvmtiEnv* jvmti, JNIEnv* jni, void* arg)
+{
+    JDWP_TRACE_ENTRY("StartWorker(" << jvmti << ',' << jni << ',' << arg << ")");
+
+    try {
+        reinterpret_cast<AgentThreadPool*>(arg)->RunWorker(jvmti, jni);
+    } catch (AgentException& e) {
+        JDWP_INFO("JDWP error in AgentThreadPool: " << e.what() << " [" << e.ErrCode() << "]");
+    }
+}
+
+void AgentThreadPool::RunWorker(jvmtiEnv* jvmti, JNIEnv* jni)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+
+    while (true) {
+        while (m_tasks.empty() && !m_isStopped) {
+            if (m_idleCount >= MAX_IDLE_WORKERS) {
+                break;
+            }
+            m_idleCount++;
+            m_monitor->Wait();
+            m_idleCount--;
+        }
+        if (m_tasks.empty()) {
+            // stopped or not needed any more
+            break;
+        }
+
+        Task task = m_tasks.front();
+        m_tasks.erase(m_tasks.begin());
+
+        m_monitor->Exit();
+        try {
+            (*task.proc)(jvmti, jni, task.arg);
+        } catch (AgentException& e) {
+            JDWP_INFO("JDWP error in agent task: " << e.what() << " [" << e.ErrCode() << "]");
+        }
+        m_monitor->Enter();
+    }
+
+    m_workerCount--;
+    if (m_isStopped) {
+        m_monitor->NotifyAll();
+    }
+}
@@ -0,0 +1,142 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * AgentThreadPool.h
+ *
+ * Runs short agent tasks, such as asynchronous commands, on reused agent
+ * threads.
+ */
+
+#ifndef _AGENT_THREAD_POOL_H_
+#define _AGENT_THREAD_POOL_H_
+
+#include <vector>
+
+#include "jni.h"
+#include "jvmti.h"
+#include "AgentBase.h"
+#include "AgentException.h"
+#include "AgentMonitor.h"
+#include "AgentAllocator.h"
+
+namespace jdwp {
+
+    /**
+     * The class keeps a set of agent worker threads, which take tasks from
+     * a queue. A new worker is started whenever a task is queued and no
+     * worker is idle, so tasks blocked for a long time, like method
+     * invocations, never delay other tasks. Up to <code>MAX_IDLE_WORKERS</code>
+     * workers stay alive waiting for the next task.
+     */
+    class AgentThreadPool : public AgentBase {
+
+    public:
+
+        /**
+         * Releases the argument of a task which is never run.
+         */
+        typedef void (*TaskRelease)(void* arg);
+
+        /**
+         * A constructor.
+         */
+        AgentThreadPool() throw();
+
+        /**
+         * A destructor.
+         */
+        ~AgentThreadPool() throw();
+
+        /**
+         * Initializes the pool.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Init(JNIEnv *jni) throw();
+
+        /**
+         * Stops idle workers and cleans the pool.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Clean(JNIEnv *jni) throw();
+
+        /**
+         * Queues the task and starts a new worker if no worker is idle.
+         *
+         * @param jni  - the JNI interface pointer
+         * @param proc    - the task function
+         * @param arg     - the argument to the task function
+         * @param release - the function releasing the argument if the pool
+         *                  is cleaned before the task is run
+         *
+         * @exception AgentException is thrown if a new worker cannot be
+         *            started.
+         */
+        void Execute(JNIEnv *jni, jvmtiStartFunction proc, void *arg,
+                     TaskRelease release) throw(AgentException);
+
+    private:
+
+        /**
+         * Queued task.
+         */
+        struct Task {
+            jvmtiStartFunction proc;
+            void* arg;
+            TaskRelease release;
+        };
+
+        /** Type for the queue of tasks. */
+        typedef vector<Task, AgentAllocator<Task> > TaskQueue;
+
+        /** Number of workers kept waiting for new tasks. */
+        static const jint MAX_IDLE_WORKERS = 4;
+
+        /** Time in ms of one wait for stopped workers in <code>Clean()</code>. */
+        static const jlong STOP_TIMEOUT = 100;
+
+        /** Number of waits for stopped workers in <code>Clean()</code>. */
+        static const jint STOP_WAITS = 10;
+
+        /**
+         * Start function of worker threads.
+         */
+        static void JNICALL StartWorker(jvmtiEnv* jvmti, JNIEnv* jni, void* arg);
+
+        /**
+         * Runs queued tasks until the worker is no more needed.
+         */
+        void RunWorker(jvmtiEnv* jvmti, JNIEnv* jni) throw(AgentException);
+
+        AgentMonitor* m_monitor;
+        TaskQueue m_tasks;
+
+        // number of started and waiting workers
+        jint m_workerCount;
+        jint m_idleCount;
+
+        bool m_isStopped;
+
+    };
+
+}
+
+#endif // _AGENT_THREAD_POOL_H_
@@ -0,0 +1,112 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// BlockPool.cpp
+
+#include "BlockPool.h"
+#include "AtomicOps_pd.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+BlockPool::BlockPool(size_t blockSize, jint maxCount) throw()
+    : m_blockSize(blockSize < sizeof(FreeBlock) ? sizeof(FreeBlock) : blockSize)
+    , m_maxCount(maxCount)
+    , m_freeBlocks(0)
+    , m_freeCount(0)
+    , m_lock(0)
+{}
+
+BlockPool::~BlockPool() throw()
+{}
+
+void BlockPool::Lock() throw()
+{
+    jint spins = 0;
+    while (!AtomicCompareAndSet(&m_lock, 0, 1)) {
+        // wait for the lock to be released without writing it
+        while (m_lock != 0) {
+            if (++spins >= MAX_LOCK_SPINS) {
+                SpinYield();
+                spins = 0;
+            }
+        }
+    }
+}
+
+void BlockPool::Unlock() throw()
+{
+    // also a memory barrier for the list updated under the lock
+    AtomicCompareAndSet(&m_lock, 1, 0);
+}
+
+void BlockPool::Clean() throw()
+{
+    FreeBlock* blocks;
+    Lock();
+    blocks = m_freeBlocks;
+    m_freeBlocks = 0;
+    m_freeCount = 0;
+    m_maxCount = 0;
+    Unlock();
+
+    while (blocks != 0) {
+        FreeBlock* next = blocks->next;
+        GetMemoryManager().Free(blocks JDWP_FILE_LINE);
+        blocks = next;
+    }
+}
+
+void* BlockPool::Allocate() throw(AgentException)
+{
+    FreeBlock* block;
+    Lock();
+    block = m_freeBlocks;
+    if (block != 0) {
+        m_freeBlocks = block->next;
+        m_freeCount--;
+    }
+    Unlock();
+
+    if (block == 0) {
+        return GetMemoryManager().Allocate(m_blockSize JDWP_FILE_LINE);
+    }
+    return block;
+}
+
+void BlockPool::Free(void* block) throw()
+{
+    if (block == 0) {
+        return;
+    }
+
+    bool isKept = false;
+    Lock();
+    if (m_freeCount < m_maxCount) {
+        FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+        freeBlock->next = m_freeBlocks;
+        m_freeBlocks = freeBlock;
+        m_freeCount++;
+        isKept = true;
+    }
+    Unlock();
+
+    if (!isKept) {
+        GetMemoryManager().Free(block JDWP_FILE_LINE);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * BlockPool.h
+ *
+ * Keeps freed memory blocks of one size for reuse, so that objects created
+ * for every event do not go through the memory manager.
+ */
+
+#ifndef _BLOCK_POOL_H_
+#define _BLOCK_POOL_H_
+
+#include "AgentBase.h"
+
+namespace jdwp {
+
+    /**
+     * The class provides a bounded free list of memory blocks of the given
+     * size. The list is guarded by a spin lock, as it is held for a few
+     * instructions only; a thread spinning for long gives up its time
+     * slice, since the holder was likely preempted. Blocks are allocated by the memory manager, so a
+     * block may be reallocated or freed by it as well.
+     */
+    class BlockPool : public AgentBase {
+
+    public:
+
+        /**
+         * A constructor.
+         *
+         * @param blockSize - the size of blocks
+         * @param maxCount  - the maximal number of kept free blocks
+         */
+        BlockPool(size_t blockSize, jint maxCount) throw();
+
+        /**
+         * A destructor.
+         */
+        ~BlockPool() throw();
+
+        /**
+         * Frees all kept blocks. Blocks freed later are not kept.
+         */
+        void Clean() throw();
+
+        /**
+         * Gets the size of blocks.
+         */
+        size_t GetBlockSize() const throw() {
+            return m_blockSize;
+        }
+
+        /**
+         * Takes a free block or allocates a new one.
+         *
+         * @return Pointer to the block.
+         *
+         * @exception If memory cannot be allocated,
+         *            <code>OutOfMemoryException</code> is thrown.
+         */
+        void* Allocate() throw(AgentException);
+
+        /**
+         * Returns the block to the pool.
+         *
+         * @param block - the pointer to the block
+         */
+        void Free(void* block) throw();
+
+    private:
+
+        /**
+         * Header of a free block.
+         */
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        /** Number of failed lock attempts before the thread yields. */
+        static const jint MAX_LOCK_SPINS = 64;
+
+        void Lock() throw();
+        void Unlock() throw();
+
+        size_t m_blockSize;
+        jint m_maxCount;
+        FreeBlock* m_freeBlocks;
+        jint m_freeCount;
+        volatile jint m_lock;
+
+    };
+
+}
+
+#endif // _BLOCK_POOL_H_
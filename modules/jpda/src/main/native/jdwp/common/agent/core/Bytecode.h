@@ -0,0 +1,163 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * Bytecode.h
+ *
+ * Constants and helpers for walking JVM bytecode.
+ */
+
+#ifndef _BYTECODE_H_
+#define _BYTECODE_H_
+
+#include "jni.h"
+
+namespace jdwp {
+
+    // lengths of JVM instructions indexed by opcode, 0 for instructions
+    // of variable length (tableswitch, lookupswitch, wide)
+    static const unsigned char OPCODE_LENGTH[] = {
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x00
+        2, 3, 2, 3, 3, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, // 0x10
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x20
+        1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, // 0x30
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x40
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x50
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x60
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x70
+        1, 1, 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, // 0x80
+        1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 3, 3, 3, 3, 3, 3, // 0x90
+        3, 3, 3, 3, 3, 3, 3, 3, 3, 2, 0, 0, 1, 1, 1, 1, // 0xa0
+        1, 1, 3, 3, 3, 3, 3, 3, 3, 5, 5, 3, 2, 3, 1, 1, // 0xb0
+        3, 3, 1, 1, 0, 4, 3, 3, 5, 5                    // 0xc0
+    };
+
+    static const jint OPCODE_COUNT =
+        sizeof(OPCODE_LENGTH) / sizeof(OPCODE_LENGTH[0]);
+
+    enum {
+        OPCODE_IFEQ = 0x99,
+        OPCODE_GOTO = 0xa7,
+        OPCODE_JSR = 0xa8,
+        OPCODE_RET = 0xa9,
+        OPCODE_TABLESWITCH = 0xaa,
+        OPCODE_LOOKUPSWITCH = 0xab,
+        OPCODE_IRETURN = 0xac,
+        OPCODE_RETURN = 0xb1,
+        OPCODE_INVOKESTATIC = 0xb8,
+        OPCODE_ATHROW = 0xbf,
+        OPCODE_WIDE = 0xc4,
+        OPCODE_IINC = 0x84,
+        OPCODE_IFNULL = 0xc6,
+        OPCODE_IFNONNULL = 0xc7,
+        OPCODE_GOTO_W = 0xc8,
+        OPCODE_JSR_W = 0xc9
+    };
+
+    /**
+     * Reads a signed big-endian 2-byte value.
+     */
+    inline jint ReadShort(const unsigned char* code, jint pc) throw()
+    {
+        return static_cast<jshort>((code[pc] << 8) | code[pc+1]);
+    }
+
+    /**
+     * Reads a signed big-endian 4-byte value.
+     */
+    inline jint ReadInt(const unsigned char* code, jint pc) throw()
+    {
+        return static_cast<jint>((static_cast<unsigned int>(code[pc]) << 24) |
+            (code[pc+1] << 16) | (code[pc+2] << 8) | code[pc+3]);
+    }
+
+    /**
+     * Reads an unsigned big-endian 2-byte value.
+     */
+    inline jint ReadUnsignedShort(const unsigned char* code, jint pc) throw()
+    {
+        return (code[pc] << 8) | code[pc+1];
+    }
+
+    /**
+     * Writes a big-endian 2-byte value.
+     */
+    inline void WriteShort(unsigned char* code, jint pc, jint value) throw()
+    {
+        code[pc] = static_cast<unsigned char>(value >> 8);
+        code[pc+1] = static_cast<unsigned char>(value);
+    }
+
+    /**
+     * Writes a big-endian 4-byte value.
+     */
+    inline void WriteInt(unsigned char* code, jint pc, jint value) throw()
+    {
+        code[pc] = static_cast<unsigned char>(value >> 24);
+        code[pc+1] = static_cast<unsigned char>(value >> 16);
+        code[pc+2] = static_cast<unsigned char>(value >> 8);
+        code[pc+3] = static_cast<unsigned char>(value);
+    }
+
+    /**
+     * Returns the length of the instruction at the given offset, or 0 if
+     * the instruction is malformed or runs past the end of the code.
+     *
+     * @param code       - the bytecode
+     * @param codeLength - the bytecode length
+     * @param pc         - the instruction offset
+     */
+    inline jint GetInstructionLength(const unsigned char* code,
+            jint codeLength, jint pc) throw()
+    {
+        jint opcode = code[pc];
+        if (opcode >= OPCODE_COUNT) {
+            return 0;
+        }
+        jint length = OPCODE_LENGTH[opcode];
+        if (opcode == OPCODE_TABLESWITCH || opcode == OPCODE_LOOKUPSWITCH) {
+            jint base = (pc + 4) & ~3;
+            if (base + 12 > codeLength) {
+                return 0;
+            }
+            if (opcode == OPCODE_TABLESWITCH) {
+                jint count = ReadInt(code, base + 8) - ReadInt(code, base + 4) + 1;
+                if (count < 0 || count > (codeLength - base - 12) / 4) {
+                    return 0;
+                }
+                length = base + 12 + count * 4 - pc;
+            } else {
+                jint count = ReadInt(code, base + 4);
+                if (count < 0 || count > (codeLength - base - 8) / 8) {
+                    return 0;
+                }
+                length = base + 8 + count * 8 - pc;
+            }
+        } else if (opcode == OPCODE_WIDE) {
+            if (pc + 1 >= codeLength) {
+                return 0;
+            }
+            length = (code[pc+1] == OPCODE_IINC) ? 6 : 4;
+        }
+        return (pc + length <= codeLength) ? length : 0;
+    }
+
+}
+
+#endif // _BYTECODE_H_
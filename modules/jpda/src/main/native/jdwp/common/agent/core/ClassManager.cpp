@@ -22,6 +22,7 @@
 // ClassManager.cpp
 
 #include <string.h>
+#include <algorithm>
 
 #include "jni.h"
 
@@ -39,6 +40,11 @@ ClassManager::ClassManager() throw()
     m_classLoaderClass = 0;
     m_OOMEClass = 0;
     m_systemClass = 0;
+    for (size_t i = 0; i < LINE_TABLE_BUCKETS; i++) {
+        m_lineTables[i] = 0;
+    }
+    m_retiredLineTables = 0;
+    m_lineTableMonitor = 0;
 }
 
 void ClassManager::Init(JNIEnv *jni) throw(AgentException)
@@ -95,6 +101,10 @@ void ClassManager::Init(JNIEnv *jni) throw(AgentException)
         throw InternalErrorException();
     }
     m_systemClass = static_cast<jclass>(jni->NewGlobalRef(m_systemClass));
+
+    m_lineTableMonitor = new AgentMonitor("_jdwp_ClassManager_lineTableMonitor");
+    m_replyCache.Init(jni);
+    m_classRegistry.Init(jni);
 }
 
 void ClassManager::Clean(JNIEnv *jni) throw()
@@ -115,6 +125,15 @@ void ClassManager::Clean(JNIEnv *jni) throw()
         jni->DeleteGlobalRef(m_OOMEClass);
     if (m_systemClass != 0)
         jni->DeleteGlobalRef(m_systemClass);
+
+    if (m_lineTableMonitor != 0) {
+        CleanLineTables();
+        delete m_lineTableMonitor;
+        m_lineTableMonitor = 0;
+    }
+
+    m_replyCache.Clean(jni);
+    m_classRegistry.Clean(jni);
 }
 
 void ClassManager::CheckOnException(JNIEnv *jni) const throw(AgentException)
@@ -310,45 +329,164 @@ jdwpTypeTag ClassManager::GetJdwpTypeTag(jclass klass) const
 }
 
 jboolean ClassManager::IsObjectValueFitsFieldType
-    (JNIEnv *jni, jobject objectValue, const char* fieldSignature) const 
+    (JNIEnv *jni, jobject objectValue, const char* fieldSignature)
     throw(AgentException)
 {
     if ( objectValue == 0 ) {
         return true;
     }
 
-    jint classCount = 0;
-    jclass* classes = 0;
+    ClassRegistry::ClassList classes;
+    m_classRegistry.FindClasses(jni, fieldSignature, classes);
+    if ( classes.empty() ) {
+        throw AgentException(JDWP_ERROR_INVALID_FIELDID);
+    }
+    jclass fieldTypeClass = classes[0];
+    return  jni->IsInstanceOf(objectValue, fieldTypeClass);
+}
 
-    jvmtiEnv* jvmti = AgentBase::GetJvmtiEnv();
+//-----------------------------------------------------------------------------
+// line table cache
+//-----------------------------------------------------------------------------
 
-    jvmtiError err;
-    JVMTI_TRACE(err, jvmti->GetLoadedClasses(&classCount, &classes));
-    JvmtiAutoFree classesAutoFree(classes);
+static bool LineEntryLess(const jvmtiLineNumberEntry& e1,
+                          const jvmtiLineNumberEntry& e2)
+{
+    return e1.start_location < e2.start_location;
+}
 
-    if (err != JVMTI_ERROR_NONE) {
-        throw AgentException(err);
+jint LineTable::FindLine(jlocation location) const throw()
+{
+    if (m_count <= 0) {
+        return -1;
+    }
+    // find the last entry starting at or before the location; code before
+    // the first entry is attributed to the first line as JDI does
+    jint low = 0;
+    jint high = m_count - 1;
+    while (low < high) {
+        jint mid = (low + high + 1) / 2;
+        if (m_entries[mid].start_location <= location) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return m_entries[low].line_number;
+}
+
+const LineTable* ClassManager::GetLineTable(jmethodID method)
+    throw(AgentException)
+{
+    const size_t bucket = GetLineTableBucket(method);
+    {
+        MonitorAutoLock lock(m_lineTableMonitor JDWP_FILE_LINE);
+        for (LineTable* t = m_lineTables[bucket]; t != 0; t = t->m_next) {
+            if (t->m_method == method) {
+                return t;
+            }
+        }
     }
 
-    int i;
-    jclass fieldTypeClass = 0;
-    for (i = 0; i < classCount; i++) {
-        char* classSignature = 0;
+    // obtain the table outside the lock, it is rare
+    jint count = 0;
+    jvmtiLineNumberEntry* table = 0;
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetLineNumberTable(method, &count, &table));
+    JvmtiAutoFree jafTable(table);
+    if (err != JVMTI_ERROR_NONE &&
+        err != JVMTI_ERROR_ABSENT_INFORMATION &&
+        err != JVMTI_ERROR_MUST_POSSESS_CAPABILITY &&
+        err != JVMTI_ERROR_NATIVE_METHOD)
+    {
+        throw AgentException(err);
+    }
+    if (err != JVMTI_ERROR_NONE) {
+        count = 0;
+    }
 
-        JVMTI_TRACE(err, jvmti->GetClassSignature(classes[i], &classSignature, 0));
-        JvmtiAutoFree classSignatureAutoFree(classSignature);
+    LineTable* lineTable = new LineTable();
+    lineTable->m_method = method;
+    lineTable->m_error = err;
+    lineTable->m_count = count;
+    lineTable->m_entries = 0;
+    lineTable->m_next = 0;
+    if (count > 0) {
+        lineTable->m_entries = reinterpret_cast<jvmtiLineNumberEntry*>
+            (GetMemoryManager().Allocate(sizeof(jvmtiLineNumberEntry) * count JDWP_FILE_LINE));
+        memcpy(lineTable->m_entries, table, sizeof(jvmtiLineNumberEntry) * count);
+        std::stable_sort(lineTable->m_entries, lineTable->m_entries + count,
+            LineEntryLess);
+    }
 
-        if (err != JVMTI_ERROR_NONE) {
-            throw AgentException(err);
+    MonitorAutoLock lock(m_lineTableMonitor JDWP_FILE_LINE);
+    for (LineTable* t = m_lineTables[bucket]; t != 0; t = t->m_next) {
+        if (t->m_method == method) {
+            // another thread has already cached it
+            lineTable->m_next = m_retiredLineTables;
+            m_retiredLineTables = lineTable;
+            return t;
         }
+    }
+    lineTable->m_next = m_lineTables[bucket];
+    m_lineTables[bucket] = lineTable;
+    JDWP_TRACE_DATA("GetLineTable: cached: method=" << method
+        << ", count=" << count << ", err=" << err);
+    return lineTable;
+}
+
+jint ClassManager::GetLineNumber(jmethodID method, jlocation location)
+    throw()
+{
+    try {
+        return GetLineTable(method)->FindLine(location);
+    } catch (AgentException& e) {
+        JDWP_TRACE_DATA("GetLineNumber: no line table: method=" << method
+            << ", err=" << e.ErrCode());
+        return -1;
+    }
+}
 
-        if ( strcmp(fieldSignature, classSignature) == 0 ) {
-            fieldTypeClass = classes[i];
-            break;
+void ClassManager::InvalidateLineTables(jclass klass) throw(AgentException)
+{
+    jint methodCount = 0;
+    jmethodID* methods = 0;
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetClassMethods(klass, &methodCount, &methods));
+    JvmtiAutoFree jafMethods(methods);
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    MonitorAutoLock lock(m_lineTableMonitor JDWP_FILE_LINE);
+    for (jint i = 0; i < methodCount; i++) {
+        LineTable** p = &m_lineTables[GetLineTableBucket(methods[i])];
+        while (*p != 0) {
+            LineTable* t = *p;
+            if (t->m_method == methods[i]) {
+                *p = t->m_next;
+                t->m_next = m_retiredLineTables;
+                m_retiredLineTables = t;
+                break;
+            }
+            p = &t->m_next;
         }
     }
-    if ( fieldTypeClass == 0 ) {
-        throw AgentException(JDWP_ERROR_INVALID_FIELDID);
+}
+
+void ClassManager::CleanLineTables() throw()
+{
+    MonitorAutoLock lock(m_lineTableMonitor JDWP_FILE_LINE);
+    for (size_t i = 0; i <= LINE_TABLE_BUCKETS; i++) {
+        LineTable** head = (i < LINE_TABLE_BUCKETS) ?
+            &m_lineTables[i] : &m_retiredLineTables;
+        while (*head != 0) {
+            LineTable* t = *head;
+            *head = t->m_next;
+            if (t->m_entries != 0) {
+                GetMemoryManager().Free(t->m_entries JDWP_FILE_LINE);
+            }
+            delete t;
+        }
     }
-    return  jni->IsInstanceOf(objectValue, fieldTypeClass);
 }
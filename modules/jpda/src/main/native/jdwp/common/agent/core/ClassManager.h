@@ -31,9 +31,48 @@
 #define _CLASS_MANAGER_H_
 
 #include "AgentBase.h"
+#include "AgentMonitor.h"
+#include "ClassRegistry.h"
+#include "ReplyCache.h"
 
 namespace jdwp {
 
+    /**
+     * Cached line number table of a method, sorted by code index.
+     */
+    class LineTable : public AgentBase {
+
+    public:
+
+        /**
+         * Finds the line number for the given code index.
+         *
+         * @param location - the code index in the method
+         *
+         * @return Returns the line number or -1 if the method has no line
+         *         information.
+         */
+        jint FindLine(jlocation location) const throw();
+
+        /** The method the table belongs to. */
+        jmethodID m_method;
+
+        /**
+         * Result of <code>GetLineNumberTable()</code>; the table is empty
+         * unless it is <code>JVMTI_ERROR_NONE</code>.
+         */
+        jvmtiError m_error;
+
+        /** Number of entries in the table. */
+        jint m_count;
+
+        /** Entries sorted by <code>start_location</code>. */
+        jvmtiLineNumberEntry* m_entries;
+
+        /** Next table in the same hash bucket. */
+        LineTable* m_next;
+    };
+
     /**
      * The class provides access to certain standard Java classes.
      */
@@ -75,7 +114,24 @@ namespace jdwp {
          *
          * @param jni - the JNI interface pointer
          */
-        void Reset(JNIEnv *jni) throw() { }
+        void Reset(JNIEnv *jni) throw() {
+            m_replyCache.Reset(jni);
+            m_classRegistry.Reset(jni);
+        }
+
+        /**
+         * Gets the registry of loaded classes.
+         */
+        ClassRegistry& GetClassRegistry() throw() {
+            return m_classRegistry;
+        }
+
+        /**
+         * Gets the cache of replies to commands about classes and methods.
+         */
+        ReplyCache& GetReplyCache() throw() {
+            return m_replyCache;
+        }
 
         /**
          * Gets an instance of the <code>java.lang.Class</code> class.
@@ -332,10 +388,61 @@ namespace jdwp {
          * @return <code>TRUE</code> if the given value fits the field type.
          */
         jboolean IsObjectValueFitsFieldType(JNIEnv *jni, jobject objectValue, const char* fieldSignature)
-            const throw(AgentException);
+            throw(AgentException);
+
+        /**
+         * Returns the line number table of the given method.
+         * The table is obtained from JVMTI on the first request and then
+         * cached until the declaring class is redefined. The returned table
+         * remains valid until the class manager is cleaned.
+         *
+         * @param method - the Java method
+         *
+         * @return Returns the cached line table, check its
+         *         <code>m_error</code> before using entries.
+         *
+         * @exception AgentException is thrown if the line table cannot be
+         *            obtained for the reason other than absence of line
+         *            information.
+         */
+        const LineTable* GetLineTable(jmethodID method) throw(AgentException);
+
+        /**
+         * Returns the line number for the given method and code index,
+         * using the cached line table.
+         *
+         * @param method   - the Java method
+         * @param location - the code index in the method
+         *
+         * @return Returns the line number or -1 if it is not known.
+         */
+        jint GetLineNumber(jmethodID method, jlocation location) throw();
+
+        /**
+         * Drops cached line tables of all methods of the given class.
+         * Should be called after the class is redefined.
+         *
+         * @param klass - the Java class
+         */
+        void InvalidateLineTables(jclass klass) throw(AgentException);
 
     private:
 
+        /** Number of buckets in the line table cache. */
+        static const size_t LINE_TABLE_BUCKETS = 1024;
+
+        /**
+         * Returns the hash bucket index for the given method.
+         */
+        static size_t GetLineTableBucket(jmethodID method) throw() {
+            return (reinterpret_cast<size_t>(method) >> 3) % LINE_TABLE_BUCKETS;
+        }
+
+        /**
+         * Frees all cached line tables.
+         */
+        void CleanLineTables() throw();
+
         jclass m_classClass;
         jclass m_threadClass;
         jclass m_threadGroupClass;
@@ -344,6 +451,18 @@ namespace jdwp {
         jclass m_OOMEClass;
         jclass m_systemClass;
 
+        // hash of cached line tables by method
+        LineTable* m_lineTables[LINE_TABLE_BUCKETS];
+
+        // invalidated tables, kept alive as callers may still use them
+        LineTable* m_retiredLineTables;
+
+        AgentMonitor* m_lineTableMonitor;
+
+        ReplyCache m_replyCache;
+
+        ClassRegistry m_classRegistry;
+
     };
 
 }
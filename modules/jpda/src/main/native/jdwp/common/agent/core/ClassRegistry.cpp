@@ -0,0 +1,448 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+// ClassRegistry.cpp
+
+#include <string.h>
+
+#include "ClassRegistry.h"
+#include "ClassManager.h"
+#include "PacketParser.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+/**
+ * Writes the value over an int written before at the given position.
+ */
+static void PatchInt(OutputPacketComposer* reply, size_t position,
+        jint value) throw(AgentException)
+{
+    size_t currentPosition = reply->GetPosition();
+    jint currentLength = reply->GetLength();
+    reply->SetPosition(position);
+    reply->WriteInt(value);
+    reply->SetPosition(currentPosition);
+    reply->SetLength(currentLength);
+}
+
+ClassRegistry::ClassRegistry() throw()
+    : m_monitor(0)
+    , m_active(false)
+    , m_classCount(0)
+    , m_generation(0)
+    , m_historyGeneration(1)
+{
+    for (jint i = 0; i < REGISTRY_BUCKETS; i++) {
+        m_classes[i] = 0;
+        m_signatures[i] = 0;
+    }
+}
+
+ClassRegistry::~ClassRegistry() throw()
+{}
+
+void ClassRegistry::Init(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Init(" << jni << ")");
+
+    m_monitor = new AgentMonitor("_jdwp_ClassRegistry_monitor");
+}
+
+void ClassRegistry::Clean(JNIEnv* jni) throw()
+{
+    JDWP_TRACE_ENTRY("Clean(" << jni << ")");
+
+    if (m_monitor != 0) {
+        {
+            MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+            DropEntries(jni, false);
+            m_removed.clear();
+            m_active = false;
+        }
+        delete m_monitor;
+        m_monitor = 0;
+    }
+}
+
+void ClassRegistry::Reset(JNIEnv* jni) throw()
+{
+    JDWP_TRACE_ENTRY("Reset(" << jni << ")");
+
+    if (m_monitor == 0) {
+        return;
+    }
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    if (!m_active) {
+        return;
+    }
+    DropEntries(jni, false);
+    m_removed.clear();
+    // generations of the ended session are not valid any more
+    m_historyGeneration = m_generation + 1;
+    m_active = false;
+
+    // ClassPrepare requests and deferred breakpoints are deleted already
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+        JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, 0));
+}
+
+void ClassRegistry::AddClass(JNIEnv* jni, jclass cls, const char* signature)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    if (!m_active) {
+        return;
+    }
+    ClassEntry* entry = FindOrAdd(jni, cls, signature);
+    if (entry != 0 && entry->generation != m_generation) {
+        // the class was registered before it was prepared
+        entry->generation = ++m_generation;
+    }
+}
+
+void ClassRegistry::FindClasses(JNIEnv* jni, const char* signature,
+        ClassList& classes)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    if (!m_active || signature[0] == '[') {
+        // array classes are registered only on refresh
+        Refresh(jni);
+    }
+
+    jint signatureHash = GetSignatureHash(signature);
+    for (ClassEntry* entry = m_signatures[GetBucket(signatureHash)];
+         entry != 0; entry = entry->nextBySignature)
+    {
+        if (entry->signatureHash == signatureHash
+            && strcmp(entry->signature, signature) == 0)
+        {
+            jclass cls = static_cast<jclass>(jni->NewLocalRef(entry->cls));
+            if (cls != 0) {
+                classes.push_back(cls);
+            }
+        }
+    }
+    JDWP_TRACE_DATA("FindClasses: signature=" << signature
+        << ", classes=" << classes.size());
+}
+
+void ClassRegistry::DropUnloaded(JNIEnv* jni) throw()
+{
+    JDWP_TRACE_ENTRY("DropUnloaded(" << jni << ")");
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    if (m_active) {
+        DropEntries(jni, true);
+    }
+}
+
+void ClassRegistry::WriteClasses(JNIEnv* jni, OutputPacketComposer* reply,
+        bool withGeneric)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    Refresh(jni);
+
+    size_t countPosition = reply->GetPosition();
+    reply->WriteInt(0);
+    jint count = WriteEntries(jni, reply, withGeneric, 0);
+    PatchInt(reply, countPosition, count);
+
+    JDWP_TRACE_DATA("WriteClasses: classes=" << count
+        << ", registered=" << m_classCount
+        << ", generation=" << m_generation);
+}
+
+void ClassRegistry::WriteChanges(JNIEnv* jni, OutputPacketComposer* reply,
+        jlong generation)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    Refresh(jni);
+
+    bool full = (generation < m_historyGeneration || generation > m_generation);
+    if (full) {
+        generation = 0;
+    }
+    reply->WriteLong(m_generation);
+    reply->WriteBoolean(full ? JNI_TRUE : JNI_FALSE);
+
+    size_t countPosition = reply->GetPosition();
+    reply->WriteInt(0);
+    jint added = WriteEntries(jni, reply, true, generation);
+    PatchInt(reply, countPosition, added);
+
+    // removed IDs are kept in the order of generations
+    size_t first = m_removed.size();
+    while (first > 0 && m_removed[first - 1].generation > generation) {
+        first--;
+    }
+    jint removed = static_cast<jint>(m_removed.size() - first);
+    reply->WriteInt(full ? 0 : removed);
+    if (!full) {
+        for (size_t i = first; i < m_removed.size(); i++) {
+            reply->WriteBytes(m_removed[i].refTypeID, REFERENCE_TYPE_ID_SIZE);
+        }
+    }
+
+    JDWP_TRACE_DATA("WriteChanges: since=" << generation
+        << ", generation=" << m_generation
+        << ", full=" << full
+        << ", added=" << added
+        << ", removed=" << (full ? 0 : removed));
+}
+
+void ClassRegistry::Refresh(JNIEnv* jni) throw(AgentException)
+{
+    jvmtiError err;
+    if (!m_active) {
+        // enable notification first not to miss classes prepared meanwhile
+        JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+            JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, 0));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        m_active = true;
+    } else {
+        // ClassUnload notification may be not available
+        DropEntries(jni, true);
+    }
+
+    jint classCount = 0;
+    jclass* classes = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetLoadedClasses(&classCount, &classes));
+    JvmtiAutoFree afc(classes);
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    if (classCount != m_classCount) {
+        JDWP_TRACE_DATA("Refresh: loaded=" << classCount
+            << ", registered=" << m_classCount);
+        for (jint i = 0; i < classCount; i++) {
+            FindOrAdd(jni, classes[i], 0);
+        }
+    }
+    for (jint i = 0; i < classCount; i++) {
+        jni->DeleteLocalRef(classes[i]);
+    }
+}
+
+ClassRegistry::ClassEntry* ClassRegistry::FindOrAdd(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    jvmtiError err;
+    jint hashCode = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetObjectHashCode(cls, &hashCode));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    ClassEntry** bucket = &m_classes[GetBucket(hashCode)];
+    for (ClassEntry* entry = *bucket; entry != 0; entry = entry->next) {
+        if (entry->hashCode == hashCode
+            && jni->IsSameObject(entry->cls, cls) == JNI_TRUE)
+        {
+            return entry;
+        }
+    }
+
+    char* classSignature = 0;
+    if (signature == 0) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetClassSignature(cls,
+            &classSignature, 0));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        signature = classSignature;
+    }
+    JvmtiAutoFree afs(classSignature);
+
+    size_t signatureLength = strlen(signature) + 1;
+    ClassEntry* entry = reinterpret_cast<ClassEntry*>(GetMemoryManager()
+        .Allocate(sizeof(ClassEntry) + signatureLength JDWP_FILE_LINE));
+    entry->cls = jni->NewWeakGlobalRef(cls);
+    if (entry->cls == 0) {
+        GetMemoryManager().Free(entry JDWP_FILE_LINE);
+        return 0;
+    }
+    memcpy(entry + 1, signature, signatureLength);
+    entry->signature = reinterpret_cast<const char*>(entry + 1);
+    entry->signatureHash = GetSignatureHash(signature);
+    entry->hashCode = hashCode;
+    entry->generation = ++m_generation;
+    entry->status = STATUS_UNKNOWN;
+    entry->length = 0;
+    entry->data = 0;
+    entry->next = *bucket;
+    *bucket = entry;
+    ClassEntry** signatureBucket =
+        &m_signatures[GetBucket(entry->signatureHash)];
+    entry->nextBySignature = *signatureBucket;
+    *signatureBucket = entry;
+    m_classCount++;
+    return entry;
+}
+
+jint ClassRegistry::WriteEntries(JNIEnv* jni, OutputPacketComposer* reply,
+        bool withGeneric, jlong generation)
+    throw(AgentException)
+{
+    jint count = 0;
+    for (jint i = 0; i < REGISTRY_BUCKETS; i++) {
+        for (ClassEntry* entry = m_classes[i]; entry != 0; entry = entry->next) {
+            if (entry->generation > generation
+                && WriteEntry(jni, reply, entry, withGeneric))
+            {
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+bool ClassRegistry::WriteEntry(JNIEnv* jni, OutputPacketComposer* reply,
+        ClassEntry* entry, bool withGeneric)
+    throw(AgentException)
+{
+    jint status = entry->status;
+    bool written = false;
+
+    if (status == STATUS_UNKNOWN || entry->data == 0) {
+        jclass cls = static_cast<jclass>(jni->NewLocalRef(entry->cls));
+        if (cls == 0) {
+            // the class is unloaded
+            return false;
+        }
+
+        jvmtiError err;
+        if (status == STATUS_UNKNOWN) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetClassStatus(cls, &status));
+            if (err != JVMTI_ERROR_NONE) {
+                jni->DeleteLocalRef(cls);
+                throw AgentException(err);
+            }
+            // According to JVMTI spec ClassStatus flag for arrays and primitive classes must be zero
+            if (status == JVMTI_CLASS_STATUS_ARRAY
+                || status == JVMTI_CLASS_STATUS_PRIMITIVE)
+            {
+                status = 0;
+            } else if ((status & JVMTI_CLASS_STATUS_PREPARED) == 0) {
+                // Given class is not prepared - don't return such class
+                jni->DeleteLocalRef(cls);
+                return false;
+            }
+            // status of initialized or erroneous class does not change
+            if (status == 0 || (status & (JVMTI_CLASS_STATUS_INITIALIZED
+                    | JVMTI_CLASS_STATUS_ERROR)) != 0)
+            {
+                entry->status = status;
+            }
+        }
+
+        if (entry->data == 0) {
+            char* signature = 0;
+            char* generic = 0;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetClassSignature(cls,
+                &signature, &generic));
+            JvmtiAutoFree afs(signature);
+            JvmtiAutoFree afg(generic);
+            if (err != JVMTI_ERROR_NONE) {
+                jni->DeleteLocalRef(cls);
+                throw AgentException(err);
+            }
+
+            size_t position = reply->GetPosition();
+            reply->WriteByte(GetClassManager().GetJdwpTypeTag(cls));
+            reply->WriteReferenceTypeID(jni, cls);
+            reply->WriteString(signature);
+            written = true;
+
+            jint length = static_cast<jint>(reply->GetPosition() - position);
+            const char* genericString = (generic != 0) ? generic : "";
+            size_t genericLength = strlen(genericString) + 1;
+            jbyte* data = reinterpret_cast<jbyte*>(GetMemoryManager()
+                .Allocate(length + genericLength JDWP_FILE_LINE));
+            memcpy(data, reply->GetData() + position, length);
+            memcpy(data + length, genericString, genericLength);
+            entry->data = data;
+            entry->length = length;
+        }
+        jni->DeleteLocalRef(cls);
+    }
+
+    if (!written) {
+        reply->WriteBytes(entry->data, entry->length);
+    }
+    if (withGeneric) {
+        reply->WriteString(reinterpret_cast<const char*>(entry->data
+            + entry->length));
+    }
+    reply->WriteInt(status);
+    return true;
+}
+
+void ClassRegistry::DropEntries(JNIEnv* jni, bool unloaded) throw()
+{
+    for (jint i = 0; i < REGISTRY_BUCKETS; i++) {
+        ClassEntry** p = &m_classes[i];
+        while (*p != 0) {
+            ClassEntry* entry = *p;
+            if (unloaded && jni->IsSameObject(entry->cls, 0) != JNI_TRUE) {
+                p = &entry->next;
+                continue;
+            }
+            if (unloaded) {
+                m_generation++;
+                if (entry->data != 0) {
+                    // the debugger may know the ID written in the entry
+                    RemovedEntry removed;
+                    removed.generation = m_generation;
+                    memcpy(removed.refTypeID, entry->data + 1,
+                        REFERENCE_TYPE_ID_SIZE);
+                    m_removed.push_back(removed);
+                }
+            }
+            *p = entry->next;
+            ClassEntry** q = &m_signatures[GetBucket(entry->signatureHash)];
+            while (*q != entry) {
+                q = &(*q)->nextBySignature;
+            }
+            *q = entry->nextBySignature;
+            m_classCount--;
+            jni->DeleteWeakGlobalRef(entry->cls);
+            if (entry->data != 0) {
+                GetMemoryManager().Free(entry->data JDWP_FILE_LINE);
+            }
+            GetMemoryManager().Free(entry JDWP_FILE_LINE);
+        }
+    }
+
+    if (m_removed.size() > MAX_REMOVED_CLASSES) {
+        // forget the older half, changes before it are not known any more
+        size_t forgotten = m_removed.size() / 2;
+        m_historyGeneration = m_removed[forgotten - 1].generation;
+        m_removed.erase(m_removed.begin(), m_removed.begin() + forgotten);
+    }
+}
@@ -0,0 +1,286 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * ClassRegistry.h
+ *
+ * Keeps the list of loaded classes up to date from class prepare and unload
+ * notifications, so that it is not rebuilt for every request, and indexes
+ * it by class signature.
+ */
+
+#ifndef _CLASS_REGISTRY_H_
+#define _CLASS_REGISTRY_H_
+
+#include <vector>
+
+#include "AgentBase.h"
+#include "AgentAllocator.h"
+#include "AgentMonitor.h"
+#include "jdwpTypes.h"
+
+namespace jdwp {
+
+    class OutputPacketComposer;
+
+    /**
+     * The class registers loaded classes of the target VM. The registry is
+     * seeded by <code>GetLoadedClasses()</code> on the first request and
+     * then updated by <code>AddClass()</code> called on the ClassPrepare
+     * event and by dropping classes collected by GC. Array classes, which
+     * have no ClassPrepare event, are picked up when the number of loaded
+     * classes differs from the registered one.
+     *
+     * Classes are also hashed by signature, so that classes are found by
+     * signature without asking signatures of all loaded classes.
+     *
+     * Each change increments the registry generation, so that changes since
+     * the given generation can be reported. The type tag, ID and signature
+     * of a class are serialized once per session and written to replies as
+     * is.
+     */
+    class ClassRegistry : public AgentBase {
+
+    public:
+
+        typedef vector<jclass, AgentAllocator<jclass> > ClassList;
+
+        /**
+         * A constructor.
+         */
+        ClassRegistry() throw();
+
+        /**
+         * A destructor.
+         */
+        ~ClassRegistry() throw();
+
+        /**
+         * Initializes the registry.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Init(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Cleans the registry.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Clean(JNIEnv* jni) throw();
+
+        /**
+         * Drops all registered classes and stops tracking class preparation.
+         * IDs written in serialized entries are valid only in the current
+         * session, so it is called when the session ends, after all event
+         * requests are deleted.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Reset(JNIEnv* jni) throw();
+
+        /**
+         * Checks whether the registry is seeded and needs the ClassPrepare
+         * notification enabled.
+         */
+        bool IsActive() const throw() {
+            return m_active;
+        }
+
+        /**
+         * Registers the prepared class. Called on the ClassPrepare event.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param cls       - the prepared class
+         * @param signature - the signature of the class
+         */
+        void AddClass(JNIEnv* jni, jclass cls, const char* signature)
+            throw(AgentException);
+
+        /**
+         * Finds loaded classes with the given signature. Classes which are
+         * not prepared yet are found as well.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param signature - the JNI signature of the class
+         * @param classes   - the list to add local references to the found
+         *                    classes to
+         */
+        void FindClasses(JNIEnv* jni, const char* signature,
+            ClassList& classes) throw(AgentException);
+
+        /**
+         * Drops classes which were unloaded.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void DropUnloaded(JNIEnv* jni) throw();
+
+        /**
+         * Writes the count and the entries of all prepared classes in the
+         * format of the <code>AllClasses</code> or
+         * <code>AllClassesWithGeneric</code> reply.
+         *
+         * @param jni         - the JNI interface pointer
+         * @param reply       - the reply to write to
+         * @param withGeneric - whether to write generic signatures
+         */
+        void WriteClasses(JNIEnv* jni, OutputPacketComposer* reply,
+            bool withGeneric) throw(AgentException);
+
+        /**
+         * Writes the current generation and the classes added and removed
+         * since the given generation. If the changes are not known, all
+         * classes are written as added and the full flag is set.
+         *
+         * @param jni        - the JNI interface pointer
+         * @param reply      - the reply to write to
+         * @param generation - the generation known to the debugger or 0
+         */
+        void WriteChanges(JNIEnv* jni, OutputPacketComposer* reply,
+            jlong generation) throw(AgentException);
+
+    private:
+
+        /**
+         * Registered class, followed by the signature in the same memory
+         * block. The data holds <code>length</code> bytes of the serialized
+         * type tag byte, ID and signature of the class, followed by the
+         * generic signature as a null-terminated string.
+         */
+        struct ClassEntry {
+            jweak cls;
+            jint hashCode;
+            jint signatureHash;
+            const char* signature;
+            jlong generation;
+            jint status;
+            jint length;
+            jbyte* data;
+            ClassEntry* next;
+            ClassEntry* nextBySignature;
+        };
+
+        /**
+         * ID of a removed class which was written to the debugger.
+         */
+        struct RemovedEntry {
+            jlong generation;
+            jbyte refTypeID[REFERENCE_TYPE_ID_SIZE];
+        };
+
+        typedef vector<RemovedEntry, AgentAllocator<RemovedEntry> > RemovedList;
+
+        /** Number of buckets in the registry. */
+        static const jint REGISTRY_BUCKETS = 4096;
+
+        /** Number of removed classes kept for reporting changes. */
+        static const size_t MAX_REMOVED_CLASSES = 4096;
+
+        /** Class status which is reported for unprepared classes. */
+        static const jint STATUS_UNKNOWN = -1;
+
+        /**
+         * Returns the hash bucket for the given class hash code.
+         */
+        static jint GetBucket(jint hashCode) throw() {
+            return static_cast<jint>(
+                static_cast<unsigned int>(hashCode) % REGISTRY_BUCKETS);
+        }
+
+        /**
+         * Returns the hash code of the given signature.
+         */
+        static jint GetSignatureHash(const char* signature) throw() {
+            unsigned int hash = 0;
+            for (const char* p = signature; *p != '\0'; p++) {
+                hash = hash * 31 + static_cast<unsigned char>(*p);
+            }
+            return static_cast<jint>(hash);
+        }
+
+        /**
+         * Seeds the registry on the first call, drops unloaded classes and
+         * registers classes loaded without the ClassPrepare event. Called
+         * under the registry monitor.
+         */
+        void Refresh(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Finds the entry of the given class or registers a new one. The
+         * signature is requested from JVMTI if it is not given. Called under
+         * the registry monitor.
+         *
+         * @return Returns the entry or 0 if the class was not registered.
+         */
+        ClassEntry* FindOrAdd(JNIEnv* jni, jclass cls, const char* signature)
+            throw(AgentException);
+
+        /**
+         * Writes the entries of prepared classes registered after the given
+         * generation and returns the number of the written entries. Called
+         * under the registry monitor.
+         */
+        jint WriteEntries(JNIEnv* jni, OutputPacketComposer* reply,
+            bool withGeneric, jlong generation) throw(AgentException);
+
+        /**
+         * Writes the entry if the class is prepared. Serializes the entry on
+         * the first call.
+         *
+         * @return Returns <code>true</code> if the entry was written.
+         */
+        bool WriteEntry(JNIEnv* jni, OutputPacketComposer* reply,
+            ClassEntry* entry, bool withGeneric) throw(AgentException);
+
+        /**
+         * Drops entries of unloaded classes, recording the removed IDs, or
+         * all entries if <code>unloaded</code> is not set. Called under the
+         * registry monitor.
+         */
+        void DropEntries(JNIEnv* jni, bool unloaded) throw();
+
+        AgentMonitor* m_monitor;
+
+        // whether the registry is seeded
+        bool m_active;
+
+        // hash of registered classes by class hash code
+        ClassEntry* m_classes[REGISTRY_BUCKETS];
+
+        // hash of registered classes by signature
+        ClassEntry* m_signatures[REGISTRY_BUCKETS];
+
+        // number of registered classes
+        jint m_classCount;
+
+        // generation of the last change
+        jlong m_generation;
+
+        // the oldest generation the changes since which are known
+        jlong m_historyGeneration;
+
+        // IDs of removed classes in the order of removal
+        RemovedList m_removed;
+
+    };
+
+}
+
+#endif // _CLASS_REGISTRY_H_
@@ -41,6 +41,7 @@
 #include "ClassLoaderReference.h"
 #include "ClassObjectReference.h"
 #include "StackFrame.h"
+#include "Vendor.h"
 
 using namespace jdwp;
 
@@ -124,6 +125,53 @@ void CommandDispatcher::ExecCommand(JNIEnv* jni, CommandParser *cmdParser)
 
 //-----------------------------------------------------------------------------
 
+void CommandDispatcher::ExecEmbeddedCommand(JNIEnv* jni, CommandParser *cmdParser)
+    throw (AgentException)
+{
+    JDWP_TRACE_ENTRY("ExecEmbeddedCommand(" << jni << ',' << cmdParser << ')');
+
+    CommandHandler *handler = 0;
+
+    jdwpCommandSet cmdSet = cmdParser->command.GetCommandSet();
+    jdwpCommand cmdKind = cmdParser->command.GetCommand();
+
+    try
+    {
+        if (IsDead())
+            throw AgentException(JDWP_ERROR_VM_DEAD);
+
+        if ((cmdSet == JDWP_COMMAND_SET_VIRTUAL_MACHINE
+                && (cmdKind == JDWP_COMMAND_VM_DISPOSE
+                    || cmdKind == JDWP_COMMAND_VM_EXIT))
+            || (cmdSet == JDWP_COMMAND_SET_VENDOR
+                && cmdKind == JDWP_COMMAND_VENDOR_BATCH))
+        {
+            throw NotImplementedException();
+        }
+
+        JDWP_TRACE_CMD("Create embedded handler: "
+            << GetCommandSetName(cmdSet) << "/"
+            << GetCommandName(cmdSet, cmdKind)
+            << "[" << cmdSet << "/" << cmdKind << "]");
+        handler = CreateCommandHandler(cmdSet, cmdKind);
+
+        // asynchronous handlers reply from another thread
+        if (!handler->IsSynchronous())
+            throw NotImplementedException();
+
+        handler->Run(jni, cmdParser);
+    }
+    catch (const AgentException &e)
+    {
+        cmdParser->reply.SetError(e.ErrCode());
+    }
+
+    if (handler != 0)
+        delete handler;
+}
+
+//-----------------------------------------------------------------------------
+
 CommandHandler*
 CommandDispatcher::CreateCommandHandler(jdwpCommandSet cmdSet, jdwpCommand cmdKind)
     throw (NotImplementedException, OutOfMemoryException)
@@ -473,6 +521,28 @@ CommandDispatcher::CreateCommandHandler(jdwpCommandSet cmdSet, jdwpCommand cmdKi
         }
         break;
 
+    //JDWP_COMMAND_SET_VENDOR----------------------------------------------
+    case JDWP_COMMAND_SET_VENDOR:
+        switch(cmdKind)
+        {
+
+        case JDWP_COMMAND_VENDOR_THREAD_STATES:
+            return new Vendor::ThreadStatesHandler();
+
+        case JDWP_COMMAND_VENDOR_THREAD_STACKS:
+            return new Vendor::ThreadStacksHandler();
+
+        case JDWP_COMMAND_VENDOR_BATCH:
+            return new Vendor::BatchHandler();
+
+        case JDWP_COMMAND_VENDOR_OBJECT_GRAPH:
+            return new Vendor::ObjectGraphHandler();
+        case JDWP_COMMAND_VENDOR_CLASSES_CHANGED:
+            return new Vendor::ClassesChangedHandler();
+
+        }
+        break;
+
     }//cmdSet
 
     JDWP_ERROR("command not implemented "
@@ -527,6 +597,8 @@ CommandDispatcher::GetCommandSetName(jdwpCommandSet cmdSet)
         return "CLASS_OBJECT_REFERENCE";
     case JDWP_COMMAND_SET_EVENT:
         return "EVENT";
+    case JDWP_COMMAND_SET_VENDOR:
+        return "VENDOR";
     }//cmdSet
 
     return "***UNKNOWN COMMAND_SET***";
@@ -799,6 +871,22 @@ CommandDispatcher::GetCommandName(jdwpCommandSet cmdSet, jdwpCommand cmdKind)
             return "COMPOSITE";
         }
         break;
+
+    case JDWP_COMMAND_SET_VENDOR:
+        switch (cmdKind)
+        {
+        case JDWP_COMMAND_VENDOR_THREAD_STATES:
+            return "THREAD_STATES";
+        case JDWP_COMMAND_VENDOR_THREAD_STACKS:
+            return "THREAD_STACKS";
+        case JDWP_COMMAND_VENDOR_BATCH:
+            return "BATCH";
+        case JDWP_COMMAND_VENDOR_OBJECT_GRAPH:
+            return "OBJECT_GRAPH";
+        case JDWP_COMMAND_VENDOR_CLASSES_CHANGED:
+            return "CLASSES_CHANGED";
+        }
+        break;
     }//cmdSet
 
     return "***UNKNOWN COMMAND***";
@@ -74,6 +74,21 @@ namespace jdwp {
         void ExecCommand(JNIEnv* jni, CommandParser *cmdParser)
             throw(AgentException);
 
+        /**
+         * Executes a command embedded in the <code>Batch</code> command.
+         * Unlike <code>ExecCommand()</code>, the reply is composed in
+         * <code>cmdParser</code> and is not written to the transport.
+         * Asynchronous commands and commands which end the session cannot
+         * be embedded and get the <code>NOT_IMPLEMENTED</code> error.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param cmdParser - a wrapper of the embedded JDWP command
+         *
+         * @see CommandParser::ReadEmbeddedCommand
+         */
+        static void ExecEmbeddedCommand(JNIEnv* jni, CommandParser *cmdParser)
+            throw(AgentException);
+
         /**
          * Returns the name corresponding to the given JDWP command set.
          *
@@ -82,18 +82,10 @@ void AsyncCommandHandler::Run(JNIEnv *jni_env, CommandParser *cmd) throw(AgentEx
 
     m_cmdParser = new CommandParser();
     cmd->MoveData(jni_env, m_cmdParser);
-    try
-    {
-        GetThreadManager().RunAgentThread(jni_env, StartExecution, this,
-            JVMTI_THREAD_MAX_PRIORITY, GetThreadName());
-    }
-    catch (const AgentException& e)
-    {
-        JDWP_ASSERT(e.ErrCode() != JDWP_ERROR_NULL_POINTER);
-        JDWP_ASSERT(e.ErrCode() != JDWP_ERROR_INVALID_PRIORITY);
 
-        throw e;
-    }
+    JDWP_TRACE_CMD("Async::Run: queue command " << GetThreadName());
+    GetThreadManager().GetThreadPool().Execute(jni_env, StartExecution, this,
+        DiscardExecution);
 }
 
 //-----------------------------------------------------------------------------
@@ -135,6 +127,13 @@ AsyncCommandHandler::StartExecution(jvmtiEnv* jvmti_env, JNIEnv* jni_env, void*
 
 //-----------------------------------------------------------------------------
 
+void AsyncCommandHandler::DiscardExecution(void* arg)
+{
+    reinterpret_cast<AsyncCommandHandler *>(arg)->Destroy();
+}
+
+//-----------------------------------------------------------------------------
+
 SpecialAsyncCommandHandler::SpecialAsyncCommandHandler()
 {
 //    m_monitor = new AgentMonitor("SpecialAsyncCommandHandler monitor");
@@ -211,6 +211,12 @@ namespace jdwp {
          */
         static void JNICALL StartExecution(jvmtiEnv* jvmti_env, JNIEnv* jni_env, void* arg);
 
+        /**
+         * Destroys the handler given as the arg parameter of a queued
+         * <code>StartExecution</code> call which is never run.
+         */
+        static void DiscardExecution(void* arg);
+
     };//class AsyncCommandHandler
 
     /**
@@ -0,0 +1,543 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// ConditionExpression.cpp
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "ConditionExpression.h"
+#include "RequestModifier.h"
+#include "Log.h"
+#include "StringOps_pd.h"
+
+using namespace jdwp;
+
+ConditionExpression::ConditionExpression() throw()
+    : m_text(0), m_depth(0), m_maxDepth(0), m_nesting(0)
+{
+}
+
+ConditionExpression::~ConditionExpression() throw()
+{
+    for (Program::iterator i = m_program.begin(); i != m_program.end(); i++) {
+        if (i->name != 0) {
+            GetMemoryManager().Free(i->name JDWP_FILE_LINE);
+        }
+        if (i->signature != 0) {
+            GetMemoryManager().Free(i->signature JDWP_FILE_LINE);
+        }
+    }
+}
+
+void ConditionExpression::Compile(const char* text) throw(AgentException)
+{
+    m_text = text;
+    m_depth = 0;
+    m_maxDepth = 0;
+    m_nesting = 0;
+    ParseOr();
+    SkipSpaces();
+    if (*m_text != '\0' || m_depth != 1) {
+        JDWP_TRACE_DATA("Compile: bad condition: " << text);
+        throw IllegalArgumentException();
+    }
+    m_text = 0;
+    JDWP_TRACE_DATA("Compile: condition=" << text
+        << ", instructions=" << m_program.size()
+        << ", stack=" << m_maxDepth);
+}
+
+void ConditionExpression::SkipSpaces() throw()
+{
+    while (*m_text != '\0' && isspace(static_cast<unsigned char>(*m_text))) {
+        m_text++;
+    }
+}
+
+bool ConditionExpression::Match(const char* token) throw()
+{
+    SkipSpaces();
+    size_t length = strlen(token);
+    if (strncmp(m_text, token, length) != 0) {
+        return false;
+    }
+    // keywords must not be followed by identifier characters
+    if (isalpha(static_cast<unsigned char>(token[0])) &&
+        (isalnum(static_cast<unsigned char>(m_text[length])) ||
+         m_text[length] == '_' || m_text[length] == '$'))
+    {
+        return false;
+    }
+    m_text += length;
+    return true;
+}
+
+void ConditionExpression::Emit(OpCode op, jdwpTag tag)
+    throw(AgentException)
+{
+    Instruction instr;
+    memset(&instr, 0, sizeof(instr));
+    instr.op = op;
+    instr.tag = tag;
+    m_program.push_back(instr);
+
+    switch (op) {
+    case OP_CONST:
+    case OP_LOCAL:
+    case OP_THIS:
+    case OP_THIS_FIELD:
+    case OP_STATIC_FIELD:
+        m_depth++;
+        break;
+    case OP_NOT:
+        break;
+    default:
+        m_depth--;
+        break;
+    }
+    if (m_depth > m_maxDepth) {
+        m_maxDepth = m_depth;
+    }
+    if (m_maxDepth > MAX_STACK_DEPTH) {
+        throw IllegalArgumentException();
+    }
+}
+
+void ConditionExpression::EnterNesting() throw(AgentException)
+{
+    if (++m_nesting > MAX_NESTING_DEPTH) {
+        JDWP_TRACE_DATA("Compile: condition is nested too deep");
+        throw IllegalArgumentException();
+    }
+}
+
+void ConditionExpression::ParseOr() throw(AgentException)
+{
+    ParseAnd();
+    while (Match("||")) {
+        ParseAnd();
+        Emit(OP_OR);
+    }
+}
+
+void ConditionExpression::ParseAnd() throw(AgentException)
+{
+    ParseNot();
+    while (Match("&&")) {
+        ParseNot();
+        Emit(OP_AND);
+    }
+}
+
+void ConditionExpression::ParseNot() throw(AgentException)
+{
+    SkipSpaces();
+    if (m_text[0] == '!' && m_text[1] != '=') {
+        m_text++;
+        EnterNesting();
+        ParseNot();
+        m_nesting--;
+        Emit(OP_NOT);
+    } else {
+        ParseCompare();
+    }
+}
+
+void ConditionExpression::ParseCompare() throw(AgentException)
+{
+    ParseOperand();
+    OpCode op;
+    // longer operators are checked first
+    if (Match("==")) {
+        op = OP_EQ;
+    } else if (Match("!=")) {
+        op = OP_NE;
+    } else if (Match("<=")) {
+        op = OP_LE;
+    } else if (Match(">=")) {
+        op = OP_GE;
+    } else if (Match("<")) {
+        op = OP_LT;
+    } else if (Match(">")) {
+        op = OP_GT;
+    } else {
+        return;
+    }
+    ParseOperand();
+    Emit(op);
+}
+
+void ConditionExpression::ParseOperand() throw(AgentException)
+{
+    SkipSpaces();
+    if (Match("(")) {
+        EnterNesting();
+        ParseOr();
+        if (!Match(")")) {
+            throw IllegalArgumentException();
+        }
+        m_nesting--;
+    } else if (Match("true")) {
+        Emit(OP_CONST, JDWP_TAG_BOOLEAN);
+        m_program.back().value.j = 1;
+    } else if (Match("false")) {
+        Emit(OP_CONST, JDWP_TAG_BOOLEAN);
+        m_program.back().value.j = 0;
+    } else if (Match("null")) {
+        Emit(OP_CONST, JDWP_TAG_OBJECT);
+        m_program.back().value.l = 0;
+    } else if (Match("static.")) {
+        AgentAutoFree afn(ParseToken(false) JDWP_FILE_LINE);
+        Emit(OP_STATIC_FIELD);
+        m_program.back().name = static_cast<char*>(afn.Release());
+        if (!Match(":")) {
+            throw IllegalArgumentException();
+        }
+        m_program.back().signature = ParseToken(true);
+        m_program.back().tag = static_cast<jdwpTag>(
+            m_program.back().signature[0]);
+    } else if (Match("this")) {
+        if (*m_text == '.') {
+            m_text++;
+            AgentAutoFree afn(ParseToken(false) JDWP_FILE_LINE);
+            Emit(OP_THIS_FIELD);
+            m_program.back().name = static_cast<char*>(afn.Release());
+            if (!Match(":")) {
+                throw IllegalArgumentException();
+            }
+            m_program.back().signature = ParseToken(true);
+            m_program.back().tag = static_cast<jdwpTag>(
+                m_program.back().signature[0]);
+        } else {
+            Emit(OP_THIS, JDWP_TAG_OBJECT);
+        }
+    } else if (*m_text == '@') {
+        m_text++;
+        if (!isdigit(static_cast<unsigned char>(*m_text))) {
+            throw IllegalArgumentException();
+        }
+        char* end;
+        long slot = strtol(m_text, &end, 10);
+        m_text = end;
+        char* signature = ParseToken(true);
+        AgentAutoFree afs(signature JDWP_FILE_LINE);
+        Emit(OP_LOCAL, static_cast<jdwpTag>(signature[0]));
+        m_program.back().slot = static_cast<jint>(slot);
+        m_program.back().signature = static_cast<char*>(afs.Release());
+    } else {
+        ParseNumber();
+    }
+}
+
+void ConditionExpression::ParseNumber() throw(AgentException)
+{
+    const char* start = m_text;
+    const char* p = start;
+    if (*p == '-') {
+        p++;
+    }
+    if (!isdigit(static_cast<unsigned char>(*p))) {
+        throw IllegalArgumentException();
+    }
+    while (isdigit(static_cast<unsigned char>(*p))) {
+        p++;
+    }
+    char* end;
+    if (*p == '.' || *p == 'e' || *p == 'E') {
+        Emit(OP_CONST, JDWP_TAG_DOUBLE);
+        m_program.back().value.d = strtod(start, &end);
+    } else {
+        Emit(OP_CONST, JDWP_TAG_LONG);
+        m_program.back().value.j = ParseLong(start, &end);
+    }
+    if (end == start) {
+        throw IllegalArgumentException();
+    }
+    m_text = end;
+}
+
+char* ConditionExpression::ParseToken(bool isSignature) throw(AgentException)
+{
+    SkipSpaces();
+    const char* start = m_text;
+    while (isalnum(static_cast<unsigned char>(*m_text)) ||
+           *m_text == '_' || *m_text == '$' ||
+           (isSignature && (*m_text == '/' || *m_text == ';' || *m_text == '[')))
+    {
+        m_text++;
+    }
+    size_t length = m_text - start;
+    if (length == 0) {
+        throw IllegalArgumentException();
+    }
+    if (isSignature && strchr("ZBCSIJFDL[", start[0]) == 0) {
+        throw IllegalArgumentException();
+    }
+    char* token = reinterpret_cast<char*>(
+        GetMemoryManager().Allocate(length + 1 JDWP_FILE_LINE));
+    strncpy(token, start, length);
+    token[length] = '\0';
+    return token;
+}
+
+bool ConditionExpression::GetThis(JNIEnv* jni, EventInfo &eInfo,
+        jobject& thisObject) const throw()
+{
+    // the instance of field events is the accessed object, not this one
+    jint modifiers;
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodModifiers(eInfo.method, &modifiers));
+    if (err != JVMTI_ERROR_NONE) {
+        return false;
+    }
+    thisObject = 0;
+    if ((modifiers & ACC_STATIC) == 0) {
+        // get "this" object from slot 0 (stated in JVM spec)
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalObject(eInfo.thread,
+            eInfo.frameDepth, 0, &thisObject));
+        if (err != JVMTI_ERROR_NONE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ConditionExpression::ReadOperand(JNIEnv* jni, EventInfo &eInfo,
+        const Instruction& instr, Value& result) const throw()
+{
+    jvmtiError err = JVMTI_ERROR_NONE;
+    jobject object = 0;
+    jclass cls = 0;
+    jfieldID field = 0;
+
+    switch (instr.op) {
+    case OP_CONST:
+        result.tag = instr.tag;
+        result.value = instr.value;
+        return true;
+    case OP_THIS:
+        result.tag = JDWP_TAG_OBJECT;
+        return GetThis(jni, eInfo, result.value.l);
+    case OP_LOCAL:
+        break;
+    case OP_THIS_FIELD:
+        if (!GetThis(jni, eInfo, object) || object == 0) {
+            return false;
+        }
+        cls = jni->GetObjectClass(object);
+        field = jni->GetFieldID(cls, instr.name, instr.signature);
+        break;
+    case OP_STATIC_FIELD:
+        cls = eInfo.cls;
+        field = jni->GetStaticFieldID(cls, instr.name, instr.signature);
+        break;
+    default:
+        return false;
+    }
+
+    if (instr.op != OP_LOCAL && field == 0) {
+        jni->ExceptionClear();
+        return false;
+    }
+
+    jint intValue = 0;
+    switch (instr.tag) {
+    case JDWP_TAG_BOOLEAN:
+    case JDWP_TAG_BYTE:
+    case JDWP_TAG_CHAR:
+    case JDWP_TAG_SHORT:
+    case JDWP_TAG_INT:
+        if (instr.op == OP_LOCAL) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalInt(eInfo.thread, eInfo.frameDepth,
+                instr.slot, &intValue));
+        } else if (instr.tag == JDWP_TAG_BOOLEAN) {
+            intValue = (object != 0) ? jni->GetBooleanField(object, field)
+                : jni->GetStaticBooleanField(cls, field);
+        } else if (instr.tag == JDWP_TAG_BYTE) {
+            intValue = (object != 0) ? jni->GetByteField(object, field)
+                : jni->GetStaticByteField(cls, field);
+        } else if (instr.tag == JDWP_TAG_CHAR) {
+            intValue = (object != 0) ? jni->GetCharField(object, field)
+                : jni->GetStaticCharField(cls, field);
+        } else if (instr.tag == JDWP_TAG_SHORT) {
+            intValue = (object != 0) ? jni->GetShortField(object, field)
+                : jni->GetStaticShortField(cls, field);
+        } else {
+            intValue = (object != 0) ? jni->GetIntField(object, field)
+                : jni->GetStaticIntField(cls, field);
+        }
+        result.tag = (instr.tag == JDWP_TAG_BOOLEAN) ?
+            JDWP_TAG_BOOLEAN : JDWP_TAG_LONG;
+        result.value.j = intValue;
+        break;
+    case JDWP_TAG_LONG:
+        if (instr.op == OP_LOCAL) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalLong(eInfo.thread, eInfo.frameDepth,
+                instr.slot, &result.value.j));
+        } else {
+            result.value.j = (object != 0) ? jni->GetLongField(object, field)
+                : jni->GetStaticLongField(cls, field);
+        }
+        result.tag = JDWP_TAG_LONG;
+        break;
+    case JDWP_TAG_FLOAT:
+        if (instr.op == OP_LOCAL) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalFloat(eInfo.thread, eInfo.frameDepth,
+                instr.slot, &result.value.f));
+        } else {
+            result.value.f = (object != 0) ? jni->GetFloatField(object, field)
+                : jni->GetStaticFloatField(cls, field);
+        }
+        result.tag = JDWP_TAG_DOUBLE;
+        result.value.d = result.value.f;
+        break;
+    case JDWP_TAG_DOUBLE:
+        if (instr.op == OP_LOCAL) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalDouble(eInfo.thread, eInfo.frameDepth,
+                instr.slot, &result.value.d));
+        } else {
+            result.value.d = (object != 0) ? jni->GetDoubleField(object, field)
+                : jni->GetStaticDoubleField(cls, field);
+        }
+        result.tag = JDWP_TAG_DOUBLE;
+        break;
+    default:
+        if (instr.op == OP_LOCAL) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalObject(eInfo.thread, eInfo.frameDepth,
+                instr.slot, &result.value.l));
+        } else {
+            result.value.l = (object != 0) ? jni->GetObjectField(object, field)
+                : jni->GetStaticObjectField(cls, field);
+        }
+        result.tag = JDWP_TAG_OBJECT;
+        break;
+    }
+    return (err == JVMTI_ERROR_NONE);
+}
+
+bool ConditionExpression::Compare(JNIEnv* jni, OpCode op, const Value& left,
+        const Value& right, bool& result) throw()
+{
+    int order;
+    if (left.tag == JDWP_TAG_OBJECT || right.tag == JDWP_TAG_OBJECT) {
+        // objects can be compared for identity only
+        if (left.tag != right.tag || (op != OP_EQ && op != OP_NE)) {
+            return false;
+        }
+        order = (JNI_TRUE == jni->IsSameObject(left.value.l, right.value.l))
+            ? 0 : 1;
+    } else if (left.tag == JDWP_TAG_DOUBLE || right.tag == JDWP_TAG_DOUBLE) {
+        jdouble l = (left.tag == JDWP_TAG_DOUBLE) ?
+            left.value.d : static_cast<jdouble>(left.value.j);
+        jdouble r = (right.tag == JDWP_TAG_DOUBLE) ?
+            right.value.d : static_cast<jdouble>(right.value.j);
+        if (l != l || r != r) {
+            // any comparison with NaN is false except !=
+            result = (op == OP_NE);
+            return true;
+        }
+        order = (l < r) ? -1 : (l > r) ? 1 : 0;
+    } else {
+        order = (left.value.j < right.value.j) ? -1 :
+            (left.value.j > right.value.j) ? 1 : 0;
+    }
+
+    switch (op) {
+    case OP_EQ: result = (order == 0); break;
+    case OP_NE: result = (order != 0); break;
+    case OP_LT: result = (order < 0); break;
+    case OP_LE: result = (order <= 0); break;
+    case OP_GT: result = (order > 0); break;
+    case OP_GE: result = (order >= 0); break;
+    default: return false;
+    }
+    return true;
+}
+
+bool ConditionExpression::Evaluate(JNIEnv* jni, EventInfo &eInfo)
+    const throw()
+{
+    if (eInfo.thread == 0 || eInfo.method == 0) {
+        return true;
+    }
+
+    // local references created by evaluation are freed with the frame
+    if (jni->PushLocalFrame(MAX_STACK_DEPTH + 2) != 0) {
+        jni->ExceptionClear();
+        return true;
+    }
+
+    Value stack[MAX_STACK_DEPTH];
+    jint depth = 0;
+    bool isEvaluated = true;
+    for (Program::const_iterator i = m_program.begin();
+            isEvaluated && i != m_program.end(); i++)
+    {
+        bool result;
+        switch (i->op) {
+        case OP_NOT:
+            if (stack[depth-1].tag != JDWP_TAG_BOOLEAN) {
+                isEvaluated = false;
+                break;
+            }
+            stack[depth-1].value.j = !stack[depth-1].value.j;
+            break;
+        case OP_AND:
+        case OP_OR:
+            if (stack[depth-2].tag != JDWP_TAG_BOOLEAN ||
+                stack[depth-1].tag != JDWP_TAG_BOOLEAN)
+            {
+                isEvaluated = false;
+                break;
+            }
+            depth--;
+            stack[depth-1].value.j = (i->op == OP_AND) ?
+                (stack[depth-1].value.j && stack[depth].value.j) :
+                (stack[depth-1].value.j || stack[depth].value.j);
+            break;
+        case OP_EQ:
+        case OP_NE:
+        case OP_LT:
+        case OP_LE:
+        case OP_GT:
+        case OP_GE:
+            isEvaluated = Compare(jni, i->op, stack[depth-2], stack[depth-1],
+                result);
+            depth--;
+            stack[depth-1].tag = JDWP_TAG_BOOLEAN;
+            stack[depth-1].value.j = result;
+            break;
+        default:
+            isEvaluated = ReadOperand(jni, eInfo, *i, stack[depth]);
+            depth++;
+            break;
+        }
+    }
+
+    bool condition = true;
+    if (!isEvaluated || depth != 1 || stack[0].tag != JDWP_TAG_BOOLEAN) {
+        JDWP_TRACE_EVENT("Evaluate: condition cannot be evaluated, event is reported");
+    } else {
+        condition = (stack[0].value.j != 0);
+    }
+
+    jni->PopLocalFrame(0);
+    return condition;
+}
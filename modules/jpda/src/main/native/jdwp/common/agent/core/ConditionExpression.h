@@ -0,0 +1,180 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * ConditionExpression.h
+ *
+ * Compiles and evaluates conditions of breakpoints and other location
+ * events in the agent.
+ */
+
+#ifndef _CONDITION_EXPRESSION_H_
+#define _CONDITION_EXPRESSION_H_
+
+#include <vector>
+
+#include "AgentBase.h"
+#include "AgentAllocator.h"
+
+namespace jdwp {
+
+    struct EventInfo;
+
+    /**
+     * The class implements a condition evaluated by the agent for the
+     * <code>Conditional</code> event request modifier.
+     * The condition text is compiled once into a postfix program, which is
+     * then evaluated in the event callback against the frame of the event
+     * method without any communication with the debugger.
+     *
+     * Grammar of the condition text:
+     * <pre>
+     *   expr    := and ('||' and)*
+     *   and     := not ('&&' not)*
+     *   not     := '!' not | compare
+     *   compare := operand (('==' | '!=' | '<' | '<=' | '>' | '>=') operand)?
+     *   operand := '(' expr ')' | 'true' | 'false' | 'null' | number
+     *            | '@' slot type             local variable of the frame
+     *            | 'this'                    this object of the frame
+     *            | 'this.' name ':' type     instance field of this object
+     *            | 'static.' name ':' type   static field of the event class
+     * </pre>
+     * where <code>type</code> is a JNI type signature, such as
+     * <code>I</code> or <code>Ljava/lang/String;</code>. Objects can be
+     * compared for identity only.
+     */
+    class ConditionExpression : public AgentBase {
+
+    public:
+
+        /**
+         * A constructor.
+         */
+        ConditionExpression() throw();
+
+        /**
+         * A destructor.
+         */
+        ~ConditionExpression() throw();
+
+        /**
+         * Compiles the given condition text.
+         *
+         * @param text - the condition text
+         *
+         * @exception IllegalArgumentException is thrown if the text is not
+         *            a valid condition or is nested too deep.
+         */
+        void Compile(const char* text) throw(AgentException);
+
+        /**
+         * Evaluates the condition for the given event.
+         *
+         * @param jni   - the JNI interface pointer
+         * @param eInfo - the request-event information
+         *
+         * @return <code>false</code> if the condition is false, or
+         *         <code>true</code> if it is true or cannot be evaluated,
+         *         so that the event is reported in the latter case.
+         */
+        bool Evaluate(JNIEnv* jni, EventInfo &eInfo) const throw();
+
+    private:
+
+        enum OpCode {
+            OP_CONST,
+            OP_LOCAL,
+            OP_THIS,
+            OP_THIS_FIELD,
+            OP_STATIC_FIELD,
+            OP_EQ,
+            OP_NE,
+            OP_LT,
+            OP_LE,
+            OP_GT,
+            OP_GE,
+            OP_NOT,
+            OP_AND,
+            OP_OR
+        };
+
+        /**
+         * Instruction of the compiled program.
+         */
+        struct Instruction {
+            OpCode op;
+            jdwpTag tag;
+            jint slot;
+            jvalue value;
+            char* name;
+            char* signature;
+        };
+
+        /**
+         * Value on the evaluation stack.
+         */
+        struct Value {
+            jdwpTag tag;
+            jvalue value;
+        };
+
+        /** Type for compiled program. */
+        typedef vector<Instruction, AgentAllocator<Instruction> > Program;
+
+        /** Maximal depth of the evaluation stack. */
+        static const jint MAX_STACK_DEPTH = 32;
+
+        /** Maximal nesting of parentheses and negations in the text. */
+        static const jint MAX_NESTING_DEPTH = 64;
+
+        /**
+         * Enters a nested expression, bounding the recursion of the parser
+         * on the stack of the thread compiling the condition.
+         */
+        void EnterNesting() throw(AgentException);
+
+        void ParseOr() throw(AgentException);
+        void ParseAnd() throw(AgentException);
+        void ParseNot() throw(AgentException);
+        void ParseCompare() throw(AgentException);
+        void ParseOperand() throw(AgentException);
+        void ParseNumber() throw(AgentException);
+        char* ParseToken(bool isSignature) throw(AgentException);
+        bool Match(const char* token) throw();
+        void SkipSpaces() throw();
+        void Emit(OpCode op, jdwpTag tag = JDWP_TAG_NONE) throw(AgentException);
+
+        bool ReadOperand(JNIEnv* jni, EventInfo &eInfo,
+            const Instruction& instr, Value& result) const throw();
+        bool GetThis(JNIEnv* jni, EventInfo &eInfo, jobject& thisObject)
+            const throw();
+        static bool Compare(JNIEnv* jni, OpCode op, const Value& left,
+            const Value& right, bool& result) throw();
+
+        Program m_program;
+        const char* m_text;
+        jint m_depth;
+        jint m_maxDepth;
+        jint m_nesting;
+
+    };
+
+}
+
+#endif // _CONDITION_EXPRESSION_H_
@@ -25,14 +25,20 @@
 #include "ThreadManager.h"
 #include "OptionParser.h"
 #include "PacketDispatcher.h"
+#include "RequestManager.h"
+#include "AtomicOps_pd.h"
 #include "Log.h"
 
 using namespace jdwp;
 
-EventDispatcher::EventDispatcher(size_t limit) throw() {
+EventDispatcher::EventDispatcher(size_t limit) throw()
+    : m_eventComposerPool(sizeof(EventComposer), EVENT_POOL_SIZE)
+    , m_eventBufferPool(EVENT_BUFFER_SIZE, EVENT_POOL_SIZE)
+{
     JDWP_ASSERT(limit > 0);
     m_idCount = 0;
     m_queueMonitor = 0;
+    m_spaceMonitor = 0;
     m_waitMonitor = 0;
     m_invokeMonitor = 0;
     m_completeMonitor = 0;
@@ -41,6 +47,11 @@ EventDispatcher::EventDispatcher(size_t limit) throw() {
     m_holdFlag = false;
     m_resetFlag = false;
     m_queueLimit = limit;
+    m_hardQueueLimit = (limit + 1) * OVERFLOW_HARD_LIMIT_FACTOR;
+    m_overflowPolicy = OVERFLOW_BLOCK;
+    m_droppedCount = 0;
+    m_consumerWaiting = 0;
+    m_producersWaiting = 0;
 }
 
 void EventDispatcher::Run(JNIEnv* jni) {
@@ -51,23 +62,8 @@ void EventDispatcher::Run(JNIEnv* jni) {
         
         try {
             while (!m_stopFlag) {
-                EventComposer *ec;
-            
-                // get next event from queue
-                {
-                    MonitorAutoLock lock(m_queueMonitor JDWP_FILE_LINE);
-
-                    while (m_holdFlag || m_eventQueue.empty()) {
-                        m_queueMonitor->Wait();
-                        if (m_stopFlag) break; // break event waiting loop
-                    }
-
-                    if (m_stopFlag) break; // break events handling loop
-
-                    ec = m_eventQueue.front();
-                    m_eventQueue.pop();
-                    m_queueMonitor->NotifyAll();
-                }
+                EventComposer *ec = TakeEvent(jni);
+                if (ec == 0) break; // break events handling loop
             
                 // send event and suspend thread according to suspend policy
                 SuspendOnEvent(jni, ec);
@@ -96,6 +92,79 @@ void EventDispatcher::Run(JNIEnv* jni) {
     }
 }
 
+EventComposer* EventDispatcher::TakeEvent(JNIEnv *jni) throw(AgentException) {
+    MonitorAutoLock lock(m_queueMonitor JDWP_FILE_LINE);
+
+    while (!m_stopFlag) {
+        if (!m_holdFlag) {
+            EventComposer *ec = PopEvent(jni);
+            if (ec != 0) {
+                return ec;
+            }
+
+            // send pending ClassPrepare events and tracepoint records when idle
+            ec = GetRequestManager().TakeClassPrepareEvents();
+            if (ec != 0) {
+                return ec;
+            }
+            ec = GetRequestManager().TakeTracepointEvents();
+            if (ec != 0) {
+                return ec;
+            }
+        }
+
+        // posting threads notify the monitor only if this flag is set, so
+        // the queue is checked again after setting it
+        AtomicCompareAndSet(&m_consumerWaiting, 0, 1);
+        if (!m_stopFlag && (m_holdFlag || m_eventQueue.IsEmpty())) {
+            m_queueMonitor->Wait();
+        }
+        m_consumerWaiting = 0;
+    }
+    return 0;
+}
+
+EventComposer* EventDispatcher::PopEvent(JNIEnv *jni) throw(AgentException) {
+    EventComposer *ec = m_eventQueue.Pop();
+    while (ec != 0) {
+        if (m_producersWaiting != 0) {
+            MonitorAutoLock lock(m_spaceMonitor JDWP_FILE_LINE);
+            m_spaceMonitor->NotifyAll();
+        }
+
+        if (m_overflowPolicy == OVERFLOW_BLOCK || !IsOverflowable(ec)
+            || m_eventQueue.GetSize() <= static_cast<jint>(m_queueLimit))
+        {
+            return ec;
+        }
+
+        if (m_overflowPolicy == OVERFLOW_COALESCE) {
+            // merge following non-suspending event sets into this one
+            EventComposer *next = m_eventQueue.Peek();
+            while (next != 0 && IsOverflowable(next)
+                   && m_eventQueue.GetSize() > static_cast<jint>(m_queueLimit))
+            {
+                ec->event.AppendCompositeEvents(next->event);
+                m_eventQueue.Pop();
+                JDWP_TRACE_EVENT("PopEvent -- coalesce event set: packet=" << next
+                    << " into packet=" << ec);
+                next->Reset(jni);
+                delete next;
+                next = m_eventQueue.Peek();
+            }
+            return ec;
+        }
+
+        AtomicIncrement(&m_droppedCount);
+        JDWP_TRACE_EVENT("PopEvent -- drop event set: packet=" << ec
+            << ", dropped=" << m_droppedCount);
+        ec->Reset(jni);
+        delete ec;
+        ec = m_eventQueue.Pop();
+    }
+    return 0;
+}
+
 void JNICALL
 EventDispatcher::StartFunction(jvmtiEnv* jvmti, JNIEnv* jni, void* arg) {
     JDWP_TRACE_ENTRY("StartFunction(" << jvmti << ',' << jni << ',' << arg << ')');
@@ -107,9 +176,13 @@ void EventDispatcher::Init(JNIEnv *jni) throw(AgentException) {
     JDWP_TRACE_ENTRY("Init(" << jni << ')');
 
     m_queueMonitor = new AgentMonitor("_jdwp_EventDispatcher_queueMonitor");
+    m_spaceMonitor = new AgentMonitor("_jdwp_EventDispatcher_spaceMonitor");
     m_waitMonitor = new AgentMonitor("_jdwp_EventDispatcher_waitMonitor");
     m_invokeMonitor = new AgentMonitor("_jdwp_EventDispatcher_invokeMonitor");
     m_completeMonitor = new AgentMonitor("_jdwp_EventDispatcher_completeMonitor");
+    m_eventQueue.Init();
+    m_overflowPolicy = GetOptionParser().GetOverflowPolicy();
+    m_droppedCount = 0;
     m_stopFlag = false;
     m_holdFlag = true;
 }
@@ -130,16 +203,27 @@ void EventDispatcher::Reset(JNIEnv *jni) throw(AgentException) {
     if (m_queueMonitor != 0) {
         MonitorAutoLock lock(m_queueMonitor JDWP_FILE_LINE);
 
-        while(!m_eventQueue.empty()) {
-            EventComposer *ec = m_eventQueue.front();
-            m_eventQueue.pop();
+        EventComposer *ec;
+        while ((ec = m_eventQueue.Pop()) != 0) {
             JDWP_TRACE_EVENT("Reset -- delete event set: packet=" << ec);
             ec->Reset(jni);
             delete ec;
         }
 
+        if (m_droppedCount != 0) {
+            JDWP_INFO("JDWP: " << m_droppedCount
+                << " event sets dropped on event queue overflow");
+            m_droppedCount = 0;
+        }
+
         m_holdFlag = true;
     }
+
+    // release all threads waiting for space in queue
+    if (m_spaceMonitor != 0) {
+        MonitorAutoLock lock(m_spaceMonitor JDWP_FILE_LINE);
+        m_spaceMonitor->NotifyAll();
+    }
     
     // release all treads waiting for suspending by event
     if (m_waitMonitor != 0) {
@@ -200,9 +284,14 @@ void EventDispatcher::Clean(JNIEnv *jni) throw(AgentException) {
     // delete monitors
     
     if (m_queueMonitor != 0) {
+        m_eventQueue.Clean();
         delete m_queueMonitor;
         m_queueMonitor = 0;
     }
+    if (m_spaceMonitor != 0) {
+        delete m_spaceMonitor;
+        m_spaceMonitor = 0;
+    }
     if (m_waitMonitor != 0){
         delete m_waitMonitor;
         m_waitMonitor = 0;
@@ -220,6 +309,11 @@ void EventDispatcher::Clean(JNIEnv *jni) throw(AgentException) {
         m_completeMonitor = 0;
     }
 
+    // free pooled objects
+
+    m_eventComposerPool.Clean();
+    m_eventBufferPool.Clean();
+
     // clean counter for packet id
 
     m_idCount = 0;
@@ -353,6 +447,56 @@ void EventDispatcher::SuspendOnEvent(JNIEnv* jni, EventComposer *ec)
     }
 }
 
+void EventDispatcher::NotifyPendingEvents() throw(AgentException)
+{
+    MonitorAutoLock lock(m_queueMonitor JDWP_FILE_LINE);
+    m_queueMonitor->NotifyAll();
+}
+
+void EventDispatcher::PostBatchedEventSet(JNIEnv *jni, EventComposer *ec,
+        jdwpEventKind eventKind)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("PostBatchedEventSet(" << jni << ',' << ec << ',' << eventKind << ')');
+    JDWP_ASSERT(ec->GetSuspendPolicy() == JDWP_SUSPEND_NONE);
+
+    if (m_stopFlag) {
+        ec->Reset(jni);
+        delete ec;
+        return;
+    }
+
+    // the batch replaces many event sets, so it does not wait for the queue limit
+    m_eventQueue.Push(ec);
+    NotifyDispatcher();
+}
+
+bool EventDispatcher::WaitForQueueSpace(size_t limit) throw(AgentException)
+{
+    while (m_eventQueue.GetSize() > static_cast<jint>(limit)) {
+        MonitorAutoLock lock(m_spaceMonitor JDWP_FILE_LINE);
+        // the dispatcher notifies the monitor only if the counter is set,
+        // so the queue is checked again after setting it
+        AtomicIncrement(&m_producersWaiting);
+        if (!m_resetFlag && m_eventQueue.GetSize() > static_cast<jint>(limit)) {
+            m_spaceMonitor->Wait();
+        }
+        AtomicDecrement(&m_producersWaiting);
+        if (m_resetFlag) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void EventDispatcher::NotifyDispatcher() throw(AgentException)
+{
+    if (m_consumerWaiting != 0) {
+        MonitorAutoLock lock(m_queueMonitor JDWP_FILE_LINE);
+        m_queueMonitor->NotifyAll();
+    }
+}
+
 void EventDispatcher::PostEventSet(JNIEnv *jni, EventComposer *ec, jdwpEventKind eventKind)
     throw(AgentException)
 {
@@ -365,22 +509,34 @@ void EventDispatcher::PostEventSet(JNIEnv *jni, EventComposer *ec, jdwpEventKind
     jdwpSuspendPolicy suspendPolicy = ec->GetSuspendPolicy();
     bool isAutoDeathEvent = ec->IsAutoDeathEvent();
 
-    // put event packet into queue
-    {
-        MonitorAutoLock lock(m_queueMonitor JDWP_FILE_LINE);
-        while (m_eventQueue.size() > m_queueLimit) {
-            m_queueMonitor->Wait();
-            if (m_resetFlag) {
-                JDWP_TRACE_EVENT("PostEventSet -- delete event set: packet=" << ec 
-                    << ", eventKind=" << eventKind);
-                ec->Reset(jni);
-                delete ec;
-                return;
-            }
+    // put event packet into queue, non-suspending events beyond the limit
+    // are handled by the dispatcher according to the overflow policy until
+    // the hard limit is reached
+    bool hasSpace;
+    if (m_overflowPolicy == OVERFLOW_BLOCK || !IsOverflowable(ec)) {
+        hasSpace = WaitForQueueSpace(m_queueLimit);
+    } else if (m_overflowPolicy == OVERFLOW_COALESCE) {
+        hasSpace = WaitForQueueSpace(m_hardQueueLimit);
+    } else {
+        hasSpace = (m_eventQueue.GetSize() <= static_cast<jint>(m_hardQueueLimit));
+        if (!hasSpace) {
+            AtomicIncrement(&m_droppedCount);
         }
-        m_eventQueue.push(ec);
-        m_queueMonitor->NotifyAll();
     }
+    if (!hasSpace) {
+        JDWP_TRACE_EVENT("PostEventSet -- delete event set: packet=" << ec 
+            << ", eventKind=" << eventKind);
+        ec->Reset(jni);
+        delete ec;
+        return;
+    }
+    // pending ClassPrepare events were generated before this event set
+    EventComposer* pending = GetRequestManager().TakeClassPrepareEvents();
+    if (pending != 0) {
+        m_eventQueue.Push(pending);
+    }
+    m_eventQueue.Push(ec);
+    NotifyDispatcher();
 
     // if thread should be suspended
     if (suspendPolicy != JDWP_SUSPEND_NONE || isAutoDeathEvent) {
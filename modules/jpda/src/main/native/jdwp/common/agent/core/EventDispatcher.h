@@ -31,8 +31,6 @@
 #ifndef _EVENT_DISPATCHER_H_
 #define _EVENT_DISPATCHER_H_
 
-#include <queue>
-
 #include "jni.h"
 #include "jvmti.h"
 #include "jdwp.h"
@@ -42,6 +40,8 @@
 #include "AgentAllocator.h"
 #include "PacketParser.h"
 #include "CommandHandler.h"
+#include "OptionParser.h"
+#include "EventQueue.h"
 
 
 namespace jdwp {
@@ -139,6 +139,28 @@ namespace jdwp {
          */
         jint NewId() throw() { return m_idCount++; }
 
+        /**
+         * Gets the pool of <code>EventComposer</code> objects.
+         */
+        BlockPool& GetEventComposerPool() throw() {
+            return m_eventComposerPool;
+        }
+
+        /**
+         * Gets the pool of data buffers of event packets.
+         */
+        BlockPool& GetEventBufferPool() throw() {
+            return m_eventBufferPool;
+        }
+
+        /**
+         * Wakes up the dispatcher thread to send events kept outside of
+         * the event queue, such as pending tracepoint records.
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        void NotifyPendingEvents() throw(AgentException);
+
         /**
          * Sends the event packet and suspends thread(s) according to suspend 
          * policy.
@@ -152,6 +174,20 @@ namespace jdwp {
         void PostEventSet(JNIEnv *jni, EventComposer *ec, jdwpEventKind eventKind)
             throw(AgentException);
 
+        /**
+         * Sends the batch of non-suspending events. Unlike 
+         * <code>PostEventSet()</code>, the batch is queued even if the event
+         * queue is full.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param ec        - the pointer to EventComposer
+         * @param eventKind - the JDWP event kind
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        void PostBatchedEventSet(JNIEnv *jni, EventComposer *ec,
+            jdwpEventKind eventKind) throw(AgentException);
+
         /**
          * Suspends thread(s) after method invocation according to invocation 
          * options.
@@ -207,10 +243,76 @@ namespace jdwp {
         void SuspendOnEvent(JNIEnv* jni, EventComposer *ec) throw(AgentException);
 
         /**
-         * Event queue type.
+         * Takes the next event set to be sent, waiting for it if the queue is
+         * empty or events are held. Called by the dispatcher thread only.
+         *
+         * @param jni - the JNI interface pointer
+         *
+         * @return The event set, or 0 if the thread is stopped.
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        EventComposer* TakeEvent(JNIEnv *jni) throw(AgentException);
+
+        /**
+         * Removes the next event set from the queue and applies the overflow
+         * policy to it. Called under <code>m_queueMonitor</code>.
+         *
+         * @param jni - the JNI interface pointer
+         *
+         * @return The event set, or 0 if the queue is empty.
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        EventComposer* PopEvent(JNIEnv *jni) throw(AgentException);
+
+        /**
+         * Waits while the queue is over the given limit.
+         *
+         * @param limit - the number of queued event sets to wait for
+         *
+         * @return <code>false</code> if the session was reset while waiting.
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        bool WaitForQueueSpace(size_t limit) throw(AgentException);
+
+        /**
+         * Wakes up the dispatcher thread if it waits for events.
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        void NotifyDispatcher() throw(AgentException);
+
+        /**
+         * Checks whether the overflow policy may drop or merge the event set.
          */
-        typedef queue<EventComposer*,
-            deque<EventComposer*, AgentAllocator<EventComposer*> > > EventQueue;
+        bool IsOverflowable(EventComposer *ec) throw() {
+            return ec->GetSuspendPolicy() == JDWP_SUSPEND_NONE
+                && !ec->IsAutoDeathEvent();
+        }
+
+        /** Maximal number of free objects and buffers kept in the pools. */
+        static const jint EVENT_POOL_SIZE = 256;
+
+        /**
+         * Ratio of the queue size at which the overflow policy is applied
+         * by posting threads to <code>m_queueLimit</code>.
+         */
+        static const size_t OVERFLOW_HARD_LIMIT_FACTOR = 4;
+
+        /** Size of pooled data buffers, which fits most of event packets. */
+        static const size_t EVENT_BUFFER_SIZE = 256;
+
+        /**
+         * Pool of <code>EventComposer</code> objects.
+         */
+        BlockPool m_eventComposerPool;
+
+        /**
+         * Pool of data buffers of event packets.
+         */
+        BlockPool m_eventBufferPool;
 
         /**
          * Event queue with event packets to be sent.
@@ -222,16 +324,52 @@ namespace jdwp {
          */
         size_t m_queueLimit;
 
+        /**
+         * Limit beyond which non-suspending events are not queued until the
+         * dispatcher catches up: they are dropped by the
+         * <code>OVERFLOW_DROP_OLDEST</code> policy and wait for space with
+         * <code>OVERFLOW_COALESCE</code>.
+         */
+        size_t m_hardQueueLimit;
+
+        /**
+         * Handling of non-suspending events beyond <code>m_queueLimit</code>.
+         */
+        OverflowPolicy m_overflowPolicy;
+
+        /**
+         * Number of events discarded by <code>OVERFLOW_DROP_OLDEST</code>
+         * policy, changed atomically.
+         */
+        volatile jint m_droppedCount;
+
+        /**
+         * Set while the dispatcher thread waits on <code>m_queueMonitor</code>.
+         */
+        volatile jint m_consumerWaiting;
+
+        /**
+         * Number of threads waiting on <code>m_spaceMonitor</code>.
+         */
+        volatile jint m_producersWaiting;
+
         /**
          * Counter for event-packet IDs.
          */
         jint m_idCount;
 
         /**
-         * Monitor for <code>m_eventQueue</code>.
+         * Monitor for taking events from <code>m_eventQueue</code> and
+         * waiting for them. Events are put into the queue without it.
          */
         AgentMonitor* m_queueMonitor;
 
+        /**
+         * Monitor for waiting until <code>m_eventQueue</code> is below
+         * its limit.
+         */
+        AgentMonitor* m_spaceMonitor;
+
         /**
          * Monitor for synchronization of events sending.
          */
@@ -0,0 +1,90 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// EventQueue.cpp
+
+#include "EventQueue.h"
+#include "AtomicOps_pd.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+EventQueue::EventQueue() throw()
+    : m_nodePool(sizeof(Node), NODE_POOL_SIZE)
+    , m_head(0)
+    , m_tail(0)
+    , m_size(0)
+{}
+
+EventQueue::~EventQueue() throw()
+{}
+
+void EventQueue::Init() throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Init()");
+
+    Node* dummy = static_cast<Node*>(m_nodePool.Allocate());
+    dummy->next = 0;
+    dummy->ec = 0;
+    m_head = dummy;
+    m_tail = dummy;
+    m_size = 0;
+}
+
+void EventQueue::Clean() throw()
+{
+    JDWP_TRACE_ENTRY("Clean()");
+
+    if (m_head != 0) {
+        // packets left are owned by their posting threads
+        while (Pop() != 0) {}
+        m_nodePool.Free(m_head);
+        m_head = 0;
+        m_tail = 0;
+    }
+    m_nodePool.Clean();
+}
+
+void EventQueue::Push(EventComposer* ec) throw(AgentException)
+{
+    Node* node = static_cast<Node*>(m_nodePool.Allocate());
+    node->next = 0;
+    node->ec = ec;
+
+    Node* prev = static_cast<Node*>(AtomicExchangePointer(
+        reinterpret_cast<void* volatile*>(&m_tail), node));
+    prev->next = node;
+
+    // also orders the link before reading whether the consumer waits
+    AtomicIncrement(&m_size);
+}
+
+EventComposer* EventQueue::Pop() throw()
+{
+    Node* head = m_head;
+    Node* next = head->next;
+    if (next == 0) {
+        return 0;
+    }
+    EventComposer* ec = next->ec;
+    next->ec = 0;
+    m_head = next;
+    m_nodePool.Free(head);
+    AtomicDecrement(&m_size);
+    return ec;
+}
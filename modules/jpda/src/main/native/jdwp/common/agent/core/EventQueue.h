@@ -0,0 +1,145 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * EventQueue.h
+ *
+ * Queue of event packets posted by application threads and sent by the
+ * event dispatcher thread.
+ */
+
+#ifndef _EVENT_QUEUE_H_
+#define _EVENT_QUEUE_H_
+
+#include "AgentBase.h"
+#include "BlockPool.h"
+#include "PacketParser.h"
+
+namespace jdwp {
+
+    /**
+     * Multi-producer single-consumer queue of event packets. Any thread
+     * may push packets without locking; packets are taken by one thread at
+     * a time only, which is the event dispatcher thread or the thread
+     * resetting it under the queue monitor.
+     *
+     * Producers link a new node by atomic exchange of the tail, so the
+     * node may be invisible to the consumer for a short time after
+     * <code>Push()</code> started.
+     */
+    class EventQueue : public AgentBase {
+
+    public:
+
+        /**
+         * A constructor.
+         */
+        EventQueue() throw();
+
+        /**
+         * A destructor.
+         */
+        ~EventQueue() throw();
+
+        /**
+         * Initializes the empty queue.
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        void Init() throw(AgentException);
+
+        /**
+         * Frees the queue and its free nodes. Packets left in the queue are
+         * not deleted.
+         */
+        void Clean() throw();
+
+        /**
+         * Appends the event packet to the queue. Called by any thread.
+         *
+         * @param ec - the pointer to EventComposer
+         *
+         * @exception If any error occurs, <code>AgentException</code> is thrown.
+         */
+        void Push(EventComposer* ec) throw(AgentException);
+
+        /**
+         * Removes the first event packet from the queue. Called by the
+         * consumer only.
+         *
+         * @return The first event packet, or 0 if the queue is empty.
+         */
+        EventComposer* Pop() throw();
+
+        /**
+         * Gets the first event packet without removing it. Called by the
+         * consumer only.
+         *
+         * @return The first event packet, or 0 if the queue is empty.
+         */
+        EventComposer* Peek() const throw() {
+            Node* next = m_head->next;
+            return (next != 0) ? next->ec : 0;
+        }
+
+        /**
+         * Checks whether the queue has no packets. Called by the consumer
+         * only.
+         */
+        bool IsEmpty() const throw() {
+            return m_head->next == 0;
+        }
+
+        /**
+         * Gets the approximate number of packets in the queue.
+         */
+        jint GetSize() const throw() {
+            return m_size;
+        }
+
+    private:
+
+        /**
+         * Queue node. The first node is a dummy one, whose packet has been
+         * already taken.
+         */
+        struct Node {
+            Node* volatile next;
+            EventComposer* ec;
+        };
+
+        /** Maximal number of free nodes kept for reuse. */
+        static const jint NODE_POOL_SIZE = 256;
+
+        // free nodes, so that posting an event does not allocate memory
+        BlockPool m_nodePool;
+
+        // read and written by the consumer only
+        Node* m_head;
+
+        // last node, exchanged by producers
+        Node* volatile m_tail;
+
+        volatile jint m_size;
+
+    };
+
+}
+
+#endif // _EVENT_QUEUE_H_
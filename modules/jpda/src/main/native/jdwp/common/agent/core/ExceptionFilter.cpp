@@ -0,0 +1,264 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// ExceptionFilter.cpp
+
+#include "ExceptionFilter.h"
+#include "RequestModifier.h"
+#include "AtomicOps_pd.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+ExceptionFilter::FilterState::FilterState() throw()
+    : m_anyMask(0)
+    , m_cacheSize(0)
+{
+    for (jint i = 0; i < CACHE_BUCKETS; i++) {
+        m_cache[i] = 0;
+    }
+}
+
+ExceptionFilter::ExceptionFilter() throw()
+    : m_monitor(0)
+    , m_state(0)
+{
+    m_epoch = 0;
+    m_readers[0] = 0;
+    m_readers[1] = 0;
+}
+
+ExceptionFilter::~ExceptionFilter() throw()
+{}
+
+void ExceptionFilter::Init(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Init(" << jni << ")");
+
+    m_monitor = new AgentMonitor("_jdwp_ExceptionFilter_monitor");
+}
+
+void ExceptionFilter::Clean(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Clean(" << jni << ")");
+
+    if (m_monitor != 0) {
+        DeleteState(jni, PublishState(0));
+        delete m_monitor;
+        m_monitor = 0;
+    }
+}
+
+void ExceptionFilter::DeleteState(JNIEnv* jni, FilterState* state) throw()
+{
+    if (state == 0) {
+        return;
+    }
+    for (IndexList::iterator i = state->m_index.begin();
+         i != state->m_index.end(); i++)
+    {
+        jni->DeleteGlobalRef(i->cls);
+    }
+    for (jint i = 0; i < CACHE_BUCKETS; i++) {
+        CacheEntry* entry = state->m_cache[i];
+        while (entry != 0) {
+            CacheEntry* next = entry->next;
+            jni->DeleteWeakGlobalRef(entry->cls);
+            GetMemoryManager().Free(entry JDWP_FILE_LINE);
+            entry = next;
+        }
+    }
+    delete state;
+}
+
+ExceptionFilter::FilterState* ExceptionFilter::AcquireState(jint& epoch) throw()
+{
+    for (;;) {
+        epoch = m_epoch;
+        AtomicIncrement(&m_readers[epoch]);
+        if (epoch == m_epoch) {
+            // the publisher deletes the replaced state only when readers
+            // of this epoch are gone
+            return m_state;
+        }
+        AtomicDecrement(&m_readers[epoch]);
+    }
+}
+
+void ExceptionFilter::ReleaseState(jint epoch) throw()
+{
+    AtomicDecrement(&m_readers[epoch]);
+}
+
+ExceptionFilter::FilterState* ExceptionFilter::PublishState(FilterState* state)
+    throw()
+{
+    FilterState* previous = static_cast<FilterState*>(
+        AtomicExchangePointer(reinterpret_cast<void* volatile*>(&m_state),
+            state));
+    // readers which see the new epoch read the new state, those which
+    // saw the previous one are waited for
+    jint epoch = m_epoch;
+    AtomicCompareAndSet(&m_epoch, epoch, 1 - epoch);
+    while (m_readers[epoch] != 0) {
+        SpinYield();
+    }
+    return previous;
+}
+
+void ExceptionFilter::Update(JNIEnv* jni, const RequestList& requests)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Update(" << jni << ',' << requests.size() << ")");
+
+    FilterState* state = new FilterState();
+    try {
+        for (RequestList::const_iterator i = requests.begin(); i != requests.end(); i++) {
+            ExceptionOnlyModifier* modifier = (*i)->GetExceptionOnly();
+            if (modifier == 0) {
+                // internal requests of step and initial exception requests
+                state->m_anyMask |= MATCH_CAUGHT | MATCH_UNCAUGHT;
+                continue;
+            }
+            jint mask = (modifier->IsCaught() ? MATCH_CAUGHT : 0) |
+                (modifier->IsUncaught() ? MATCH_UNCAUGHT : 0);
+            if (modifier->GetClass() == 0) {
+                state->m_anyMask |= mask;
+                continue;
+            }
+
+            IndexList::iterator entry = state->m_index.begin();
+            while (entry != state->m_index.end() &&
+                   jni->IsSameObject(entry->cls, modifier->GetClass()) != JNI_TRUE)
+            {
+                entry++;
+            }
+            if (entry != state->m_index.end()) {
+                entry->mask |= mask;
+            } else {
+                IndexEntry newEntry;
+                newEntry.cls = static_cast<jclass>(
+                    jni->NewGlobalRef(modifier->GetClass()));
+                if (newEntry.cls == 0) {
+                    throw OutOfMemoryException();
+                }
+                newEntry.mask = mask;
+                state->m_index.push_back(newEntry);
+            }
+        }
+    } catch (AgentException&) {
+        DeleteState(jni, state);
+        throw;
+    }
+    JDWP_TRACE_EVENT("Update: exception filter: classes=" << state->m_index.size()
+        << ", anyMask=" << state->m_anyMask);
+
+    // not under the filter monitor: readers being waited for may need it
+    DeleteState(jni, PublishState(state));
+}
+
+bool ExceptionFilter::MayMatch(JNIEnv* jni, jclass exceptionClass,
+        bool caught)
+    throw(AgentException)
+{
+    const jint bit = caught ? MATCH_CAUGHT : MATCH_UNCAUGHT;
+
+    jint epoch;
+    FilterState* state = AcquireState(epoch);
+    bool result;
+    try {
+        result = MatchState(jni, state, exceptionClass, bit);
+    } catch (AgentException&) {
+        ReleaseState(epoch);
+        throw;
+    }
+    ReleaseState(epoch);
+    return result;
+}
+
+bool ExceptionFilter::MatchState(JNIEnv* jni, FilterState* state,
+        jclass exceptionClass, jint bit)
+    throw(AgentException)
+{
+    if (state == 0) {
+        // no Exception requests were published yet
+        return false;
+    }
+    if ((state->m_anyMask & bit) != 0) {
+        return true;
+    }
+    if (state->m_index.empty()) {
+        return false;
+    }
+
+    jvmtiError err;
+    jint hashCode = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetObjectHashCode(exceptionClass, &hashCode));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+    CacheEntry* volatile* bucket =
+        &state->m_cache[static_cast<unsigned int>(hashCode) % CACHE_BUCKETS];
+    CacheEntry* head = *bucket;
+    for (CacheEntry* entry = head; entry != 0; entry = entry->next) {
+        if (entry->hashCode == hashCode &&
+            jni->IsSameObject(entry->cls, exceptionClass) == JNI_TRUE)
+        {
+            return (entry->mask & bit) != 0;
+        }
+    }
+
+    // first exception of this class since the requests changed
+    jint mask = 0;
+    for (IndexList::const_iterator i = state->m_index.begin();
+         i != state->m_index.end(); i++)
+    {
+        if (jni->IsAssignableFrom(exceptionClass, i->cls) == JNI_TRUE) {
+            mask |= i->mask;
+        }
+    }
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    // entries are never removed while the state is published, so only
+    // those prepended since the lookup above need to be checked
+    for (CacheEntry* entry = *bucket; entry != head; entry = entry->next) {
+        if (entry->hashCode == hashCode &&
+            jni->IsSameObject(entry->cls, exceptionClass) == JNI_TRUE)
+        {
+            return (mask & bit) != 0;
+        }
+    }
+    if (state->m_cacheSize >= MAX_CACHE_SIZE) {
+        // the cache is dropped with the state on the next update
+        return (mask & bit) != 0;
+    }
+    CacheEntry* entry = reinterpret_cast<CacheEntry*>
+        (GetMemoryManager().Allocate(sizeof(CacheEntry) JDWP_FILE_LINE));
+    entry->cls = jni->NewWeakGlobalRef(exceptionClass);
+    if (entry->cls == 0) {
+        GetMemoryManager().Free(entry JDWP_FILE_LINE);
+    } else {
+        entry->hashCode = hashCode;
+        entry->mask = mask;
+        entry->next = *bucket;
+        // the full barrier publishes the entry to lock-free readers
+        AtomicExchangePointer(reinterpret_cast<void* volatile*>(bucket), entry);
+        state->m_cacheSize++;
+    }
+    return (mask & bit) != 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * ExceptionFilter.h
+ *
+ * Rejects thrown exceptions that cannot match any Exception event request
+ * before the event is processed.
+ */
+
+#ifndef _EXCEPTION_FILTER_H_
+#define _EXCEPTION_FILTER_H_
+
+#include <vector>
+
+#include "AgentBase.h"
+#include "AgentMonitor.h"
+#include "AgentAllocator.h"
+#include "AgentEventRequest.h"
+
+namespace jdwp {
+
+    /**
+     * The class indexes published Exception event requests by the class of
+     * their <code>ExceptionOnly</code> modifier and caches, per thrown
+     * exception class, which of the indexed classes it is assignable to.
+     * The filter is conservative: it may accept exceptions no request
+     * matches, but never rejects one that some request could match.
+     */
+    class ExceptionFilter : public AgentBase {
+
+    public:
+
+        /**
+         * A constructor.
+         */
+        ExceptionFilter() throw();
+
+        /**
+         * A destructor.
+         */
+        ~ExceptionFilter() throw();
+
+        /**
+         * Initializes the filter.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Init(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Cleans the filter.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Clean(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Rebuilds the index for the given Exception event requests and
+         * drops the cached results.
+         *
+         * @param jni      - the JNI interface pointer
+         * @param requests - the published Exception event requests
+         */
+        void Update(JNIEnv* jni, const RequestList& requests)
+            throw(AgentException);
+
+        /**
+         * Checks whether any Exception event request may match an exception
+         * of the given class.
+         *
+         * @param jni            - the JNI interface pointer
+         * @param exceptionClass - the class of the thrown exception
+         * @param caught         - whether the exception is caught
+         *
+         * @return <code>false</code> if no request can match the exception.
+         */
+        bool MayMatch(JNIEnv* jni, jclass exceptionClass, bool caught)
+            throw(AgentException);
+
+    private:
+
+        enum {
+            MATCH_CAUGHT = 1,
+            MATCH_UNCAUGHT = 2
+        };
+
+        /**
+         * Exception class of <code>ExceptionOnly</code> modifiers with the
+         * combined caught/uncaught mask of their requests.
+         */
+        struct IndexEntry {
+            jclass cls;
+            jint mask;
+        };
+
+        /**
+         * Cached match mask of a thrown exception class.
+         */
+        struct CacheEntry {
+            jweak cls;
+            jint hashCode;
+            jint mask;
+            CacheEntry* next;
+        };
+
+        /** Type for the index of exception classes. */
+        typedef vector<IndexEntry, AgentAllocator<IndexEntry> > IndexList;
+
+        /** Number of buckets in the cache. */
+        static const jint CACHE_BUCKETS = 256;
+
+        /** Number of cached classes after which no more are cached. */
+        static const jint MAX_CACHE_SIZE = 4096;
+
+        /**
+         * Index and cache built for one published set of requests. The mask
+         * and index are not changed once the state is published, and cache
+         * entries are only prepended under the filter monitor, so readers
+         * use the state without a lock.
+         */
+        class FilterState : public AgentBase {
+        public:
+
+            /**
+             * Creates an empty state.
+             */
+            FilterState() throw();
+
+            /** Mask of requests without exception class restriction. */
+            jint m_anyMask;
+
+            /** Classes of <code>ExceptionOnly</code> modifiers. */
+            IndexList m_index;
+
+            /** Hash of cached results by identity hash code of thrown class. */
+            CacheEntry* volatile m_cache[CACHE_BUCKETS];
+
+            /** Number of cached results, changed under the filter monitor. */
+            jint m_cacheSize;
+
+        }; //FilterState
+
+        /**
+         * Pins the published state for the calling reader.
+         *
+         * @param epoch - receives the epoch to pass to ReleaseState()
+         *
+         * @return The published state or 0.
+         */
+        FilterState* AcquireState(jint& epoch) throw();
+
+        /**
+         * Unpins the state acquired with AcquireState().
+         *
+         * @param epoch - the epoch returned by AcquireState()
+         */
+        void ReleaseState(jint epoch) throw();
+
+        /**
+         * Publishes a new state and waits until no reader uses the previous
+         * one. Callers are serialized by the request monitor.
+         *
+         * @param state - the state to publish or 0
+         *
+         * @return The previous state, to be deleted by the caller.
+         */
+        FilterState* PublishState(FilterState* state) throw();
+
+        /**
+         * Deletes the state with its global references.
+         */
+        static void DeleteState(JNIEnv* jni, FilterState* state) throw();
+
+        /**
+         * Computes the match of the thrown class against the given state
+         * and caches it.
+         *
+         * @return <code>true</code> if a request may match the exception.
+         */
+        bool MatchState(JNIEnv* jni, FilterState* state, jclass exceptionClass,
+                        jint bit) throw(AgentException);
+
+        AgentMonitor* m_monitor;
+
+        // published state, replaced by Update()
+        FilterState* volatile m_state;
+
+        // epoch of readers and number of readers in each epoch
+        volatile jint m_epoch;
+        volatile jint m_readers[2];
+
+    };
+
+}
+
+#endif // _EXCEPTION_FILTER_H_
@@ -0,0 +1,1423 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// MethodTraceInjector.cpp
+
+#include <string.h>
+
+#include "MethodTraceInjector.h"
+#include "RequestManager.h"
+#include "RequestModifier.h"
+#include "ClassManager.h"
+#include "OptionParser.h"
+#include "Bytecode.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+const char* const MethodTraceInjector::TRACE_CLASS_NAME =
+    "org/apache/harmony/jdwp/agent/MethodTrace";
+
+/** Type for class file bytes. */
+typedef vector<unsigned char, AgentAllocator<unsigned char> > ByteBuffer;
+
+typedef MethodTraceInjector::OffsetList OffsetList;
+
+enum {
+    CONSTANT_UTF8 = 1,
+    CONSTANT_CLASS = 7,
+    CONSTANT_METHODREF = 10,
+    CONSTANT_NAME_AND_TYPE = 12
+};
+
+//-----------------------------------------------------------------------------
+// ClassFileRewriter
+//-----------------------------------------------------------------------------
+
+namespace {
+
+    /**
+     * Inserts calls of the helper class methods into the code of all methods
+     * of a class file: one call at the method start and one before each
+     * return instruction. Branch offsets, switch padding, exception table,
+     * line number and local variable tables and stack map frames are
+     * adjusted for the inserted code. A method whose code cannot be safely
+     * rewritten, such as one with an unknown attribute that may refer to
+     * bytecode offsets, is copied unchanged. New offsets of instructions
+     * of the rewritten methods are collected into the given list, if any.
+     */
+    class ClassFileRewriter {
+
+    public:
+
+        ClassFileRewriter(const unsigned char* data, jint length,
+                MethodTraceInjector::MethodOffsetsList* methods) throw()
+            : m_data(data), m_length(length), m_pos(0),
+              m_entryRef(0), m_exitRef(0), m_isChanged(false),
+              m_methods(methods)
+        {}
+
+        /**
+         * Rewrites the class file into the given buffer.
+         *
+         * @return <code>false</code> if no method is changed.
+         *
+         * @exception AgentException is thrown if the class file is malformed.
+         */
+        bool Rewrite(ByteBuffer& out) throw(AgentException);
+
+    private:
+
+        /** Number of constant pool entries added to the class. */
+        static const jint NEW_ENTRY_COUNT = 9;
+
+        void Require(jint count) throw(AgentException) {
+            if (count < 0 || m_pos + count > m_length) {
+                throw AgentException(JDWP_ERROR_INVALID_CLASS_FORMAT);
+            }
+        }
+
+        jint U1() throw(AgentException) {
+            Require(1);
+            return m_data[m_pos++];
+        }
+
+        jint U2() throw(AgentException) {
+            Require(2);
+            jint value = ReadUnsignedShort(m_data, m_pos);
+            m_pos += 2;
+            return value;
+        }
+
+        jint U4() throw(AgentException) {
+            Require(4);
+            jint value = ReadInt(m_data, m_pos);
+            m_pos += 4;
+            return value;
+        }
+
+        void Skip(jint count) throw(AgentException) {
+            Require(count);
+            m_pos += count;
+        }
+
+        static void Put1(ByteBuffer& out, jint value) throw(AgentException) {
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        static void Put2(ByteBuffer& out, jint value) throw(AgentException) {
+            out.push_back(static_cast<unsigned char>(value >> 8));
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        static void Put4(ByteBuffer& out, jint value) throw(AgentException) {
+            Put2(out, value >> 16);
+            Put2(out, value);
+        }
+
+        static void PutUtf8(ByteBuffer& out, const char* str)
+            throw(AgentException)
+        {
+            jint length = static_cast<jint>(strlen(str));
+            Put1(out, CONSTANT_UTF8);
+            Put2(out, length);
+            out.insert(out.end(), str, str + length);
+        }
+
+        void Copy(ByteBuffer& out, jint from, jint to) throw(AgentException) {
+            out.insert(out.end(), m_data + from, m_data + to);
+        }
+
+        bool IsUtf8(jint index, const char* str) const throw();
+
+        void AddMethodOffsets(jint nameIndex, jint descriptorIndex)
+            throw(AgentException);
+
+        void SkipAttributes() throw(AgentException);
+
+        bool RewriteCode(jint start, jint end, ByteBuffer& out)
+            throw(AgentException);
+
+        static jint MapOffset(const OffsetList& offsets, jint pc) throw() {
+            if (pc < 0 || pc >= static_cast<jint>(offsets.size())) {
+                return -1;
+            }
+            return offsets[pc];
+        }
+
+        static bool RewriteInstructions(const unsigned char* code,
+            jint codeLength, const OffsetList& offsets, jint entryRef,
+            jint exitRef, ByteBuffer& out) throw(AgentException);
+
+        static bool RewriteStackMapTable(const unsigned char* data,
+            jint length, const OffsetList& offsets, ByteBuffer& out)
+            throw(AgentException);
+
+        static bool CopyVerificationTypes(const unsigned char* data,
+            jint length, jint& pos, jint count, const OffsetList& offsets,
+            ByteBuffer& out) throw(AgentException);
+
+        const unsigned char* m_data;
+        jint m_length;
+        jint m_pos;
+        OffsetList m_constants;
+        OffsetList m_offsets;
+        jint m_entryRef;
+        jint m_exitRef;
+        bool m_isChanged;
+        MethodTraceInjector::MethodOffsetsList* m_methods;
+
+    };
+
+}
+
+bool ClassFileRewriter::IsUtf8(jint index, const char* str) const throw()
+{
+    if (index <= 0 || index >= static_cast<jint>(m_constants.size())) {
+        return false;
+    }
+    jint pos = m_constants[index];
+    if (pos == 0 || m_data[pos] != CONSTANT_UTF8) {
+        return false;
+    }
+    jint length = ReadUnsignedShort(m_data, pos + 1);
+    return (static_cast<size_t>(length) == strlen(str) &&
+        memcmp(m_data + pos + 3, str, length) == 0);
+}
+
+void ClassFileRewriter::AddMethodOffsets(jint nameIndex,
+        jint descriptorIndex)
+    throw(AgentException)
+{
+    if (m_methods == 0) {
+        return;
+    }
+    if (nameIndex <= 0 || nameIndex >= static_cast<jint>(m_constants.size()) ||
+        descriptorIndex <= 0 ||
+        descriptorIndex >= static_cast<jint>(m_constants.size()))
+    {
+        throw AgentException(JDWP_ERROR_INVALID_CLASS_FORMAT);
+    }
+    jint namePos = m_constants[nameIndex];
+    jint descriptorPos = m_constants[descriptorIndex];
+    if (namePos == 0 || m_data[namePos] != CONSTANT_UTF8 ||
+        descriptorPos == 0 || m_data[descriptorPos] != CONSTANT_UTF8)
+    {
+        throw AgentException(JDWP_ERROR_INVALID_CLASS_FORMAT);
+    }
+
+    // lengths of UTF8 entries are checked when the constant pool is read
+    jint nameLength = ReadUnsignedShort(m_data, namePos + 1);
+    jint descriptorLength = ReadUnsignedShort(m_data, descriptorPos + 1);
+    char* name = reinterpret_cast<char*>(AgentBase::GetMemoryManager()
+        .Allocate(nameLength + descriptorLength + 1 JDWP_FILE_LINE));
+    AgentAutoFree afName(name JDWP_FILE_LINE);
+    memcpy(name, m_data + namePos + 3, nameLength);
+    memcpy(name + nameLength, m_data + descriptorPos + 3, descriptorLength);
+    name[nameLength + descriptorLength] = '\0';
+
+    MethodTraceInjector::MethodOffsets method;
+    method.method = 0;
+    method.name = name;
+    method.offsets.swap(m_offsets);
+    m_methods->push_back(method);
+    afName.Release();
+}
+
+void ClassFileRewriter::SkipAttributes() throw(AgentException)
+{
+    jint count = U2();
+    for (jint i = 0; i < count; i++) {
+        Skip(2);
+        Skip(U4());
+    }
+}
+
+bool ClassFileRewriter::Rewrite(ByteBuffer& out) throw(AgentException)
+{
+    if (static_cast<unsigned int>(U4()) != 0xCAFEBABE) {
+        throw AgentException(JDWP_ERROR_INVALID_CLASS_FORMAT);
+    }
+    Skip(4);
+    jint constantCount = U2();
+    if (constantCount + NEW_ENTRY_COUNT > 0xFFFF) {
+        return false;
+    }
+
+    // remember offsets of constant pool entries
+    m_constants.assign(constantCount, 0);
+    for (jint i = 1; i < constantCount; i++) {
+        m_constants[i] = m_pos;
+        jint tag = U1();
+        switch (tag) {
+        case CONSTANT_UTF8:
+            Skip(U2());
+            break;
+        case 3:  // Integer
+        case 4:  // Float
+        case 9:  // Fieldref
+        case 10: // Methodref
+        case 11: // InterfaceMethodref
+        case 12: // NameAndType
+        case 17: // Dynamic
+        case 18: // InvokeDynamic
+            Skip(4);
+            break;
+        case 5:  // Long
+        case 6:  // Double
+            Skip(8);
+            i++;
+            break;
+        case 7:  // Class
+        case 8:  // String
+        case 16: // MethodType
+        case 19: // Module
+        case 20: // Package
+            Skip(2);
+            break;
+        case 15: // MethodHandle
+            Skip(3);
+            break;
+        default:
+            throw AgentException(JDWP_ERROR_INVALID_CLASS_FORMAT);
+        }
+    }
+
+    // append references to the helper class methods to the constant pool
+    jint base = constantCount;
+    m_entryRef = base + 7;
+    m_exitRef = base + 8;
+
+    out.reserve(m_length + m_length / 8 + 128);
+    Copy(out, 0, 8);
+    Put2(out, constantCount + NEW_ENTRY_COUNT);
+    Copy(out, 10, m_pos);
+    PutUtf8(out, MethodTraceInjector::TRACE_CLASS_NAME);
+    Put1(out, CONSTANT_CLASS);
+    Put2(out, base);
+    PutUtf8(out, "entry");
+    PutUtf8(out, "exit");
+    PutUtf8(out, "()V");
+    Put1(out, CONSTANT_NAME_AND_TYPE);
+    Put2(out, base + 2);
+    Put2(out, base + 4);
+    Put1(out, CONSTANT_NAME_AND_TYPE);
+    Put2(out, base + 3);
+    Put2(out, base + 4);
+    Put1(out, CONSTANT_METHODREF);
+    Put2(out, base + 1);
+    Put2(out, base + 5);
+    Put1(out, CONSTANT_METHODREF);
+    Put2(out, base + 1);
+    Put2(out, base + 6);
+
+    // copy class header, interfaces and fields
+    jint start = m_pos;
+    Skip(6);
+    Skip(U2() * 2);
+    jint fieldCount = U2();
+    for (jint i = 0; i < fieldCount; i++) {
+        Skip(6);
+        SkipAttributes();
+    }
+    Copy(out, start, m_pos);
+
+    jint methodCount = U2();
+    Put2(out, methodCount);
+    for (jint i = 0; i < methodCount; i++) {
+        start = m_pos;
+        jint access = U2();
+        jint nameIndex = U2();
+        jint descriptorIndex = U2();
+        jint attrCount = U2();
+        Copy(out, start, m_pos);
+        for (jint j = 0; j < attrCount; j++) {
+            start = m_pos;
+            jint name = U2();
+            jint length = U4();
+            Skip(length);
+            if (IsUtf8(name, "Code") &&
+                (access & (ACC_NATIVE | ACC_ABSTRACT)) == 0)
+            {
+                size_t attrStart = out.size();
+                Copy(out, start, start + 2);
+                Put4(out, 0);
+                if (RewriteCode(start + 6, m_pos, out)) {
+                    jint newLength = static_cast<jint>(out.size() - attrStart - 6);
+                    WriteInt(&out[0], static_cast<jint>(attrStart + 2), newLength);
+                    AddMethodOffsets(nameIndex, descriptorIndex);
+                    m_isChanged = true;
+                    continue;
+                }
+                out.resize(attrStart);
+            }
+            Copy(out, start, m_pos);
+        }
+    }
+
+    // copy class attributes
+    start = m_pos;
+    SkipAttributes();
+    Copy(out, start, m_pos);
+    return m_isChanged;
+}
+
+bool ClassFileRewriter::RewriteCode(jint start, jint end, ByteBuffer& out)
+    throw(AgentException)
+{
+    const unsigned char* data = m_data + start;
+    jint length = end - start;
+    if (length < 12) {
+        return false;
+    }
+    jint codeLength = ReadInt(data, 4);
+    if (codeLength <= 0 || codeLength > length - 12) {
+        return false;
+    }
+    const unsigned char* code = data + 8;
+
+    // compute new offsets of instructions; branches to a return instruction
+    // are redirected to the exit probe inserted before it
+    OffsetList& offsets = m_offsets;
+    offsets.assign(codeLength + 1, -1);
+    jint newPc = MethodTraceInjector::PROBE_LENGTH;
+    for (jint pc = 0; pc < codeLength; ) {
+        jint instrLength = GetInstructionLength(code, codeLength, pc);
+        if (instrLength == 0) {
+            return false;
+        }
+        jint opcode = code[pc];
+        offsets[pc] = newPc;
+        newPc += instrLength;
+        if (opcode >= OPCODE_IRETURN && opcode <= OPCODE_RETURN) {
+            newPc += MethodTraceInjector::PROBE_LENGTH;
+        } else if (opcode == OPCODE_TABLESWITCH ||
+                   opcode == OPCODE_LOOKUPSWITCH)
+        {
+            // switch padding depends on the new offset
+            newPc += (3 - (offsets[pc] & 3)) - (3 - (pc & 3));
+        }
+        pc += instrLength;
+    }
+    offsets[codeLength] = newPc;
+    if (newPc >= 0x10000) {
+        return false;
+    }
+
+    // max_stack and max_locals are not affected by the probes
+    Put2(out, ReadUnsignedShort(data, 0));
+    Put2(out, ReadUnsignedShort(data, 2));
+    Put4(out, newPc);
+    size_t codeStart = out.size();
+    if (!RewriteInstructions(code, codeLength, offsets, m_entryRef,
+            m_exitRef, out))
+    {
+        return false;
+    }
+    JDWP_ASSERT(static_cast<jint>(out.size() - codeStart) == newPc);
+
+    // exception table
+    jint pos = 8 + codeLength;
+    jint handlerCount = ReadUnsignedShort(data, pos);
+    pos += 2;
+    if (pos + handlerCount * 8 + 2 > length) {
+        return false;
+    }
+    Put2(out, handlerCount);
+    for (jint i = 0; i < handlerCount; i++, pos += 8) {
+        jint startPc = MapOffset(offsets, ReadUnsignedShort(data, pos));
+        jint endPc = MapOffset(offsets, ReadUnsignedShort(data, pos + 2));
+        jint handlerPc = MapOffset(offsets, ReadUnsignedShort(data, pos + 4));
+        if (startPc < 0 || endPc < 0 || handlerPc < 0) {
+            return false;
+        }
+        Put2(out, startPc);
+        Put2(out, endPc);
+        Put2(out, handlerPc);
+        Put2(out, ReadUnsignedShort(data, pos + 6));
+    }
+
+    // code attributes
+    jint attrCount = ReadUnsignedShort(data, pos);
+    pos += 2;
+    Put2(out, attrCount);
+    for (jint i = 0; i < attrCount; i++) {
+        if (pos + 6 > length) {
+            return false;
+        }
+        jint name = ReadUnsignedShort(data, pos);
+        jint attrLength = ReadInt(data, pos + 2);
+        if (attrLength < 0 || attrLength > length - pos - 6) {
+            return false;
+        }
+        const unsigned char* attr = data + pos + 6;
+        pos += 6 + attrLength;
+
+        size_t attrStart = out.size();
+        Put2(out, name);
+        Put4(out, attrLength);
+        if (IsUtf8(name, "LineNumberTable")) {
+            jint count = (attrLength >= 2) ? ReadUnsignedShort(attr, 0) : -1;
+            if (count < 0 || 2 + count * 4 != attrLength) {
+                return false;
+            }
+            Put2(out, count);
+            for (jint j = 0; j < count; j++) {
+                // the entry probe belongs to the first line
+                jint startPc = ReadUnsignedShort(attr, 2 + j * 4);
+                jint newStart = (startPc == 0) ? 0 : MapOffset(offsets, startPc);
+                if (newStart < 0) {
+                    return false;
+                }
+                Put2(out, newStart);
+                Put2(out, ReadUnsignedShort(attr, 4 + j * 4));
+            }
+        } else if (IsUtf8(name, "LocalVariableTable") ||
+                   IsUtf8(name, "LocalVariableTypeTable"))
+        {
+            jint count = (attrLength >= 2) ? ReadUnsignedShort(attr, 0) : -1;
+            if (count < 0 || 2 + count * 10 != attrLength) {
+                return false;
+            }
+            Put2(out, count);
+            for (jint j = 0; j < count; j++) {
+                const unsigned char* entry = attr + 2 + j * 10;
+                jint startPc = ReadUnsignedShort(entry, 0);
+                jint newStart = (startPc == 0) ? 0 : MapOffset(offsets, startPc);
+                jint newEnd = MapOffset(offsets,
+                    startPc + ReadUnsignedShort(entry, 2));
+                if (newStart < 0 || newEnd < newStart) {
+                    return false;
+                }
+                Put2(out, newStart);
+                Put2(out, newEnd - newStart);
+                out.insert(out.end(), entry + 4, entry + 10);
+            }
+        } else if (IsUtf8(name, "StackMapTable")) {
+            if (!RewriteStackMapTable(attr, attrLength, offsets, out)) {
+                return false;
+            }
+            jint newLength = static_cast<jint>(out.size() - attrStart - 6);
+            WriteInt(&out[0], static_cast<jint>(attrStart + 2), newLength);
+        } else {
+            // unknown attributes may refer to bytecode offsets
+            return false;
+        }
+    }
+    return (pos == length);
+}
+
+bool ClassFileRewriter::RewriteInstructions(const unsigned char* code,
+        jint codeLength, const OffsetList& offsets, jint entryRef,
+        jint exitRef, ByteBuffer& out)
+    throw(AgentException)
+{
+    size_t codeStart = out.size();
+    Put1(out, OPCODE_INVOKESTATIC);
+    Put2(out, entryRef);
+
+    for (jint pc = 0; pc < codeLength; ) {
+        jint opcode = code[pc];
+        jint instrLength = GetInstructionLength(code, codeLength, pc);
+        jint newPc = offsets[pc];
+
+        if (opcode >= OPCODE_IRETURN && opcode <= OPCODE_RETURN) {
+            Put1(out, OPCODE_INVOKESTATIC);
+            Put2(out, exitRef);
+            Put1(out, opcode);
+        } else if ((opcode >= OPCODE_IFEQ && opcode <= OPCODE_JSR) ||
+                   opcode == OPCODE_IFNULL || opcode == OPCODE_IFNONNULL)
+        {
+            jint target = MapOffset(offsets, pc + ReadShort(code, pc + 1));
+            jint offset = target - newPc;
+            if (target < 0 || offset < -0x8000 || offset > 0x7FFF) {
+                return false;
+            }
+            Put1(out, opcode);
+            Put2(out, offset);
+        } else if (opcode == OPCODE_GOTO_W || opcode == OPCODE_JSR_W) {
+            jint target = MapOffset(offsets, pc + ReadInt(code, pc + 1));
+            if (target < 0) {
+                return false;
+            }
+            Put1(out, opcode);
+            Put4(out, target - newPc);
+        } else if (opcode == OPCODE_TABLESWITCH ||
+                   opcode == OPCODE_LOOKUPSWITCH)
+        {
+            Put1(out, opcode);
+            while ((out.size() - codeStart) % 4 != 0) {
+                Put1(out, 0);
+            }
+            jint base = (pc + 4) & ~3;
+            jint target = MapOffset(offsets, pc + ReadInt(code, base));
+            if (target < 0) {
+                return false;
+            }
+            Put4(out, target - newPc);
+            jint count;
+            jint first;
+            jint step;
+            if (opcode == OPCODE_TABLESWITCH) {
+                // low and high values are followed by jump offsets
+                count = ReadInt(code, base + 8) - ReadInt(code, base + 4) + 1;
+                first = base + 12;
+                step = 4;
+                out.insert(out.end(), code + base + 4, code + base + 12);
+            } else {
+                // number of pairs is followed by match-offset pairs
+                count = ReadInt(code, base + 4);
+                first = base + 12;
+                step = 8;
+                out.insert(out.end(), code + base + 4, code + base + 8);
+            }
+            for (jint i = 0; i < count; i++) {
+                jint entry = first + i * step;
+                if (opcode == OPCODE_LOOKUPSWITCH) {
+                    out.insert(out.end(), code + entry - 4, code + entry);
+                }
+                target = MapOffset(offsets, pc + ReadInt(code, entry));
+                if (target < 0) {
+                    return false;
+                }
+                Put4(out, target - newPc);
+            }
+        } else {
+            out.insert(out.end(), code + pc, code + pc + instrLength);
+        }
+        pc += instrLength;
+    }
+    return true;
+}
+
+bool ClassFileRewriter::CopyVerificationTypes(const unsigned char* data,
+        jint length, jint& pos, jint count, const OffsetList& offsets,
+        ByteBuffer& out)
+    throw(AgentException)
+{
+    for (jint i = 0; i < count; i++) {
+        if (pos >= length) {
+            return false;
+        }
+        jint tag = data[pos++];
+        Put1(out, tag);
+        if (tag == 7 || tag == 8) {
+            if (pos + 2 > length) {
+                return false;
+            }
+            jint value = ReadUnsignedShort(data, pos);
+            pos += 2;
+            if (tag == 8) {
+                // Uninitialized(offset) refers to the new instruction
+                value = MapOffset(offsets, value);
+                if (value < 0) {
+                    return false;
+                }
+            }
+            Put2(out, value);
+        } else if (tag > 8) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ClassFileRewriter::RewriteStackMapTable(const unsigned char* data,
+        jint length, const OffsetList& offsets, ByteBuffer& out)
+    throw(AgentException)
+{
+    if (length < 2) {
+        return false;
+    }
+    jint count = ReadUnsignedShort(data, 0);
+    Put2(out, count);
+    jint pos = 2;
+    jint offset = -1;
+    jint newOffset = -1;
+    for (jint i = 0; i < count; i++) {
+        if (pos >= length) {
+            return false;
+        }
+        jint type = data[pos++];
+        jint delta;
+        if (type < 128) {
+            delta = type & 63;
+        } else if (type >= 247) {
+            if (pos + 2 > length) {
+                return false;
+            }
+            delta = ReadUnsignedShort(data, pos);
+            pos += 2;
+        } else {
+            return false;
+        }
+
+        offset += delta + 1;
+        jint mapped = MapOffset(offsets, offset);
+        if (mapped < 0 || mapped <= newOffset) {
+            return false;
+        }
+        jint newDelta = mapped - newOffset - 1;
+        newOffset = mapped;
+
+        if (type < 64 || type == 251) {
+            // same_frame or same_frame_extended
+            if (newDelta < 64) {
+                Put1(out, newDelta);
+            } else {
+                Put1(out, 251);
+                Put2(out, newDelta);
+            }
+        } else if (type < 128 || type == 247) {
+            // same_locals_1_stack_item_frame, possibly extended
+            if (newDelta < 64) {
+                Put1(out, 64 + newDelta);
+            } else {
+                Put1(out, 247);
+                Put2(out, newDelta);
+            }
+            if (!CopyVerificationTypes(data, length, pos, 1, offsets, out)) {
+                return false;
+            }
+        } else if (type < 251) {
+            // chop_frame
+            Put1(out, type);
+            Put2(out, newDelta);
+        } else if (type < 255) {
+            // append_frame
+            Put1(out, type);
+            Put2(out, newDelta);
+            if (!CopyVerificationTypes(data, length, pos, type - 251,
+                    offsets, out))
+            {
+                return false;
+            }
+        } else {
+            // full_frame
+            Put1(out, type);
+            Put2(out, newDelta);
+            for (jint k = 0; k < 2; k++) {
+                if (pos + 2 > length) {
+                    return false;
+                }
+                jint typeCount = ReadUnsignedShort(data, pos);
+                pos += 2;
+                Put2(out, typeCount);
+                if (!CopyVerificationTypes(data, length, pos, typeCount,
+                        offsets, out))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return (pos == length);
+}
+
+//-----------------------------------------------------------------------------
+// MethodTraceInjector
+//-----------------------------------------------------------------------------
+
+MethodTraceInjector::MethodTraceInjector() throw()
+    : m_monitor(0)
+    , m_batch(0)
+    , m_batchJni(0)
+    , m_traceClass(0)
+    , m_isEnabled(false)
+    , m_isHookEnabled(false)
+{}
+
+MethodTraceInjector::~MethodTraceInjector() throw()
+{}
+
+void MethodTraceInjector::Init(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Init(" << jni << ")");
+
+    m_monitor = new AgentMonitor("_jdwp_MethodTraceInjector_monitor");
+    m_isEnabled = false;
+    if (GetOptionParser().GetInject()) {
+        jvmtiError err;
+        jvmtiCapabilities caps;
+        memset(&caps, 0, sizeof(caps));
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetCapabilities(&caps));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        m_isEnabled = (caps.can_retransform_classes != 0);
+        if (!m_isEnabled) {
+            JDWP_INFO("Method entry/exit injection is not supported by VM");
+        }
+    }
+}
+
+void MethodTraceInjector::Clean(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Clean(" << jni << ")");
+
+    if (m_isHookEnabled) {
+        jvmtiError err;
+        JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+            JVMTI_DISABLE, JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, 0));
+        m_isHookEnabled = false;
+    }
+    if (m_monitor != 0) {
+        {
+            MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+            FreePatterns(m_patterns);
+            for (InstrumentedClassList::iterator i = m_instrumentedClasses.begin();
+                    i != m_instrumentedClasses.end(); i++)
+            {
+                GetMemoryManager().Free(i->signature JDWP_FILE_LINE);
+                if (i->cls != 0) {
+                    jni->DeleteWeakGlobalRef(i->cls);
+                }
+            }
+            m_instrumentedClasses.clear();
+        }
+        delete m_monitor;
+        m_monitor = 0;
+    }
+    if (m_traceClass != 0) {
+        jni->DeleteGlobalRef(m_traceClass);
+        m_traceClass = 0;
+    }
+    m_isEnabled = false;
+}
+
+void MethodTraceInjector::FreePatterns(PatternList& patterns) throw()
+{
+    for (PatternList::iterator i = patterns.begin(); i != patterns.end(); i++) {
+        GetMemoryManager().Free(const_cast<char*>(*i) JDWP_FILE_LINE);
+    }
+    patterns.clear();
+}
+
+void MethodTraceInjector::FreeCodeRemaps(CodeRemapList& remaps) throw()
+{
+    for (CodeRemapList::iterator i = remaps.begin(); i != remaps.end(); i++) {
+        GetMemoryManager().Free(i->signature JDWP_FILE_LINE);
+        for (MethodOffsetsList::iterator j = i->methods.begin();
+                j != i->methods.end(); j++)
+        {
+            if (j->name != 0) {
+                GetMemoryManager().Free(j->name JDWP_FILE_LINE);
+            }
+        }
+    }
+    remaps.clear();
+}
+
+bool MethodTraceInjector::MatchPatterns(const PatternList& patterns,
+        const char* signature) throw()
+{
+    for (PatternList::const_iterator i = patterns.begin(); i != patterns.end(); i++) {
+        if (RequestModifier::MatchPattern(signature, *i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MethodTraceInjector::IsTraceClass(const char* signature) throw()
+{
+    size_t length = strlen(TRACE_CLASS_NAME);
+    return (signature[0] == 'L' &&
+        strncmp(signature + 1, TRACE_CLASS_NAME, length) == 0 &&
+        strcmp(signature + 1 + length, ";") == 0);
+}
+
+void MethodTraceInjector::DefineTraceClass(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("DefineTraceClass(" << jni << ")");
+
+    // public final class with two public static native void methods
+    ByteBuffer data;
+    const jint nameLength = static_cast<jint>(strlen(TRACE_CLASS_NAME));
+    const unsigned char header[] = {
+        0xCA, 0xFE, 0xBA, 0xBE, 0x00, 0x00, 0x00, 0x31, 0x00, 0x08
+    };
+    data.insert(data.end(), header, header + sizeof(header));
+    data.push_back(CONSTANT_UTF8);                                 // #1
+    data.push_back(static_cast<unsigned char>(nameLength >> 8));
+    data.push_back(static_cast<unsigned char>(nameLength));
+    data.insert(data.end(), TRACE_CLASS_NAME, TRACE_CLASS_NAME + nameLength);
+    const unsigned char rest[] = {
+        CONSTANT_CLASS, 0x00, 0x01,                                 // #2
+        CONSTANT_UTF8, 0x00, 0x10,                                  // #3
+        'j', 'a', 'v', 'a', '/', 'l', 'a', 'n', 'g', '/',
+        'O', 'b', 'j', 'e', 'c', 't',
+        CONSTANT_CLASS, 0x00, 0x03,                                 // #4
+        CONSTANT_UTF8, 0x00, 0x05, 'e', 'n', 't', 'r', 'y',         // #5
+        CONSTANT_UTF8, 0x00, 0x04, 'e', 'x', 'i', 't',              // #6
+        CONSTANT_UTF8, 0x00, 0x03, '(', ')', 'V',                   // #7
+        0x00, 0x31, 0x00, 0x02, 0x00, 0x04,     // access, this, super
+        0x00, 0x00,                             // interfaces
+        0x00, 0x00,                             // fields
+        0x00, 0x02,                             // methods
+        0x01, 0x09, 0x00, 0x05, 0x00, 0x07, 0x00, 0x00,
+        0x01, 0x09, 0x00, 0x06, 0x00, 0x07, 0x00, 0x00,
+        0x00, 0x00                              // attributes
+    };
+    data.insert(data.end(), rest, rest + sizeof(rest));
+
+    jclass cls = jni->DefineClass(TRACE_CLASS_NAME, 0,
+        reinterpret_cast<const jbyte*>(&data[0]),
+        static_cast<jsize>(data.size()));
+    if (cls == 0) {
+        jni->ExceptionClear();
+        JDWP_INFO("Unable to define class " << TRACE_CLASS_NAME);
+        throw InternalErrorException();
+    }
+
+    JNINativeMethod methods[] = {
+        { const_cast<char*>("entry"), const_cast<char*>("()V"),
+            reinterpret_cast<void*>(&RequestManager::HandleInjectedMethodEntry) },
+        { const_cast<char*>("exit"), const_cast<char*>("()V"),
+            reinterpret_cast<void*>(&RequestManager::HandleInjectedMethodExit) }
+    };
+    if (jni->RegisterNatives(cls, methods, 2) != 0) {
+        jni->ExceptionClear();
+        JDWP_INFO("Unable to register natives of " << TRACE_CLASS_NAME);
+        throw InternalErrorException();
+    }
+
+    m_traceClass = static_cast<jclass>(jni->NewGlobalRef(cls));
+    if (m_traceClass == 0) {
+        throw OutOfMemoryException();
+    }
+}
+
+void MethodTraceInjector::ControlHook(bool enable) throw(AgentException)
+{
+    if (enable == m_isHookEnabled) {
+        return;
+    }
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+        (enable) ? JVMTI_ENABLE : JVMTI_DISABLE,
+        JVMTI_EVENT_CLASS_FILE_LOAD_HOOK, 0));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+    m_isHookEnabled = enable;
+}
+
+void MethodTraceInjector::DisableUnusedHook() throw(AgentException)
+{
+    bool isUsed;
+    {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        isUsed = !m_patterns.empty() || !m_instrumentedClasses.empty();
+    }
+    if (!isUsed) {
+        ControlHook(false);
+    }
+}
+
+void MethodTraceInjector::SetPatterns(JNIEnv* jni,
+        const PatternList& patterns)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("SetPatterns(" << jni << ',' << patterns.size() << ")");
+    JDWP_ASSERT(m_isEnabled);
+
+    if (m_traceClass == 0 && !patterns.empty()) {
+        DefineTraceClass(jni);
+    }
+
+    PatternList oldPatterns;
+    bool isSwapped = false;
+    try {
+        for (PatternList::const_iterator i = patterns.begin(); i != patterns.end(); i++) {
+            size_t length = strlen(*i);
+            char* pattern = reinterpret_cast<char*>
+                (GetMemoryManager().Allocate(length + 1 JDWP_FILE_LINE));
+            memcpy(pattern, *i, length + 1);
+            oldPatterns.push_back(pattern);
+        }
+        {
+            MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+            oldPatterns.swap(m_patterns);
+            isSwapped = true;
+        }
+
+        // classes loaded later are instrumented by ClassFileLoadHook
+        if (!m_patterns.empty()) {
+            ControlHook(true);
+        }
+        RetransformLoadedClasses(jni);
+    } catch (AgentException& e) {
+        if (isSwapped) {
+            // loaded classes are not retransformed for the new patterns
+            MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+            oldPatterns.swap(m_patterns);
+        }
+        FreePatterns(oldPatterns);
+        throw e;
+    }
+    FreePatterns(oldPatterns);
+    DisableUnusedHook();
+}
+
+bool MethodTraceInjector::NeedsRetransform(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    // the helper class is never instrumented
+    if (IsTraceClass(signature)) {
+        return false;
+    }
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    bool isInstrumented = (FindInstrumentedClass(jni, cls, signature) != -1);
+    return (MatchPatterns(m_patterns, signature) != isInstrumented);
+}
+
+void MethodTraceInjector::UpdateClass(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("UpdateClass(" << jni << ',' << cls << ','
+        << JDWP_CHECK_NULL(signature) << ")");
+
+    if (!NeedsRetransform(jni, cls, signature)) {
+        return;
+    }
+    jvmtiError err;
+    jboolean isModifiable = JNI_FALSE;
+    JVMTI_TRACE(err, GetJvmtiEnv()->IsModifiableClass(cls, &isModifiable));
+    if (err != JVMTI_ERROR_NONE || isModifiable != JNI_TRUE) {
+        return;
+    }
+
+    // the class was loaded while the patterns were changed
+    CodeRemapList batch;
+    try {
+        AddToBatch(batch, cls, signature,
+            IsClassInstrumented(jni, cls, signature));
+        Retransform(jni, batch);
+    } catch (AgentException& e) {
+        FreeCodeRemaps(batch);
+        throw e;
+    }
+    FreeCodeRemaps(batch);
+    DisableUnusedHook();
+}
+
+void MethodTraceInjector::RetransformLoadedClasses(JNIEnv* jni)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("RetransformLoadedClasses(" << jni << ")");
+
+    PruneInstrumentedClasses(jni);
+
+    jvmtiEnv* jvmti = GetJvmtiEnv();
+    jvmtiError err;
+    jint classCount = 0;
+    jclass* classes = 0;
+    JVMTI_TRACE(err, jvmti->GetLoadedClasses(&classCount, &classes));
+    JvmtiAutoFree afClasses(classes);
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    // only classes added to the batch keep their local references
+    CodeRemapList batch;
+    try {
+        for (jint i = 0; i < classCount; i++) {
+            jclass cls = classes[i];
+            classes[i] = 0;
+            jboolean isModifiable = JNI_FALSE;
+            char* signature = 0;
+            JVMTI_TRACE(err, jvmti->IsModifiableClass(cls, &isModifiable));
+            if (err == JVMTI_ERROR_NONE && isModifiable == JNI_TRUE) {
+                JVMTI_TRACE(err, jvmti->GetClassSignature(cls, &signature, 0));
+            }
+            JvmtiAutoFree afSignature(signature);
+            if (err == JVMTI_ERROR_NONE && isModifiable == JNI_TRUE &&
+                NeedsRetransform(jni, cls, signature))
+            {
+                AddToBatch(batch, cls, signature,
+                    IsClassInstrumented(jni, cls, signature));
+                continue;
+            }
+            jni->DeleteLocalRef(cls);
+        }
+        Retransform(jni, batch);
+    } catch (AgentException& e) {
+        for (jint i = 0; i < classCount; i++) {
+            if (classes[i] != 0) {
+                jni->DeleteLocalRef(classes[i]);
+            }
+        }
+        for (CodeRemapList::iterator i = batch.begin(); i != batch.end(); i++) {
+            jni->DeleteLocalRef(i->cls);
+        }
+        FreeCodeRemaps(batch);
+        throw e;
+    }
+    for (CodeRemapList::iterator i = batch.begin(); i != batch.end(); i++) {
+        jni->DeleteLocalRef(i->cls);
+    }
+    FreeCodeRemaps(batch);
+}
+
+void MethodTraceInjector::AddToBatch(CodeRemapList& batch, jclass cls,
+        const char* signature, bool wasInstrumented)
+    throw(AgentException)
+{
+    size_t length = strlen(signature);
+    char* copy = reinterpret_cast<char*>
+        (GetMemoryManager().Allocate(length + 1 JDWP_FILE_LINE));
+    AgentAutoFree afCopy(copy JDWP_FILE_LINE);
+    memcpy(copy, signature, length + 1);
+
+    CodeRemap remap;
+    remap.cls = cls;
+    remap.signature = copy;
+    remap.wasInstrumented = wasInstrumented;
+    remap.isInstrumented = wasInstrumented;
+    batch.push_back(remap);
+    afCopy.Release();
+}
+
+void MethodTraceInjector::Retransform(JNIEnv* jni, CodeRemapList& batch)
+    throw(AgentException)
+{
+    if (batch.empty()) {
+        return;
+    }
+    JDWP_TRACE_PROG("Retransform: retransform " << batch.size()
+        << " classes");
+
+    // the hook collects offsets of the instrumented code, even if the
+    // injected calls are removed
+    ControlHook(true);
+
+    vector<jclass, AgentAllocator<jclass> > classes;
+    for (CodeRemapList::const_iterator i = batch.begin(); i != batch.end(); i++) {
+        classes.push_back(i->cls);
+    }
+    {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        m_batch = &batch;
+        m_batchJni = jni;
+    }
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->RetransformClasses(
+        static_cast<jint>(classes.size()), &classes[0]));
+    {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        m_batch = 0;
+        m_batchJni = 0;
+    }
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    for (CodeRemapList::iterator i = batch.begin(); i != batch.end(); i++) {
+        if (i->isInstrumented == i->wasInstrumented) {
+            continue;
+        }
+        SetClassInstrumented(jni, i->cls, i->signature, i->isInstrumented);
+        if (i->methods.empty()) {
+            // none of the methods is rewritten, so the code is the same
+            continue;
+        }
+        ResolveMethods(*i);
+
+        // cached line tables and replies refer to the previous code
+        GetClassManager().InvalidateLineTables(i->cls);
+        GetClassManager().GetReplyCache().Invalidate(jni, i->cls);
+        GetRequestManager().RemapLocations(jni, *i);
+    }
+}
+
+void MethodTraceInjector::ResolveMethods(CodeRemap& remap)
+    throw(AgentException)
+{
+    jvmtiEnv* jvmti = GetJvmtiEnv();
+    jvmtiError err;
+    jint methodCount = 0;
+    jmethodID* methods = 0;
+    JVMTI_TRACE(err, jvmti->GetClassMethods(remap.cls, &methodCount, &methods));
+    JvmtiAutoFree afMethods(methods);
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    for (jint i = 0; i < methodCount; i++) {
+        char* name = 0;
+        char* signature = 0;
+        JVMTI_TRACE(err, jvmti->GetMethodName(methods[i], &name, &signature, 0));
+        JvmtiAutoFree afName(name);
+        JvmtiAutoFree afSignature(signature);
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+
+        size_t nameLength = strlen(name);
+        MethodOffsetsList::iterator j = remap.methods.begin();
+        for (; j != remap.methods.end(); j++) {
+            if (j->method == 0 && strncmp(j->name, name, nameLength) == 0 &&
+                strcmp(j->name + nameLength, signature) == 0)
+            {
+                break;
+            }
+        }
+        if (j != remap.methods.end()) {
+            j->method = methods[i];
+        } else {
+            // the code of the method is not changed
+            MethodOffsets method;
+            method.method = methods[i];
+            method.name = 0;
+            remap.methods.push_back(method);
+        }
+    }
+}
+
+bool MethodTraceInjector::MapLocation(const CodeRemap& remap,
+        jmethodID method, jlocation& location)
+    throw()
+{
+    for (MethodOffsetsList::const_iterator i = remap.methods.begin();
+            i != remap.methods.end(); i++)
+    {
+        if (i->method != method) {
+            continue;
+        }
+        // the last offset is the new code length
+        const OffsetList& offsets = i->offsets;
+        jint codeLength = static_cast<jint>(offsets.size()) - 1;
+        if (codeLength <= 0 || location < 0) {
+            return true;
+        }
+        if (remap.isInstrumented) {
+            // the entry probe belongs to the first instruction
+            if (location > 0 && location < codeLength &&
+                offsets[static_cast<jint>(location)] >= 0)
+            {
+                location = offsets[static_cast<jint>(location)];
+            }
+        } else {
+            // a probe belongs to the instruction following it
+            jint pc = 0;
+            for (jint j = 0; j < codeLength && offsets[j] <= location; j++) {
+                if (offsets[j] >= 0) {
+                    pc = j;
+                }
+            }
+            location = pc;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool MethodTraceInjector::HasMethod(const CodeRemap& remap,
+        jmethodID method)
+    throw()
+{
+    for (MethodOffsetsList::const_iterator i = remap.methods.begin();
+            i != remap.methods.end(); i++)
+    {
+        if (i->method == method) {
+            return true;
+        }
+    }
+    return false;
+}
+
+jint MethodTraceInjector::FindInstrumentedClass(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    jint unbound = -1;
+    for (size_t i = 0; i < m_instrumentedClasses.size(); i++) {
+        const InstrumentedClass& entry = m_instrumentedClasses[i];
+        if (strcmp(entry.signature, signature) != 0) {
+            continue;
+        }
+        if (entry.cls == 0) {
+            if (unbound == -1) {
+                unbound = static_cast<jint>(i);
+            }
+        } else if (JNI_TRUE == jni->IsSameObject(entry.cls, cls)) {
+            return static_cast<jint>(i);
+        }
+    }
+    if (unbound != -1) {
+        jweak ref = jni->NewWeakGlobalRef(cls);
+        if (ref == 0) {
+            throw OutOfMemoryException();
+        }
+        m_instrumentedClasses[unbound].cls = ref;
+    }
+    return unbound;
+}
+
+bool MethodTraceInjector::IsClassInstrumented(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    return (FindInstrumentedClass(jni, cls, signature) != -1);
+}
+
+void MethodTraceInjector::SetClassInstrumented(JNIEnv* jni, jclass cls,
+        const char* signature, bool isInstrumented)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    jint index = (cls != 0) ? FindInstrumentedClass(jni, cls, signature) : -1;
+    if (isInstrumented && index == -1) {
+        size_t length = strlen(signature);
+        char* copy = reinterpret_cast<char*>
+            (GetMemoryManager().Allocate(length + 1 JDWP_FILE_LINE));
+        AgentAutoFree afCopy(copy JDWP_FILE_LINE);
+        memcpy(copy, signature, length + 1);
+
+        InstrumentedClass entry;
+        entry.signature = copy;
+        entry.cls = 0;
+        m_instrumentedClasses.push_back(entry);
+        afCopy.Release();
+        if (cls != 0) {
+            // the entry stays unbound if there is no memory for the reference
+            m_instrumentedClasses.back().cls = jni->NewWeakGlobalRef(cls);
+        }
+    } else if (!isInstrumented && index != -1) {
+        InstrumentedClass& entry = m_instrumentedClasses[index];
+        GetMemoryManager().Free(entry.signature JDWP_FILE_LINE);
+        jni->DeleteWeakGlobalRef(entry.cls);
+        m_instrumentedClasses.erase(m_instrumentedClasses.begin() + index);
+    }
+}
+
+void MethodTraceInjector::PruneInstrumentedClasses(JNIEnv* jni) throw()
+{
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    InstrumentedClassList::iterator kept = m_instrumentedClasses.begin();
+    for (InstrumentedClassList::iterator i = m_instrumentedClasses.begin();
+            i != m_instrumentedClasses.end(); i++)
+    {
+        if (i->cls != 0 && JNI_TRUE == jni->IsSameObject(i->cls, 0)) {
+            // the class is unloaded
+            GetMemoryManager().Free(i->signature JDWP_FILE_LINE);
+            jni->DeleteWeakGlobalRef(i->cls);
+        } else {
+            *kept++ = *i;
+        }
+    }
+    m_instrumentedClasses.erase(kept, m_instrumentedClasses.end());
+}
+
+void MethodTraceInjector::TransformClass(jvmtiEnv* jvmti, JNIEnv* jni,
+        jclass classBeingRedefined, const char* name, jint classDataLength,
+        const unsigned char* classData, jint* newClassDataLength,
+        unsigned char** newClassData)
+    throw(AgentException)
+{
+    size_t length = strlen(name);
+    char* signature = reinterpret_cast<char*>
+        (GetMemoryManager().Allocate(length + 3 JDWP_FILE_LINE));
+    AgentAutoFree afSignature(signature JDWP_FILE_LINE);
+    signature[0] = 'L';
+    memcpy(signature + 1, name, length);
+    signature[length + 1] = ';';
+    signature[length + 2] = '\0';
+
+    // a class retransformed by this injector is looked up in the batch
+    // of the calling thread
+    CodeRemap* remap = 0;
+    bool isMatched;
+    {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        isMatched = MatchPatterns(m_patterns, signature);
+        if (classBeingRedefined != 0 && m_batch != 0 && m_batchJni == jni) {
+            for (CodeRemapList::iterator i = m_batch->begin();
+                    i != m_batch->end(); i++)
+            {
+                if (JNI_TRUE == jni->IsSameObject(i->cls, classBeingRedefined)) {
+                    remap = &*i;
+                    break;
+                }
+            }
+        }
+    }
+
+    // a matching class counts as instrumented even if none of its
+    // methods can be rewritten, so that it is not retransformed again
+    if (remap != 0) {
+        // the list is updated when the whole batch is retransformed
+        remap->isInstrumented = isMatched;
+    } else if (isMatched) {
+        SetClassInstrumented(jni, classBeingRedefined, signature, true);
+    } else {
+        if (classBeingRedefined != 0) {
+            SetClassInstrumented(jni, classBeingRedefined, signature, false);
+        }
+        return;
+    }
+
+    // offsets are collected for a retransformed class even if the injected
+    // calls are removed, they map the previous code then
+    ByteBuffer buffer;
+    ClassFileRewriter rewriter(classData, classDataLength,
+        (remap != 0) ? &remap->methods : 0);
+    if (!rewriter.Rewrite(buffer) || !isMatched) {
+        return;
+    }
+
+    jvmtiError err;
+    unsigned char* data = 0;
+    JVMTI_TRACE(err, jvmti->Allocate(static_cast<jlong>(buffer.size()),
+        &data));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+    memcpy(data, &buffer[0], buffer.size());
+    *newClassData = data;
+    *newClassDataLength = static_cast<jint>(buffer.size());
+    JDWP_TRACE_PROG("TransformClass: instrumented class " << name);
+}
+
+void JNICALL MethodTraceInjector::HandleClassFileLoadHook(jvmtiEnv* jvmti,
+        JNIEnv* jni, jclass classBeingRedefined, jobject loader,
+        const char* name, jobject protectionDomain, jint classDataLength,
+        const unsigned char* classData, jint* newClassDataLength,
+        unsigned char** newClassData)
+{
+    JDWP_TRACE_ENTRY("HandleClassFileLoadHook(" << jvmti << ',' << jni
+        << ',' << classBeingRedefined << ',' << JDWP_CHECK_NULL(name) << ')');
+
+    if (name == 0 || strcmp(name, TRACE_CLASS_NAME) == 0) {
+        return;
+    }
+
+    try {
+        GetRequestManager().GetMethodTraceInjector().TransformClass(jvmti,
+            jni, classBeingRedefined, name, classDataLength, classData,
+            newClassDataLength, newClassData);
+    } catch (AgentException& e) {
+        // the class is left unchanged
+        JDWP_INFO("JDWP error in CLASS_FILE_LOAD_HOOK: " << e.what() << " ["
+            << e.ErrCode() << "] class=" << JDWP_CHECK_NULL(name));
+    }
+}
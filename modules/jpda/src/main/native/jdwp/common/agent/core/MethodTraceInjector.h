@@ -0,0 +1,354 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * MethodTraceInjector.h
+ *
+ * Reports method entry and exit by calls injected into the bytecode of
+ * selected classes instead of enabling JVMTI MethodEntry/MethodExit events,
+ * which switch the whole VM to interpreted execution.
+ */
+
+#ifndef _METHOD_TRACE_INJECTOR_H_
+#define _METHOD_TRACE_INJECTOR_H_
+
+#include <vector>
+
+#include "AgentBase.h"
+#include "AgentMonitor.h"
+#include "AgentAllocator.h"
+
+namespace jdwp {
+
+    /**
+     * The class instruments classes matching a set of class patterns, so
+     * that each method of such a class calls native methods of the helper
+     * class <code>TRACE_CLASS_NAME</code> on entry and before each normal
+     * return. The natives are <code>RequestManager::HandleInjectedMethodEntry</code>
+     * and <code>RequestManager::HandleInjectedMethodExit</code>.
+     *
+     * Classes are instrumented by the <code>ClassFileLoadHook</code> event
+     * when they are loaded. Loaded classes which get or lose the injected
+     * calls when the patterns are changed are retransformed, and bytecode
+     * indices known to the agent are moved to the new code by
+     * <code>RequestManager::RemapLocations</code>. Methods which cannot be
+     * safely rewritten are left unchanged.
+     */
+    class MethodTraceInjector : public AgentBase {
+
+    public:
+
+        /** Type for list of class patterns. */
+        typedef vector<const char*, AgentAllocator<const char*> > PatternList;
+
+        /** Type for list of bytecode offsets. */
+        typedef vector<jint, AgentAllocator<jint> > OffsetList;
+
+        /**
+         * New offsets of the instructions of a method in its instrumented
+         * code, indexed by offsets in the original code.
+         */
+        struct MethodOffsets {
+            jmethodID method;
+            char* name;   // method name followed by its descriptor
+            OffsetList offsets;
+        };
+
+        /** Type for list of method offsets. */
+        typedef vector<MethodOffsets, AgentAllocator<MethodOffsets> >
+            MethodOffsetsList;
+
+        /**
+         * Describes a class retransformed to add or remove injected calls.
+         * Methods which are not rewritten have empty offset lists.
+         */
+        struct CodeRemap {
+            jclass cls;
+            char* signature;
+            bool wasInstrumented;
+            bool isInstrumented;
+            MethodOffsetsList methods;
+        };
+
+        /** Type for list of retransformed classes. */
+        typedef vector<CodeRemap, AgentAllocator<CodeRemap> > CodeRemapList;
+
+        /** Internal name of the helper class defined by the agent. */
+        static const char* const TRACE_CLASS_NAME;
+
+        /** Length of the injected <code>invokestatic</code> instruction. */
+        static const jint PROBE_LENGTH = 3;
+
+        /**
+         * A constructor.
+         */
+        MethodTraceInjector() throw();
+
+        /**
+         * A destructor.
+         */
+        ~MethodTraceInjector() throw();
+
+        /**
+         * Initializes the injector. The injection is enabled only if the
+         * <code>inject</code> agent option is set.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Init(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Cleans the injector.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Clean(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Checks whether method entry/exit events can be reported by the
+         * injected code.
+         */
+        bool IsEnabled() const throw() {
+            return m_isEnabled;
+        }
+
+        /**
+         * Checks whether <code>ClassFileLoadHook</code> events are enabled,
+         * that is there are patterns or instrumented classes.
+         */
+        bool IsHookEnabled() const throw() {
+            return m_isHookEnabled;
+        }
+
+        /**
+         * Replaces the set of patterns of the instrumented classes and
+         * retransforms loaded classes which match the new patterns but are
+         * not instrumented, or are instrumented but do not match them.
+         * Should be called with the request monitor held.
+         *
+         * @param jni      - the JNI interface pointer
+         * @param patterns - the class patterns in the form used by
+         *                   <code>ClassMatchModifier</code>
+         *
+         * @throws AgentException if the classes cannot be retransformed,
+         *         the old patterns are kept then.
+         */
+        void SetPatterns(JNIEnv* jni, const PatternList& patterns)
+            throw(AgentException);
+
+        /**
+         * Checks whether the given class, which has just been prepared, was
+         * loaded while the patterns were changed and is instrumented for
+         * the previous patterns.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param cls       - the prepared class
+         * @param signature - the class signature
+         */
+        bool NeedsRetransform(JNIEnv* jni, jclass cls, const char* signature)
+            throw(AgentException);
+
+        /**
+         * Retransforms the given prepared class if it is instrumented for
+         * the previous patterns. Should be called with the request monitor
+         * held.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param cls       - the prepared class
+         * @param signature - the class signature
+         */
+        void UpdateClass(JNIEnv* jni, jclass cls, const char* signature)
+            throw(AgentException);
+
+        /**
+         * Maps a bytecode index of a method of the retransformed class to
+         * the new code.
+         *
+         * @param remap    - the retransformed class
+         * @param method   - the method
+         * @param location - the index in the previous code, replaced by the
+         *                   index in the new code
+         *
+         * @return <code>false</code> if the method does not belong to the
+         *         class.
+         */
+        static bool MapLocation(const CodeRemap& remap, jmethodID method,
+            jlocation& location) throw();
+
+        /**
+         * Checks whether the method belongs to the retransformed class.
+         */
+        static bool HasMethod(const CodeRemap& remap, jmethodID method)
+            throw();
+
+        /**
+         * <code>ClassFileLoadHook</code> event callback.
+         *
+         * @param jvmti               - the JVMTI interface pointer
+         * @param jni                 - the JNI interface pointer
+         * @param classBeingRedefined - the class being redefined or 0
+         * @param loader              - the class loader
+         * @param name                - the internal name of the class
+         * @param protectionDomain    - the protection domain of the class
+         * @param classDataLength     - the length of the class file
+         * @param classData           - the class file bytes
+         * @param newClassDataLength  - the length of the new class file
+         * @param newClassData        - the new class file bytes
+         */
+        static void JNICALL HandleClassFileLoadHook(jvmtiEnv* jvmti,
+            JNIEnv* jni, jclass classBeingRedefined, jobject loader,
+            const char* name, jobject protectionDomain, jint classDataLength,
+            const unsigned char* classData, jint* newClassDataLength,
+            unsigned char** newClassData);
+
+    private:
+
+        /**
+         * Class transformed while matching the patterns, even if none of
+         * its methods could be rewritten. The reference is 0 until the
+         * class is found by its signature after the load.
+         */
+        struct InstrumentedClass {
+            char* signature;
+            jweak cls;
+        };
+
+        /** Type for list of instrumented classes. */
+        typedef vector<InstrumentedClass, AgentAllocator<InstrumentedClass> >
+            InstrumentedClassList;
+
+        /**
+         * Checks whether the class with given signature matches any of
+         * the given patterns.
+         */
+        static bool MatchPatterns(const PatternList& patterns,
+            const char* signature) throw();
+
+        /**
+         * Checks whether the signature is of the helper class.
+         */
+        static bool IsTraceClass(const char* signature) throw();
+
+        /**
+         * Defines the helper class and binds its native methods.
+         */
+        void DefineTraceClass(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Enables or disables <code>ClassFileLoadHook</code> events.
+         */
+        void ControlHook(bool enable) throw(AgentException);
+
+        /**
+         * Disables <code>ClassFileLoadHook</code> events if there are no
+         * patterns and no instrumented classes.
+         */
+        void DisableUnusedHook() throw(AgentException);
+
+        /**
+         * Rewrites the class file for the <code>ClassFileLoadHook</code>
+         * event and records whether the class is instrumented.
+         */
+        void TransformClass(jvmtiEnv* jvmti, JNIEnv* jni,
+            jclass classBeingRedefined, const char* name, jint classDataLength,
+            const unsigned char* classData, jint* newClassDataLength,
+            unsigned char** newClassData) throw(AgentException);
+
+        /**
+         * Retransforms all loaded classes whose injected calls do not
+         * correspond to the current patterns.
+         */
+        void RetransformLoadedClasses(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Retransforms the given classes and passes the changed ones to
+         * <code>RequestManager::RemapLocations</code>.
+         */
+        void Retransform(JNIEnv* jni, CodeRemapList& batch)
+            throw(AgentException);
+
+        /**
+         * Resolves methods of the retransformed class, so that all of them
+         * are listed in the remap.
+         */
+        void ResolveMethods(CodeRemap& remap) throw(AgentException);
+
+        /**
+         * Adds the class to the retransformation batch.
+         */
+        void AddToBatch(CodeRemapList& batch, jclass cls,
+            const char* signature, bool wasInstrumented)
+            throw(AgentException);
+
+        /**
+         * Finds the instrumented class in the list. A class instrumented
+         * when loaded is bound to the given reference on first lookup.
+         * Should be called with <code>m_monitor</code> held.
+         *
+         * @return index in the list or -1 if the class is not instrumented.
+         */
+        jint FindInstrumentedClass(JNIEnv* jni, jclass cls,
+            const char* signature) throw(AgentException);
+
+        /**
+         * Checks whether the given class is in the list of instrumented
+         * classes.
+         */
+        bool IsClassInstrumented(JNIEnv* jni, jclass cls,
+            const char* signature) throw(AgentException);
+
+        /**
+         * Adds the class to or removes it from the list of instrumented
+         * classes. The class reference may be 0 for a class being loaded.
+         */
+        void SetClassInstrumented(JNIEnv* jni, jclass cls,
+            const char* signature, bool isInstrumented) throw(AgentException);
+
+        /**
+         * Removes unloaded classes from the list of instrumented classes.
+         */
+        void PruneInstrumentedClasses(JNIEnv* jni) throw();
+
+        /**
+         * Frees the strings of the given list and clears it.
+         */
+        static void FreePatterns(PatternList& patterns) throw();
+
+        /**
+         * Frees the strings of the given list and clears it.
+         */
+        static void FreeCodeRemaps(CodeRemapList& remaps) throw();
+
+        // guards m_patterns, m_instrumentedClasses and m_batch, which are
+        // read by ClassFileLoadHook callbacks
+        AgentMonitor* m_monitor;
+        PatternList m_patterns;
+        InstrumentedClassList m_instrumentedClasses;
+        // classes being retransformed by the thread with m_batchJni
+        CodeRemapList* m_batch;
+        JNIEnv* m_batchJni;
+        jclass m_traceClass;
+        bool m_isEnabled;
+        bool m_isHookEnabled;
+
+    };
+
+}
+
+#endif // _METHOD_TRACE_INJECTOR_H_
@@ -48,6 +48,9 @@ OptionParser::OptionParser() throw()
     m_kindFilter = 0;
     m_srcFilter = 0;
     m_onuncaught = false;
+    m_inject = false;
+    m_lazyCapabilities = false;
+    m_overflowPolicy = OVERFLOW_BLOCK;
     m_onthrow = 0;
     m_launch = 0;
 }
@@ -63,6 +66,20 @@ bool OptionParser::AsciiToBool(const char *str) throw(IllegalArgumentException)
     }
 }
 
+OverflowPolicy OptionParser::AsciiToOverflowPolicy(const char *str)
+    throw(IllegalArgumentException)
+{
+    if (strcmp("block", str) == 0) {
+        return OVERFLOW_BLOCK;
+    } else if (strcmp("drop", str) == 0) {
+        return OVERFLOW_DROP_OLDEST;
+    } else if (strcmp("coalesce", str) == 0) {
+        return OVERFLOW_COALESCE;
+    } else {
+        throw IllegalArgumentException();
+    }
+}
+
 void OptionParser::Parse(const char* str) throw(AgentException)
 {
     size_t i;
@@ -145,6 +162,12 @@ void OptionParser::Parse(const char* str) throw(AgentException)
             m_launch = m_options[k].value;
         } else if (strcmp("onuncaught", m_options[k].name) == 0) {
             m_onuncaught = AsciiToBool(m_options[k].value);
+        } else if (strcmp("inject", m_options[k].name) == 0) {
+            m_inject = AsciiToBool(m_options[k].value);
+        } else if (strcmp("lazycaps", m_options[k].name) == 0) {
+            m_lazyCapabilities = AsciiToBool(m_options[k].value);
+        } else if (strcmp("overflow", m_options[k].name) == 0) {
+            m_overflowPolicy = AsciiToOverflowPolicy(m_options[k].value);
         } else if (strcmp("onthrow", m_options[k].name) == 0) {
             m_onthrow = m_options[k].value;
         } else if (strcmp("help", m_options[k].name) == 0) {
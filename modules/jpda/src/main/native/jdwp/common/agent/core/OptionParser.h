@@ -35,6 +35,16 @@
 
 namespace jdwp {
 
+    /**
+     * Policies applied to non-suspending events posted when the event queue
+     * is full.
+     */
+    enum OverflowPolicy {
+        OVERFLOW_BLOCK,         // the posting thread waits for space
+        OVERFLOW_DROP_OLDEST,   // the oldest events are discarded
+        OVERFLOW_COALESCE       // queued events are merged into one packet
+    };
+
     /**
      * The class provides certain means for parsing and manipulating agent options
      * that are passed to the command line of the target VM.
@@ -127,6 +137,33 @@ namespace jdwp {
             return m_onuncaught;
         }
 
+        /**
+         * Returns a value for the agent's <code>inject</code> option.
+         *
+         * @return Boolean.
+         */
+        bool GetInject() const throw() {
+            return m_inject;
+        }
+
+        /**
+         * Returns a value for the agent's <code>lazycaps</code> option.
+         *
+         * @return Boolean.
+         */
+        bool GetLazyCapabilities() const throw() {
+            return m_lazyCapabilities;
+        }
+
+        /**
+         * Returns a value for the agent's <code>overflow</code> option.
+         *
+         * @return The policy for non-suspending events on a full queue.
+         */
+        OverflowPolicy GetOverflowPolicy() const throw() {
+            return m_overflowPolicy;
+        }
+
         /**
          * Returns a time-out value for transport operations.
          *
@@ -218,6 +255,16 @@ namespace jdwp {
          */
         bool AsciiToBool(const char *str) throw(IllegalArgumentException);
 
+        /**
+         * The helper converting string to the queue overflow policy.
+         *
+         * @param str - the input null-terminated string
+         *
+         * @exception IllegalArgumentException.
+         */
+        OverflowPolicy AsciiToOverflowPolicy(const char *str)
+            throw(IllegalArgumentException);
+
         int m_optionCount;
         char *m_optionString;
         Option *m_options;
@@ -226,6 +273,9 @@ namespace jdwp {
         bool m_suspend;
         bool m_server;
         bool m_onuncaught;
+        bool m_inject;
+        bool m_lazyCapabilities;
+        OverflowPolicy m_overflowPolicy;
         jlong m_timeout;
         const char *m_transport;
         const char *m_address;
@@ -28,6 +28,7 @@
 #include "ClassManager.h"
 #include "RequestManager.h"
 #include "OptionParser.h"
+#include "AgentManager.h"
 
 using namespace jdwp;
 
@@ -300,6 +301,7 @@ PacketDispatcher::ResetAll(JNIEnv *jni) throw(AgentException)
         GetPacketDispatcher().Reset(jni);
         GetClassManager().Reset(jni);
         GetObjectManager().Reset(jni);
+        GetAgentManager().RelinquishLazyCapabilities();
     }
 }
 
@@ -29,6 +29,7 @@
 #include "ObjectManager.h"
 #include "TransportManager.h"
 #include "ClassManager.h"
+#include "EventDispatcher.h"
 
 #include <cstring>
 
@@ -177,6 +178,38 @@ void InputPacketParser::ReadPacketFromTransport() throw (TransportException) {
     GetTransportManager().Read(&m_packet);
 }
 
+void InputPacketParser::ReadEmbeddedPacket(InputPacketParser* to)
+    throw (AgentException) {
+    JDWP_ASSERT(!to->IsPacketInitialized());
+
+    jbyte cmdSet = ReadByte();
+    jbyte cmd = ReadByte();
+    jint length = ReadInt();
+    if (length < 0) {
+        throw AgentException(JDWP_ERROR_INVALID_LENGTH);
+    }
+
+    jbyte* data = 0;
+    if (length > 0) {
+        data = static_cast<jbyte*>
+            (GetMemoryManager().Allocate(length JDWP_FILE_LINE));
+        try {
+            ReadRawData(data, length);
+        } catch (const AgentException& e) {
+            GetMemoryManager().Free(data JDWP_FILE_LINE);
+            throw e;
+        }
+    }
+
+    to->m_packet.type.cmd.id = GetId();
+    to->m_packet.type.cmd.len = JDWP_MIN_PACKET_LENGTH + length;
+    to->m_packet.type.cmd.flags = 0;
+    to->m_packet.type.cmd.cmdSet = cmdSet;
+    to->m_packet.type.cmd.cmd = cmd;
+    to->m_packet.type.cmd.data = data;
+    to->m_position = 0;
+}
+
 void InputPacketParser::ReadBigEndianData(void* data, int len) throw (InternalErrorException) {
     JDWP_ASSERT(IsPacketInitialized());
 
@@ -484,6 +517,13 @@ void OutputPacketComposer::WritePacketToTransport() throw (TransportException) {
 
 void OutputPacketComposer::AllocateMemoryForData(int length) throw (OutOfMemoryException) {
     size_t newPosition = m_position + static_cast<size_t>(length);
+    if (m_allocatedSize == 0 && m_bufferPool != 0
+        && newPosition < m_bufferPool->GetBlockSize())
+    {
+        m_packet.type.cmd.data = static_cast<jbyte*>(m_bufferPool->Allocate());
+        m_allocatedSize = m_bufferPool->GetBlockSize();
+        return;
+    }
     if (newPosition >= m_allocatedSize) {
         // then reallocate buffer
         size_t newAllocatedSize = m_allocatedSize + ALLOCATION_STEP;
@@ -693,12 +733,72 @@ void OutputPacketComposer::WriteValues(JNIEnv *jni, jdwpTag tag,
         WriteUntaggedValue(jni, tag, value[i]);
 }
 
+void OutputPacketComposer::WriteBytes(const jbyte* data, jint length) throw (OutOfMemoryException) {
+    if (length > 0) {
+        WriteRawData(data, length);
+    }
+}
+
 void OutputPacketComposer::WriteByteArray(jbyte* byte, jint length) throw (OutOfMemoryException) {
     WriteInt(length);
     WriteRawData(byte, length);
 }
 
+void OutputPacketComposer::AppendCompositeEvents(const OutputPacketComposer& from)
+    throw (AgentException) {
+    // composite packet data: byte suspendPolicy, int events, events
+    const size_t eventsPosition = sizeof(jbyte) + sizeof(jint);
+    JDWP_ASSERT(m_position >= eventsPosition && from.m_position >= eventsPosition);
+
+    const jbyte* fromData = from.m_packet.type.cmd.data;
+    jint count = 0;
+    jint fromCount = 0;
+    for (size_t i = sizeof(jbyte); i < eventsPosition; i++) {
+        count = (count << 8) | (m_packet.type.cmd.data[i] & 0xFF);
+        fromCount = (fromCount << 8) | (fromData[i] & 0xFF);
+    }
+
+    WriteRawData(&fromData[eventsPosition],
+        static_cast<int>(from.m_position - eventsPosition));
+    for (int i = 0; i < from.m_registeredObjectIDCount; i++) {
+        RegisterObjectID(from.m_registeredObjectIDTable[i]);
+    }
+
+    size_t currentPosition = m_position;
+    jint currentLength = GetLength();
+    m_position = sizeof(jbyte);
+    WriteInt(count + fromCount);
+    m_position = currentPosition;
+    SetLength(currentLength);
+}
+
+void OutputPacketComposer::AppendEmbeddedReply(const OutputPacketComposer& from)
+    throw (AgentException) {
+    jint error = from.GetError();
+    WriteInt(error);
+    if (error != JDWP_ERROR_NONE) {
+        // data written before the error are not sent
+        WriteInt(0);
+        return;
+    }
+
+    WriteInt(static_cast<jint>(from.m_position));
+    if (from.m_position > 0) {
+        WriteRawData(from.m_packet.type.cmd.data,
+            static_cast<int>(from.m_position));
+    }
+    for (int i = 0; i < from.m_registeredObjectIDCount; i++) {
+        RegisterObjectID(from.m_registeredObjectIDTable[i]);
+    }
+}
+
 void OutputPacketComposer::Reset(JNIEnv *jni) {
+    if (m_bufferPool != 0 && m_packet.type.cmd.data != 0
+        && m_allocatedSize == m_bufferPool->GetBlockSize())
+    {
+        m_bufferPool->Free(m_packet.type.cmd.data);
+        m_packet.type.cmd.data = 0;
+    }
     PacketWrapper::Reset(jni);
     m_position = 0;
     m_allocatedSize = 0;
@@ -794,13 +894,37 @@ void CommandParser::ReadCommand() throw (TransportException) {
 }
 
 void CommandParser::WriteReply(JNIEnv *jni) throw (TransportException) {
+    if (m_isEmbedded) {
+        // kept for WriteEmbeddedReply()
+        return;
+    }
     reply.WritePacketToTransport();
     Reset(jni);
 }
 
+void CommandParser::ReadEmbeddedCommand(InputPacketParser& batch)
+    throw (AgentException) {
+    batch.ReadEmbeddedPacket(&command);
+    reply.CreateJDWPReply(command.GetId(), JDWP_ERROR_NONE);
+    m_isEmbedded = true;
+}
+
+void CommandParser::WriteEmbeddedReply(JNIEnv *jni, OutputPacketComposer* to)
+    throw (AgentException) {
+    JDWP_ASSERT(m_isEmbedded);
+    try {
+        to->AppendEmbeddedReply(reply);
+    } catch (const AgentException& e) {
+        Reset(jni);
+        throw e;
+    }
+    Reset(jni);
+}
+
 void CommandParser::Reset(JNIEnv *jni) {
     command.Reset(jni);
     reply.Reset(jni);
+    m_isEmbedded = false;
 }
 
 void CommandParser::MoveData(JNIEnv *jni, CommandParser* to) {
@@ -815,6 +939,7 @@ void CommandParser::MoveData(JNIEnv *jni, CommandParser* to) {
 EventComposer::EventComposer(jint id,
     jdwpCommandSet commandSet, jdwpCommand command, jdwpSuspendPolicy sp)
 {
+    event.SetBufferPool(&GetEventDispatcher().GetEventBufferPool());
     event.CreateJDWPEvent(id, commandSet, command);
     m_suspendPolicy = sp;
     m_thread = 0;
@@ -825,6 +950,17 @@ EventComposer::EventComposer(jint id,
     event.WriteByte(sp);
 }
 
+void* EventComposer::operator new(size_t size) throw(AgentException)
+{
+    JDWP_ASSERT(size == GetEventDispatcher().GetEventComposerPool().GetBlockSize());
+    return GetEventDispatcher().GetEventComposerPool().Allocate();
+}
+
+void EventComposer::operator delete(void* ptr) throw()
+{
+    GetEventDispatcher().GetEventComposerPool().Free(ptr);
+}
+
 void EventComposer::WriteThread(JNIEnv *jni, jthread thread)
     throw (OutOfMemoryException)
 {
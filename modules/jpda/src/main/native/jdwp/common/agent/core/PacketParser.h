@@ -33,6 +33,7 @@
 #include "jdwpTransport.h"
 #include "AgentBase.h"
 #include "jdwpTypes.h"
+#include "BlockPool.h"
 
 #include "jni.h"
 
@@ -81,7 +82,9 @@ namespace jdwp {
          * Returns the value of the command-set field of the JDWP packet. 
          */
         jdwpCommandSet GetCommandSet() const {
-            return static_cast<jdwpCommandSet>(m_packet.type.cmd.cmdSet);
+            // vendor command sets are above 127
+            return static_cast<jdwpCommandSet>(
+                static_cast<unsigned char>(m_packet.type.cmd.cmdSet));
         }
 
         /**
@@ -200,6 +203,18 @@ namespace jdwp {
          */
         void ReadPacketFromTransport() throw (TransportException);
 
+        /**
+         * Reads a command embedded in this packet into another
+         * InputPacketParser  instance. The embedded command is written as
+         * byte commandSet, byte command, int length, followed by
+         * length bytes of command data, and gets the ID of this packet.
+         *
+         * @param to - another InputPacketParser
+         *
+         * @throws AgentException.
+         */
+        void ReadEmbeddedPacket(InputPacketParser* to) throw (AgentException);
+
         /** 
          * Sequentially reads the byte value from the JDWP packet's data. 
          *
@@ -692,9 +707,19 @@ namespace jdwp {
          */
         OutputPacketComposer()
             : PacketWrapper(), m_position(0), m_allocatedSize(0)
+            , m_bufferPool(0)
             , m_registeredObjectIDTable(0), m_registeredObjectIDCount(0)
             , m_registeredObjectIDTableSise(0) {}
 
+        /**
+         * Sets the pool of data buffers. The first buffer of the packet is
+         * taken from the pool and returned to it on <code>Reset()</code>
+         * unless it was reallocated.
+         *
+         * @param pool - the pool of data buffers
+         */
+        void SetBufferPool(BlockPool* pool) { m_bufferPool = pool; }
+
         /**
          * Fills header fields with the values specific for the new JDWP reply.
          *
@@ -965,6 +990,46 @@ namespace jdwp {
          */
         void WriteByteArray(jbyte* byte, jint length) throw (OutOfMemoryException);
 
+        /**
+         * Appends events of another <code>Composite</code> event packet to
+         * this one and updates the number of events. Object IDs registered
+         * in the other packet are registered in this one as well.
+         *
+         * @param from - the composite event packet to append
+         *
+         * @throws AgentException.
+         */
+        void AppendCompositeEvents(const OutputPacketComposer& from)
+            throw (AgentException);
+
+        /**
+         * Appends a reply to an embedded command as int errorCode,
+         * int length, followed by length bytes of reply data. Object IDs
+         * registered in the embedded reply are registered in this one as
+         * well.
+         *
+         * @param from - the reply to the embedded command
+         *
+         * @throws AgentException.
+         */
+        void AppendEmbeddedReply(const OutputPacketComposer& from)
+            throw (AgentException);
+
+        /**
+         * Returns the data written to the packet; its length is
+         * <code>GetPosition()</code>.
+         */
+        const jbyte* GetData() const { return m_packet.type.cmd.data; }
+
+        /**
+         * Writes the given bytes as is, for example the data of a reply
+         * taken by <code>GetData()</code>.
+         *
+         * @param data   - the bytes to write
+         * @param length - the number of bytes
+         */
+        void WriteBytes(const jbyte* data, jint length) throw (OutOfMemoryException);
+
         /** 
          * Disposes all stored references and prepares 
          * OutputPacketComposer  for working with the next packets.
@@ -996,6 +1061,7 @@ namespace jdwp {
     private:
         size_t m_position;
         size_t m_allocatedSize;
+        BlockPool* m_bufferPool;
         
         ObjectID *m_registeredObjectIDTable;
         int m_registeredObjectIDCount;
@@ -1045,6 +1111,11 @@ namespace jdwp {
 
     public:
 
+        /**
+         * Creates an empty instance of CommandParser .
+         */
+        CommandParser() : m_isEmbedded(false) {}
+
         /**
          * The given method initializes command and reply structures.
          * There should be no access for command and reply packet's data before
@@ -1064,6 +1135,30 @@ namespace jdwp {
          */
         void WriteReply(JNIEnv *jni) throw (TransportException);
 
+        /**
+         * Initializes command and reply structures for a command embedded
+         * in the given packet. The reply to such command is not written
+         * to the transport by <code>WriteReply()</code>, but is kept until
+         * <code>WriteEmbeddedReply()</code> is invoked.
+         *
+         * @param batch - the packet with embedded commands
+         *
+         * @throws AgentException.
+         */
+        void ReadEmbeddedCommand(InputPacketParser& batch) throw (AgentException);
+
+        /**
+         * Appends the reply to the embedded command to the given packet and
+         * resets the CommandParser  object.
+         *
+         * @param jni - the JNI interface pointer
+         * @param to  - the reply to the command with embedded commands
+         *
+         * @throws AgentException.
+         */
+        void WriteEmbeddedReply(JNIEnv *jni, OutputPacketComposer* to)
+            throw (AgentException);
+
         /**
          * Moves all data to another CommandParser  instance.
          *
@@ -1089,6 +1184,8 @@ namespace jdwp {
          */
         void Reset(JNIEnv *jni);
 
+        bool m_isEmbedded;
+
     };
 
     /**
@@ -1184,6 +1281,18 @@ namespace jdwp {
          */
         void SetAutoDeathEvent(bool yes) { m_isAutoDeathEvent = yes; }
 
+        /**
+         * Takes the memory for a new event set from the pool of
+         * <code>EventDispatcher</code>.
+         */
+        static void* operator new(size_t size) throw(AgentException);
+
+        /**
+         * Returns the memory of the event set to the pool of
+         * <code>EventDispatcher</code>.
+         */
+        static void operator delete(void* ptr) throw();
+
         /**
          * A public field for working with <code>OutputPacketComposer<code/>.
          */
@@ -0,0 +1,187 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+// ReplyCache.cpp
+
+#include <string.h>
+
+#include "ReplyCache.h"
+#include "PacketParser.h"
+#include "Log.h"
+
+using namespace jdwp;
+
+ReplyCache::ReplyCache() throw()
+    : m_monitor(0)
+    , m_cacheSize(0)
+{
+    for (jint i = 0; i < CACHE_BUCKETS; i++) {
+        m_cache[i] = 0;
+    }
+}
+
+ReplyCache::~ReplyCache() throw()
+{}
+
+void ReplyCache::Init(JNIEnv* jni) throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("Init(" << jni << ")");
+
+    m_monitor = new AgentMonitor("_jdwp_ReplyCache_monitor");
+}
+
+void ReplyCache::Clean(JNIEnv* jni) throw()
+{
+    JDWP_TRACE_ENTRY("Clean(" << jni << ")");
+
+    if (m_monitor != 0) {
+        {
+            MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+            DropEntries(jni, 0, false);
+        }
+        delete m_monitor;
+        m_monitor = 0;
+    }
+}
+
+void ReplyCache::Reset(JNIEnv* jni) throw()
+{
+    JDWP_TRACE_ENTRY("Reset(" << jni << ")");
+
+    if (m_monitor != 0) {
+        MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+        DropEntries(jni, 0, false);
+    }
+}
+
+bool ReplyCache::WriteReply(JNIEnv* jni, CommandParser* cmdParser,
+        jclass cls, jmethodID method)
+    throw(AgentException)
+{
+    jvmtiError err;
+    jint hashCode = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetObjectHashCode(cls, &hashCode));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    jdwpCommandSet cmdSet = cmdParser->command.GetCommandSet();
+    jdwpCommand cmd = cmdParser->command.GetCommand();
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    for (CacheEntry* entry = m_cache[GetBucket(hashCode, method)];
+         entry != 0; entry = entry->next)
+    {
+        if (entry->hashCode == hashCode && entry->method == method
+            && entry->cmdSet == cmdSet && entry->cmd == cmd
+            && jni->IsSameObject(entry->cls, cls) == JNI_TRUE)
+        {
+            JDWP_TRACE_DATA("WriteReply: cached: cmd=" << cmdSet << "/" << cmd
+                << ", cls=" << cls
+                << ", method=" << method
+                << ", length=" << entry->length);
+            cmdParser->reply.WriteBytes(reinterpret_cast<jbyte*>(entry + 1),
+                entry->length);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ReplyCache::StoreReply(JNIEnv* jni, CommandParser* cmdParser,
+        jclass cls, jmethodID method)
+    throw(AgentException)
+{
+    if (cmdParser->reply.GetError() != JDWP_ERROR_NONE) {
+        return;
+    }
+
+    jvmtiError err;
+    jint hashCode = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetObjectHashCode(cls, &hashCode));
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    jint length = static_cast<jint>(cmdParser->reply.GetPosition());
+    CacheEntry* entry = reinterpret_cast<CacheEntry*>
+        (GetMemoryManager().Allocate(sizeof(CacheEntry) + length JDWP_FILE_LINE));
+    entry->cls = jni->NewWeakGlobalRef(cls);
+    if (entry->cls == 0) {
+        GetMemoryManager().Free(entry JDWP_FILE_LINE);
+        return;
+    }
+    entry->hashCode = hashCode;
+    entry->method = method;
+    entry->cmdSet = cmdParser->command.GetCommandSet();
+    entry->cmd = cmdParser->command.GetCommand();
+    entry->length = length;
+    if (length > 0) {
+        memcpy(entry + 1, cmdParser->reply.GetData(), length);
+    }
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    if (m_cacheSize + length > MAX_CACHE_SIZE) {
+        // entries of unloaded classes are dropped here as well
+        DropEntries(jni, 0, false);
+    }
+    CacheEntry** bucket = &m_cache[GetBucket(hashCode, method)];
+    entry->next = *bucket;
+    *bucket = entry;
+    m_cacheSize += length;
+}
+
+void ReplyCache::Invalidate(JNIEnv* jni, jclass cls) throw()
+{
+    JDWP_TRACE_ENTRY("Invalidate(" << jni << ',' << cls << ")");
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    DropEntries(jni, cls, false);
+}
+
+void ReplyCache::DropUnloaded(JNIEnv* jni) throw()
+{
+    JDWP_TRACE_ENTRY("DropUnloaded(" << jni << ")");
+
+    MonitorAutoLock lock(m_monitor JDWP_FILE_LINE);
+    DropEntries(jni, 0, true);
+}
+
+void ReplyCache::DropEntries(JNIEnv* jni, jclass cls, bool unloaded) throw()
+{
+    for (jint i = 0; i < CACHE_BUCKETS; i++) {
+        CacheEntry** p = &m_cache[i];
+        while (*p != 0) {
+            CacheEntry* entry = *p;
+            bool drop = true;
+            if (cls != 0) {
+                drop = (jni->IsSameObject(entry->cls, cls) == JNI_TRUE);
+            } else if (unloaded) {
+                drop = (jni->IsSameObject(entry->cls, 0) == JNI_TRUE);
+            }
+            if (drop) {
+                *p = entry->next;
+                m_cacheSize -= entry->length;
+                jni->DeleteWeakGlobalRef(entry->cls);
+                GetMemoryManager().Free(entry JDWP_FILE_LINE);
+            } else {
+                p = &entry->next;
+            }
+        }
+    }
+}
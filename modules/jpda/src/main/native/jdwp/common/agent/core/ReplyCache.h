@@ -0,0 +1,170 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * ReplyCache.h
+ *
+ * Keeps replies to commands which describe a class or method and do not
+ * change until the class is redefined or unloaded.
+ */
+
+#ifndef _REPLY_CACHE_H_
+#define _REPLY_CACHE_H_
+
+#include "AgentBase.h"
+#include "AgentMonitor.h"
+
+namespace jdwp {
+
+    class CommandParser;
+
+    /**
+     * The class caches the reply data of a command by its command set,
+     * command, class and method. A cached reply is written instead of
+     * executing the command again, until the entries of the class are
+     * invalidated by <code>Invalidate()</code> or dropped when the class is
+     * unloaded.
+     */
+    class ReplyCache : public AgentBase {
+
+    public:
+
+        /**
+         * A constructor.
+         */
+        ReplyCache() throw();
+
+        /**
+         * A destructor.
+         */
+        ~ReplyCache() throw();
+
+        /**
+         * Initializes the cache.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Init(JNIEnv* jni) throw(AgentException);
+
+        /**
+         * Cleans the cache.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Clean(JNIEnv* jni) throw();
+
+        /**
+         * Drops all cached replies. IDs written in replies are valid only
+         * in the current session, so it is called when the session ends.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void Reset(JNIEnv* jni) throw();
+
+        /**
+         * Writes the cached reply to the command, if any.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param cmdParser - the command with no reply data written yet
+         * @param cls       - the class the command is about
+         * @param method    - the method the command is about or 0
+         *
+         * @return <code>true</code> if the reply was written.
+         */
+        bool WriteReply(JNIEnv* jni, CommandParser* cmdParser, jclass cls,
+            jmethodID method) throw(AgentException);
+
+        /**
+         * Caches the reply data written to the command.
+         *
+         * @param jni       - the JNI interface pointer
+         * @param cmdParser - the command with the complete reply
+         * @param cls       - the class the command is about
+         * @param method    - the method the command is about or 0
+         */
+        void StoreReply(JNIEnv* jni, CommandParser* cmdParser, jclass cls,
+            jmethodID method) throw(AgentException);
+
+        /**
+         * Drops cached replies about the given class and its methods.
+         * Should be called after the class is redefined.
+         *
+         * @param jni - the JNI interface pointer
+         * @param cls - the Java class
+         */
+        void Invalidate(JNIEnv* jni, jclass cls) throw();
+
+        /**
+         * Drops cached replies about unloaded classes.
+         *
+         * @param jni - the JNI interface pointer
+         */
+        void DropUnloaded(JNIEnv* jni) throw();
+
+    private:
+
+        /**
+         * Cached reply, followed by <code>length</code> bytes of data in
+         * the same memory block.
+         */
+        struct CacheEntry {
+            jweak cls;
+            jint hashCode;
+            jmethodID method;
+            jdwpCommandSet cmdSet;
+            jdwpCommand cmd;
+            jint length;
+            CacheEntry* next;
+        };
+
+        /** Number of buckets in the cache. */
+        static const jint CACHE_BUCKETS = 1024;
+
+        /** Bytes of cached data which cause the cache to be dropped. */
+        static const size_t MAX_CACHE_SIZE = 4 * 1024 * 1024;
+
+        /**
+         * Returns the hash bucket for the given class hash code and method.
+         */
+        static jint GetBucket(jint hashCode, jmethodID method) throw() {
+            size_t hash = static_cast<unsigned int>(hashCode)
+                ^ (reinterpret_cast<size_t>(method) >> 3);
+            return static_cast<jint>(hash % CACHE_BUCKETS);
+        }
+
+        /**
+         * Drops entries of the given class, entries of unloaded classes if
+         * <code>unloaded</code> is set, or all entries if neither is given.
+         * Called under the cache monitor.
+         */
+        void DropEntries(JNIEnv* jni, jclass cls, bool unloaded) throw();
+
+        AgentMonitor* m_monitor;
+
+        // hash of cached replies by class hash code and method
+        CacheEntry* m_cache[CACHE_BUCKETS];
+
+        // total length of cached data
+        size_t m_cacheSize;
+
+    };
+
+}
+
+#endif // _REPLY_CACHE_H_
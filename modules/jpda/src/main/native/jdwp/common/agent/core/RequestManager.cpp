@@ -22,6 +22,7 @@
 // RequestManager.cpp
 
 #include <string.h>
+#include <algorithm>
 
 #include "RequestManager.h"
 #include "ThreadManager.h"
@@ -31,6 +32,7 @@
 #include "OptionParser.h"
 #include "Log.h"
 #include "AgentManager.h"
+#include "AtomicOps_pd.h"
 
 using namespace jdwp;
 
@@ -40,11 +42,69 @@ using namespace jdwp;
  */
 static bool ENABLE_COMBINED_METHOD_EXIT_EVENT = false;
 
+/**
+ * All event kinds which have their own list of requests.
+ */
+static const jdwpEventKind REQUEST_LIST_KINDS[] = {
+    JDWP_EVENT_SINGLE_STEP,
+    JDWP_EVENT_BREAKPOINT,
+    JDWP_EVENT_FRAME_POP,
+    JDWP_EVENT_EXCEPTION,
+    JDWP_EVENT_USER_DEFINED,
+    JDWP_EVENT_THREAD_START,
+    JDWP_EVENT_THREAD_END,
+    JDWP_EVENT_CLASS_PREPARE,
+    JDWP_EVENT_CLASS_UNLOAD,
+    JDWP_EVENT_CLASS_LOAD,
+    JDWP_EVENT_FIELD_ACCESS,
+    JDWP_EVENT_FIELD_MODIFICATION,
+    JDWP_EVENT_EXCEPTION_CATCH,
+    JDWP_EVENT_METHOD_ENTRY,
+    JDWP_EVENT_METHOD_EXIT,
+    JDWP_EVENT_VM_DEATH
+};
+
+static const size_t REQUEST_LIST_KIND_COUNT =
+    sizeof(REQUEST_LIST_KINDS) / sizeof(REQUEST_LIST_KINDS[0]);
+
 RequestManager::RequestManager() throw()
     : m_requestIdCount(0)
     , m_requestMonitor(0) 
+    , m_snapshotEpoch(0)
     , m_combinedEventsMonitor(0) 
-{}
+    , m_tracepointMonitor(0)
+    , m_tracepointEvents(0)
+    , m_tracepointCountPosition(0)
+    , m_tracepointCount(0)
+    , m_classPrepareMonitor(0)
+    , m_classPrepareEvents(0)
+    , m_classPrepareCountPosition(0)
+    , m_classPrepareCount(0)
+    , m_classPrepareStartTime(0)
+    , m_classPrepareBatchIds(0)
+    , m_classPrepareBatchIdCount(0)
+    , m_singleStepRequests(0)
+    , m_breakpointRequests(0)
+    , m_framePopRequests(0)
+    , m_exceptionRequests(0)
+    , m_userDefinedRequests(0)
+    , m_threadStartRequests(0)
+    , m_threadEndRequests(0)
+    , m_classPrepareRequests(0)
+    , m_classUnloadRequests(0)
+    , m_classLoadRequests(0)
+    , m_fieldAccessRequests(0)
+    , m_fieldModificationRequests(0)
+    , m_exceptionCatchRequests(0)
+    , m_methodEntryRequests(0)
+    , m_methodExitRequests(0)
+    , m_vmDeathRequests(0)
+    , m_combinedEventsPool(sizeof(CombinedEventsInfo), EVENT_POOL_SIZE)
+    , m_eventListPool(sizeof(RequestID) * (EVENT_LIST_SIZE + 1), EVENT_POOL_SIZE)
+{
+    m_snapshotReaders[0] = 0;
+    m_snapshotReaders[1] = 0;
+}
 
 RequestManager::~RequestManager() throw() 
 {}
@@ -55,7 +115,16 @@ void RequestManager::Init(JNIEnv* jni) throw(AgentException)
 
     m_requestMonitor = new AgentMonitor("_jdwp_RequestManager_requestMonitor");
     m_combinedEventsMonitor = new AgentMonitor("_jdwp_RequestManager_combinedEventsMonitor");;
+    m_tracepointMonitor = new AgentMonitor("_jdwp_RequestManager_tracepointMonitor");
+    m_classPrepareMonitor = new AgentMonitor("_jdwp_RequestManager_classPrepareMonitor");
     m_requestIdCount = 1;
+    m_methodTraceInjector.Init(jni);
+    m_exceptionFilter.Init(jni);
+
+    RequestList empty;
+    for (size_t i = 0; i < REQUEST_LIST_KIND_COUNT; i++) {
+        GetRequestSnapshot(REQUEST_LIST_KINDS[i]) = new RequestListSnapshot(empty);
+    }
 }
 
 void RequestManager::Clean(JNIEnv* jni) throw(AgentException)
@@ -65,6 +134,12 @@ void RequestManager::Clean(JNIEnv* jni) throw(AgentException)
     if (m_requestMonitor != 0){
         {
             MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+            // requests left are not deleted here, as before Reset() does it
+            for (size_t i = 0; i < REQUEST_LIST_KIND_COUNT; i++) {
+                RequestListSnapshot*& snapshot = GetRequestSnapshot(REQUEST_LIST_KINDS[i]);
+                delete snapshot;
+                snapshot = 0;
+            }
         }
         delete m_requestMonitor;
         m_requestMonitor = 0;
@@ -78,6 +153,24 @@ void RequestManager::Clean(JNIEnv* jni) throw(AgentException)
         delete m_combinedEventsMonitor;
         m_combinedEventsMonitor = 0;
     }
+
+    if (m_tracepointMonitor != 0){
+        DeleteTracepointEvents(jni);
+        delete m_tracepointMonitor;
+        m_tracepointMonitor = 0;
+    }
+
+    if (m_classPrepareMonitor != 0){
+        DeleteClassPrepareEvents(jni);
+        delete m_classPrepareMonitor;
+        m_classPrepareMonitor = 0;
+    }
+
+    m_methodTraceInjector.Clean(jni);
+    m_exceptionFilter.Clean(jni);
+
+    m_combinedEventsPool.Clean();
+    m_eventListPool.Clean();
 }
 
 void RequestManager::Reset(JNIEnv* jni) throw(AgentException)
@@ -118,6 +211,22 @@ void RequestManager::Reset(JNIEnv* jni) throw(AgentException)
             JDWP_INFO("JDWP error: " << e.what() << " [" << e.ErrCode() << "]");
         }
     }
+
+    if (m_tracepointMonitor != 0) {
+        try {
+            DeleteTracepointEvents(jni);
+        } catch (AgentException& e) {
+            JDWP_INFO("JDWP error: " << e.what() << " [" << e.ErrCode() << "]");
+        }
+    }
+
+    if (m_classPrepareMonitor != 0) {
+        try {
+            DeleteClassPrepareEvents(jni);
+        } catch (AgentException& e) {
+            JDWP_INFO("JDWP error: " << e.what() << " [" << e.ErrCode() << "]");
+        }
+    }
 }
 
 void RequestManager::ControlBreakpoint(JNIEnv* jni,
@@ -126,6 +235,12 @@ void RequestManager::ControlBreakpoint(JNIEnv* jni,
 {
     JDWP_TRACE_ENTRY("ControlBreakpoint(" << jni << ',' << request << ',' << enable << ")");
 
+    DeferredLocationModifier* dlm = request->GetDeferredLocation();
+    if (dlm != 0) {
+        ControlDeferredBreakpoint(jni, dlm, enable);
+        return;
+    }
+
     LocationOnlyModifier* lom = request->GetLocation();
     if (lom == 0) {
         throw InternalErrorException();
@@ -133,20 +248,7 @@ void RequestManager::ControlBreakpoint(JNIEnv* jni,
     jclass cls = lom->GetClass();
     jmethodID method = lom->GetMethod();
     jlocation location = lom->GetLocation();
-    bool found = false;
-    RequestList& rl = GetRequestList(request->GetEventKind());
-    for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
-        AgentEventRequest* req = *i;
-        LocationOnlyModifier* m = req->GetLocation();
-        if (m != 0 && method == m->GetMethod() &&
-            location == m->GetLocation() &&
-            JNI_TRUE == jni->IsSameObject(cls, m->GetClass()))
-        {
-            found = true;
-            break;
-        }
-    }
-    if (!found) {
+    if (!IsBreakpointSet(jni, cls, method, location)) {
         JDWP_TRACE_EVENT("ControlBreakpoint: breakpoint "
             << (enable ? "set" : "clear") << ", loc=" << location);
         jvmtiError err;
@@ -172,6 +274,193 @@ void RequestManager::ControlBreakpoint(JNIEnv* jni,
     }
 }
 
+bool RequestManager::IsBreakpointSet(JNIEnv* jni, jclass cls,
+        jmethodID method, jlocation location)
+    throw(AgentException)
+{
+    const RequestList& rl = GetRequestList(JDWP_EVENT_BREAKPOINT);
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        AgentEventRequest* req = *i;
+        LocationOnlyModifier* m = req->GetLocation();
+        if (m != 0 && method == m->GetMethod() &&
+            location == m->GetLocation() &&
+            (cls == 0 || JNI_TRUE == jni->IsSameObject(cls, m->GetClass())))
+        {
+            return true;
+        }
+        DeferredLocationModifier* dlm = req->GetDeferredLocation();
+        if (dlm != 0 && dlm->IsResolvedAt(method, location)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RequestManager::HasDeferredBreakpoints() throw(AgentException)
+{
+    const RequestList& rl = GetRequestList(JDWP_EVENT_BREAKPOINT);
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        if ((*i)->GetDeferredLocation() != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RequestManager::HasGlobalClassPrepare() throw(AgentException)
+{
+    const RequestList& rl = GetRequestList(JDWP_EVENT_CLASS_PREPARE);
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        if ((*i)->GetThread() == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void RequestManager::ControlDeferredBreakpoint(JNIEnv* jni,
+        DeferredLocationModifier* modifier, bool enable)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("ControlDeferredBreakpoint(" << jni << ',' << modifier
+        << ',' << enable << ")");
+
+    jvmtiError err;
+    if (enable) {
+        // ClassPrepare notification is needed to resolve the breakpoint in
+        // classes loaded later, even if there are no ClassPrepare requests
+        if (!HasDeferredBreakpoints()) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+                JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, 0));
+            if (err != JVMTI_ERROR_NONE) {
+                throw AgentException(err);
+            }
+        }
+
+        jint classCount = 0;
+        jclass* classes = 0;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetLoadedClasses(&classCount, &classes));
+        JvmtiAutoFree afc(classes);
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        for (jint i = 0; i < classCount; i++) {
+            jint status = 0;
+            char* signature = 0;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetClassStatus(classes[i], &status));
+            if (err == JVMTI_ERROR_NONE &&
+                (status & JVMTI_CLASS_STATUS_PREPARED) != 0)
+            {
+                JVMTI_TRACE(err, GetJvmtiEnv()->GetClassSignature(classes[i],
+                    &signature, 0));
+                JvmtiAutoFree afs(signature);
+                if (err == JVMTI_ERROR_NONE && modifier->MatchClass(signature)) {
+                    ResolveDeferredBreakpoint(jni, modifier, classes[i]);
+                }
+            }
+            jni->DeleteLocalRef(classes[i]);
+        }
+    } else {
+        DeferredLocationModifier::ResolvedLocationList& locations =
+            modifier->GetResolvedLocations();
+        for (DeferredLocationModifier::ResolvedLocationList::const_iterator i =
+                locations.begin(); i != locations.end(); i++)
+        {
+            if (!IsBreakpointSet(jni, 0, i->method, i->location)) {
+                // breakpoints in unloaded classes are already cleared
+                JVMTI_TRACE(err, GetJvmtiEnv()->ClearBreakpoint(i->method,
+                    i->location));
+            }
+        }
+        locations.clear();
+        ReleaseClassPrepare();
+    }
+}
+
+void RequestManager::ReleaseClassPrepare() throw(AgentException)
+{
+    if (!HasDeferredBreakpoints() && !HasGlobalClassPrepare() &&
+        !GetClassManager().GetClassRegistry().IsActive() &&
+        !m_methodTraceInjector.IsHookEnabled())
+    {
+        jvmtiError err;
+        JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+            JVMTI_DISABLE, JVMTI_EVENT_CLASS_PREPARE, 0));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+    }
+}
+
+void RequestManager::ResolveDeferredBreakpoint(JNIEnv* jni,
+        DeferredLocationModifier* modifier, jclass cls)
+    throw(AgentException)
+{
+    jint methodCount = 0;
+    jmethodID* methods = 0;
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetClassMethods(cls, &methodCount, &methods));
+    JvmtiAutoFree afm(methods);
+    if (err != JVMTI_ERROR_NONE) {
+        throw AgentException(err);
+    }
+
+    for (jint i = 0; i < methodCount; i++) {
+        jlocation location = modifier->FindLocation(methods[i]);
+        if (location == -1 || modifier->IsResolvedAt(methods[i], location)) {
+            continue;
+        }
+        if (!IsBreakpointSet(jni, 0, methods[i], location)) {
+            JVMTI_TRACE(err, GetJvmtiEnv()->SetBreakpoint(methods[i], location));
+            if (err != JVMTI_ERROR_NONE) {
+                JDWP_TRACE_EVENT("ResolveDeferredBreakpoint: breakpoint not set:"
+                    << " method=" << methods[i] << " loc=" << location
+                    << " err=" << err);
+                continue;
+            }
+        }
+        JDWP_TRACE_EVENT("ResolveDeferredBreakpoint: breakpoint set:"
+            << " method=" << methods[i] << " loc=" << location);
+        DeferredLocationModifier::ResolvedLocation resolved;
+        resolved.method = methods[i];
+        resolved.location = location;
+        modifier->GetResolvedLocations().push_back(resolved);
+    }
+}
+
+void RequestManager::ResolveDeferredBreakpoints(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    // check the snapshot first, so that loading of unrelated classes
+    // does not take the request monitor
+    bool isMatched = false;
+    {
+        RequestListSnapshot* snapshot = AcquireRequestList(JDWP_EVENT_BREAKPOINT);
+        RequestListAutoRelease autoRelease(snapshot);
+        const RequestList& rl = snapshot->m_list;
+        for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+            DeferredLocationModifier* dlm = (*i)->GetDeferredLocation();
+            if (dlm != 0 && dlm->MatchClass(signature)) {
+                isMatched = true;
+                break;
+            }
+        }
+    }
+    if (!isMatched) {
+        return;
+    }
+
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    const RequestList& rl = GetRequestList(JDWP_EVENT_BREAKPOINT);
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        DeferredLocationModifier* dlm = (*i)->GetDeferredLocation();
+        if (dlm != 0 && dlm->MatchClass(signature)) {
+            ResolveDeferredBreakpoint(jni, dlm, cls);
+        }
+    }
+}
+
 void RequestManager::ControlWatchpoint(JNIEnv* jni,
         AgentEventRequest* request, bool enable)
     throw(AgentException)
@@ -185,8 +474,8 @@ void RequestManager::ControlWatchpoint(JNIEnv* jni,
     jclass cls = fom->GetClass();
     jfieldID field = fom->GetField();
     bool found = false;
-    RequestList& rl = GetRequestList(request->GetEventKind());
-    for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
+    const RequestList& rl = GetRequestList(request->GetEventKind());
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
         AgentEventRequest* req = *i;
         FieldOnlyModifier *m = req->GetField();
         if (m != 0 && field == m->GetField() &&
@@ -263,6 +552,9 @@ void RequestManager::ControlEvent(JNIEnv* jni,
     bool nullThreadForSetEventNotificationMode = false;
     switch (request->GetEventKind()) {
     case JDWP_EVENT_SINGLE_STEP:
+        if (enable) {
+            GetAgentManager().RequireCapability(AgentManager::CAP_SINGLE_STEP);
+        }
         // manually controlled inside StepRequest
         //eventType = JVMTI_EVENT_SINGLE_STEP;
         //break;
@@ -289,10 +581,16 @@ void RequestManager::ControlEvent(JNIEnv* jni,
         // avoid standard event enable/disable technique
         return;
     case JDWP_EVENT_FIELD_ACCESS:
+        if (enable) {
+            GetAgentManager().RequireCapability(AgentManager::CAP_FIELD_ACCESS);
+        }
         eventType = JVMTI_EVENT_FIELD_ACCESS;
         ControlWatchpoint(jni, request, enable);
         break;
     case JDWP_EVENT_FIELD_MODIFICATION:
+        if (enable) {
+            GetAgentManager().RequireCapability(AgentManager::CAP_FIELD_MODIFICATION);
+        }
         eventType = JVMTI_EVENT_FIELD_MODIFICATION;
         ControlWatchpoint(jni, request, enable);
         break;
@@ -301,9 +599,15 @@ void RequestManager::ControlEvent(JNIEnv* jni,
         break;
     case JDWP_EVENT_METHOD_ENTRY:
         eventType = JVMTI_EVENT_METHOD_ENTRY;
+        if (ControlMethodTrace(jni, request, enable)) {
+            return;
+        }
         break;
     case JDWP_EVENT_METHOD_EXIT:
         eventType = JVMTI_EVENT_METHOD_EXIT;
+        if (ControlMethodTrace(jni, request, enable)) {
+            return;
+        }
         break;
     case JDWP_EVENT_THREAD_START:
         eventType = JVMTI_EVENT_THREAD_START;
@@ -318,8 +622,13 @@ void RequestManager::ControlEvent(JNIEnv* jni,
     }
 
     jthread thread = request->GetThread();
-    RequestList& rl = GetRequestList(request->GetEventKind());
-    for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
+    const RequestList& rl = GetRequestList(request->GetEventKind());
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        AgentEventRequest* req = *i;
+        if (req->IsInjected()) {
+            // does not need JVMTI events
+            continue;
+        }
         if (nullThreadForSetEventNotificationMode) {
             //
             // SetEventNotificationMode() for some events must be called with
@@ -330,13 +639,23 @@ void RequestManager::ControlEvent(JNIEnv* jni,
             //
             return;
         }
-        AgentEventRequest* req = *i;
         if (JNI_TRUE == jni->IsSameObject(thread, req->GetThread())) {
             // there is similar request, so do nothing
             return;
         }
     }
 
+    if (!enable && thread == 0 &&
+        request->GetEventKind() == JDWP_EVENT_CLASS_PREPARE &&
+        (HasDeferredBreakpoints() ||
+            GetClassManager().GetClassRegistry().IsActive() ||
+            m_methodTraceInjector.IsHookEnabled()))
+    {
+        // ClassPrepare notification is still needed for deferred breakpoints,
+        // the class registry or the method trace injector
+        return;
+    }
+
     JDWP_TRACE_EVENT("ControlEvent: request " << GetEventKindName(request->GetEventKind())
         << "[" << request->GetEventKind() << "] "
         << (enable ? "on" : "off") << ", thread=" << thread);
@@ -360,7 +679,176 @@ void RequestManager::ControlEvent(JNIEnv* jni,
     }
 }
 
-RequestList& RequestManager::GetRequestList(jdwpEventKind kind)
+bool RequestManager::ControlMethodTrace(JNIEnv* jni,
+        AgentEventRequest* request, bool enable)
+    throw(AgentException)
+{
+    if (enable) {
+        if (!m_methodTraceInjector.IsEnabled() ||
+            request->GetClassMatch() == 0)
+        {
+            return false;
+        }
+        request->SetInjected(true);
+    } else if (!request->IsInjected()) {
+        return false;
+    }
+
+    // instrument classes matching the first ClassMatch pattern of each
+    // injected request, the rest of modifiers are applied to the events
+    MethodTraceInjector::PatternList patterns;
+    const RequestList& entryList = GetRequestList(JDWP_EVENT_METHOD_ENTRY);
+    for (RequestListConstIterator i = entryList.begin(); i != entryList.end(); i++) {
+        if ((*i)->IsInjected()) {
+            patterns.push_back((*i)->GetClassMatch()->GetPattern());
+        }
+    }
+    const RequestList& exitList = GetRequestList(JDWP_EVENT_METHOD_EXIT);
+    for (RequestListConstIterator i = exitList.begin(); i != exitList.end(); i++) {
+        if ((*i)->IsInjected()) {
+            patterns.push_back((*i)->GetClassMatch()->GetPattern());
+        }
+    }
+    if (enable) {
+        patterns.push_back(request->GetClassMatch()->GetPattern());
+    }
+
+    JDWP_TRACE_EVENT("ControlMethodTrace: request "
+        << GetEventKindName(request->GetEventKind())
+        << " " << (enable ? "on" : "off") << ", patterns=" << patterns.size());
+    if (!patterns.empty()) {
+        // classes loaded while loaded classes are retransformed are checked
+        // again when they are prepared
+        jvmtiError err;
+        JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(
+            JVMTI_ENABLE, JVMTI_EVENT_CLASS_PREPARE, 0));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+    }
+    bool isInjected = true;
+    try {
+        m_methodTraceInjector.SetPatterns(jni, patterns);
+    } catch (AgentException& e) {
+        if (!enable) {
+            throw e;
+        }
+        JDWP_INFO("Unable to inject method entry/exit calls, using JVMTI events: "
+            << e.what() << " [" << e.ErrCode() << "]");
+        request->SetInjected(false);
+        isInjected = false;
+    }
+    ReleaseClassPrepare();
+    return isInjected;
+}
+
+void RequestManager::UpdateMethodTrace(JNIEnv* jni, jclass cls,
+        const char* signature)
+    throw(AgentException)
+{
+    // check the class first, so that loading of classes, which are
+    // instrumented for the current patterns, does not take the request
+    // monitor
+    if (!m_methodTraceInjector.IsHookEnabled() ||
+        !m_methodTraceInjector.NeedsRetransform(jni, cls, signature))
+    {
+        return;
+    }
+
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    m_methodTraceInjector.UpdateClass(jni, cls, signature);
+    ReleaseClassPrepare();
+}
+
+void RequestManager::RemapLocations(JNIEnv* jni,
+        const MethodTraceInjector::CodeRemap& remap)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("RemapLocations(" << jni << ','
+        << JDWP_CHECK_NULL(remap.signature) << ")");
+
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+
+    // internal breakpoints of steps over a line refer to the previous code
+    RequestList steps(GetRequestList(JDWP_EVENT_SINGLE_STEP));
+    for (RequestListConstIterator i = steps.begin(); i != steps.end(); i++) {
+        reinterpret_cast<StepRequest*> (*i)->OnCodeChanged(jni, remap.cls);
+    }
+
+    // breakpoints at the previous indices are cleared first, as several
+    // requests may share a location
+    jvmtiError err;
+    const RequestList& rl = GetRequestList(JDWP_EVENT_BREAKPOINT);
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        LocationOnlyModifier* lom = (*i)->GetLocation();
+        if (lom != 0) {
+            jlocation location = lom->GetLocation();
+            if (MethodTraceInjector::MapLocation(remap, lom->GetMethod(),
+                    location) && location != lom->GetLocation())
+            {
+                // the VM may have cleared the breakpoint already
+                JVMTI_TRACE(err, GetJvmtiEnv()->ClearBreakpoint(
+                    lom->GetMethod(), lom->GetLocation()));
+                lom->SetLocation(location);
+            }
+        }
+        DeferredLocationModifier* dlm = (*i)->GetDeferredLocation();
+        if (dlm != 0) {
+            DeferredLocationModifier::ResolvedLocationList& locations =
+                dlm->GetResolvedLocations();
+            for (DeferredLocationModifier::ResolvedLocationList::iterator j =
+                    locations.begin(); j != locations.end(); j++)
+            {
+                jlocation location = j->location;
+                if (MethodTraceInjector::MapLocation(remap, j->method,
+                        location) && location != j->location)
+                {
+                    JVMTI_TRACE(err, GetJvmtiEnv()->ClearBreakpoint(
+                        j->method, j->location));
+                    j->location = location;
+                }
+            }
+        }
+    }
+
+    // all breakpoints of the class are set again at the new indices
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        LocationOnlyModifier* lom = (*i)->GetLocation();
+        if (lom != 0 &&
+            MethodTraceInjector::HasMethod(remap, lom->GetMethod()))
+        {
+            JVMTI_TRACE(err, GetJvmtiEnv()->SetBreakpoint(lom->GetMethod(),
+                lom->GetLocation()));
+            if (err != JVMTI_ERROR_NONE && err != JVMTI_ERROR_DUPLICATE) {
+                JDWP_TRACE_EVENT("RemapLocations: breakpoint not set:"
+                    << " method=" << lom->GetMethod()
+                    << " loc=" << lom->GetLocation() << " err=" << err);
+            }
+        }
+        DeferredLocationModifier* dlm = (*i)->GetDeferredLocation();
+        if (dlm == 0) {
+            continue;
+        }
+        const DeferredLocationModifier::ResolvedLocationList& locations =
+            dlm->GetResolvedLocations();
+        for (DeferredLocationModifier::ResolvedLocationList::const_iterator j =
+                locations.begin(); j != locations.end(); j++)
+        {
+            if (!MethodTraceInjector::HasMethod(remap, j->method)) {
+                continue;
+            }
+            JVMTI_TRACE(err, GetJvmtiEnv()->SetBreakpoint(j->method,
+                j->location));
+            if (err != JVMTI_ERROR_NONE && err != JVMTI_ERROR_DUPLICATE) {
+                JDWP_TRACE_EVENT("RemapLocations: breakpoint not set:"
+                    << " method=" << j->method
+                    << " loc=" << j->location << " err=" << err);
+            }
+        }
+    }
+}
+
+RequestListSnapshot*& RequestManager::GetRequestSnapshot(jdwpEventKind kind)
     throw(AgentException)
 {
     switch (kind) {
@@ -401,6 +889,97 @@ RequestList& RequestManager::GetRequestList(jdwpEventKind kind)
     }
 }
 
+const RequestList& RequestManager::GetRequestList(jdwpEventKind kind)
+    throw(AgentException)
+{
+    RequestListSnapshot* snapshot = GetRequestSnapshot(kind);
+    JDWP_ASSERT(snapshot != 0);
+    return snapshot->m_list;
+}
+
+RequestListSnapshot* RequestManager::AcquireRequestList(jdwpEventKind kind)
+    throw(AgentException)
+{
+    RequestListSnapshot*& slot = GetRequestSnapshot(kind);
+    RequestListSnapshot* snapshot = 0;
+    while (snapshot == 0) {
+        jint epoch = m_snapshotEpoch;
+        AtomicIncrement(&m_snapshotReaders[epoch]);
+        if (epoch == m_snapshotEpoch) {
+            // a publisher releases the replaced snapshot only when readers
+            // of this epoch are gone, so it is not freed before pinned
+            snapshot = slot;
+            AtomicIncrement(&snapshot->m_refCount);
+        }
+        AtomicDecrement(&m_snapshotReaders[epoch]);
+    }
+    return snapshot;
+}
+
+void RequestManager::ReleaseRequestList(RequestListSnapshot* snapshot) throw()
+{
+    if (snapshot == 0) {
+        return;
+    }
+
+    if (AtomicDecrement(&snapshot->m_refCount) > 0) {
+        return;
+    }
+
+    // the last holder, the snapshot is not reachable any more
+    RequestList garbage;
+    const RequestList& rl = snapshot->m_list;
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        if ((*i)->Release() == 0) {
+            garbage.push_back(*i);
+        }
+    }
+    delete snapshot;
+
+    if (!garbage.empty()) {
+        // deleted requests may in turn delete their internal requests, so
+        // serialize with modifications of request lists
+        MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+        for (RequestListIterator i = garbage.begin(); i != garbage.end(); i++) {
+            JDWP_TRACE_EVENT("ReleaseRequestList: delete request: event="
+                << GetEventKindName((*i)->GetEventKind())
+                << ", req=" << (*i)->GetRequestId());
+            delete *i;
+        }
+    }
+}
+
+void RequestManager::PublishRequestList(jdwpEventKind kind,
+        const RequestList& list)
+    throw(AgentException)
+{
+    RequestListSnapshot* snapshot = new RequestListSnapshot(list);
+    for (RequestListConstIterator i = list.begin(); i != list.end(); i++) {
+        (*i)->AddRef();
+    }
+    RequestListSnapshot*& slot = GetRequestSnapshot(kind);
+    RequestListSnapshot* previous = static_cast<RequestListSnapshot*>(
+        AtomicExchangePointer(reinterpret_cast<void* volatile*>(&slot),
+            snapshot));
+    WaitForSnapshotReaders();
+    ReleaseRequestList(previous);
+
+    if (kind == JDWP_EVENT_EXCEPTION) {
+        m_exceptionFilter.Update(GetJniEnv(), list);
+    }
+}
+
+void RequestManager::WaitForSnapshotReaders() throw()
+{
+    // readers which see the new epoch read the new snapshot, those which
+    // saw the previous one are waited for; publishers are serialized
+    jint epoch = m_snapshotEpoch;
+    AtomicCompareAndSet(&m_snapshotEpoch, epoch, 1 - epoch);
+    while (m_snapshotReaders[epoch] != 0) {
+        SpinYield();
+    }
+}
+
 void RequestManager::AddInternalRequest(JNIEnv* jni,
         AgentEventRequest* request)
     throw(AgentException)
@@ -411,10 +990,42 @@ void RequestManager::AddInternalRequest(JNIEnv* jni,
         << "], modCount=" << request->GetModifierCount()
         << ", policy=" << request->GetSuspendPolicy());
     JDWP_ASSERT(m_requestIdCount > 0);
-    RequestList& rl = GetRequestList(request->GetEventKind());
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestList rl(GetRequestList(request->GetEventKind()));
     ControlEvent(jni, request, true);
     rl.push_back(request);
+    PublishRequestList(request->GetEventKind(), rl);
+}
+
+void RequestManager::AddInternalRequests(JNIEnv* jni,
+        const RequestList& requests)
+    throw(AgentException)
+{
+    if (requests.empty()) {
+        return;
+    }
+    const jdwpEventKind kind = requests.front()->GetEventKind();
+    JDWP_TRACE_EVENT("AddInternalRequests: event=" << GetEventKindName(kind)
+        << "[" << kind << "], count=" << requests.size());
+    JDWP_ASSERT(m_requestIdCount > 0);
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestList rl(GetRequestList(kind));
+    RequestListConstIterator i = requests.begin();
+    try {
+        for (; i != requests.end(); i++) {
+            JDWP_ASSERT((*i)->GetEventKind() == kind);
+            ControlEvent(jni, *i, true);
+        }
+    } catch (AgentException&) {
+        // roll back events enabled for already processed requests
+        while (i != requests.begin()) {
+            i--;
+            ControlEvent(jni, *i, false);
+        }
+        throw;
+    }
+    rl.insert(rl.end(), requests.begin(), requests.end());
+    PublishRequestList(kind, rl);
 }
 
 void RequestManager::EnableInternalStepRequest(JNIEnv* jni, jthread thread) throw(AgentException)
@@ -432,6 +1043,7 @@ void RequestManager::EnableInternalStepRequest(JNIEnv* jni, jthread thread) thro
     }
 #endif // NDEBUG
     
+    GetAgentManager().RequireCapability(AgentManager::CAP_SINGLE_STEP);
     JVMTI_TRACE(err, GetJvmtiEnv()->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_SINGLE_STEP, thread));
     if (err != JVMTI_ERROR_NONE) {
         throw AgentException(err);
@@ -474,12 +1086,13 @@ RequestID RequestManager::AddRequest(JNIEnv* jni, AgentEventRequest* request)
         << ", modCount=" << request->GetModifierCount()
         << ", policy=" << request->GetSuspendPolicy());
     JDWP_ASSERT(m_requestIdCount > 0);
-    RequestList& rl = GetRequestList(request->GetEventKind());
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestList rl(GetRequestList(request->GetEventKind()));
     ControlEvent(jni, request, true);
     int id = m_requestIdCount++;
     request->SetRequestId(id);
     rl.push_back(request);
+    PublishRequestList(request->GetEventKind(), rl);
     return id;
 }
 
@@ -489,14 +1102,19 @@ void RequestManager::DeleteRequest(JNIEnv* jni,
 {
     JDWP_TRACE_EVENT("DeleteRequest: event=" << GetEventKindName(kind)
         << "[" << kind << "], req=" << id);
-    RequestList& rl = GetRequestList(kind);
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    // the pinned snapshot keeps the deleted request alive until its
+    // events are disabled against the published list
+    RequestListSnapshot* snapshot = AcquireRequestList(kind);
+    RequestListAutoRelease autoRelease(snapshot);
+    RequestList rl(snapshot->m_list);
     for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
         AgentEventRequest* req = *i;
         if (id == req->GetRequestId()) {
             rl.erase(i);
+            PublishRequestList(kind, rl);
             ControlEvent(jni, req, false);
-            delete req;
+            req->OnDelete(jni);
             break;
         }
     }
@@ -509,19 +1127,55 @@ void RequestManager::DeleteRequest(JNIEnv* jni, AgentEventRequest* request)
         << GetEventKindName(request->GetEventKind())
         << "[" << request->GetEventKind()
         << "], req=" << request->GetRequestId());
-    RequestList& rl = GetRequestList(request->GetEventKind());
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestListSnapshot* snapshot =
+        AcquireRequestList(request->GetEventKind());
+    RequestListAutoRelease autoRelease(snapshot);
+    RequestList rl(snapshot->m_list);
     for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
         if (*i == request) {
             AgentEventRequest* req = *i;
             rl.erase(i);
+            PublishRequestList(req->GetEventKind(), rl);
             ControlEvent(jni, req, false);
-            delete req;
+            req->OnDelete(jni);
             break;
         }
     }
 }
 
+void RequestManager::DeleteRequests(JNIEnv* jni, const RequestList& requests)
+     throw(AgentException)
+{
+    if (requests.empty()) {
+        return;
+    }
+    const jdwpEventKind kind = requests.front()->GetEventKind();
+    JDWP_TRACE_EVENT("DeleteRequests: event=" << GetEventKindName(kind)
+        << "[" << kind << "], count=" << requests.size());
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestListSnapshot* snapshot = AcquireRequestList(kind);
+    RequestListAutoRelease autoRelease(snapshot);
+    RequestList rl(snapshot->m_list);
+    RequestList deleted;
+    for (RequestListIterator i = rl.begin(); i != rl.end(); ) {
+        if (find(requests.begin(), requests.end(), *i) != requests.end()) {
+            deleted.push_back(*i);
+            i = rl.erase(i);
+        } else {
+            i++;
+        }
+    }
+    if (deleted.empty()) {
+        return;
+    }
+    PublishRequestList(kind, rl);
+    for (RequestListConstIterator i = deleted.begin(); i != deleted.end(); i++) {
+        ControlEvent(jni, *i, false);
+        (*i)->OnDelete(jni);
+    }
+}
+
 void RequestManager::DeleteAllBreakpoints(JNIEnv* jni)
     throw(AgentException)
 {
@@ -532,16 +1186,19 @@ void RequestManager::DeleteAllRequests(JNIEnv* jni, jdwpEventKind eventKind) thr
 {
     JDWP_TRACE_EVENT("DeleteAllRequests: event=" << GetEventKindName(eventKind)
         << "[" << eventKind << "]"); 
-    RequestList& rl = GetRequestList(eventKind);
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestListSnapshot* snapshot = AcquireRequestList(eventKind);
+    RequestListAutoRelease autoRelease(snapshot);
+    RequestList rl(snapshot->m_list);
     while (!rl.empty()) {
         AgentEventRequest* req = rl.back();
         rl.pop_back();
+        // events are controlled against the published list, so publish
+        // the remaining requests before disabling events of this one
+        PublishRequestList(eventKind, rl);
         ControlEvent(jni, req, false);
-        if(req != 0)
-            delete req;
+        req->OnDelete(jni);
     }
-
 }
 
 const char*
@@ -580,6 +1237,8 @@ RequestManager::GetEventKindName(jdwpEventKind kind) const throw()
         return "METHOD_EXIT";
     case JDWP_EVENT_VM_DEATH:
         return "VM_DEATH";
+    case JDWP_EVENT_TRACEPOINT:
+        return "TRACEPOINT";
     default:
         return "UNKNOWN";
     }
@@ -588,9 +1247,9 @@ RequestManager::GetEventKindName(jdwpEventKind kind) const throw()
 StepRequest* RequestManager::FindStepRequest(JNIEnv* jni, jthread thread)
     throw(AgentException)
 {
-    RequestList& rl = GetRequestList(JDWP_EVENT_SINGLE_STEP);
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
-    for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
+    const RequestList& rl = GetRequestList(JDWP_EVENT_SINGLE_STEP);
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
         StepRequest* req = reinterpret_cast<StepRequest*> (*i);
         if (JNI_TRUE == jni->IsSameObject(thread, req->GetThread())) {
             return req;
@@ -604,19 +1263,41 @@ void RequestManager::DeleteStepRequest(JNIEnv* jni, jthread thread)
 {
     JDWP_TRACE_ENTRY("DeleteStepRequest(" << jni << ',' << thread << ")");
 
-    RequestList& rl = GetRequestList(JDWP_EVENT_SINGLE_STEP);
     MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    RequestList rl(GetRequestList(JDWP_EVENT_SINGLE_STEP));
     for (RequestListIterator i = rl.begin(); i != rl.end(); i++) {
         StepRequest* req = reinterpret_cast<StepRequest*> (*i);
         if (JNI_TRUE == jni->IsSameObject(thread, req->GetThread())) {
             JDWP_TRACE_EVENT("DeleteStepRequest: req=" << req->GetRequestId());
             rl.erase(i);
-            delete req;
+            req->OnDelete(jni);
+            PublishRequestList(JDWP_EVENT_SINGLE_STEP, rl);
             break;
         }
     }
 }
 
+bool RequestManager::OnStepBreakpoint(JNIEnv* jni, EventInfo& eInfo)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    StepRequest* step = FindStepRequest(jni, eInfo.thread);
+    return (step != 0 && step->OnBreakpoint(jni, eInfo));
+}
+
+bool RequestManager::OnStepException(JNIEnv* jni, EventInfo& eInfo,
+        AgentEventRequest* request)
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+    StepRequest* step = FindStepRequest(jni, eInfo.thread);
+    if (step == 0 || !step->IsOwnRequest(request)) {
+        return false;
+    }
+    step->OnException(jni);
+    return true;
+}
+
 // extract filtered RequestID(s) into list
 void RequestManager::GenerateEvents(JNIEnv* jni, EventInfo &eInfo,
         jint &eventCount, RequestID* &eventList, jdwpSuspendPolicy &sp)
@@ -624,20 +1305,42 @@ void RequestManager::GenerateEvents(JNIEnv* jni, EventInfo &eInfo,
 {
     JDWP_TRACE_ENTRY("GenerateEvents(" << jni << ", ...)");
 
-    RequestList& rl = GetRequestList(eInfo.kind);
-    MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
-    eventList = reinterpret_cast<RequestID*>
-        (GetMemoryManager().Allocate(sizeof(RequestID)*rl.size() JDWP_FILE_LINE));
-    for (RequestListIterator i = rl.begin(); i != rl.end();) {
+    // scan the snapshot without holding m_requestMonitor, so that event
+    // callbacks in different threads and request modifications do not
+    // serialize on each other
+    RequestListSnapshot* snapshot = AcquireRequestList(eInfo.kind);
+    RequestListAutoRelease autoRelease(snapshot);
+    const RequestList& rl = snapshot->m_list;
+    eventList = AllocateEventList(rl.size());
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
         AgentEventRequest* req = *i;
-        if (req->GetModifierCount() <= 0 || req->ApplyModifiers(jni, eInfo)) {
+        if (eInfo.kind == JDWP_EVENT_BREAKPOINT && req->GetCapture() != 0) {
+            // tracepoints are handled by GenerateTracepoints()
+            continue;
+        }
+        if (req->IsInjected() != eInfo.injected) {
+            // events of injected requests are reported by injected calls only
+            continue;
+        }
+        if (MatchRequest(jni, req, eInfo)) {
             if (req->GetRequestId() == 0 &&
                 eInfo.kind == JDWP_EVENT_METHOD_ENTRY)
             {
+                MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
                 StepRequest* step = FindStepRequest(jni, eInfo.thread);
                 if (step != 0) {
                     step->OnMethodEntry(jni, eInfo);
                 }
+            } else if (req->GetRequestId() == 0 &&
+                eInfo.kind == JDWP_EVENT_BREAKPOINT)
+            {
+                // internal breakpoints of step requests are already
+                // handled by OnStepBreakpoint()
+            } else if (req->GetRequestId() == 0 &&
+                eInfo.kind == JDWP_EVENT_EXCEPTION &&
+                OnStepException(jni, eInfo, req))
+            {
+                // exception in the stepped thread is handled by step request
             } else {
                 JDWP_TRACE_EVENT("GenerateEvents: event #" << eventCount
                     << ": kind=" << GetEventKindName(eInfo.kind)
@@ -652,16 +1355,328 @@ void RequestManager::GenerateEvents(JNIEnv* jni, EventInfo &eInfo,
                 eventList[eventCount++] = req->GetRequestId();
             }
             if (req->IsExpired()) {
-                i = rl.erase(i);
-                ControlEvent(jni, req, false);
-                delete req;
-                continue;
+                // does nothing if another thread has already deleted
+                // the request found in the same snapshot
+                DeleteRequest(jni, req);
+            }
+        }
+    }
+}
+
+RequestID* RequestManager::AllocateEventList(size_t size)
+    throw(AgentException)
+{
+    if (size == 0) {
+        return 0;
+    }
+    RequestID* block;
+    if (size <= EVENT_LIST_SIZE) {
+        block = static_cast<RequestID*>(m_eventListPool.Allocate());
+        block[0] = static_cast<RequestID>(EVENT_LIST_SIZE);
+    } else {
+        block = reinterpret_cast<RequestID*>(GetMemoryManager().Allocate(
+            sizeof(RequestID) * (size + 1) JDWP_FILE_LINE));
+        block[0] = static_cast<RequestID>(size);
+    }
+    return block + 1;
+}
+
+void RequestManager::FreeEventList(RequestID* list) throw()
+{
+    if (list == 0) {
+        return;
+    }
+    RequestID* block = list - 1;
+    if (block[0] == static_cast<RequestID>(EVENT_LIST_SIZE)) {
+        m_eventListPool.Free(block);
+    } else {
+        GetMemoryManager().Free(block JDWP_FILE_LINE);
+    }
+}
+
+bool RequestManager::MatchRequest(JNIEnv* jni, AgentEventRequest* req,
+        EventInfo &eInfo) throw(AgentException)
+{
+    if (req->GetModifierCount() <= 0) {
+        return !req->IsExpired();
+    } else if (req->IsCounted()) {
+        // Count modifier is decremented on each match, so only these
+        // requests need synchronized update; it also prevents reporting
+        // the request expired in another thread
+        MonitorAutoLock lock(m_requestMonitor JDWP_FILE_LINE);
+        return !req->IsExpired() && req->ApplyModifiers(jni, eInfo);
+    } else {
+        return !req->IsExpired() && req->ApplyModifiers(jni, eInfo);
+    }
+}
+
+// --------------------- begin of tracepoints support --------------------------
+
+void RequestManager::GenerateTracepoints(JNIEnv* jni, EventInfo &eInfo)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("GenerateTracepoints(" << jni << ", ...)");
+
+    RequestListSnapshot* snapshot = AcquireRequestList(JDWP_EVENT_BREAKPOINT);
+    RequestListAutoRelease autoRelease(snapshot);
+    const RequestList& rl = snapshot->m_list;
+    jdwpTypeTag typeTag = JDWP_TYPE_TAG_CLASS;
+    bool isTypeTagKnown = false;
+
+    for (RequestListConstIterator i = rl.begin(); i != rl.end(); i++) {
+        AgentEventRequest* req = *i;
+        CaptureModifier* capture = req->GetCapture();
+        if (capture == 0 || !MatchRequest(jni, req, eInfo)) {
+            continue;
+        }
+        if (!isTypeTagKnown) {
+            typeTag = GetClassManager().GetJdwpTypeTag(eInfo.cls);
+            isTypeTagKnown = true;
+        }
+
+        EventComposer* ec = 0;
+        bool isFirst = false;
+        {
+            MonitorAutoLock lock(m_tracepointMonitor JDWP_FILE_LINE);
+            if (m_tracepointEvents == 0) {
+                m_tracepointEvents = new EventComposer(GetEventDispatcher().NewId(),
+                    JDWP_COMMAND_SET_EVENT, JDWP_COMMAND_E_COMPOSITE, JDWP_SUSPEND_NONE);
+                m_tracepointCountPosition = m_tracepointEvents->event.GetPosition();
+                m_tracepointEvents->event.WriteInt(0);
+                m_tracepointCount = 0;
+                isFirst = true;
+            }
+
+            // keep the batch consistent if the record cannot be written
+            OutputPacketComposer& packet = m_tracepointEvents->event;
+            size_t recordPosition = packet.GetPosition();
+            jint recordLength = packet.GetLength();
+            try {
+                packet.WriteByte(JDWP_EVENT_TRACEPOINT);
+                packet.WriteInt(req->GetRequestId());
+                packet.WriteThreadID(jni, eInfo.thread);
+                packet.WriteLocation(jni, typeTag, eInfo.cls, eInfo.method,
+                    eInfo.location);
+                capture->WriteValues(jni, eInfo, packet);
+            } catch (AgentException& e) {
+                packet.SetPosition(recordPosition);
+                packet.SetLength(recordLength);
+                throw e;
             }
+            m_tracepointCount++;
+            JDWP_TRACE_EVENT("GenerateTracepoints: record #" << m_tracepointCount
+                << ": req=" << req->GetRequestId());
+
+            if (m_tracepointCount >= TRACEPOINT_BATCH_SIZE) {
+                ec = DetachTracepointEvents();
+            }
+        }
+
+        if (ec != 0) {
+            GetEventDispatcher().PostEventSet(jni, ec, JDWP_EVENT_TRACEPOINT);
+        } else if (isFirst) {
+            // wake up the dispatcher to send the batch when it is idle
+            GetEventDispatcher().NotifyPendingEvents();
         }
-        i++;
+
+        if (req->IsExpired()) {
+            DeleteRequest(jni, req);
+        }
+    }
+}
+
+EventComposer* RequestManager::DetachTracepointEvents()
+    throw(AgentException)
+{
+    EventComposer* ec = m_tracepointEvents;
+    if (ec != 0) {
+        OutputPacketComposer& packet = ec->event;
+        size_t currentPos = packet.GetPosition();
+        jint currentLength = packet.GetLength();
+        packet.SetPosition(m_tracepointCountPosition);
+        packet.WriteInt(m_tracepointCount);
+        packet.SetPosition(currentPos);
+        packet.SetLength(currentLength);
+        JDWP_TRACE_EVENT("DetachTracepointEvents: records=" << m_tracepointCount);
+        m_tracepointEvents = 0;
+        m_tracepointCount = 0;
+    }
+    return ec;
+}
+
+EventComposer* RequestManager::TakeTracepointEvents()
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_tracepointMonitor JDWP_FILE_LINE);
+    return DetachTracepointEvents();
+}
+
+void RequestManager::DeleteTracepointEvents(JNIEnv* jni) throw(AgentException)
+{
+    EventComposer* ec = 0;
+    {
+        MonitorAutoLock lock(m_tracepointMonitor JDWP_FILE_LINE);
+        ec = m_tracepointEvents;
+        m_tracepointEvents = 0;
+        m_tracepointCount = 0;
+    }
+    if (ec != 0) {
+        ec->Reset(jni);
+        delete ec;
+    }
+}
+
+// --------------------- end of tracepoints support ----------------------------
+
+// --------------------- begin of ClassPrepare batching -----------------------
+
+void RequestManager::BatchClassPrepareEvents(JNIEnv* jni, jthread thread,
+        jclass cls, jdwpTypeTag typeTag, const char* signature, jint status,
+        const RequestID* eventList, jint eventCount)
+    throw(AgentException)
+{
+    JDWP_TRACE_ENTRY("BatchClassPrepareEvents(" << jni << ',' << thread << ',' 
+        << cls << ',' << JDWP_CHECK_NULL(signature) << ',' << eventCount << ")");
+
+    jvmtiError err;
+    jlong now = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetTime(&now));
+    if (err != JVMTI_ERROR_NONE) {
+        // without a timer only the size bounds the batch
+        now = 0;
+    }
+
+    EventComposer* previous = 0;
+    EventComposer* ec = 0;
+    bool isFirst = false;
+    try {
+        {
+            MonitorAutoLock lock(m_classPrepareMonitor JDWP_FILE_LINE);
+
+            // events matching other requests start a new batch
+            if (m_classPrepareEvents != 0) {
+                bool isSame = (m_classPrepareBatchIdCount == eventCount);
+                for (jint i = 0; isSame && i < eventCount; i++) {
+                    isSame = (m_classPrepareBatchIds[i] == eventList[i]);
+                }
+                if (!isSame) {
+                    previous = DetachClassPrepareEvents();
+                }
+            }
+
+            if (m_classPrepareEvents == 0) {
+                RequestID* ids = reinterpret_cast<RequestID*>
+                    (GetMemoryManager().Allocate(sizeof(RequestID) * eventCount JDWP_FILE_LINE));
+                for (jint i = 0; i < eventCount; i++) {
+                    ids[i] = eventList[i];
+                }
+                m_classPrepareBatchIds = ids;
+                m_classPrepareBatchIdCount = eventCount;
+                m_classPrepareEvents = new EventComposer(GetEventDispatcher().NewId(),
+                    JDWP_COMMAND_SET_EVENT, JDWP_COMMAND_E_COMPOSITE, JDWP_SUSPEND_NONE);
+                m_classPrepareCountPosition = m_classPrepareEvents->event.GetPosition();
+                m_classPrepareEvents->event.WriteInt(0);
+                m_classPrepareCount = 0;
+                m_classPrepareStartTime = now;
+                isFirst = true;
+            }
+
+            // keep the batch consistent if the events cannot be written
+            OutputPacketComposer& packet = m_classPrepareEvents->event;
+            size_t recordPosition = packet.GetPosition();
+            jint recordLength = packet.GetLength();
+            try {
+                for (jint i = 0; i < eventCount; i++) {
+                    packet.WriteByte(JDWP_EVENT_CLASS_PREPARE);
+                    packet.WriteInt(eventList[i]);
+                    packet.WriteThreadID(jni, thread);
+                    packet.WriteByte(typeTag);
+                    packet.WriteReferenceTypeID(jni, cls);
+                    packet.WriteString(signature);
+                    packet.WriteInt(status);
+                }
+            } catch (AgentException& e) {
+                packet.SetPosition(recordPosition);
+                packet.SetLength(recordLength);
+                throw e;
+            }
+            m_classPrepareCount += eventCount;
+            JDWP_TRACE_EVENT("BatchClassPrepareEvents: events=" << m_classPrepareCount);
+
+            if (m_classPrepareCount >= CLASS_PREPARE_BATCH_SIZE ||
+                now - m_classPrepareStartTime >= CLASS_PREPARE_BATCH_TIME)
+            {
+                ec = DetachClassPrepareEvents();
+            }
+        }
+    } catch (AgentException& e) {
+        // events of the detached batch are sent anyway
+        if (previous != 0) {
+            GetEventDispatcher().PostBatchedEventSet(jni, previous,
+                JDWP_EVENT_CLASS_PREPARE);
+        }
+        throw e;
+    }
+
+    if (previous != 0) {
+        GetEventDispatcher().PostBatchedEventSet(jni, previous,
+            JDWP_EVENT_CLASS_PREPARE);
+    }
+    if (ec != 0) {
+        GetEventDispatcher().PostBatchedEventSet(jni, ec,
+            JDWP_EVENT_CLASS_PREPARE);
+    } else if (isFirst) {
+        // wake up the dispatcher to send the batch when it is idle
+        GetEventDispatcher().NotifyPendingEvents();
     }
 }
 
+EventComposer* RequestManager::DetachClassPrepareEvents()
+    throw(AgentException)
+{
+    EventComposer* ec = m_classPrepareEvents;
+    if (ec != 0) {
+        OutputPacketComposer& packet = ec->event;
+        size_t currentPos = packet.GetPosition();
+        jint currentLength = packet.GetLength();
+        packet.SetPosition(m_classPrepareCountPosition);
+        packet.WriteInt(m_classPrepareCount);
+        packet.SetPosition(currentPos);
+        packet.SetLength(currentLength);
+        JDWP_TRACE_EVENT("DetachClassPrepareEvents: events=" << m_classPrepareCount);
+        m_classPrepareEvents = 0;
+        m_classPrepareCount = 0;
+    }
+    if (m_classPrepareBatchIds != 0) {
+        GetMemoryManager().Free(m_classPrepareBatchIds JDWP_FILE_LINE);
+        m_classPrepareBatchIds = 0;
+        m_classPrepareBatchIdCount = 0;
+    }
+    return ec;
+}
+
+EventComposer* RequestManager::TakeClassPrepareEvents()
+    throw(AgentException)
+{
+    MonitorAutoLock lock(m_classPrepareMonitor JDWP_FILE_LINE);
+    return DetachClassPrepareEvents();
+}
+
+void RequestManager::DeleteClassPrepareEvents(JNIEnv* jni) throw(AgentException)
+{
+    EventComposer* ec = 0;
+    {
+        MonitorAutoLock lock(m_classPrepareMonitor JDWP_FILE_LINE);
+        ec = DetachClassPrepareEvents();
+    }
+    if (ec != 0) {
+        ec->Reset(jni);
+        delete ec;
+    }
+}
+
+// --------------------- end of ClassPrepare batching -------------------------
+
 // --------------------- begin of combined events support ---------------------
 
 CombinedEventsInfo::CombinedEventsInfo() throw ()
@@ -682,12 +1697,21 @@ CombinedEventsInfo::~CombinedEventsInfo() throw ()
 
     // destroy event lists
     for (int i = 0; i < COMBINED_EVENT_COUNT; i++) {
-        if (m_combinedEventsLists[i].list != 0) {
-            GetMemoryManager().Free(m_combinedEventsLists[i].list JDWP_FILE_LINE);
-        };
+        GetRequestManager().FreeEventList(m_combinedEventsLists[i].list);
     }
 }
 
+void* CombinedEventsInfo::operator new(size_t size) throw(AgentException)
+{
+    JDWP_ASSERT(size == GetRequestManager().GetCombinedEventsPool().GetBlockSize());
+    return GetRequestManager().GetCombinedEventsPool().Allocate();
+}
+
+void CombinedEventsInfo::operator delete(void* ptr) throw()
+{
+    GetRequestManager().GetCombinedEventsPool().Free(ptr);
+}
+
 void CombinedEventsInfo::Init(JNIEnv *jni, EventInfo &eInfo) 
         throw (OutOfMemoryException) 
 {
@@ -963,8 +1987,10 @@ void JNICALL RequestManager::HandleVMInit(jvmtiEnv *jvmti, JNIEnv *jni, jthread
     JDWP_TRACE_ENTRY("HandleVMInit(" << jvmti << ',' << jni << ',' << thread << ')');
 
     try {
+        // running VM is never suspended by attached agent
         jdwpSuspendPolicy sp = 
-            GetOptionParser().GetSuspend() ? JDWP_SUSPEND_ALL : JDWP_SUSPEND_NONE;
+            (GetOptionParser().GetSuspend() && !GetAgentManager().IsAttached())
+                ? JDWP_SUSPEND_ALL : JDWP_SUSPEND_NONE;
         EventComposer *ec = 
             new EventComposer(GetEventDispatcher().NewId(),
                 JDWP_COMMAND_SET_EVENT, JDWP_COMMAND_E_COMPOSITE, sp);
@@ -993,7 +2019,7 @@ void JNICALL RequestManager::HandleVMDeath(jvmtiEnv* jvmti, JNIEnv* jni)
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // for VM_DEATH event use SUSPEND_POLICY_ALL for any suspension
         if (sp != JDWP_SUSPEND_NONE) {
@@ -1050,6 +2076,16 @@ void JNICALL RequestManager::HandleClassPrepare(jvmtiEnv* jvmti, JNIEnv* jni,
         }
 #endif // NDEBUG
 
+        // a class loaded while method trace patterns were changed is
+        // retransformed before deferred breakpoints are resolved in it
+        GetRequestManager().UpdateMethodTrace(jni, cls, eInfo.signature);
+
+        // set deferred breakpoints before any code of the class is executed
+        GetRequestManager().ResolveDeferredBreakpoints(jni, cls, eInfo.signature);
+
+        GetClassManager().GetClassRegistry().AddClass(jni, cls,
+            eInfo.signature);
+
         jint eventCount = 0;
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
@@ -1057,7 +2093,7 @@ void JNICALL RequestManager::HandleClassPrepare(jvmtiEnv* jvmti, JNIEnv* jni,
         eInfo.thread = isAgent ? 0 : thread;
         sp = isAgent ? JDWP_SUSPEND_NONE : sp;
     
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -1067,6 +2103,12 @@ void JNICALL RequestManager::HandleClassPrepare(jvmtiEnv* jvmti, JNIEnv* jni,
             if (err != JVMTI_ERROR_NONE) {
                 throw AgentException(err);
             }
+            if (sp == JDWP_SUSPEND_NONE) {
+                // merge class loading storms into few composite packets
+                GetRequestManager().BatchClassPrepareEvents(jni, thread, cls,
+                    typeTag, eInfo.signature, status, eventList, eventCount);
+                return;
+            }
             EventComposer *ec = new EventComposer(GetEventDispatcher().NewId(),
                 JDWP_COMMAND_SET_EVENT, JDWP_COMMAND_E_COMPOSITE, sp);
             ec->event.WriteInt(eventCount);
@@ -1119,11 +2161,14 @@ void JNICALL RequestManager::HandleClassUnload(jvmtiEnv* jvmti, JNIEnv* jni,
         }
 #endif // NDEBUG
 
+        GetClassManager().GetReplyCache().DropUnloaded(jni);
+        GetClassManager().GetClassRegistry().DropUnloaded(jni);
+
         jint eventCount = 0;
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         bool isAgent = GetThreadManager().IsAgentThread(jni, thread);
         if (isAgent) {
@@ -1190,7 +2235,7 @@ void JNICALL RequestManager::HandleThreadEnd(jvmtiEnv* jvmti, JNIEnv* jni,
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -1239,7 +2284,7 @@ void JNICALL RequestManager::HandleThreadStart(jvmtiEnv* jvmti, JNIEnv* jni,
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -1285,11 +2330,6 @@ void JNICALL RequestManager::HandleBreakpoint(jvmtiEnv* jvmti, JNIEnv* jni,
         eInfo.location = location;
         CombinedEventsInfo::CombinedEventsKind combinedKind = CombinedEventsInfo::COMBINED_EVENT_BREAKPOINT;
 
-        // if this combined event was already prediced, ignore event
-        if (GetRequestManager().IsPredictedCombinedEvent(jni, eInfo, combinedKind)) {
-            return;
-        }
-
         JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodDeclaringClass(method, &eInfo.cls));
         if (err != JVMTI_ERROR_NONE) {
             throw AgentException(err);
@@ -1301,6 +2341,15 @@ void JNICALL RequestManager::HandleBreakpoint(jvmtiEnv* jvmti, JNIEnv* jni,
             throw AgentException(err);
         }
 
+        // record tracepoints first, as they are never part of combined
+        // events predicted by other callbacks
+        GetRequestManager().GenerateTracepoints(jni, eInfo);
+
+        // if this combined event was already prediced, ignore event
+        if (GetRequestManager().IsPredictedCombinedEvent(jni, eInfo, combinedKind)) {
+            return;
+        }
+
 #ifndef NDEBUG
         if (JDWP_TRACE_ENABLED(LOG_KIND_EVENT)) {
             char* name = 0;
@@ -1321,18 +2370,33 @@ void JNICALL RequestManager::HandleBreakpoint(jvmtiEnv* jvmti, JNIEnv* jni,
         CombinedEventsInfo* combinedEvents = new CombinedEventsInfo();
         combinedEvents->Init(jni, eInfo);
         
-        // generate BREAKPOINT events according to existing requests
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
-        CombinedEventsInfo::CombinedEventsList* events = 
-            &combinedEvents->m_combinedEventsLists[combinedKind];
+        CombinedEventsInfo::CombinedEventsList* events;
+
+        // generate SINGLE_STEP events if step over line driven by internal
+        // breakpoints is completed at this location
+        if (GetRequestManager().OnStepBreakpoint(jni, eInfo)) {
+            events = &combinedEvents->m_combinedEventsLists[
+                CombinedEventsInfo::COMBINED_EVENT_SINGLE_STEP];
+            eInfo.kind = JDWP_EVENT_SINGLE_STEP;
+            GetRequestManager().GenerateEvents(jni, eInfo, events->count, events->list, sp);
+            eInfo.kind = JDWP_EVENT_BREAKPOINT;
+            JDWP_TRACE_EVENT("HandleBreakpoint: SINGLE_STEP events:"
+                    << " count=" << events->count
+                    << ", suspendPolicy=" << sp 
+                    << ", location=" << combinedEvents->m_eInfo.location);
+        }
+
+        // generate BREAKPOINT events according to existing requests
+        events = &combinedEvents->m_combinedEventsLists[combinedKind];
         GetRequestManager().GenerateEvents(jni, eInfo, events->count, events->list, sp);
         JDWP_TRACE_EVENT("HandleBreakpoint: BREAKPOINT events:"
                 << " count=" << events->count
                 << ", suspendPolicy=" << sp 
                 << ", location=" << combinedEvents->m_eInfo.location);
 
-        // if no BREAKPOINT events then return from callback
-        if (events->count <= 0) {
+        // if no SINGLE_STEP or BREAKPOINT events then return from callback
+        if (combinedEvents->GetEventsCount() <= 0) {
             combinedEvents->Clean(jni);
             delete combinedEvents;
             combinedEvents = 0;
@@ -1468,6 +2532,18 @@ void JNICALL RequestManager::HandleException(jvmtiEnv* jvmti, JNIEnv* jni,
             return;
         }
 
+        if (exceptionClass == 0) {
+            exceptionClass = jni->GetObjectClass(exception);
+        }
+        JDWP_ASSERT(exceptionClass != 0);
+
+        // exceptions no request is interested in are dropped by one lookup
+        if (!GetRequestManager().GetExceptionFilter().MayMatch(jni,
+                exceptionClass, catch_method != 0))
+        {
+            return;
+        }
+
         EventInfo eInfo;
         memset(&eInfo, 0, sizeof(eInfo));
         eInfo.kind = JDWP_EVENT_EXCEPTION;
@@ -1488,12 +2564,7 @@ void JNICALL RequestManager::HandleException(jvmtiEnv* jvmti, JNIEnv* jni,
             throw AgentException(err);
         }
 
-        if (exceptionClass != 0) {
-            eInfo.auxClass = exceptionClass;
-        } else {
-            eInfo.auxClass = jni->GetObjectClass(exception);
-        }
-        JDWP_ASSERT(eInfo.auxClass != 0);
+        eInfo.auxClass = exceptionClass;
 
         if (catch_method != 0) {
             eInfo.caught = true;
@@ -1520,7 +2591,7 @@ void JNICALL RequestManager::HandleException(jvmtiEnv* jvmti, JNIEnv* jni,
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -1795,7 +2866,7 @@ void JNICALL RequestManager::HandleMethodExit(jvmtiEnv* jvmti, JNIEnv* jni,
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -1818,6 +2889,111 @@ void JNICALL RequestManager::HandleMethodExit(jvmtiEnv* jvmti, JNIEnv* jni,
     }
 }
 
+void JNICALL RequestManager::HandleInjectedMethodEntry(JNIEnv* jni,
+        jclass cls)
+{
+    HandleInjectedMethodEvent(jni, JDWP_EVENT_METHOD_ENTRY);
+}
+
+void JNICALL RequestManager::HandleInjectedMethodExit(JNIEnv* jni,
+        jclass cls)
+{
+    HandleInjectedMethodEvent(jni, JDWP_EVENT_METHOD_EXIT);
+}
+
+void RequestManager::HandleInjectedMethodEvent(JNIEnv* jni,
+        jdwpEventKind kind) throw()
+{
+    JDWP_TRACE_ENTRY("HandleInjectedMethodEvent(" << jni << ',' << kind << ')');
+
+    jvmtiError err;
+    jthread thread = 0;
+    JVMTI_TRACE(err, GetJvmtiEnv()->GetCurrentThread(&thread));
+    if (err != JVMTI_ERROR_NONE) {
+        return;
+    }
+
+    // if occured in agent thread, ignore event
+    if (GetThreadManager().IsAgentThread(jni, thread)) {
+        return;
+    }
+
+    // if is popFrames process, ignore event
+    if (kind == JDWP_EVENT_METHOD_ENTRY &&
+        GetThreadManager().IsPopFramesProcess(jni, thread))
+    {
+        return;
+    }
+
+    try {
+        EventInfo eInfo;
+        memset(&eInfo, 0, sizeof(eInfo));
+        eInfo.kind = kind;
+        eInfo.thread = thread;
+        eInfo.injected = true;
+        // frame 0 is the native method of the helper class
+        eInfo.frameDepth = 1;
+
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetFrameLocation(thread,
+            eInfo.frameDepth, &eInfo.method, &eInfo.location));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+        if (kind == JDWP_EVENT_METHOD_EXIT) {
+            // report location of the return instruction following the call
+            eInfo.location += MethodTraceInjector::PROBE_LENGTH;
+        }
+
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodDeclaringClass(eInfo.method,
+            &eInfo.cls));
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetClassSignature(eInfo.cls,
+            &eInfo.signature, 0));
+        JvmtiAutoFree jafSignature(eInfo.signature);
+        if (err != JVMTI_ERROR_NONE) {
+            throw AgentException(err);
+        }
+
+        JDWP_TRACE_EVENT("injected " << GetRequestManager().GetEventKindName(kind)
+            << " event:"
+            << " class=" << JDWP_CHECK_NULL(eInfo.signature)
+            << " method=" << eInfo.method
+            << " loc=" << eInfo.location);
+
+        // combined events are not predicted for injected calls
+        jint eventCount = 0;
+        RequestID *eventList = 0;
+        jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
+        GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
+        EventListAutoFree aafEL(eventList);
+
+        // post generated events
+        if (eventCount > 0) {
+            jdwpTypeTag typeTag = GetClassManager().GetJdwpTypeTag(eInfo.cls);
+            EventComposer *ec = new EventComposer(GetEventDispatcher().NewId(),
+                JDWP_COMMAND_SET_EVENT, JDWP_COMMAND_E_COMPOSITE, sp);
+            ec->event.WriteInt(eventCount);
+            for (jint i = 0; i < eventCount; i++) {
+                ec->event.WriteByte(kind);
+                ec->event.WriteInt(eventList[i]);
+                ec->WriteThread(jni, thread);
+                ec->event.WriteLocation(jni,
+                    typeTag, eInfo.cls, eInfo.method, eInfo.location);
+            }
+            JDWP_TRACE_EVENT("HandleInjectedMethodEvent: post set of "
+                << eventCount << " events");
+            GetEventDispatcher().PostEventSet(jni, ec, kind);
+        }
+    } catch (AgentException& e) {
+        JDWP_INFO("JDWP error in injected "
+            << GetRequestManager().GetEventKindName(kind) << ": "
+            << e.what() << " [" << e.ErrCode() << "]");
+    }
+}
+
 void JNICALL RequestManager::HandleFieldAccess(jvmtiEnv* jvmti, JNIEnv* jni,
         jthread thread, jmethodID method, jlocation location,
         jclass field_class, jobject object, jfieldID field)
@@ -1880,7 +3056,7 @@ void JNICALL RequestManager::HandleFieldAccess(jvmtiEnv* jvmti, JNIEnv* jni,
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -1972,7 +3148,7 @@ void JNICALL RequestManager::HandleFieldModification(jvmtiEnv* jvmti,
         RequestID *eventList = 0;
         jdwpSuspendPolicy sp = JDWP_SUSPEND_NONE;
         GetRequestManager().GenerateEvents(jni, eInfo, eventCount, eventList, sp);
-        AgentAutoFree aafEL(eventList JDWP_FILE_LINE);
+        EventListAutoFree aafEL(eventList);
 
         // post generated events
         if (eventCount > 0) {
@@ -2201,6 +3377,7 @@ void JNICALL RequestManager::HandleFramePop(jvmtiEnv* jvmti, JNIEnv* jni,
         }
 #endif // NDEBUG
 
+        MonitorAutoLock lock(GetRequestManager().m_requestMonitor JDWP_FILE_LINE);
         StepRequest* step = GetRequestManager().FindStepRequest(jni, thread);
         if (step != 0) {
             step->OnFramePop(jni);
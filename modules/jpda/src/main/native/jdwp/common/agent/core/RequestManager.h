@@ -38,16 +38,44 @@
 #include "AgentAllocator.h"
 #include "AgentEventRequest.h"
 #include "PacketParser.h"
+#include "MethodTraceInjector.h"
+#include "ExceptionFilter.h"
+#include "BlockPool.h"
 
 namespace jdwp {
 
-    /** Type for list of event requests. */
-    typedef vector<AgentEventRequest*,
-        AgentAllocator<AgentEventRequest*> > RequestList;
-
     /** Type for list iterator for event requests. */
     typedef RequestList::iterator RequestListIterator;
 
+    /** Type for constant list iterator for event requests. */
+    typedef RequestList::const_iterator RequestListConstIterator;
+
+    /**
+     * Immutable snapshot of the event requests registered for one event kind.
+     * A published snapshot is never modified: <code>RequestManager</code>
+     * builds a new copy under its request monitor and swaps it in, so event
+     * callbacks scan requests without holding any lock. A snapshot is freed
+     * when the last reference to it is released, and every request is
+     * deleted when no snapshot refers to it any more.
+     */
+    class RequestListSnapshot : public AgentBase {
+    public:
+
+        /**
+         * Creates a snapshot with the given requests, owned by the caller.
+         *
+         * @param list - the requests to copy into the snapshot
+         */
+        RequestListSnapshot(const RequestList& list) : m_list(list), m_refCount(1) {}
+
+        /** Requests of the snapshot. */
+        const RequestList m_list;
+
+        /** Number of holders of the snapshot, changed atomically. */
+        volatile jint m_refCount;
+
+    }; //RequestListSnapshot
+
     /** Class for storing and handling info about combined events
       * with the same location in the same thread.
       */
@@ -113,6 +141,18 @@ namespace jdwp {
          */
         void CountOccuredCallback(CombinedEventsKind combinedKind) throw ();
 
+        /**
+         * Takes the memory for a new object from the pool of
+         * <code>RequestManager</code>.
+         */
+        static void* operator new(size_t size) throw(AgentException);
+
+        /**
+         * Returns the memory of the object to the pool of
+         * <code>RequestManager</code>.
+         */
+        static void operator delete(void* ptr) throw();
+
     }; //CombinedEventsInfo
 
     /** Type for list of stored combined events info in all threads. */
@@ -163,6 +203,27 @@ namespace jdwp {
          */
         void Reset(JNIEnv* jni) throw(AgentException);
 
+        /**
+         * Returns the current snapshot of requests of the given kind.
+         * The returned snapshot stays valid and unchanged until it is
+         * released with <code>ReleaseRequestList()</code>, even if requests
+         * are added or deleted meanwhile.
+         *
+         * @param kind - the JDWP event kind
+         *
+         * @throws AgentException.
+         */
+        RequestListSnapshot* AcquireRequestList(jdwpEventKind kind)
+            throw(AgentException);
+
+        /**
+         * Releases the snapshot obtained by <code>AcquireRequestList()</code>
+         * and deletes the requests no longer referred by any snapshot.
+         *
+         * @param snapshot - the snapshot to release, may be <code>NULL</code>
+         */
+        void ReleaseRequestList(RequestListSnapshot* snapshot) throw();
+
         /**
          * Adds the given internal request to the list of requests of corresponding types.
          *
@@ -174,6 +235,19 @@ namespace jdwp {
         void AddInternalRequest(JNIEnv* jni, AgentEventRequest* request)
             throw(AgentException);
 
+        /**
+         * Adds the given internal requests of the same kind at once. Either
+         * all requests are added, or none of them if an error occurs.
+         *
+         * @param jni      - the JNI interface pointer
+         * @param requests - the list of <code>AgentEventRequest</code>
+         *                   instance pointers
+         *
+         * @throws AgentException.
+         */
+        void AddInternalRequests(JNIEnv* jni, const RequestList& requests)
+            throw(AgentException);
+
         /**
          * Adds the given request to the list of requests of corresponding types 
          * and assigns the unique ID for the request.
@@ -209,6 +283,18 @@ namespace jdwp {
         void DeleteRequest(JNIEnv* jni, AgentEventRequest* request)
             throw(AgentException);
 
+        /**
+         * Removes the given requests of the same kind from the corresponding
+         * request list at once.
+         *
+         * @param jni      - the JNI interface pointer
+         * @param requests - the list of pointers to the requests to delete
+         *
+         * @throws AgentException.
+         */
+        void DeleteRequests(JNIEnv* jni, const RequestList& requests)
+            throw(AgentException);
+
         /**
          * Removes all requests with the given kind from the corresponding request list.
          *
@@ -230,6 +316,74 @@ namespace jdwp {
          */
         void DeleteAllBreakpoints(JNIEnv* jni) throw(AgentException);
 
+        /**
+         * Takes the pending batch of tracepoint records, if any. Called by
+         * <code>EventDispatcher</code> when it has no other events to send,
+         * so that records are batched while the dispatcher is busy.
+         *
+         * @return The event packet with pending records, or 0.
+         */
+        EventComposer* TakeTracepointEvents() throw(AgentException);
+
+        /**
+         * Takes the pending batch of non-suspending ClassPrepare events, if
+         * any. Called by <code>EventDispatcher</code> when it has no other
+         * events to send and before any other event set is queued, so that
+         * the order of events is kept.
+         *
+         * @return The event packet with pending events, or 0.
+         */
+        EventComposer* TakeClassPrepareEvents() throw(AgentException);
+
+        /**
+         * Allocates a list for IDs of requests matched by an event. Short
+         * lists are taken from the pool.
+         *
+         * @param size - the maximal number of IDs
+         *
+         * @return The list, or 0 if <code>size</code> is 0.
+         */
+        RequestID* AllocateEventList(size_t size) throw(AgentException);
+
+        /**
+         * Frees the list allocated by <code>AllocateEventList()</code>.
+         *
+         * @param list - the list or 0
+         */
+        void FreeEventList(RequestID* list) throw();
+
+        /**
+         * Gets the pool of <code>CombinedEventsInfo</code> objects.
+         */
+        BlockPool& GetCombinedEventsPool() throw() {
+            return m_combinedEventsPool;
+        }
+
+        /**
+         * Gets the filter of exceptions matching Exception event requests.
+         */
+        ExceptionFilter& GetExceptionFilter() throw() {
+            return m_exceptionFilter;
+        }
+
+        /**
+         * Gets the injector of method entry/exit calls.
+         */
+        MethodTraceInjector& GetMethodTraceInjector() throw() {
+            return m_methodTraceInjector;
+        }
+
+        /**
+         * Moves breakpoints set in the methods of a class retransformed by
+         * <code>MethodTraceInjector</code> to the new bytecode indices, and
+         * switches steps over a line in the class to single stepping.
+         *
+         * @param jni   - the JNI interface pointer
+         * @param remap - the retransformed class
+         */
+        void RemapLocations(JNIEnv* jni,
+            const MethodTraceInjector::CodeRemap& remap) throw(AgentException);
+
         /**
          * Returns the name of the given JDWP event kind.
          *
@@ -373,6 +527,27 @@ namespace jdwp {
             jthread thread, jmethodID method, jboolean was_popped_by_exception,
             jvalue return_value);
 
+        /**
+         * Native method called on entry to a method of an instrumented class.
+         *
+         * @param jni - the JNI interface pointer
+         * @param cls - the helper class
+         *
+         * @see MethodTraceInjector
+         */
+        static void JNICALL HandleInjectedMethodEntry(JNIEnv* jni, jclass cls);
+
+        /**
+         * Native method called before a normal return from a method of an
+         * instrumented class.
+         *
+         * @param jni - the JNI interface pointer
+         * @param cls - the helper class
+         *
+         * @see MethodTraceInjector
+         */
+        static void JNICALL HandleInjectedMethodExit(JNIEnv* jni, jclass cls);
+
         /**
          * <code>FieldAccess</code> event callbacks.
          *
@@ -441,6 +616,62 @@ namespace jdwp {
         void ControlBreakpoint(JNIEnv* jni, AgentEventRequest* request,
             bool enable) throw(AgentException);
 
+        /**
+         * Enables/disables all appropriate events for given Breakpoint event
+         * request with DeferredLocation modifier. 
+         */
+        void ControlDeferredBreakpoint(JNIEnv* jni,
+            DeferredLocationModifier* modifier, bool enable)
+            throw(AgentException);
+
+        /**
+         * Checks whether a JVMTI breakpoint is set at the given location
+         * for any published Breakpoint event request. 
+         */
+        bool IsBreakpointSet(JNIEnv* jni, jclass cls, jmethodID method,
+            jlocation location) throw(AgentException);
+
+        /**
+         * Checks whether any Breakpoint event request with DeferredLocation
+         * modifier is published. 
+         */
+        bool HasDeferredBreakpoints() throw(AgentException);
+
+        /**
+         * Checks whether any ClassPrepare event request for all threads
+         * is published. 
+         */
+        bool HasGlobalClassPrepare() throw(AgentException);
+
+        /**
+         * Disables ClassPrepare notification unless it is needed for
+         * requests, deferred breakpoints, the class registry or the method
+         * trace injector.
+         */
+        void ReleaseClassPrepare() throw(AgentException);
+
+        /**
+         * Retransforms the given class, which has just been prepared, if it
+         * is instrumented for previous method trace patterns.
+         */
+        void UpdateMethodTrace(JNIEnv* jni, jclass cls, const char* signature)
+            throw(AgentException);
+
+        /**
+         * Sets breakpoints for the given deferred location in all methods
+         * of the given prepared class. 
+         */
+        void ResolveDeferredBreakpoint(JNIEnv* jni,
+            DeferredLocationModifier* modifier, jclass cls)
+            throw(AgentException);
+
+        /**
+         * Resolves all deferred breakpoints matching the given class, which
+         * has just been prepared. 
+         */
+        void ResolveDeferredBreakpoints(JNIEnv* jni, jclass cls,
+            const char* signature) throw(AgentException);
+
         /**
          * Enables/disables all appropriate events for given Watchpoint event request. 
          */
@@ -455,6 +686,17 @@ namespace jdwp {
         jint ControlClassUnload(JNIEnv* jni, AgentEventRequest* request, 
             bool enable) throw(AgentException);
 
+        /**
+         * Enables/disables injected calls for given MethodEntry or MethodExit
+         * event request with ClassMatch modifier.
+         *
+         * @return <code>true</code> if events of the request are reported by
+         *         injected calls, or <code>false</code> if JVMTI events
+         *         should be used.
+         */
+        bool ControlMethodTrace(JNIEnv* jni, AgentEventRequest* request,
+            bool enable) throw(AgentException);
+
         /**
          * Enables/disables all appropriate events for given event request. 
          */
@@ -462,11 +704,33 @@ namespace jdwp {
             throw(AgentException);
 
         /**
-         * Returns all registered event requests for given event kind. 
+         * Returns the published snapshot slot for given event kind. 
+         */
+        RequestListSnapshot*& GetRequestSnapshot(jdwpEventKind kind)
+            throw(AgentException);
+
+        /**
+         * Returns all registered event requests for given event kind.
+         * Should be called with <code>m_requestMonitor</code> held.
          */
-        RequestList& GetRequestList(jdwpEventKind kind)
+        const RequestList& GetRequestList(jdwpEventKind kind)
             throw(AgentException);
 
+        /**
+         * Publishes the given list as the new snapshot of requests of given
+         * kind and releases the previous one.
+         * Should be called with <code>m_requestMonitor</code> held.
+         */
+        void PublishRequestList(jdwpEventKind kind, const RequestList& list)
+            throw(AgentException);
+
+        /**
+         * Flips the reader epoch and waits until readers of the previous
+         * epoch pin their snapshots, so that a replaced snapshot can be
+         * released. Should be called with <code>m_requestMonitor</code> held.
+         */
+        void WaitForSnapshotReaders() throw();
+
         /**
          * Deletes step request for given thread if any. 
          */
@@ -479,6 +743,26 @@ namespace jdwp {
         StepRequest* FindStepRequest(JNIEnv* jni, jthread thread)
             throw(AgentException);
 
+        /**
+         * Passes the breakpoint event to the step request of the event
+         * thread, if any.
+         *
+         * @return <code>true</code> if the step is completed at the
+         *         breakpoint location.
+         */
+        bool OnStepBreakpoint(JNIEnv* jni, EventInfo& eInfo)
+            throw(AgentException);
+
+        /**
+         * Passes the exception event to the step request of the event
+         * thread, if the given internal request belongs to it.
+         *
+         * @return <code>true</code> if the event is consumed by the step
+         *         request and should not be reported.
+         */
+        bool OnStepException(JNIEnv* jni, EventInfo& eInfo,
+                AgentEventRequest* request) throw(AgentException);
+
         /**
          * Write data for all combined events to event packet. 
          */
@@ -528,28 +812,164 @@ namespace jdwp {
         void GenerateEvents(JNIEnv* jni, EventInfo &event, jint &eventCount, 
                     RequestID* &eventList, jdwpSuspendPolicy &sp) throw(AgentException);
 
+        /**
+         * Generates and posts MethodEntry or MethodExit events reported by
+         * the injected calls.
+         */
+        static void HandleInjectedMethodEvent(JNIEnv* jni, jdwpEventKind kind)
+            throw();
+
+        /**
+         * Applies modifiers of the given request to the fired event.
+         */
+        bool MatchRequest(JNIEnv* jni, AgentEventRequest* request,
+                    EventInfo &eInfo) throw(AgentException);
+
+        /**
+         * Writes records of all tracepoint requests matched to the fired
+         * breakpoint event into the pending batch.
+         */
+        void GenerateTracepoints(JNIEnv* jni, EventInfo &eInfo)
+            throw(AgentException);
+
+        /**
+         * Detaches the pending batch of tracepoint records. Called under
+         * the tracepoint monitor.
+         */
+        EventComposer* DetachTracepointEvents() throw(AgentException);
+
+        /**
+         * Discards the pending batch of tracepoint records.
+         */
+        void DeleteTracepointEvents(JNIEnv* jni) throw(AgentException);
+
+        /** Maximal number of tracepoint records sent in one packet. */
+        static const jint TRACEPOINT_BATCH_SIZE = 256;
+
+        /**
+         * Writes non-suspending ClassPrepare events generated for the given
+         * class into the pending batch. The batch is posted when it is full,
+         * too old, or the matched requests change.
+         */
+        void BatchClassPrepareEvents(JNIEnv* jni, jthread thread, jclass cls,
+            jdwpTypeTag typeTag, const char* signature, jint status,
+            const RequestID* eventList, jint eventCount) throw(AgentException);
+
+        /**
+         * Detaches the pending batch of ClassPrepare events. Called under
+         * the class prepare monitor.
+         */
+        EventComposer* DetachClassPrepareEvents() throw(AgentException);
+
+        /**
+         * Discards the pending batch of ClassPrepare events.
+         */
+        void DeleteClassPrepareEvents(JNIEnv* jni) throw(AgentException);
+
+        /** Maximal number of ClassPrepare events sent in one packet. */
+        static const jint CLASS_PREPARE_BATCH_SIZE = 1024;
+
+        /** Maximal age of the pending ClassPrepare batch in nanoseconds. */
+        static const jlong CLASS_PREPARE_BATCH_TIME = 100000000;
+
         RequestID m_requestIdCount;
+
+        // serializes modifications of request lists
         AgentMonitor* m_requestMonitor;
+
+        // epoch of readers pinning snapshots, flipped by publishers
+        volatile jint m_snapshotEpoch;
+
+        // number of readers pinning a snapshot in each epoch
+        volatile jint m_snapshotReaders[2];
+
         AgentMonitor* m_combinedEventsMonitor;
 
-        RequestList m_singleStepRequests;
-        RequestList m_breakpointRequests;
-        RequestList m_framePopRequests;
-        RequestList m_exceptionRequests;
-        RequestList m_userDefinedRequests;
-        RequestList m_threadStartRequests;
-        RequestList m_threadEndRequests;
-        RequestList m_classPrepareRequests;
-        RequestList m_classUnloadRequests;
-        RequestList m_classLoadRequests;
-        RequestList m_fieldAccessRequests;
-        RequestList m_fieldModificationRequests;
-        RequestList m_exceptionCatchRequests;
-        RequestList m_methodEntryRequests;
-        RequestList m_methodExitRequests;
-        RequestList m_vmDeathRequests;
+        // guards the pending batch of tracepoint records
+        AgentMonitor* m_tracepointMonitor;
+        EventComposer* m_tracepointEvents;
+        size_t m_tracepointCountPosition;
+        jint m_tracepointCount;
+
+        // guards the pending batch of ClassPrepare events, which all match
+        // the same requests
+        AgentMonitor* m_classPrepareMonitor;
+        EventComposer* m_classPrepareEvents;
+        size_t m_classPrepareCountPosition;
+        jint m_classPrepareCount;
+        jlong m_classPrepareStartTime;
+        RequestID* m_classPrepareBatchIds;
+        jint m_classPrepareBatchIdCount;
+
+        RequestListSnapshot* m_singleStepRequests;
+        RequestListSnapshot* m_breakpointRequests;
+        RequestListSnapshot* m_framePopRequests;
+        RequestListSnapshot* m_exceptionRequests;
+        RequestListSnapshot* m_userDefinedRequests;
+        RequestListSnapshot* m_threadStartRequests;
+        RequestListSnapshot* m_threadEndRequests;
+        RequestListSnapshot* m_classPrepareRequests;
+        RequestListSnapshot* m_classUnloadRequests;
+        RequestListSnapshot* m_classLoadRequests;
+        RequestListSnapshot* m_fieldAccessRequests;
+        RequestListSnapshot* m_fieldModificationRequests;
+        RequestListSnapshot* m_exceptionCatchRequests;
+        RequestListSnapshot* m_methodEntryRequests;
+        RequestListSnapshot* m_methodExitRequests;
+        RequestListSnapshot* m_vmDeathRequests;
 
         CombinedEventsInfoList m_combinedEventsInfoList;
+
+        MethodTraceInjector m_methodTraceInjector;
+
+        ExceptionFilter m_exceptionFilter;
+
+        /** Maximal number of free objects and lists kept in the pools. */
+        static const jint EVENT_POOL_SIZE = 256;
+
+        /** Number of IDs in pooled event lists. */
+        static const size_t EVENT_LIST_SIZE = 8;
+
+        BlockPool m_combinedEventsPool;
+
+        // lists with EVENT_LIST_SIZE IDs, preceded by the list capacity
+        BlockPool m_eventListPool;
+    };
+
+    /**
+     * Releases the acquired snapshot of event requests on scope exit.
+     */
+    class RequestListAutoRelease {
+
+    public:
+
+        RequestListAutoRelease(RequestListSnapshot* snapshot) throw()
+            : m_snapshot(snapshot) {}
+
+        ~RequestListAutoRelease() throw() {
+            AgentBase::GetRequestManager().ReleaseRequestList(m_snapshot);
+        }
+
+    private:
+        RequestListSnapshot* m_snapshot;
+    };
+
+    /**
+     * Frees the list of request IDs generated for an event on scope exit.
+     */
+    class EventListAutoFree {
+
+    public:
+
+        EventListAutoFree(RequestID* list) throw()
+            : m_list(list) {}
+
+        ~EventListAutoFree() throw() {
+            AgentBase::GetRequestManager().FreeEventList(m_list);
+        }
+
+    private:
+        RequestID* m_list;
     };
 
 }
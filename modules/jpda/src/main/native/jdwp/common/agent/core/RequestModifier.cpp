@@ -24,12 +24,15 @@
 #include <string.h>
 
 #include "RequestModifier.h"
+#include "ClassManager.h"
+#include "PacketParser.h"
+#include "AtomicOps_pd.h"
 
 using namespace jdwp;
 
 // match signature with pattern omitting first 'L' and last ";"
 bool RequestModifier::MatchPattern(const char *signature, const char *pattern)
-    const throw()
+    throw()
 {
     if (signature == 0) {
         return false;
@@ -52,3 +55,245 @@ bool RequestModifier::MatchPattern(const char *signature, const char *pattern)
             strncmp(pattern, &signature[1], patternLength) == 0);
     }
 }
+
+jlocation DeferredLocationModifier::FindLocation(jmethodID method)
+    const throw()
+{
+    jvmtiError err;
+    if (m_methodName[0] != '\0' || m_methodSignature[0] != '\0') {
+        char* name = 0;
+        char* signature = 0;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodName(method,
+            &name, &signature, 0));
+        JvmtiAutoFree afn(name);
+        JvmtiAutoFree afs(signature);
+        if (err != JVMTI_ERROR_NONE ||
+            (m_methodName[0] != '\0' && strcmp(name, m_methodName) != 0) ||
+            (m_methodSignature[0] != '\0' &&
+             strcmp(signature, m_methodSignature) != 0))
+        {
+            return -1;
+        }
+    }
+
+    if (m_line <= 0) {
+        jlocation start;
+        jlocation end;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodLocation(method,
+            &start, &end));
+        if (err != JVMTI_ERROR_NONE || start == -1 ||
+            m_codeIndex < start || m_codeIndex > end)
+        {
+            return -1;
+        }
+        return m_codeIndex;
+    }
+
+    try {
+        // entries are sorted by location, so the first one is the line start
+        const LineTable* lineTable = GetClassManager().GetLineTable(method);
+        for (jint i = 0; i < lineTable->m_count; i++) {
+            if (lineTable->m_entries[i].line_number == m_line) {
+                return lineTable->m_entries[i].start_location;
+            }
+        }
+    } catch (AgentException& e) {
+        JDWP_TRACE_DATA("FindLocation: no line table: method=" << method
+            << ", err=" << e.ErrCode());
+    }
+    return -1;
+}
+
+bool DeferredLocationModifier::IsResolvedAt(jmethodID method,
+        jlocation location) const throw()
+{
+    for (ResolvedLocationList::const_iterator i = m_resolvedLocations.begin();
+            i != m_resolvedLocations.end(); i++)
+    {
+        if (i->method == method && i->location == location) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SampleModifier::Apply(JNIEnv* jni, EventInfo &eInfo) throw()
+{
+    if (m_interval > 1) {
+        jint hit = AtomicIncrement(&m_hitCount);
+        if (static_cast<unsigned int>(hit) % m_interval != 0) {
+            return false;
+        }
+    }
+
+    if (m_maxPerSecond > 0) {
+        jlong nanos;
+        jvmtiError err;
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetTime(&nanos));
+        if (err != JVMTI_ERROR_NONE) {
+            return true;
+        }
+        // only equality of seconds matters, so truncation is harmless
+        jint second = static_cast<jint>(nanos / 1000000000);
+        jint oldSecond = m_second;
+        if (second != oldSecond &&
+            AtomicCompareAndSet(&m_second, oldSecond, second))
+        {
+            m_secondCount = 0;
+        }
+        if (AtomicIncrement(&m_secondCount) > m_maxPerSecond) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CaptureModifier::WriteValues(JNIEnv* jni, EventInfo &eInfo,
+        OutputPacketComposer& packet) const throw(AgentException)
+{
+    jvmtiError err;
+    jobject thisObject = 0;
+    bool isThisRead = false;
+
+    for (CaptureList::const_iterator i = m_captures.begin();
+            i != m_captures.end(); i++)
+    {
+        if (i->kind == JDWP_CAPTURE_THREAD_NAME) {
+            jvmtiThreadInfo info;
+            info.name = 0;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadInfo(eInfo.thread, &info));
+            JvmtiAutoFree jafName(info.name);
+            if (err != JVMTI_ERROR_NONE) {
+                packet.WriteString("");
+                continue;
+            }
+            jni->DeleteLocalRef(info.thread_group);
+            jni->DeleteLocalRef(info.context_class_loader);
+            packet.WriteString(info.name);
+            continue;
+        }
+
+        if (i->kind == JDWP_CAPTURE_TIMESTAMP) {
+            jlong nanos = 0;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetTime(&nanos));
+            packet.WriteLong(nanos);
+            continue;
+        }
+
+        jfieldID field = 0;
+        if (i->kind == JDWP_CAPTURE_THIS_FIELD) {
+            if (!isThisRead) {
+                isThisRead = true;
+                // the instance of field events is the accessed object
+                thisObject = 0;
+                jint modifiers = ACC_STATIC;
+                JVMTI_TRACE(err, GetJvmtiEnv()->GetMethodModifiers(eInfo.method,
+                    &modifiers));
+                if (err == JVMTI_ERROR_NONE && (modifiers & ACC_STATIC) == 0) {
+                    // get "this" object from slot 0 (stated in JVM spec)
+                    JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalObject(eInfo.thread,
+                        eInfo.frameDepth, 0, &thisObject));
+                    if (err != JVMTI_ERROR_NONE) {
+                        thisObject = 0;
+                    }
+                }
+            }
+            if (thisObject != 0) {
+                jclass cls = jni->GetObjectClass(thisObject);
+                field = jni->GetFieldID(cls, i->name, i->signature);
+                jni->DeleteLocalRef(cls);
+                if (field == 0) {
+                    jni->ExceptionClear();
+                }
+            }
+            if (field == 0) {
+                packet.WriteByte(JDWP_TAG_VOID);
+                continue;
+            }
+        }
+
+        jvalue value;
+        err = JVMTI_ERROR_NONE;
+        switch (i->tag) {
+        case JDWP_TAG_BOOLEAN:
+        case JDWP_TAG_BYTE:
+        case JDWP_TAG_CHAR:
+        case JDWP_TAG_SHORT:
+        case JDWP_TAG_INT:
+            {
+                jint intValue = 0;
+                if (field == 0) {
+                    JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalInt(eInfo.thread,
+                        eInfo.frameDepth, i->slot, &intValue));
+                } else if (i->tag == JDWP_TAG_BOOLEAN) {
+                    intValue = jni->GetBooleanField(thisObject, field);
+                } else if (i->tag == JDWP_TAG_BYTE) {
+                    intValue = jni->GetByteField(thisObject, field);
+                } else if (i->tag == JDWP_TAG_CHAR) {
+                    intValue = jni->GetCharField(thisObject, field);
+                } else if (i->tag == JDWP_TAG_SHORT) {
+                    intValue = jni->GetShortField(thisObject, field);
+                } else {
+                    intValue = jni->GetIntField(thisObject, field);
+                }
+                switch (i->tag) {
+                case JDWP_TAG_BOOLEAN: value.z = static_cast<jboolean>(intValue); break;
+                case JDWP_TAG_BYTE: value.b = static_cast<jbyte>(intValue); break;
+                case JDWP_TAG_CHAR: value.c = static_cast<jchar>(intValue); break;
+                case JDWP_TAG_SHORT: value.s = static_cast<jshort>(intValue); break;
+                default: value.i = intValue; break;
+                }
+                break;
+            }
+        case JDWP_TAG_LONG:
+            if (field == 0) {
+                JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalLong(eInfo.thread,
+                    eInfo.frameDepth, i->slot, &value.j));
+            } else {
+                value.j = jni->GetLongField(thisObject, field);
+            }
+            break;
+        case JDWP_TAG_FLOAT:
+            if (field == 0) {
+                JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalFloat(eInfo.thread,
+                    eInfo.frameDepth, i->slot, &value.f));
+            } else {
+                value.f = jni->GetFloatField(thisObject, field);
+            }
+            break;
+        case JDWP_TAG_DOUBLE:
+            if (field == 0) {
+                JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalDouble(eInfo.thread,
+                    eInfo.frameDepth, i->slot, &value.d));
+            } else {
+                value.d = jni->GetDoubleField(thisObject, field);
+            }
+            break;
+        default:
+            // any object tag
+            if (field == 0) {
+                JVMTI_TRACE(err, GetJvmtiEnv()->GetLocalObject(eInfo.thread,
+                    eInfo.frameDepth, i->slot, &value.l));
+            } else {
+                value.l = jni->GetObjectField(thisObject, field);
+            }
+            if (err == JVMTI_ERROR_NONE) {
+                packet.WriteTaggedObjectID(jni, value.l);
+                jni->DeleteLocalRef(value.l);
+            } else {
+                packet.WriteByte(JDWP_TAG_VOID);
+            }
+            continue;
+        }
+
+        if (err == JVMTI_ERROR_NONE) {
+            packet.WriteValue(jni, i->tag, value);
+        } else {
+            packet.WriteByte(JDWP_TAG_VOID);
+        }
+    }
+
+    if (thisObject != 0) {
+        jni->DeleteLocalRef(thisObject);
+    }
+}
@@ -29,10 +29,16 @@
 #ifndef _REQUEST_MODIFIER_H_
 #define _REQUEST_MODIFIER_H_
 
+#include <vector>
+
 #include "AgentBase.h"
+#include "AgentAllocator.h"
+#include "ConditionExpression.h"
 
 namespace jdwp {
 
+    class OutputPacketComposer;
+
     /**
      * The event description structure used in <code>RequestManager</code>.
      */
@@ -94,6 +100,19 @@ namespace jdwp {
          * was caught.
          */
         bool caught;
+
+        /**
+         * The flag indicating that the method entry or exit event is reported
+         * by the code injected into the method rather than by JVMTI.
+         */
+        bool injected;
+
+        /**
+         * The depth of the frame of <code>method</code> in the thread
+         * stack, which is not 0 when the event is posted by a helper
+         * method called from that frame.
+         */
+        jint frameDepth;
     };
 
     /**
@@ -135,10 +154,17 @@ namespace jdwp {
          */
         jdwpRequestModifier GetKind() const throw() { return m_kind; }
 
-    protected:
+        /**
+         * Matches the class signature against the class pattern of
+         * <code>ClassMatch</code> and <code>ClassExclude</code> modifiers.
+         *
+         * @param signature - the JNI class signature
+         * @param pattern   - the class pattern with '/' separators
+         */
+        static bool MatchPattern(const char *signature, const char *pattern)
+            throw();
 
-        bool MatchPattern(const char *signature, const char *pattern)
-            const throw();
+    protected:
 
         jdwpRequestModifier m_kind;
 
@@ -196,10 +222,59 @@ namespace jdwp {
 
     };
 
+    /**
+     * The class implements the vendor-specific <code>Sample</code> modifier
+     * enabling every N-th of the requested events, and at most K of them per
+     * second, to be reported without expiring the request. Counters are
+     * updated atomically, so the modifier is applied without the request
+     * monitor; a few more than K events may pass at the second boundary.
+     */
+    class SampleModifier : public RequestModifier {
+
+    public:
+
+        /**
+         * A constructor.
+         *
+         * @param interval     - the sampling interval, 1 to pass every event
+         * @param maxPerSecond - the maximal rate of events, 0 for no limit
+         */
+        SampleModifier(jint interval, jint maxPerSecond) :
+            RequestModifier(JDWP_MODIFIER_SAMPLE),
+            m_interval(interval),
+            m_maxPerSecond(maxPerSecond),
+            m_hitCount(0),
+            m_second(0),
+            m_secondCount(0)
+        {}
+
+        /**
+         * Applies sampling and rate limit for the given event.
+         *
+         * @param jni    - the JNI interface pointer
+         * @param eInfo  - the request-event information
+         *
+         * @return Returns <code>TRUE</code> if the event is sampled and the
+         *         rate limit is not reached, otherwise <code>FALSE</code>.
+         */
+        bool Apply(JNIEnv* jni, EventInfo &eInfo) throw();
+
+    private:
+
+        jint m_interval;
+        jint m_maxPerSecond;
+        volatile jint m_hitCount;
+        volatile jint m_second;
+        volatile jint m_secondCount;
+
+    };
+
     /**
      * The class implements the Conditional modifier enabling the requested events
-     * to be reported depending on the specified expression. Currently, not 
-     * implemented.
+     * to be reported depending on the specified expression. The standard form
+     * refers to an expression ID, which is not supported and always passes;
+     * the vendor-specific form carries a <code>ConditionExpression</code>
+     * that is evaluated by the agent in the event callback.
      */
     class ConditionalModifier : public RequestModifier {
 
@@ -212,9 +287,26 @@ namespace jdwp {
          */
         ConditionalModifier(jint id) :
             RequestModifier(JDWP_MODIFIER_CONDITIONAL),
-            m_exprID(id)
+            m_exprID(id), m_expression(0)
+        {}
+
+        /**
+         * A constructor.
+         *
+         * @param expression - the compiled condition, owned by the modifier
+         */
+        ConditionalModifier(ConditionExpression* expression) :
+            RequestModifier(JDWP_MODIFIER_CONDITIONAL),
+            m_exprID(0), m_expression(expression)
         {}
 
+        /**
+         * A destructor.
+         */
+        ~ConditionalModifier() {
+            delete m_expression;
+        }
+
         /**
          * Gets the expression ID.
          *
@@ -228,15 +320,17 @@ namespace jdwp {
          * @param jni    - the JNI interface pointer
          * @param eInfo  - the request-event information
          *
-         * @return <code>TRUE</code> (not implemented).
+         * @return <code>FALSE</code> only if the compiled condition is
+         *         evaluated to false.
          */
         bool Apply(JNIEnv* jni, EventInfo &eInfo) throw() {
-            return true;
+            return (m_expression == 0 || m_expression->Evaluate(jni, eInfo));
         }
 
     private:
 
         jint m_exprID;
+        ConditionExpression* m_expression;
 
     };
 
@@ -538,6 +632,16 @@ namespace jdwp {
             return m_location;
         }
 
+        /**
+         * Sets the Java location, when the method code is changed by
+         * retransformation.
+         *
+         * @param loc - the Java location in the new code
+         */
+        void SetLocation(jlocation loc) throw() {
+            m_location = loc;
+        }
+
         /**
          * Applies filtering by belonging to the given location for the given event.
          *
@@ -899,6 +1003,203 @@ namespace jdwp {
 
     };
 
+    /**
+     * The class implements the vendor-specific <code>DeferredLocation</code>
+     * modifier for breakpoint requests. The breakpoint location is given by
+     * class pattern plus line number or method and code index, so it can be
+     * requested before the class is loaded; <code>RequestManager</code>
+     * resolves it in every matching class when the class is prepared.
+     */
+    class DeferredLocationModifier : public RequestModifier {
+
+    public:
+
+        /**
+         * A resolved breakpoint location.
+         */
+        struct ResolvedLocation {
+            jmethodID method;
+            jlocation location;
+        };
+
+        /** Type for list of resolved locations. */
+        typedef vector<ResolvedLocation,
+            AgentAllocator<ResolvedLocation> > ResolvedLocationList;
+
+        /**
+         * A constructor.
+         *
+         * @param pattern         - the class match pattern
+         * @param line            - the line number, or not positive value
+         *                          to use the code index
+         * @param methodName      - the method name, empty for any method
+         * @param methodSignature - the method signature, empty for any
+         * @param codeIndex       - the code index in the method
+         */
+        DeferredLocationModifier(char* pattern, jint line, char* methodName,
+                char* methodSignature, jlocation codeIndex)
+            : RequestModifier(JDWP_MODIFIER_DEFERRED_LOCATION)
+            , m_pattern(pattern)
+            , m_line(line)
+            , m_methodName(methodName)
+            , m_methodSignature(methodSignature)
+            , m_codeIndex(codeIndex)
+        {}
+
+        /**
+         * A destructor.
+         */
+        ~DeferredLocationModifier() {
+            GetMemoryManager().Free(m_pattern JDWP_FILE_LINE);
+            GetMemoryManager().Free(m_methodName JDWP_FILE_LINE);
+            GetMemoryManager().Free(m_methodSignature JDWP_FILE_LINE);
+        }
+
+        /**
+         * Checks whether the given class signature matches the class pattern.
+         *
+         * @param signature - the class signature
+         */
+        bool MatchClass(const char* signature) const throw() {
+            return MatchPattern(signature, m_pattern);
+        }
+
+        /**
+         * Finds the breakpoint location in the given method.
+         *
+         * @param method - the method of a matching class
+         *
+         * @return The location, or -1 if the breakpoint is not in the method.
+         */
+        jlocation FindLocation(jmethodID method) const throw();
+
+        /**
+         * Gets locations where the breakpoint has been resolved. Used by
+         * <code>RequestManager</code> only, under its request monitor.
+         */
+        ResolvedLocationList& GetResolvedLocations() throw() {
+            return m_resolvedLocations;
+        }
+
+        /**
+         * Checks whether the breakpoint has been resolved at the given location.
+         *
+         * @param method   - the method ID
+         * @param location - the location in the method
+         */
+        bool IsResolvedAt(jmethodID method, jlocation location) const throw();
+
+        /**
+         * Applies filtering by the deferred location for the given event.
+         *
+         * @param jni   - the JNI interface pointer
+         * @param eInfo - the request-event information
+         *
+         * @return Returns <code>TRUE</code>, if the event class matches the
+         *         pattern and the event location is the breakpoint location
+         *         in the event method.
+         */
+        bool Apply(JNIEnv* jni, EventInfo &eInfo) throw()
+        {
+            JDWP_ASSERT(eInfo.signature != 0);
+            return (MatchPattern(eInfo.signature, m_pattern) &&
+                FindLocation(eInfo.method) == eInfo.location);
+        }
+
+    private:
+
+        char* m_pattern;
+        jint m_line;
+        char* m_methodName;
+        char* m_methodSignature;
+        jlocation m_codeIndex;
+        ResolvedLocationList m_resolvedLocations;
+
+    };
+
+    /**
+     * The class implements the vendor-specific <code>Capture</code> modifier
+     * of tracepoint requests. It declares the values written to the
+     * tracepoint record when the request matches.
+     */
+    class CaptureModifier : public RequestModifier {
+
+    public:
+
+        /**
+         * A value to be captured.
+         */
+        struct Capture {
+            jdwpCaptureKind kind;
+            jint slot;
+            jdwpTag tag;
+            char* name;
+            char* signature;
+        };
+
+        /** Type for list of captured values. */
+        typedef vector<Capture, AgentAllocator<Capture> > CaptureList;
+
+        /**
+         * A constructor.
+         */
+        CaptureModifier() : RequestModifier(JDWP_MODIFIER_CAPTURE) {}
+
+        /**
+         * A destructor.
+         */
+        ~CaptureModifier() {
+            for (CaptureList::iterator i = m_captures.begin();
+                    i != m_captures.end(); i++)
+            {
+                if (i->name != 0) {
+                    GetMemoryManager().Free(i->name JDWP_FILE_LINE);
+                }
+                if (i->signature != 0) {
+                    GetMemoryManager().Free(i->signature JDWP_FILE_LINE);
+                }
+            }
+        }
+
+        /**
+         * Adds the value to be captured. The name and signature are owned
+         * by the modifier after the call.
+         *
+         * @param capture - the captured value description
+         */
+        void AddCapture(const Capture& capture) throw(AgentException) {
+            m_captures.push_back(capture);
+        }
+
+        /**
+         * Writes the captured values of the given event to the packet.
+         * A value which cannot be read is written as <code>VOID</code>.
+         *
+         * @param jni    - the JNI interface pointer
+         * @param eInfo  - the request-event information
+         * @param packet - the packet to write values to
+         */
+        void WriteValues(JNIEnv* jni, EventInfo &eInfo,
+            OutputPacketComposer& packet) const throw(AgentException);
+
+        /**
+         * Applies no filtering, the modifier only declares captured values.
+         *
+         * @param jni   - the JNI interface pointer
+         * @param eInfo - the request-event information
+         *
+         * @return <code>TRUE</code>.
+         */
+        bool Apply(JNIEnv* jni, EventInfo &eInfo) throw() {
+            return true;
+        }
+
+    private:
+
+        CaptureList m_captures;
+
+    };
+
 }
 
 #endif // _REQUEST_MODIFIER_H_
@@ -27,6 +27,7 @@
 #include "ObjectManager.h"
 #include "EventDispatcher.h"
 #include "RequestManager.h"
+#include "AgentManager.h"
 
 using namespace jdwp;
 
@@ -97,8 +98,57 @@ namespace jdwp {
 
     //-------------------------------------------------------------------------
 
+    /**
+     * Thread infos are also kept in the JVMTI thread-local storage of their
+     * threads. The lowest bit of the stored pointer marks agent threads, so
+     * that they can be recognized without taking the thread manager lock.
+     * An empty storage is not conclusive: threads get their info before
+     * they are started, when the storage cannot be set yet.
+     */
+    const size_t AGENT_THREAD_TAG = 1;
+
+    /**
+     * Value stored for threads found to have no thread info.
+     */
+    const size_t NO_THREAD_INFO = 2;
+
+    /**
+     * Stores the given thread info in the thread-local storage of the thread.
+     * Errors are ignored, as threads which are not yet started or already
+     * terminated are found by the thread info list.
+     * @param thread the given java thread, or 0 for the current thread.
+     * @param info the thread info to be stored, or 0 to clear the storage.
+     */
+    void SetThreadLocalInfo(jthread thread, ThreadInfo *info)
+    {
+        size_t data = reinterpret_cast<size_t>(info);
+        if (info != 0 && info->m_isAgentThread) {
+            data |= AGENT_THREAD_TAG;
+        }
+        jvmtiError err;
+        JVMTI_TRACE(err, AgentBase::GetJvmtiEnv()->SetThreadLocalStorage(thread,
+            reinterpret_cast<const void*>(data)));
+    }
+
+    /**
+     * Reads the tagged thread info pointer from the thread-local storage.
+     * @param thread the given java thread.
+     * @param data the stored value.
+     */
+    jvmtiError GetThreadLocalInfo(jthread thread, size_t &data)
+    {
+        void* value = 0;
+        jvmtiError err;
+        JVMTI_TRACE(err, AgentBase::GetJvmtiEnv()->GetThreadLocalStorage(thread, &value));
+        data = reinterpret_cast<size_t>(value);
+        return err;
+    }
+
     /**
      * Looks for corresponding thread info in the thread info list.
+     * The thread info is taken from the thread-local storage if it is set,
+     * otherwise the list is scanned and the result is stored for the next
+     * lookup. Called under the thread manager lock.
      * @param jni the JNI interface pointer.
      * @param thrdInfoList pointer to the thread info list.
      * @param thread the given java thread.
@@ -107,11 +157,70 @@ namespace jdwp {
     void FindThreadInfo(JNIEnv *jni, ThreadInfoList *thrdInfoList, jthread thread,
         ThreadInfoList::iterator &result)
     {
+        size_t data;
+        bool isAlive = (GetThreadLocalInfo(thread, data) == JVMTI_ERROR_NONE);
+        if (isAlive && data == NO_THREAD_INFO) {
+            result = thrdInfoList->end();
+            return;
+        }
+        if (isAlive && data != 0) {
+            ThreadInfo *info = reinterpret_cast<ThreadInfo*>(data & ~AGENT_THREAD_TAG);
+            result = std::find(thrdInfoList->begin(), thrdInfoList->end(), info);
+            return;
+        }
         for (result = thrdInfoList->begin(); result != thrdInfoList->end(); result++) {
             if (*result != 0 && 
                     jni->IsSameObject((*result)->m_thread, thread) == JNI_TRUE)
                 break;
         }
+        if (isAlive) {
+            if (result != thrdInfoList->end()) {
+                SetThreadLocalInfo(thread, *result);
+            } else {
+                jvmtiError err;
+                JVMTI_TRACE(err, AgentBase::GetJvmtiEnv()->SetThreadLocalStorage(thread,
+                    reinterpret_cast<const void*>(NO_THREAD_INFO)));
+            }
+        }
+    }
+
+    /**
+     * Adds the thread info to an empty slot of the thread info list.
+     * @param thrdInfoList pointer to the thread info list.
+     * @param thrdinf the thread info to be added.
+     */
+    void InsertThreadInfo(ThreadInfoList *thrdInfoList, ThreadInfo *thrdinf)
+    {
+        ThreadInfoList::iterator place =
+            std::find(thrdInfoList->begin(), thrdInfoList->end(), (ThreadInfo*)0);
+        if (place != thrdInfoList->end()) {
+            *place = thrdinf;
+        } else {
+            thrdInfoList->push_back(thrdinf);
+        }
+        SetThreadLocalInfo(thrdinf->m_thread, thrdinf);
+    }
+
+    /**
+     * Start parameters of an agent thread.
+     */
+    struct AgentThreadStart {
+        jvmtiStartFunction proc;
+        const void* arg;
+        ThreadInfo* info;
+    };
+
+    /**
+     * Marks the started agent thread in its thread-local storage and runs
+     * the agent thread function.
+     */
+    void JNICALL StartAgentThread(jvmtiEnv* jvmti, JNIEnv* jni, void* arg)
+    {
+        AgentThreadStart start = *reinterpret_cast<AgentThreadStart*>(arg);
+        AgentBase::GetMemoryManager().Free(arg JDWP_FILE_LINE);
+
+        SetThreadLocalInfo(0, start.info);
+        (*start.proc)(jvmti, jni, const_cast<void*>(start.arg));
     }
 
 }// namespace jdwp
@@ -142,6 +251,7 @@ ThreadManager::Init(JNIEnv *jni) throw()
     m_stepMonitorReleased = false;
     m_popFramesMonitorReleased = false;
 
+    m_threadPool.Init(jni);
 }
 
 //-----------------------------------------------------------------------------
@@ -151,6 +261,8 @@ ThreadManager::Clean(JNIEnv *jni) throw()
 {
     JDWP_TRACE_ENTRY("Clean(" << jni << ')');
 
+    m_threadPool.Clean(jni);
+
     if(m_execMonitor !=0) {
         delete m_execMonitor;
         m_execMonitor = 0;
@@ -206,9 +318,27 @@ ThreadManager::ClearThreadList(JNIEnv *jni)
 {
     JDWP_TRACE_ENTRY("ClearThreadList(" << jni << ')');
 
+    // agent threads, like workers of the thread pool, live across sessions
+    // and keep their infos unless they are terminated
+    ThreadInfoList::iterator kept = m_threadInfoList.begin();
     for (ThreadInfoList::iterator iter = m_threadInfoList.begin(); iter != m_threadInfoList.end(); iter++) {
         if (*iter == 0) continue;
-        if (!(*iter)->m_isAgentThread) {
+        if ((*iter)->m_isAgentThread) {
+            jint state = 0;
+            jvmtiError err;
+            JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadState((*iter)->m_thread, &state));
+            if (err != JVMTI_ERROR_NONE ||
+                (state & JVMTI_THREAD_STATE_TERMINATED) == 0)
+            {
+                *kept++ = *iter;
+                continue;
+            }
+            JDWP_TRACE_THREAD("Reset: remove agent thread=" << (*iter)->m_thread
+                << ", name=" << JDWP_CHECK_NULL((*iter)->m_threadName));
+            (*iter)->Clean(jni);
+            delete *iter;
+            *iter = 0;
+        } else {
             JDWP_TRACE_THREAD("Reset: resume thread=" << (*iter)->m_thread 
                 << ", name=" << JDWP_CHECK_NULL((*iter)->m_threadName));
             // resume thread
@@ -216,12 +346,13 @@ ThreadManager::ClearThreadList(JNIEnv *jni)
             jvmtiError err;
             JVMTI_TRACE(err, GetJvmtiEnv()->ResumeThread((*iter)->m_thread));
             // remove from list and destroy
+            SetThreadLocalInfo((*iter)->m_thread, 0);
             (*iter)->Clean(jni);
             delete *iter;
             *iter = 0;
         }
     }
-    m_threadInfoList.clear();
+    m_threadInfoList.erase(kept, m_threadInfoList.end());
 }
 
 //-----------------------------------------------------------------------------
@@ -254,8 +385,30 @@ ThreadManager::RunAgentThread(JNIEnv *jni, jvmtiStartFunction proc,
         thread = CreateAgentThread(jni, name);
     }
 
+    // agent thread info is stored in thread-local storage on thread start
+    ThreadInfo* info;
+    {
+        MonitorAutoLock lock(m_thrdmgrMonitor JDWP_FILE_LINE);
+        ThreadInfoList::iterator result;
+        FindThreadInfo(jni, &m_threadInfoList, thread, result);
+        info = (result != m_threadInfoList.end()) ? *result : 0;
+    }
+
     jvmtiError err;
-    JVMTI_TRACE(err, GetJvmtiEnv()->RunAgentThread(thread, proc, arg, priority));
+    if (info == 0 || !info->m_isAgentThread) {
+        JVMTI_TRACE(err, GetJvmtiEnv()->RunAgentThread(thread, proc, arg, priority));
+    } else {
+        AgentThreadStart* start = reinterpret_cast<AgentThreadStart*>
+            (GetMemoryManager().Allocate(sizeof(AgentThreadStart) JDWP_FILE_LINE));
+        start->proc = proc;
+        start->arg = arg;
+        start->info = info;
+        JVMTI_TRACE(err, GetJvmtiEnv()->RunAgentThread(thread, StartAgentThread,
+            start, priority));
+        if (err != JVMTI_ERROR_NONE) {
+            GetMemoryManager().Free(start JDWP_FILE_LINE);
+        }
+    }
 
     if (err != JVMTI_ERROR_NONE)
         throw AgentException(err);
@@ -311,18 +464,8 @@ ThreadManager::AddThread(JNIEnv *jni, jthread thread, bool isAgentThread, bool i
 
     MonitorAutoLock lock(m_thrdmgrMonitor JDWP_FILE_LINE);
 
-    ThreadInfoList::iterator place = m_threadInfoList.end();
     ThreadInfoList::iterator result;
-    for (result = m_threadInfoList.begin(); 
-                               result != m_threadInfoList.end(); result++) {
-        if (*result == 0) {
-            // save pointer to empty slot
-            place = result;
-        } else if (jni->IsSameObject((*result)->m_thread, thread) == JNI_TRUE) {
-            // thread found
-            break;
-        }
-    }
+    FindThreadInfo(jni, &m_threadInfoList, thread, result);
 
     // not found
     if  (result == m_threadInfoList.end())
@@ -346,11 +489,7 @@ ThreadManager::AddThread(JNIEnv *jni, jthread thread, bool isAgentThread, bool i
         JDWP_TRACE_THREAD("AddThread: add thread=" << thread 
             << ", name=" << JDWP_CHECK_NULL(thrdinf->m_threadName));
 
-        if (place != m_threadInfoList.end()) {
-            *place = thrdinf;
-        } else {
-            m_threadInfoList.push_back(thrdinf);
-        }
+        InsertThreadInfo(&m_threadInfoList, thrdinf);
 
         return thrdinf;
     }
@@ -368,18 +507,8 @@ ThreadManager::InternalSuspend(JNIEnv *jni, jthread thread, bool ignoreInternal,
         << ',' << ignoreInternal << ',' << isOnEvent << ')');
 
     // find thread
-    ThreadInfoList::iterator place = m_threadInfoList.end();
     ThreadInfoList::iterator result;
-    for (result = m_threadInfoList.begin(); 
-                               result != m_threadInfoList.end(); result++) {
-        if (*result == 0) {
-            // save pointer to empty slot
-            place = result;
-        } else if (jni->IsSameObject((*result)->m_thread, thread) == JNI_TRUE) {
-            // thread found
-            break;
-        }
-    }
+    FindThreadInfo(jni, &m_threadInfoList, thread, result);
     
     if  (result == m_threadInfoList.end())
     {
@@ -394,27 +523,7 @@ ThreadManager::InternalSuspend(JNIEnv *jni, jthread thread, bool ignoreInternal,
             throw AgentException(err);
 
         // add thread
-        ThreadInfo *thrdinf = new ThreadInfo(jni, thread, false, isOnEvent);
-        thrdinf->m_suspendCount = 1 ;
-        if (place != m_threadInfoList.end()) {
-            *place = thrdinf;
-        } else {
-            m_threadInfoList.push_back(thrdinf);
-        }
-
-#ifndef NDEBUG
-        // save thread name for debugging purpose
-        if (JDWP_TRACE_ENABLED(LOG_KIND_THREAD)) {
-            jvmtiError err;
-            jvmtiThreadInfo info;
-
-            JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadInfo(thread, &info));
-            if (err != JVMTI_ERROR_NONE)
-                throw AgentException(err);
-
-            thrdinf->m_threadName = info.name;
-        }
-#endif // NDEBUG
+        ThreadInfo *thrdinf = AddSuspendedThread(jni, thread, isOnEvent);
 
         JDWP_TRACE_THREAD("InternalSuspend: suspend thread=" << thread 
             << ", name=" << JDWP_CHECK_NULL(thrdinf->m_threadName)
@@ -443,6 +552,33 @@ ThreadManager::InternalSuspend(JNIEnv *jni, jthread thread, bool ignoreInternal,
 
 //-----------------------------------------------------------------------------
 
+ThreadInfo*
+ThreadManager::AddSuspendedThread(JNIEnv *jni, jthread thread, bool isOnEvent)
+    throw(AgentException)
+{
+    ThreadInfo *thrdinf = new ThreadInfo(jni, thread, false, isOnEvent);
+    thrdinf->m_suspendCount = 1 ;
+    InsertThreadInfo(&m_threadInfoList, thrdinf);
+
+#ifndef NDEBUG
+    // save thread name for debugging purpose
+    if (JDWP_TRACE_ENABLED(LOG_KIND_THREAD)) {
+        jvmtiError err;
+        jvmtiThreadInfo info;
+
+        JVMTI_TRACE(err, GetJvmtiEnv()->GetThreadInfo(thread, &info));
+        if (err != JVMTI_ERROR_NONE)
+            throw AgentException(err);
+
+        thrdinf->m_threadName = info.name;
+    }
+#endif // NDEBUG
+
+    return thrdinf;
+}
+
+//-----------------------------------------------------------------------------
+
 void
 ThreadManager::Suspend(JNIEnv *jni, jthread thread, bool isOnEvent) throw(AgentException)
 {
@@ -491,6 +627,7 @@ ThreadManager::InternalResume(JNIEnv *jni, jthread thread, bool ignoreInternal)
             << ", isOnEvent=" << (*result)->m_isOnEvent);
 
         // remove from list and destroy
+        SetThreadLocalInfo((*result)->m_thread, 0);
         (*result)->Clean(jni);
         delete *result;
         *result = 0;
@@ -533,14 +670,61 @@ ThreadManager::SuspendAll(JNIEnv *jni, jthread threadOnEvent) throw(AgentExcepti
         throw AgentException(err);
     JvmtiAutoFree dobj(threads);
 
+    if (count == 0)
+        return;
+
+    // already suspended threads just increase suspend count,
+    // the rest is suspended by one JVMTI call
+    jthread *list = reinterpret_cast<jthread*>
+        (GetMemoryManager().Allocate(count * sizeof(jthread) JDWP_FILE_LINE));
+    AgentAutoFree aafList(list JDWP_FILE_LINE);
+    jint listCount = 0;
+
     for (jint i = 0; i < count; i++)
     {
         JDWP_ASSERT(threads[i] != 0);
+        ThreadInfoList::iterator result;
+        FindThreadInfo(jni, &m_threadInfoList, threads[i], result);
+        if (result == m_threadInfoList.end()) {
+            list[listCount++] = threads[i];
+        } else if (!(*result)->m_isAgentThread) {
+            JDWP_TRACE_THREAD("SuspendAll: increase count thread=" << threads[i] 
+                << ", name=" << JDWP_CHECK_NULL((*result)->m_threadName)
+                << ", oldCount=" << (*result)->m_suspendCount);
+            JDWP_ASSERT((*result)->m_suspendCount > 0);
+            (*result)->m_suspendCount++;
+        }
+    }
+
+    jvmtiError *results = 0;
+    if (listCount > 0) {
+        results = reinterpret_cast<jvmtiError*>
+            (GetMemoryManager().Allocate(listCount * sizeof(jvmtiError) JDWP_FILE_LINE));
+        JVMTI_TRACE(err, GetJvmtiEnv()->SuspendThreadList(listCount, list, results));
+        if (err != JVMTI_ERROR_NONE) {
+            // retry all threads one by one
+            for (jint i = 0; i < listCount; i++) {
+                results[i] = err;
+            }
+        }
+    }
+    AgentAutoFree aafResults(results JDWP_FILE_LINE);
+
+    err = JVMTI_ERROR_NONE;
+    for (jint i = 0; i < listCount; i++)
+    {
+        bool isOnEvent = (threadOnEvent != 0 && jni->IsSameObject(threadOnEvent, list[i]));
         try
         {
-            // suspend thread (ignoring internal)
-            bool isOnEvent = (threadOnEvent != 0 && jni->IsSameObject(threadOnEvent, threads[i]));
-            InternalSuspend(jni, threads[i], true, isOnEvent);
+            if (results[i] == JVMTI_ERROR_NONE) {
+                ThreadInfo *thrdinf = AddSuspendedThread(jni, list[i], isOnEvent);
+                JDWP_TRACE_THREAD("SuspendAll: suspend thread=" << list[i] 
+                    << ", name=" << JDWP_CHECK_NULL(thrdinf->m_threadName)
+                    << ", isOnEvent=" << thrdinf->m_isOnEvent);
+            } else {
+                // suspend thread (ignoring internal)
+                InternalSuspend(jni, list[i], true, isOnEvent);
+            }
         }
         catch (const AgentException &e)
         {
@@ -570,7 +754,18 @@ ThreadManager::ResumeAll(JNIEnv *jni) throw(AgentException)
 
     MonitorAutoLock lock(m_thrdmgrMonitor JDWP_FILE_LINE);
 
-    // resume all not internal threads and remove from list
+    if (m_threadInfoList.empty())
+        return;
+
+    // threads with suspend count 1 are resumed by one JVMTI call
+    jthread *list = reinterpret_cast<jthread*>(GetMemoryManager().Allocate(
+        m_threadInfoList.size() * sizeof(jthread) JDWP_FILE_LINE));
+    AgentAutoFree aafList(list JDWP_FILE_LINE);
+    size_t *slots = reinterpret_cast<size_t*>(GetMemoryManager().Allocate(
+        m_threadInfoList.size() * sizeof(size_t) JDWP_FILE_LINE));
+    AgentAutoFree aafSlots(slots JDWP_FILE_LINE);
+    jint listCount = 0;
+
     for (ThreadInfoList::iterator iter = m_threadInfoList.begin(); iter != m_threadInfoList.end(); iter++) {
 
         if (*iter == 0) continue;
@@ -589,22 +784,9 @@ ThreadManager::ResumeAll(JNIEnv *jni) throw(AgentException)
                 // destroy stack frame IDs
                 GetObjectManager().DeleteFrameIDs(jni, (*iter)->m_thread);
 
-                // resume thread
-                jvmtiError err;
-                JVMTI_TRACE(err, GetJvmtiEnv()->ResumeThread((*iter)->m_thread));
-
-                JDWP_ASSERT(err != JVMTI_ERROR_THREAD_NOT_SUSPENDED);
-                JDWP_ASSERT(err != JVMTI_ERROR_INVALID_TYPESTATE);
-                JDWP_ASSERT(err != JVMTI_ERROR_INVALID_THREAD);
-                JDWP_ASSERT(err != JVMTI_ERROR_THREAD_NOT_ALIVE);
-
-                if (err != JVMTI_ERROR_NONE)
-                    throw AgentException(err);
-
-                // remove from list and destroy
-                (*iter)->Clean(jni);
-                delete *iter;
-                *iter = 0;
+                list[listCount] = (*iter)->m_thread;
+                slots[listCount] = iter - m_threadInfoList.begin();
+                listCount++;
             } else {
                 // just decrease suspend count
                 JDWP_TRACE_THREAD("ResumeAll: decrease count thread=" << (*iter)->m_thread 
@@ -621,6 +803,50 @@ ThreadManager::ResumeAll(JNIEnv *jni) throw(AgentException)
                 << ", isOnEvent=" << (*iter)->m_isOnEvent);
         }
     }
+
+    if (listCount == 0)
+        return;
+
+    jvmtiError *results = reinterpret_cast<jvmtiError*>
+        (GetMemoryManager().Allocate(listCount * sizeof(jvmtiError) JDWP_FILE_LINE));
+    AgentAutoFree aafResults(results JDWP_FILE_LINE);
+
+    jvmtiError err;
+    JVMTI_TRACE(err, GetJvmtiEnv()->ResumeThreadList(listCount, list, results));
+    if (err != JVMTI_ERROR_NONE) {
+        for (jint i = 0; i < listCount; i++) {
+            results[i] = err;
+        }
+    }
+
+    err = JVMTI_ERROR_NONE;
+    for (jint i = 0; i < listCount; i++) {
+        if (results[i] != JVMTI_ERROR_NONE) {
+            // retry failed thread alone
+            JVMTI_TRACE(results[i], GetJvmtiEnv()->ResumeThread(list[i]));
+
+            JDWP_ASSERT(results[i] != JVMTI_ERROR_THREAD_NOT_SUSPENDED);
+            JDWP_ASSERT(results[i] != JVMTI_ERROR_INVALID_TYPESTATE);
+            JDWP_ASSERT(results[i] != JVMTI_ERROR_INVALID_THREAD);
+            JDWP_ASSERT(results[i] != JVMTI_ERROR_THREAD_NOT_ALIVE);
+
+            if (results[i] != JVMTI_ERROR_NONE) {
+                // thread stays in list
+                err = results[i];
+                continue;
+            }
+        }
+
+        // remove from list and destroy
+        ThreadInfoList::iterator iter = m_threadInfoList.begin() + slots[i];
+        SetThreadLocalInfo((*iter)->m_thread, 0);
+        (*iter)->Clean(jni);
+        delete *iter;
+        *iter = 0;
+    }
+
+    if (err != JVMTI_ERROR_NONE)
+        throw AgentException(err);
 }
 
 //-----------------------------------------------------------------------------
@@ -681,6 +907,13 @@ ThreadManager::IsAgentThread(JNIEnv *jni, jthread thread)
 {
     //JDWP_TRACE_ENTRY("IsAgentThread(" << jni << ',' << thread << ')');
 
+    // agent threads are tagged in the thread-local storage of alive threads,
+    // but not before their info is found by the first lookup
+    size_t data;
+    if (GetThreadLocalInfo(thread, data) == JVMTI_ERROR_NONE && data != 0) {
+        return (data & AGENT_THREAD_TAG) != 0;
+    }
+
     MonitorAutoLock lock(m_thrdmgrMonitor JDWP_FILE_LINE);
 
     bool ret_value = false;
@@ -881,6 +1114,9 @@ void ThreadManager::PerformPopFrames(JNIEnv* jni, jint framesToPop, jthread thre
 {
     JDWP_TRACE_ENTRY("PerformPopFrames(" << jni << ',' << framesToPop << ',' << thread << ')');
 
+    GetAgentManager().RequireCapability(AgentManager::CAP_POP_FRAME);
+    GetAgentManager().RequireCapability(AgentManager::CAP_SINGLE_STEP);
+
     MonitorAutoLock thrdmgrMonitorLock(m_thrdmgrMonitor JDWP_FILE_LINE);
     
     // thread should be suspended
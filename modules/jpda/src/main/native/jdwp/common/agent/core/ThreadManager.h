@@ -38,6 +38,7 @@
 #include "AgentMonitor.h"
 #include "AgentAllocator.h"
 #include "CommandHandler.h"
+#include "AgentThreadPool.h"
 
 namespace jdwp {
 
@@ -98,6 +99,13 @@ namespace jdwp {
          */
         void Reset(JNIEnv *jni) throw(AgentException);
 
+        /**
+         * Gets the pool of agent threads running asynchronous commands.
+         */
+        AgentThreadPool& GetThreadPool() throw() {
+            return m_threadPool;
+        }
+
         /**
          * Creates a new agent thread and starts the specified function in it.
          * thread.
@@ -246,6 +254,8 @@ namespace jdwp {
 
         /**
          * Checks if the specified thread is an agent thread.
+         * For alive threads the check is a single read of the thread-local
+         * storage and does not take the thread manager lock.
          *
          * @param jni    - the JNI interface pointer
          * @param thread - the thread to be checked
@@ -370,6 +380,11 @@ namespace jdwp {
          */
         AgentMonitor    *m_thrdmgrMonitor;
 
+        /**
+         * Reused agent threads for asynchronous commands.
+         */
+        AgentThreadPool m_threadPool;
+
         /**
          * List of registered handlers for deferred method invocation.
          */
@@ -431,6 +446,10 @@ namespace jdwp {
         // not synchronized
         void InternalResume(JNIEnv *jni, jthread thread, bool ignoreInternal) throw(AgentException);
 
+        // not synchronized
+        ThreadInfo* AddSuspendedThread(JNIEnv *jni, jthread thread, bool isOnEvent)
+            throw(AgentException);
+
         // not synchronized
         void InternalSuspend(JNIEnv *jni, jthread thread, bool ignoreInternal, bool isOnEvent = false) throw(AgentException);
 
@@ -55,7 +55,10 @@ typedef enum jdwpCommandSet {
     JDWP_COMMAND_SET_EVENT_REQUEST = 15,
     JDWP_COMMAND_SET_STACK_FRAME = 16,
     JDWP_COMMAND_SET_CLASS_OBJECT_REFERENCE = 17,
-    JDWP_COMMAND_SET_EVENT = 64
+    JDWP_COMMAND_SET_EVENT = 64,
+
+    /* Vendor-specific command sets */
+    JDWP_COMMAND_SET_VENDOR = 128
 } jdwpCommandSet;
 
 
@@ -171,7 +174,62 @@ typedef enum jdwpCommand {
     JDWP_COMMAND_COR_REFLECTED_TYPE = 1,
 
     /* Commands Event */
-    JDWP_COMMAND_E_COMPOSITE = 100
+    JDWP_COMMAND_E_COMPOSITE = 100,
+
+    /* Commands Vendor */
+
+    /*
+     * ThreadStates: int threads, then threads threadIDs (0 threads for all
+     * application threads). Reply: int threads, then for each thread:
+     * threadID thread, string name, int threadStatus, int suspendStatus,
+     * threadGroupID group, int suspendCount, int frameCount (-1 if the
+     * thread is not suspended).
+     */
+    JDWP_COMMAND_VENDOR_THREAD_STATES = 1,
+
+    /*
+     * ThreadStacks: int threads, then threads threadIDs of suspended threads
+     * (0 threads for all suspended application threads), int maxFrames (-1
+     * for all frames), boolean withFrameIDs. Reply: int threads, then for
+     * each thread: threadID thread, int frames, then for each frame from the
+     * top: frameID frame (only if withFrameIDs), location location.
+     */
+    JDWP_COMMAND_VENDOR_THREAD_STACKS = 2,
+
+    /*
+     * Batch: int commands, then for each command: byte commandSet,
+     * byte command, int length, followed by length bytes of command data.
+     * Reply: int commands, then for each command in order: int errorCode,
+     * int length, followed by length bytes of reply data.
+     */
+    JDWP_COMMAND_VENDOR_BATCH = 3,
+
+    /*
+     * ObjectGraph: int roots, then roots objectIDs, int maxDepth (0 for
+     * roots only), int maxNodes, int maxPreview. Reply: int nodes, then for
+     * each node in breadth-first order: tagged-objectID object, byte
+     * refTypeTag, referenceTypeID type, int depth, then
+     *   for a string: int length, string value of at most maxPreview chars;
+     *   for an array: int length, arrayregion of at most maxPreview values;
+     *   otherwise: boolean newType, if newType: int fields, then for each
+     *   instance field of the type and its superclasses: fieldID field,
+     *   string name, string signature, int modBits; then int values, then
+     *   the value of each of those fields.
+     * Objects referenced by field values and array previews are nodes as
+     * well while maxDepth and maxNodes allow.
+     */
+    JDWP_COMMAND_VENDOR_OBJECT_GRAPH = 4,
+
+    /*
+     * ClassesChanged: long generation (0 if none is known). Reply: long
+     * generation, boolean full, int added, then for each class prepared
+     * since the given generation: byte refTypeTag, referenceTypeID type,
+     * string signature, string genericSignature, int status; int removed,
+     * then removed referenceTypeIDs of classes unloaded since the given
+     * generation. If the changes are not known, full is set, all classes
+     * are written as added and removed is 0.
+     */
+    JDWP_COMMAND_VENDOR_CLASSES_CHANGED = 5
 
 } jdwpCommand;
 
@@ -258,7 +316,17 @@ typedef enum jdwpEventKind {
     JDWP_EVENT_VM_INIT = 90,
     JDWP_EVENT_VM_START = JDWP_EVENT_VM_INIT,
     JDWP_EVENT_VM_DEATH = 99,
-    JDWP_EVENT_VM_DISCONNECTED = 100
+    JDWP_EVENT_VM_DISCONNECTED = 100,
+
+    /* Vendor-specific event kinds */
+
+    /*
+     * Tracepoint: a non-suspending breakpoint with the Capture modifier.
+     * Records are sent in batches as Composite events with the SUSPEND_NONE
+     * policy, each record is: byte eventKind, int requestID, threadID thread,
+     * location location, then the captured values in the declared order.
+     */
+    JDWP_EVENT_TRACEPOINT = 110
 } jdwpEventKind;
 
 /* EventRequest/ModifierKind Constants */
@@ -274,9 +342,54 @@ typedef enum jdwpRequestModifier {
     JDWP_MODIFIER_EXCEPTION_ONLY = 8,
     JDWP_MODIFIER_FIELD_ONLY = 9,
     JDWP_MODIFIER_STEP = 10,
-    JDWP_MODIFIER_INSTANCE_ONLY = 11
+    JDWP_MODIFIER_INSTANCE_ONLY = 11,
+
+    /* Vendor-specific modifiers */
+
+    /*
+     * DeferredLocation: string classPattern, int line, string methodName,
+     * string methodSignature, long codeIndex. Breakpoint is set at the first
+     * location of the line if line > 0, otherwise at codeIndex of the named
+     * method, in every class matching the pattern when it is prepared.
+     * Empty method name or signature matches any method.
+     */
+    JDWP_MODIFIER_DEFERRED_LOCATION = 100,
+
+    /*
+     * ConditionExpression: string expression. Event is reported only if
+     * the expression evaluated by the agent in the event thread is true
+     * (see ConditionExpression.h for the expression syntax).
+     */
+    JDWP_MODIFIER_CONDITION_EXPRESSION = 101,
+
+    /*
+     * Capture: int count, then count values, each is byte captureKind
+     * followed by: int slot, byte tag (for LOCAL); string name, string
+     * signature (for THIS_FIELD); nothing (for THREAD_NAME and TIMESTAMP).
+     * Allowed for TRACEPOINT requests only, which require it.
+     */
+    JDWP_MODIFIER_CAPTURE = 102,
+
+    /*
+     * Sample: int interval, int maxPerSecond. Passes every interval-th
+     * event and at most maxPerSecond events per second (0 for no limit).
+     * Unlike Count, the request never expires.
+     */
+    JDWP_MODIFIER_SAMPLE = 103
 } jdwpRequestModifier;
 
+/* Vendor-specific CaptureKind Constants */
+typedef enum jdwpCaptureKind {
+    /* local variable of the frame: tagged value, or VOID tag if unavailable */
+    JDWP_CAPTURE_LOCAL = 1,
+    /* field of this object: tagged value, or VOID tag if unavailable */
+    JDWP_CAPTURE_THIS_FIELD = 2,
+    /* name of the event thread: string */
+    JDWP_CAPTURE_THREAD_NAME = 3,
+    /* time of the event in nanoseconds: long */
+    JDWP_CAPTURE_TIMESTAMP = 4
+} jdwpCaptureKind;
+
 /* ThreadStatus Constants */
 typedef enum jdwpThreadStatus {
     JDWP_THREAD_STATUS_UNKNOWN = -1,
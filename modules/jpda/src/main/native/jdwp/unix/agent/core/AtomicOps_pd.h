@@ -0,0 +1,86 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * AtomicOps_pd.h
+ *
+ * The given header file includes platform depended atomic operations
+ * for the Linux platform.
+ */
+
+#ifndef _ATOMIC_OPS_PD_H_
+#define _ATOMIC_OPS_PD_H_
+
+#include <sched.h>
+
+#include "jni.h"
+
+namespace jdwp {
+
+    /**
+     * Atomically increments the value.
+     *
+     * @return The incremented value.
+     */
+    inline jint AtomicIncrement(volatile jint* value) {
+        return __sync_add_and_fetch(value, 1);
+    }
+
+    /**
+     * Atomically decrements the value.
+     *
+     * @return The decremented value.
+     */
+    inline jint AtomicDecrement(volatile jint* value) {
+        return __sync_sub_and_fetch(value, 1);
+    }
+
+    /**
+     * Atomically sets the value to <code>newValue</code> if it is equal
+     * to <code>oldValue</code>.
+     *
+     * @return <code>true</code> if the value is set.
+     */
+    inline bool AtomicCompareAndSet(volatile jint* value, jint oldValue,
+            jint newValue) {
+        return __sync_bool_compare_and_swap(value, oldValue, newValue);
+    }
+
+    /**
+     * Atomically replaces the pointer with <code>newValue</code>. Acts as
+     * a full memory barrier.
+     *
+     * @return The previous value.
+     */
+    inline void* AtomicExchangePointer(void* volatile* target, void* newValue) {
+        // __sync_lock_test_and_set() alone is only an acquire barrier
+        __sync_synchronize();
+        return __sync_lock_test_and_set(target, newValue);
+    }
+
+    /**
+     * Gives up the processor to other threads while spinning.
+     */
+    inline void SpinYield() {
+        sched_yield();
+    }
+
+}//jdwp
+
+#endif // _ATOMIC_OPS_PD_H_
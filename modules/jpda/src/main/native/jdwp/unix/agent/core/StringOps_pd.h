@@ -0,0 +1,51 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/**
+ * @file
+ * StringOps_pd.h
+ *
+ * The given header file includes platform depended string conversions
+ * for the Linux platform.
+ */
+
+#ifndef _STRING_OPS_PD_H_
+#define _STRING_OPS_PD_H_
+
+#include <stdlib.h>
+
+#include "jni.h"
+
+namespace jdwp {
+
+    /**
+     * Converts the decimal number at the beginning of the string to
+     * a 64-bit value, as <code>strtol()</code> does.
+     *
+     * @param str - the string to convert
+     * @param end - receives the pointer past the converted characters
+     *
+     * @return The converted value.
+     */
+    inline jlong ParseLong(const char* str, char** end) {
+        return static_cast<jlong>(strtoll(str, end, 10));
+    }
+
+}//jdwp
+
+#endif // _STRING_OPS_PD_H_